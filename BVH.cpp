@@ -0,0 +1,218 @@
+#include "BVH.hpp"
+
+#include <cassert>
+
+//-------------------------
+
+uint32_t BVH::alloc_node() {
+	if (free_nodes != -1U) {
+		uint32_t node = free_nodes;
+		free_nodes = nodes[node].right;
+		nodes[node] = Node();
+		return node;
+	}
+	nodes.emplace_back();
+	return uint32_t(nodes.size() - 1);
+}
+
+void BVH::free_node(uint32_t node) {
+	nodes[node] = Node();
+	nodes[node].right = free_nodes;
+	free_nodes = node;
+}
+
+void BVH::clear() {
+	nodes.clear();
+	root = -1U;
+	free_nodes = -1U;
+	leaves = 0;
+}
+
+void BVH::refit(uint32_t node) {
+	while (node != -1U) {
+		Node &n = nodes[node];
+		Box box = nodes[n.left].box;
+		box.enlarge(nodes[n.right].box);
+		//(nothing above will change either)
+		if (box.min == n.box.min && box.max == n.box.max) break;
+		n.box = box;
+		node = n.parent;
+	}
+}
+
+//-------------------------
+
+std::vector< uint32_t > BVH::build(std::vector< Box > const &boxes, std::vector< uint32_t > const &items) {
+	assert(boxes.size() == items.size());
+	clear();
+
+	std::vector< uint32_t > ret(boxes.size(), -1U);
+	if (boxes.empty()) return ret;
+
+	//a tree over N leaves has 2N-1 nodes; leaves go first, in input order:
+	nodes.resize(2 * boxes.size() - 1);
+	std::vector< glm::vec3 > centers(boxes.size());
+	for (uint32_t i = 0; i < boxes.size(); ++i) {
+		nodes[i].box = boxes[i];
+		nodes[i].item = items[i];
+		centers[i] = 0.5f * (boxes[i].min + boxes[i].max);
+		ret[i] = i;
+	}
+	leaves = uint32_t(boxes.size());
+
+	std::vector< uint32_t > order(boxes.size());
+	for (uint32_t i = 0; i < order.size(); ++i) order[i] = i;
+
+	free_nodes = uint32_t(boxes.size()); //(build_range allocates internal nodes from here, in order)
+	root = build_range(order, centers, 0, uint32_t(order.size()));
+	free_nodes = -1U;
+	assert(nodes[root].parent == -1U);
+
+	return ret;
+}
+
+uint32_t BVH::build_range(std::vector< uint32_t > &order, std::vector< glm::vec3 > const &centers, uint32_t begin, uint32_t end) {
+	assert(begin < end);
+	if (end - begin == 1) return order[begin];
+
+	//split at the median center along the longest axis of the centers' bounds:
+	Box center_box;
+	for (uint32_t i = begin; i < end; ++i) {
+		center_box.min = glm::min(center_box.min, centers[order[i]]);
+		center_box.max = glm::max(center_box.max, centers[order[i]]);
+	}
+	glm::vec3 size = center_box.max - center_box.min;
+	uint32_t axis = (size.x >= size.y && size.x >= size.z ? 0 : (size.y >= size.z ? 1 : 2));
+	uint32_t mid = begin + (end - begin) / 2;
+	std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, [&](uint32_t a, uint32_t b) {
+		return centers[a][axis] < centers[b][axis];
+	});
+
+	uint32_t node = free_nodes++;
+	uint32_t left = build_range(order, centers, begin, mid);
+	uint32_t right = build_range(order, centers, mid, end);
+
+	Node &n = nodes[node];
+	n.left = left;
+	n.right = right;
+	n.box = nodes[left].box;
+	n.box.enlarge(nodes[right].box);
+	nodes[left].parent = node;
+	nodes[right].parent = node;
+	return node;
+}
+
+//-------------------------
+
+uint32_t BVH::insert(Box const &box, uint32_t item) {
+	uint32_t leaf = alloc_node();
+	nodes[leaf].box = box;
+	nodes[leaf].item = item;
+	leaves += 1;
+
+	if (root == -1U) {
+		root = leaf;
+		return leaf;
+	}
+
+	//walk down to find a good sibling, using the increase in (half) surface area as cost:
+	uint32_t sibling = root;
+	while (!nodes[sibling].is_leaf()) {
+		Node const &n = nodes[sibling];
+
+		Box combined = n.box;
+		combined.enlarge(box);
+		float combined_area = combined.half_area();
+
+		//cost of making a new parent for 'leaf' and this node:
+		float cost = 2.0f * combined_area;
+		//minimum cost pushed down to children:
+		float inherited = 2.0f * (combined_area - n.box.half_area());
+
+		auto descend_cost = [&](uint32_t child) {
+			Box b = nodes[child].box;
+			b.enlarge(box);
+			if (nodes[child].is_leaf()) return b.half_area() + inherited;
+			return b.half_area() - nodes[child].box.half_area() + inherited;
+		};
+		float cost_left = descend_cost(n.left);
+		float cost_right = descend_cost(n.right);
+
+		if (cost < cost_left && cost < cost_right) break;
+		sibling = (cost_left < cost_right ? n.left : n.right);
+	}
+
+	//make a new parent for sibling and leaf:
+	uint32_t old_parent = nodes[sibling].parent;
+	uint32_t parent = alloc_node();
+	Node &p = nodes[parent];
+	p.parent = old_parent;
+	p.left = sibling;
+	p.right = leaf;
+	p.box = nodes[sibling].box;
+	p.box.enlarge(box);
+	nodes[sibling].parent = parent;
+	nodes[leaf].parent = parent;
+
+	if (old_parent == -1U) {
+		root = parent;
+	} else {
+		if (nodes[old_parent].left == sibling) nodes[old_parent].left = parent;
+		else nodes[old_parent].right = parent;
+		refit(old_parent);
+	}
+
+	return leaf;
+}
+
+void BVH::remove(uint32_t leaf) {
+	assert(leaf < nodes.size() && nodes[leaf].is_leaf());
+	assert(leaves > 0);
+	leaves -= 1;
+
+	if (leaf == root) {
+		free_node(leaf);
+		root = -1U;
+		return;
+	}
+
+	//replace parent with sibling:
+	uint32_t parent = nodes[leaf].parent;
+	uint32_t grandparent = nodes[parent].parent;
+	uint32_t sibling = (nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left);
+
+	nodes[sibling].parent = grandparent;
+	if (grandparent == -1U) {
+		root = sibling;
+	} else {
+		if (nodes[grandparent].left == parent) nodes[grandparent].left = sibling;
+		else nodes[grandparent].right = sibling;
+		refit(grandparent);
+	}
+
+	free_node(parent);
+	free_node(leaf);
+}
+
+void BVH::update(uint32_t leaf, Box const &box) {
+	assert(leaf < nodes.size() && nodes[leaf].is_leaf());
+	if (box.min == nodes[leaf].box.min && box.max == nodes[leaf].box.max) return;
+	nodes[leaf].box = box;
+	refit(nodes[leaf].parent);
+}
+
+//-------------------------
+
+void BVH::frustum_planes(glm::mat4 const &clip_from_world, glm::vec4 (&planes)[6]) {
+	//(rows of the matrix; a point is inside if -w <= x,y,z <= w in clip space)
+	glm::vec4 row[4];
+	for (uint32_t r = 0; r < 4; ++r) {
+		row[r] = glm::vec4(clip_from_world[0][r], clip_from_world[1][r], clip_from_world[2][r], clip_from_world[3][r]);
+	}
+	planes[0] = row[3] + row[0];
+	planes[1] = row[3] - row[0];
+	planes[2] = row[3] + row[1];
+	planes[3] = row[3] - row[1];
+	planes[4] = row[3] + row[2];
+	planes[5] = row[3] - row[2];
+}
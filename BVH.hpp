@@ -0,0 +1,174 @@
+#pragma once
+
+/*
+ * BVH is a dynamic bounding volume hierarchy over axis-aligned boxes,
+ *  for quickly finding the items inside a view frustum or along a ray.
+ *
+ * Items (any uint32_t the caller likes) are stored in leaves:
+ *  - build() makes a balanced tree over many boxes at once
+ *  - insert() / remove() add and remove single leaves
+ *  - update() changes a leaf's box and refits its ancestors (moving
+ *     items doesn't change the tree's structure, so if things move a
+ *     long way query performance will degrade until the next build())
+ *
+ */
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+
+struct BVH {
+	struct Box {
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+
+		void enlarge(Box const &other) {
+			min = glm::min(min, other.min);
+			max = glm::max(max, other.max);
+		}
+		float half_area() const {
+			glm::vec3 size = max - min;
+			return size.x * size.y + size.y * size.z + size.z * size.x;
+		}
+	};
+
+	//replace contents with a balanced tree over 'boxes' (much faster than inserting them one at a time):
+	// returns the leaf for each box (in the same order)
+	std::vector< uint32_t > build(std::vector< Box > const &boxes, std::vector< uint32_t > const &items);
+
+	//add a box for 'item'; returns a leaf (for update() / remove()):
+	uint32_t insert(Box const &box, uint32_t item);
+	void remove(uint32_t leaf);
+
+	//change a leaf's box, refitting ancestors as needed:
+	void update(uint32_t leaf, Box const &box);
+
+	void clear();
+
+	uint32_t leaf_count() const { return leaves; }
+	uint32_t item(uint32_t leaf) const { return nodes[leaf].item; }
+	Box const &box(uint32_t leaf) const { return nodes[leaf].box; }
+
+	//distance along a ray (origin + t * direction) at which it enters 'box', or infinity if it misses (or enters after max_t):
+	// (takes 1.0f / direction, since that is usually shared between many tests)
+	static float ray_enter(Box const &box, glm::vec3 const &origin, glm::vec3 const &inv_direction, float max_t) {
+		glm::vec3 t0 = (box.min - origin) * inv_direction;
+		glm::vec3 t1 = (box.max - origin) * inv_direction;
+		glm::vec3 near = glm::min(t0, t1);
+		glm::vec3 far = glm::max(t0, t1);
+		float t_enter = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+		float t_exit = std::min(std::min(far.x, far.y), std::min(far.z, max_t));
+		return (t_enter <= t_exit ? t_enter : std::numeric_limits< float >::infinity());
+	}
+
+	//frustum planes (a, b, c, d: a*x + b*y + c*z + d >= 0 inside) from a clip_from_world matrix:
+	static void frustum_planes(glm::mat4 const &clip_from_world, glm::vec4 (&planes)[6]);
+
+	//n.b. queries use scratch space in the BVH, so don't run two at once (or modify the BVH from 'fn'):
+
+	//call fn(item) for every item whose box is (at least partly) inside the frustum:
+	template< typename F >
+	void query_frustum(glm::vec4 const (&planes)[6], F &&fn) const;
+
+	//call fn(item, t) for every item whose box is hit by the ray (origin + t * direction, 0 <= t <= max_t),
+	// visiting nearer boxes first; fn returns the new max_t, so returning the distance to a hit finds the closest hit:
+	template< typename F >
+	void query_ray(glm::vec3 const &origin, glm::vec3 const &direction, float max_t, F &&fn) const;
+
+	//-- internals --
+	struct Node {
+		Box box;
+		uint32_t parent = -1U;
+		uint32_t left = -1U; //-1U for leaves
+		uint32_t right = -1U; //(also used as the 'next' pointer for free nodes)
+		uint32_t item = -1U; //(leaves only)
+		bool is_leaf() const { return left == -1U; }
+	};
+	std::vector< Node > nodes;
+	uint32_t root = -1U;
+	uint32_t free_nodes = -1U; //first node in free list
+	uint32_t leaves = 0;
+
+	uint32_t alloc_node();
+	void free_node(uint32_t node);
+	void refit(uint32_t node); //recompute boxes from 'node' up toward the root
+	uint32_t build_range(std::vector< uint32_t > &order, std::vector< glm::vec3 > const &centers, uint32_t begin, uint32_t end);
+
+	mutable std::vector< uint32_t > stack; //(scratch space for queries)
+};
+
+//-------------------------
+
+template< typename F >
+void BVH::query_frustum(glm::vec4 const (&planes)[6], F &&fn) const {
+	if (root == -1U) return;
+
+	//stack of (node, planes-still-to-test mask) pairs:
+	// (once a box is entirely inside a plane, its children are too, so that plane can be skipped)
+	stack.clear();
+	stack.emplace_back(root);
+	stack.emplace_back(0x3fu);
+	while (!stack.empty()) {
+		uint32_t mask = stack.back(); stack.pop_back();
+		Node const &node = nodes[stack.back()]; stack.pop_back();
+
+		glm::vec3 center = 0.5f * (node.box.min + node.box.max);
+		glm::vec3 extent = 0.5f * (node.box.max - node.box.min);
+		bool outside = false;
+		for (uint32_t p = 0; p < 6; ++p) {
+			if (!(mask & (1u << p))) continue;
+			glm::vec3 normal = glm::vec3(planes[p]);
+			float distance = glm::dot(normal, center) + planes[p].w;
+			float radius = glm::dot(glm::abs(normal), extent);
+			if (distance + radius < 0.0f) { outside = true; break; }
+			if (distance - radius >= 0.0f) mask &= ~(1u << p);
+		}
+		if (outside) continue;
+
+		if (node.is_leaf()) {
+			fn(node.item);
+		} else {
+			stack.emplace_back(node.left); stack.emplace_back(mask);
+			stack.emplace_back(node.right); stack.emplace_back(mask);
+		}
+	}
+}
+
+template< typename F >
+void BVH::query_ray(glm::vec3 const &origin, glm::vec3 const &direction, float max_t, F &&fn) const {
+	if (root == -1U) return;
+
+	glm::vec3 inv_direction = 1.0f / direction; //(infinities are fine here)
+	auto enter = [&](Box const &box) {
+		return ray_enter(box, origin, inv_direction, max_t);
+	};
+
+	stack.clear();
+	stack.emplace_back(root);
+	while (!stack.empty()) {
+		Node const &node = nodes[stack.back()]; stack.pop_back();
+
+		//(test on the way out, since max_t may have shrunk since this node was pushed)
+		float t = enter(node.box);
+		if (t == std::numeric_limits< float >::infinity()) continue;
+
+		if (node.is_leaf()) {
+			max_t = std::min(max_t, fn(node.item, t));
+			continue;
+		}
+
+		float t_left = enter(nodes[node.left].box);
+		float t_right = enter(nodes[node.right].box);
+		//push the farther child first, so the nearer one is visited first:
+		if (t_left > t_right) {
+			if (t_left != std::numeric_limits< float >::infinity()) stack.emplace_back(node.left);
+			if (t_right != std::numeric_limits< float >::infinity()) stack.emplace_back(node.right);
+		} else {
+			if (t_right != std::numeric_limits< float >::infinity()) stack.emplace_back(node.right);
+			if (t_left != std::numeric_limits< float >::infinity()) stack.emplace_back(node.left);
+		}
+	}
+}
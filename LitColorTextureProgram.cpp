@@ -3,6 +3,8 @@
 #include "gl_compile_program.hpp"
 #include "gl_errors.hpp"
 
+#include <glm/gtc/type_ptr.hpp>
+
 Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
 
 Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> LitColorTextureProgram const * {
@@ -43,29 +45,74 @@ Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> L
 	return ret;
 });
 
-LitColorTextureProgram::LitColorTextureProgram() {
-	//Compile vertex and fragment shaders using the convenient 'gl_compile_program' helper function:
-	program = gl_compile_program(
-		//vertex shader:
-		"#version 330\n"
-		"uniform mat4 CLIP_FROM_OBJECT;\n"
-		"uniform mat4x3 LIGHT_FROM_OBJECT;\n"
-		"uniform mat3 LIGHT_FROM_NORMAL;\n"
-		"in vec4 Position;\n"
-		"in vec3 Normal;\n"
-		"in vec4 Color;\n"
-		"in vec2 TexCoord;\n"
+//(registered after lit_color_texture_program in the same tag, so it runs after the pipeline template is built)
+Load< LitColorTextureProgram > lit_color_texture_program_instanced(LoadTagEarly, []() -> LitColorTextureProgram const * {
+	LitColorTextureProgram *ret = new LitColorTextureProgram(LitColorTextureProgram::Instanced);
+
+	lit_color_texture_program_pipeline.instanced.program = ret->program;
+	lit_color_texture_program_pipeline.instanced.WORLD_FROM_OBJECT_mat4x3 = ret->WORLD_FROM_OBJECT_mat4x3;
+	lit_color_texture_program_pipeline.instanced.LIGHT_FROM_NORMAL_mat3 = ret->INSTANCE_LIGHT_FROM_NORMAL_mat3;
+	lit_color_texture_program_pipeline.instanced.CLIP_FROM_WORLD_mat4 = ret->CLIP_FROM_WORLD_mat4;
+	lit_color_texture_program_pipeline.instanced.LIGHT_FROM_WORLD_mat4x3 = ret->LIGHT_FROM_WORLD_mat4x3;
+	lit_color_texture_program_pipeline.instanced.OBJECT_FROM_POSITION_mat4x3 = ret->OBJECT_FROM_POSITION_mat4x3;
+
+	return ret;
+});
+
+LitColorTextureProgram::LitColorTextureProgram(Variant variant) {
+	//per-vertex attributes have fixed locations, so a vertex array made for either variant works with the other:
+	std::string vertex_inputs =
+		"layout(location = 0) in vec4 Position;\n"
+		"layout(location = 1) in vec3 Normal;\n"
+		"layout(location = 2) in vec4 Color;\n"
+		"layout(location = 3) in vec2 TexCoord;\n"
 		"out vec3 position;\n"
 		"out vec3 normal;\n"
 		"out vec4 color;\n"
 		"out vec2 texCoord;\n"
-		"void main() {\n"
-		"	gl_Position = CLIP_FROM_OBJECT * Position;\n"
-		"	position = LIGHT_FROM_OBJECT * Position;\n"
-		"	normal = LIGHT_FROM_NORMAL * Normal;\n"
-		"	color = Color;\n"
-		"	texCoord = TexCoord;\n"
-		"}\n"
+	;
+
+	std::string vertex_shader;
+	if (variant == Plain) {
+		vertex_shader =
+			"#version 330\n"
+			"uniform mat4 CLIP_FROM_OBJECT;\n"
+			"uniform mat4x3 LIGHT_FROM_OBJECT;\n"
+			"uniform mat3 LIGHT_FROM_NORMAL;\n"
+			+ vertex_inputs +
+			"void main() {\n"
+			"	gl_Position = CLIP_FROM_OBJECT * Position;\n"
+			"	position = LIGHT_FROM_OBJECT * Position;\n"
+			"	normal = LIGHT_FROM_NORMAL * Normal;\n"
+			"	color = Color;\n"
+			"	texCoord = TexCoord;\n"
+			"}\n"
+		;
+	} else { assert(variant == Instanced);
+		vertex_shader =
+			"#version 330\n"
+			"uniform mat4 CLIP_FROM_WORLD;\n"
+			"uniform mat4x3 LIGHT_FROM_WORLD;\n"
+			"uniform mat4x3 OBJECT_FROM_POSITION;\n" //(dequantizes positions; see MeshBuffer::Quantized)
+			"layout(location = 4) in mat4x3 WORLD_FROM_OBJECT;\n" //(per-instance)
+			"layout(location = 8) in mat3 LIGHT_FROM_NORMAL;\n" //(per-instance; computed once per instance by Scene::draw)
+			+ vertex_inputs +
+			"void main() {\n"
+			"	vec4 object_position = vec4(OBJECT_FROM_POSITION * Position, 1.0);\n"
+			"	vec4 world_position = vec4(WORLD_FROM_OBJECT * object_position, 1.0);\n"
+			"	gl_Position = CLIP_FROM_WORLD * world_position;\n"
+			"	position = LIGHT_FROM_WORLD * world_position;\n"
+			"	normal = LIGHT_FROM_NORMAL * Normal;\n"
+			"	color = Color;\n"
+			"	texCoord = TexCoord;\n"
+			"}\n"
+		;
+	}
+
+	//Compile vertex and fragment shaders using the convenient 'gl_compile_program' helper function:
+	program = gl_compile_program(
+		//vertex shader:
+		vertex_shader
 	,
 		//fragment shader:
 		"#version 330\n"
@@ -131,10 +178,19 @@ LitColorTextureProgram::LitColorTextureProgram() {
 	Color_vec4 = glGetAttribLocation(program, "Color");
 	TexCoord_vec2 = glGetAttribLocation(program, "TexCoord");
 
+	if (variant == Instanced) {
+		WORLD_FROM_OBJECT_mat4x3 = glGetAttribLocation(program, "WORLD_FROM_OBJECT");
+		INSTANCE_LIGHT_FROM_NORMAL_mat3 = glGetAttribLocation(program, "LIGHT_FROM_NORMAL");
+	}
+
 	//look up the locations of uniforms:
+	// (glGetUniformLocation returns -1 for the other variant's uniforms)
 	CLIP_FROM_OBJECT_mat4 = glGetUniformLocation(program, "CLIP_FROM_OBJECT");
 	LIGHT_FROM_OBJECT_mat4x3 = glGetUniformLocation(program, "LIGHT_FROM_OBJECT");
 	LIGHT_FROM_NORMAL_mat3 = glGetUniformLocation(program, "LIGHT_FROM_NORMAL");
+	CLIP_FROM_WORLD_mat4 = glGetUniformLocation(program, "CLIP_FROM_WORLD");
+	LIGHT_FROM_WORLD_mat4x3 = glGetUniformLocation(program, "LIGHT_FROM_WORLD");
+	OBJECT_FROM_POSITION_mat4x3 = glGetUniformLocation(program, "OBJECT_FROM_POSITION");
 
 	LIGHT_TYPE_int = glGetUniformLocation(program, "LIGHT_TYPE");
 	LIGHT_LOCATION_vec3 = glGetUniformLocation(program, "LIGHT_LOCATION");
@@ -150,6 +206,12 @@ LitColorTextureProgram::LitColorTextureProgram() {
 
 	glUniform1i(TEX_sampler2D, 0); //set TEX to sample from GL_TEXTURE0
 
+	if (OBJECT_FROM_POSITION_mat4x3 != -1U) {
+		//default to unquantized positions:
+		glm::mat4x3 identity = glm::mat4x3(1.0f);
+		glUniformMatrix4x3fv(OBJECT_FROM_POSITION_mat4x3, 1, GL_FALSE, glm::value_ptr(identity));
+	}
+
 	glUseProgram(0); //unbind program -- glUniform* calls refer to ??? now
 }
 
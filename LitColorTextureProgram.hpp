@@ -6,7 +6,14 @@
 
 //Shader program that draws transformed, lit, textured vertices tinted with vertex colors:
 struct LitColorTextureProgram {
-	LitColorTextureProgram();
+	//The Instanced variant takes the object-to-world matrix from a per-instance attribute instead of uniforms,
+	// so many copies of a mesh can be drawn with one glDrawArraysInstanced call.
+	// (both variants use the same per-vertex attribute locations, so they can share vertex array objects)
+	enum Variant {
+		Plain,
+		Instanced,
+	};
+	LitColorTextureProgram(Variant variant = Plain);
 	~LitColorTextureProgram();
 
 	GLuint program = 0;
@@ -17,11 +24,20 @@ struct LitColorTextureProgram {
 	GLuint Color_vec4 = -1U;
 	GLuint TexCoord_vec2 = -1U;
 
-	//Uniform (per-invocation variable) locations:
+	//Attribute (per-instance variable) locations -- Instanced only:
+	GLuint WORLD_FROM_OBJECT_mat4x3 = -1U; //(uses four consecutive locations, one per column)
+	GLuint INSTANCE_LIGHT_FROM_NORMAL_mat3 = -1U; //(uses three consecutive locations; named apart from the Plain uniform LIGHT_FROM_NORMAL_mat3)
+
+	//Uniform (per-invocation variable) locations -- Plain only:
 	GLuint CLIP_FROM_OBJECT_mat4 = -1U;
 	GLuint LIGHT_FROM_OBJECT_mat4x3 = -1U;
 	GLuint LIGHT_FROM_NORMAL_mat3 = -1U;
 
+	//Uniform (per-invocation variable) locations -- Instanced only:
+	GLuint CLIP_FROM_WORLD_mat4 = -1U;
+	GLuint LIGHT_FROM_WORLD_mat4x3 = -1U;
+	GLuint OBJECT_FROM_POSITION_mat4x3 = -1U; //(position dequantization; see MeshBuffer::Quantized)
+
 	//lighting:
 	GLuint LIGHT_TYPE_int = -1U;
 	GLuint LIGHT_LOCATION_vec3 = -1U;
@@ -34,7 +50,9 @@ struct LitColorTextureProgram {
 };
 
 extern Load< LitColorTextureProgram > lit_color_texture_program;
+extern Load< LitColorTextureProgram > lit_color_texture_program_instanced;
 
 //For convenient scene-graph setup, copy this object:
 // NOTE: by default, has texture bound to 1-pixel white texture -- so it's okay to use with vertex-color-only meshes.
+// NOTE: pipeline.instanced refers to lit_color_texture_program_instanced, so Scene::draw can instance repeated meshes.
 extern Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
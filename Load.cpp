@@ -2,11 +2,37 @@
 
 #include <array>
 #include <list>
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
 #include <cassert>
 
 namespace {
-	std::array< std::list< std::function< void() > >, MaxLoadTag > &get_load_lists() {
-		static std::array< std::list< std::function< void() > >, MaxLoadTag > load_lists;
+	struct Job {
+		void const *key = nullptr; //nullptr for plain load functions
+		std::string name;
+		std::vector< void const * > dependencies;
+		std::function< void() > work; //(worker thread; may be empty)
+		std::function< void() > finish; //(main thread; may be empty)
+
+		//filled in by call_load_functions():
+		std::vector< uint32_t > after; //indices (in same tag) of jobs that must be done first
+		enum State : uint8_t { Waiting, Working, Worked, Done } state = Waiting;
+		float work_begin = 0.0f, work_end = 0.0f; //seconds since call_load_functions() started
+		float finish_begin = 0.0f, finish_end = 0.0f;
+		float path = 0.0f; //length of the longest chain of dependencies ending with this job
+		uint32_t path_prev = -1U; //previous job in that chain
+	};
+
+	std::array< std::list< Job >, MaxLoadTag > &get_load_lists() {
+		static std::array< std::list< Job >, MaxLoadTag > load_lists;
 		return load_lists;
 	}
 }
@@ -14,7 +40,23 @@ namespace {
 void add_load_function(LoadTag tag, std::function< void() > const &fn) {
 	auto &load_lists = get_load_lists();
 	assert(tag < load_lists.size());
-	load_lists[tag].emplace_back(fn);
+	Job job;
+	job.finish = fn;
+	load_lists[tag].emplace_back(std::move(job));
+}
+
+void add_load_job(void const *key, LoadTag tag, std::string const &name, std::vector< void const * > const &dependencies,
+	std::function< void() > const &work, std::function< void() > const &finish) {
+	assert(key);
+	auto &load_lists = get_load_lists();
+	assert(tag < load_lists.size());
+	Job job;
+	job.key = key;
+	job.name = name;
+	job.dependencies = dependencies;
+	job.work = work;
+	job.finish = finish;
+	load_lists[tag].emplace_back(std::move(job));
 }
 
 void call_load_functions() {
@@ -22,11 +64,231 @@ void call_load_functions() {
 	assert(!has_been_called && "call_load_functions should only be called *once*");
 	has_been_called = true;
 
+	auto start = std::chrono::steady_clock::now();
+	auto now = [&start]() -> float {
+		return std::chrono::duration< float >(std::chrono::steady_clock::now() - start).count();
+	};
+
 	auto &load_lists = get_load_lists();
-	for (auto &fn_list : load_lists) {
-		while (!fn_list.empty()) {
-			(*fn_list.begin())(); //call first function in the list
-			fn_list.pop_front(); //remove from list
+
+	//name plain load functions and figure out which tag every job is in:
+	std::unordered_map< void const *, LoadTag > key_tags;
+	for (uint32_t tag = 0; tag < load_lists.size(); ++tag) {
+		uint32_t plain = 0;
+		for (auto &job : load_lists[tag]) {
+			if (job.key) {
+				if (!key_tags.emplace(job.key, LoadTag(tag)).second) {
+					throw std::runtime_error("Load job '" + job.name + "' was registered twice.");
+				}
+			} else {
+				job.name = "load function " + std::to_string(tag) + "." + std::to_string(plain++);
+			}
+		}
+	}
+
+	//worker threads pull from 'queue' and push to 'worked':
+	std::mutex mutex;
+	std::condition_variable work_cv, worked_cv;
+	std::deque< Job * > queue;
+	std::deque< Job * > worked;
+	std::exception_ptr worker_error;
+	bool quit = false;
+
+	std::vector< std::thread > workers;
+	uint32_t worker_count = std::max(2u, std::thread::hardware_concurrency()) - 1; //(leave a core for the main thread)
+
+	auto worker_main = [&]() {
+		std::unique_lock< std::mutex > lock(mutex);
+		while (true) {
+			work_cv.wait(lock, [&](){ return quit || !queue.empty(); });
+			if (quit) break;
+			Job *job = queue.front();
+			queue.pop_front();
+			lock.unlock();
+			job->work_begin = now();
+			try {
+				job->work();
+			} catch (...) {
+				lock.lock();
+				if (!worker_error) worker_error = std::current_exception();
+				lock.unlock();
+			}
+			job->work_end = now();
+			lock.lock();
+			worked.emplace_back(job);
+			worked_cv.notify_one();
+		}
+	};
+
+	//stop workers on the way out (including if an exception is thrown):
+	struct StopWorkers {
+		std::function< void() > fn;
+		~StopWorkers() { fn(); }
+	} stop_workers{ [&]() {
+		{
+			std::unique_lock< std::mutex > lock(mutex);
+			quit = true;
+		}
+		work_cv.notify_all();
+		for (auto &worker : workers) worker.join();
+		workers.clear();
+	}};
+
+	//timings, for the report at the end:
+	struct Timing {
+		std::string name;
+		float work_begin, work_end, finish_begin, finish_end;
+		uint32_t path_prev;
+	};
+	std::vector< Timing > report;
+	float tag_base_path = 0.0f;
+	uint32_t tag_base_prev = -1U;
+
+	for (uint32_t tag = 0; tag < load_lists.size(); ++tag) {
+		std::vector< Job * > jobs;
+		for (auto &job : load_lists[tag]) {
+			jobs.emplace_back(&job);
+		}
+
+		//resolve dependencies:
+		std::unordered_map< void const *, uint32_t > key_index;
+		for (uint32_t j = 0; j < jobs.size(); ++j) {
+			if (jobs[j]->key) key_index.emplace(jobs[j]->key, j);
+		}
+		for (uint32_t j = 0; j < jobs.size(); ++j) {
+			Job &job = *jobs[j];
+			if (job.key) {
+				for (void const *dep : job.dependencies) {
+					auto f = key_index.find(dep);
+					if (f != key_index.end()) {
+						job.after.emplace_back(f->second);
+						continue;
+					}
+					auto t = key_tags.find(dep);
+					if (t == key_tags.end()) {
+						throw std::runtime_error("Load job '" + job.name + "' depends on something that was never registered.");
+					} else if (t->second > tag) {
+						throw std::runtime_error("Load job '" + job.name + "' depends on a job with a later tag.");
+					}
+					//(dependencies in earlier tags are already done)
+				}
+			} else {
+				//plain load functions wait for everything registered before them, as they always have:
+				for (uint32_t b = 0; b < j; ++b) job.after.emplace_back(b);
+			}
+		}
+
+		//work through the jobs:
+		uint32_t done = 0;
+		uint32_t in_flight = 0;
+		while (done < jobs.size()) {
+			//start anything that is ready:
+			bool progress = false;
+			for (uint32_t j = 0; j < jobs.size(); ++j) {
+				Job &job = *jobs[j];
+				if (job.state != Job::Waiting) continue;
+				bool ready = true;
+				for (uint32_t a : job.after) {
+					if (jobs[a]->state != Job::Done) {
+						ready = false;
+						break;
+					}
+				}
+				if (!ready) continue;
+				if (job.work) {
+					if (workers.empty()) {
+						for (uint32_t w = 0; w < worker_count; ++w) workers.emplace_back(worker_main);
+					}
+					job.state = Job::Working;
+					++in_flight;
+					{
+						std::unique_lock< std::mutex > lock(mutex);
+						queue.emplace_back(&job);
+					}
+					work_cv.notify_one();
+				} else {
+					job.work_begin = job.work_end = now();
+					job.state = Job::Worked;
+					std::unique_lock< std::mutex > lock(mutex);
+					worked.emplace_back(&job);
+				}
+				progress = true;
+			}
+
+			//finish jobs whose work is complete (on this thread, which has the OpenGL context):
+			Job *job = nullptr;
+			{
+				std::unique_lock< std::mutex > lock(mutex);
+				if (worked.empty()) {
+					if (in_flight == 0 && !progress) {
+						throw std::runtime_error("Load jobs have a dependency cycle.");
+					}
+					worked_cv.wait(lock, [&](){ return !worked.empty(); });
+				}
+				if (worker_error) std::rethrow_exception(worker_error);
+				job = worked.front();
+				worked.pop_front();
+			}
+			if (job->state == Job::Working) --in_flight;
+			job->finish_begin = now();
+			if (job->finish) job->finish();
+			job->finish_end = now();
+			job->state = Job::Done;
+			++done;
+
+			//longest chain of dependencies ending with this job:
+			job->path = tag_base_path;
+			job->path_prev = tag_base_prev;
+			for (uint32_t a : job->after) {
+				if (jobs[a]->path > job->path) {
+					job->path = jobs[a]->path;
+					job->path_prev = uint32_t(report.size() + a);
+				}
+			}
+			job->path += (job->work_end - job->work_begin) + (job->finish_end - job->finish_begin);
+		}
+
+		//everything in the next tag waits for the slowest chain in this one:
+		for (uint32_t j = 0; j < jobs.size(); ++j) {
+			if (jobs[j]->path > tag_base_path) {
+				tag_base_path = jobs[j]->path;
+				tag_base_prev = uint32_t(report.size() + j);
+			}
+		}
+		for (auto job : jobs) {
+			report.emplace_back(Timing{ job->name, job->work_begin, job->work_end, job->finish_begin, job->finish_end, job->path_prev });
+		}
+
+		load_lists[tag].clear();
+	}
+
+	uint32_t workers_used = uint32_t(workers.size());
+	stop_workers.fn();
+
+	//report timings:
+	std::cout << "Loaded " << report.size() << " things in " << std::fixed << std::setprecision(1) << now() * 1e3f << " ms (" << workers_used << " worker threads):\n";
+	std::vector< uint32_t > order(report.size());
+	for (uint32_t i = 0; i < order.size(); ++i) order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){
+		return report[a].work_begin < report[b].work_begin;
+	});
+	for (uint32_t i : order) {
+		Timing const &t = report[i];
+		std::cout << "  " << std::setw(8) << t.work_begin * 1e3f << " ms +"
+			<< std::setw(7) << (t.work_end - t.work_begin) * 1e3f << " ms work +"
+			<< std::setw(7) << (t.finish_end - t.finish_begin) * 1e3f << " ms finish  " << t.name << "\n";
+	}
+	if (tag_base_prev != -1U) {
+		std::vector< std::string > path;
+		for (uint32_t i = tag_base_prev; i != -1U; i = report[i].path_prev) {
+			path.emplace_back(report[i].name);
+		}
+		std::cout << "  critical path (" << tag_base_path * 1e3f << " ms):";
+		for (auto p = path.rbegin(); p != path.rend(); ++p) {
+			std::cout << (p == path.rbegin() ? " " : " -> ") << *p;
 		}
+		std::cout << "\n";
 	}
+	std::cout << std::defaultfloat;
+	std::cout.flush();
 }
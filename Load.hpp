@@ -20,10 +20,31 @@
  * These functions are grouped by 'tags', which allow some sequencing of calls.
  * (particularly, this is useful for loading large data blobs [e.g. Meshes] before looking up individual elements within them.)
  *
+ * Loading can also happen in parallel. An "async" Load<> splits its work into:
+ *  - a 'load' function that runs on a worker thread (file reads, decoding, parsing -- no OpenGL calls!), and
+ *  - an optional 'upload' function that runs afterward on the main thread (where the OpenGL context lives).
+ * Async Load<>s say what they depend on by listing other Load<>s:
+ *
+ * Load< MeshBuffer > level_meshes(LoadTagDefault, "level.pnct", {}, []() -> MeshBuffer * {
+ *     return new MeshBuffer(data_path("level.pnct"), MeshBuffer::DeferUpload);
+ * }, [](MeshBuffer *buffer) {
+ *     buffer->upload();
+ * });
+ * Load< Scene > level_scene(LoadTagDefault, "level.scene", {&level_meshes}, []() -> Scene * {
+ *     return new Scene(data_path("level.scene"), ... level_meshes->lookup(...) ...);
+ * });
+ *
+ * Tags still act as barriers: everything in one tag finishes before anything in the next starts.
+ * Within a tag, plain (non-async) load functions run on the main thread after everything registered before them.
+ *
+ * call_load_functions() prints how long each loader took, along with the longest chain of dependencies (the critical path).
+ *
  */
 
 #include <functional>
 #include <stdexcept>
+#include <string>
+#include <vector>
 #include <cstdint>
 
 
@@ -38,6 +59,13 @@ enum LoadTag : uint32_t {
 // (only call *before* "call_load_functions()")
 void add_load_function(LoadTag tag, std::function< void() > const &fn);
 
+//Add a job that runs 'work' on a worker thread and then 'finish' on the main thread:
+// - 'key' identifies the job (generally, the address of the Load<> that registered it)
+// - 'dependencies' are keys of other jobs that must be done before 'work' starts
+// (only call *before* "call_load_functions()")
+void add_load_job(void const *key, LoadTag tag, std::string const &name, std::vector< void const * > const &dependencies,
+	std::function< void() > const &work, std::function< void() > const &finish);
+
 //Call all loading functions:
 // (loading functions may throw exceptions if they fail.)
 // (only call *once*)
@@ -60,6 +88,19 @@ struct Load {
 		});
 	}
 
+	//Async version: 'load_fn' runs on a worker thread once all of 'after' have loaded, then 'upload_fn' (if given) runs on the main thread:
+	Load(LoadTag tag, std::string const &name, std::vector< void const * > const &after,
+		std::function< T *() > const &load_fn, std::function< void(T *) > const &upload_fn = nullptr) : value(nullptr) {
+		add_load_job(this, tag, name, after, [this,load_fn](){
+			this->value = load_fn();
+			if (!(this->value)) {
+				throw std::runtime_error("Loading failed.");
+			}
+		}, [this,upload_fn](){
+			if (upload_fn) upload_fn(const_cast< T * >(this->value));
+		});
+	}
+
 	//Make a "Load< T >" behave like a "T const *":
 	explicit operator bool() { return value != nullptr; }
 	operator T const *() { return value; }
@@ -140,9 +140,23 @@ const game_names = [
 	maek.CPP('main.cpp'),
 	maek.CPP('LitColorTextureProgram.cpp'),
 	//maek.CPP('ColorTextureProgram.cpp'),  //not used right now, but you might want it
+];
+
+const sound_names = [
 	maek.CPP('Sound.cpp'),
+	maek.CPP('mix_kernels.cpp'),
+	maek.CPP('resample.cpp'),
+	maek.CPP('hrtf.cpp'),
 	maek.CPP('load_wav.cpp'),
-	maek.CPP('load_opus.cpp')
+	maek.CPP('load_opus.cpp'),
+	maek.CPP('pcm_cache.cpp'),
+	maek.CPP('SampleCache.cpp'),
+	maek.CPP('OpusStream.cpp')
+];
+
+//(used both by common_names, for mesh loading, and by sound_names, for the sample cache):
+const mapped_file_names = [
+	maek.CPP('MappedFile.cpp')
 ];
 
 const common_names = [
@@ -152,7 +166,9 @@ const common_names = [
 	maek.CPP('DrawLines.cpp'),
 	maek.CPP('ColorProgram.cpp'),
 	maek.CPP('Scene.cpp'),
+	maek.CPP('BVH.cpp'),
 	maek.CPP('Mesh.cpp'),
+	...mapped_file_names,
 	maek.CPP('load_save_png.cpp'),
 	maek.CPP('gl_compile_program.cpp'),
 	maek.CPP('Mode.cpp'),
@@ -172,16 +188,45 @@ const show_scene_names = [
 	maek.CPP('ShowSceneMode.cpp')
 ];
 
+const pnct_tool_names = [
+	maek.CPP('PnctFile.cpp')
+];
+
+const optimize_meshes_names = [
+	maek.CPP('optimize-meshes.cpp')
+];
+
+const simplify_meshes_names = [
+	maek.CPP('simplify-meshes.cpp')
+];
+
+const sound_bench_names = [
+	maek.CPP('sound-bench.cpp')
+];
+
+const scene_bench_names = [
+	maek.CPP('scene-bench.cpp')
+];
+
+const render_bench_names = [
+	maek.CPP('render-bench.cpp')
+];
+
 //the '[exeFile =] LINK(objFiles, exeFileBase, [, options])' links an array of objects into an executable:
 // objFiles: array of objects to link
 // exeFileBase: name of executable file to produce
 //returns exeFile: exeFileBase + a platform-dependant suffix (e.g., '.exe' on windows)
-const game_exe = maek.LINK([...game_names, ...common_names], 'dist/game');
+const game_exe = maek.LINK([...game_names, ...sound_names, ...common_names], 'dist/game');
 const show_meshes_exe = maek.LINK([...show_meshes_names, ...common_names], 'scenes/show-meshes');
 const show_scene_exe = maek.LINK([...show_scene_names, ...common_names], 'scenes/show-scene');
+const optimize_meshes_exe = maek.LINK([...optimize_meshes_names, ...pnct_tool_names], 'scenes/optimize-meshes');
+const simplify_meshes_exe = maek.LINK([...simplify_meshes_names, ...pnct_tool_names], 'scenes/simplify-meshes');
+const sound_bench_exe = maek.LINK([...sound_bench_names, ...sound_names, ...mapped_file_names], 'dist/sound-bench');
+const scene_bench_exe = maek.LINK([...scene_bench_names, ...common_names], 'dist/scene-bench');
+const render_bench_exe = maek.LINK([...render_bench_names, ...sound_names, ...mapped_file_names], 'dist/render-bench');
 
 //set the default target to the game (and copy the readme files):
-maek.TARGETS = [game_exe, show_meshes_exe, show_scene_exe, ...copies];
+maek.TARGETS = [game_exe, show_meshes_exe, show_scene_exe, optimize_meshes_exe, simplify_meshes_exe, sound_bench_exe, scene_bench_exe, render_bench_exe, ...copies];
 
 //Note that tasks that produce ':abstract targets' are never cached.
 // This is similar to how .PHONY targets behave in make.
@@ -0,0 +1,42 @@
+#pragma once
+
+/*
+ * MappedFile maps a whole file into memory (read-only), so its contents
+ *  can be used in place rather than being read into a buffer.
+ *
+ * Use map_chunk() (in read_write_chunk.hpp) to get typed views of chunks.
+ *
+ */
+
+#include <string>
+#include <streambuf>
+#include <cstdint>
+#include <cstddef>
+
+struct MappedFile {
+	//map 'filename'; throws on error:
+	MappedFile(std::string const &filename);
+	~MappedFile();
+
+	MappedFile(MappedFile const &) = delete;
+	MappedFile &operator=(MappedFile const &) = delete;
+
+	std::string filename;
+	uint8_t const *data = nullptr; //(nullptr if the file is empty)
+	size_t size = 0;
+
+	//-- internals --
+	#if defined(_WIN32)
+	void *file_handle = nullptr;
+	void *mapping_handle = nullptr;
+	#endif
+};
+
+//std::streambuf over (part of) a MappedFile, for code that wants a std::istream:
+// std::istream stream(&buf);
+struct MappedStreambuf : std::streambuf {
+	MappedStreambuf(MappedFile const &file, size_t offset = 0) {
+		char *begin = const_cast< char * >(reinterpret_cast< char const * >(file.data));
+		setg(begin, begin + offset, begin + file.size);
+	}
+};
@@ -4,17 +4,58 @@
 #include <glm/glm.hpp>
 
 #include <stdexcept>
-#include <fstream>
 #include <iostream>
 #include <vector>
 #include <string>
 #include <set>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <cstddef>
+#include <cassert>
 
-MeshBuffer::MeshBuffer(std::string const &filename) {
-	glGenBuffers(1, &buffer);
+//helpers for MeshBuffer::Quantized:
+
+//pack a (unit) vector as signed normalized 10:10:10:2 (GL_INT_2_10_10_10_REV):
+static uint32_t pack_snorm_10_10_10_2(glm::vec3 const &v) {
+	auto snorm10 = [](float x) -> uint32_t {
+		return uint32_t(int32_t(std::round(std::clamp(x, -1.0f, 1.0f) * 511.0f))) & 0x3ffu;
+	};
+	return snorm10(v.x) | (snorm10(v.y) << 10) | (snorm10(v.z) << 20);
+}
+
+//convert a float to a half float (GL_HALF_FLOAT), rounding to nearest even:
+static uint16_t pack_half(float f) {
+	uint32_t bits;
+	std::memcpy(&bits, &f, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000u;
+	uint32_t exponent = (bits >> 23) & 0xffu;
+	uint32_t mantissa = bits & 0x7fffffu;
+
+	if (exponent == 0xff) return uint16_t(sign | 0x7c00u | (mantissa ? 0x200u : 0u)); //inf or nan
+	int32_t e = int32_t(exponent) - 127 + 15;
+	if (e >= 0x1f) return uint16_t(sign | 0x7c00u); //too large: inf
+
+	uint32_t shift = 13;
+	uint32_t half = 0;
+	if (e <= 0) {
+		//subnormal half (or zero):
+		if (e < -10) return uint16_t(sign);
+		mantissa |= 0x800000u;
+		shift = uint32_t(14 - e);
+	} else {
+		half = uint32_t(e) << 10;
+	}
+	half |= mantissa >> shift;
+	uint32_t rest = mantissa & ((1u << shift) - 1u);
+	uint32_t halfway = 1u << (shift - 1u);
+	if (rest > halfway || (rest == halfway && (half & 1u))) ++half; //(carry into exponent is the right thing)
+	return uint16_t(sign | half);
+}
 
-	std::ifstream file(filename, std::ios::binary);
+MeshBuffer::MeshBuffer(std::string const &filename, Upload when, Format format) {
+	mapped = std::make_unique< MappedFile >(filename);
+	size_t at = 0; //read position in file
 
 	GLuint total = 0;
 
@@ -25,18 +66,22 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		glm::vec2 TexCoord;
 	};
 	static_assert(sizeof(Vertex) == 3*4+3*4+4*1+2*4, "Vertex is packed.");
-	std::vector< Vertex > data;
+	Vertex const *data = nullptr;
 
-	//read + upload data chunk:
+	//read data chunk (kept in 'pending' until upload):
 	if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".pnct") {
-		read_chunk(file, "pnct", &data);
-
-		//upload data:
-		glBindBuffer(GL_ARRAY_BUFFER, buffer);
-		glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(Vertex), data.data(), GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		pending = map_chunk(*mapped, &at, "pnct", &unaligned);
+		if (pending.size() % sizeof(Vertex) != 0) {
+			throw std::runtime_error("Size of pnct chunk not divisible by vertex size");
+		}
+		if (reinterpret_cast< uintptr_t >(pending.data()) % alignof(Vertex) != 0) {
+			//(never happens for files written by export-meshes.py, since pnct is the first chunk)
+			unaligned.assign(pending.begin(), pending.end());
+			pending = std::span< uint8_t const >(unaligned);
+		}
+		data = reinterpret_cast< Vertex const * >(pending.data());
 
-		total = GLuint(data.size()); //store total for later checks on index
+		total = GLuint(pending.size() / sizeof(Vertex)); //store total for later checks on index
 
 		//store attrib locations:
 		Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
@@ -47,18 +92,68 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		throw std::runtime_error("Unknown file type '" + filename + "'");
 	}
 
-	std::vector< char > strings;
-	read_chunk(file, "str0", &strings);
+	//read (optional) index chunk, also kept in 'pending_indices' until upload:
+	// (files written by older versions of export-meshes.py have no index chunk, just triangle soup)
+	GLenum index_type = GL_NONE;
+	uint32_t index_size = 0;
+	if (at <= mapped->size && mapped->size - at >= 4) {
+		std::string magic(reinterpret_cast< char const * >(mapped->data + at), 4);
+		if (magic == "ix16") {
+			index_type = GL_UNSIGNED_SHORT;
+			index_size = sizeof(uint16_t);
+		} else if (magic == "ix32") {
+			index_type = GL_UNSIGNED_INT;
+			index_size = sizeof(uint32_t);
+		}
+	}
+	if (index_type != GL_NONE) {
+		pending_indices = map_chunk(*mapped, &at, index_size == 2 ? "ix16" : "ix32", &unaligned_indices);
+		if (pending_indices.size() % index_size != 0) {
+			throw std::runtime_error("Size of index chunk not divisible by index size");
+		}
+		if (reinterpret_cast< uintptr_t >(pending_indices.data()) % index_size != 0) {
+			unaligned_indices.assign(pending_indices.begin(), pending_indices.end());
+			pending_indices = std::span< uint8_t const >(unaligned_indices);
+		}
+	}
+	GLuint index_total = (index_size ? GLuint(pending_indices.size() / index_size) : 0);
+	auto index_at = [&](uint32_t i) -> uint32_t {
+		if (index_type == GL_UNSIGNED_SHORT) return reinterpret_cast< uint16_t const * >(pending_indices.data())[i];
+		else return reinterpret_cast< uint32_t const * >(pending_indices.data())[i];
+	};
 
-	{ //read index chunk, add to meshes:
+	std::vector< char > strings_unaligned;
+	std::span< char const > strings = map_chunk(*mapped, &at, "str0", &strings_unaligned);
+
+	//vertex ranges of meshes (used when quantizing):
+	struct MeshRange {
+		uint32_t vertex_begin, vertex_end;
+		Mesh *mesh;
+	};
+	std::vector< MeshRange > ranges;
+
+	//mesh made from each index entry (nullptr if its name collided), for resolving levels of detail:
+	std::vector< Mesh * > entry_meshes;
+
+	auto add_mesh = [&](std::string const &name, Mesh const &mesh, uint32_t vertex_begin, uint32_t vertex_end) {
+		auto ret = meshes.insert(std::make_pair(name, mesh));
+		if (!ret.second) {
+			std::cerr << "WARNING: mesh name '" + name + "' in filename '" + filename + "' collides with existing mesh." << std::endl;
+		} else {
+			ranges.emplace_back(MeshRange{ vertex_begin, vertex_end, &ret.first->second });
+		}
+		entry_meshes.emplace_back(ret.second ? &ret.first->second : nullptr);
+	};
+
+	if (index_type == GL_NONE) { //read index chunk, add to meshes:
 		struct IndexEntry {
 			uint32_t name_begin, name_end;
 			uint32_t vertex_begin, vertex_end;
 		};
 		static_assert(sizeof(IndexEntry) == 16, "Index entry should be packed");
 
-		std::vector< IndexEntry > index;
-		read_chunk(file, "idx0", &index);
+		std::vector< IndexEntry > index_unaligned;
+		std::span< IndexEntry const > index = map_chunk(*mapped, &at, "idx0", &index_unaligned);
 
 		for (auto const &entry : index) {
 			if (!(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
@@ -67,7 +162,7 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 			if (!(entry.vertex_begin <= entry.vertex_end && entry.vertex_end <= total)) {
 				throw std::runtime_error("index entry has out-of-range vertex start/count");
 			}
-			std::string name(&strings[0] + entry.name_begin, &strings[0] + entry.name_end);
+			std::string name(strings.data() + entry.name_begin, strings.data() + entry.name_end);
 			Mesh mesh;
 			mesh.type = GL_TRIANGLES;
 			mesh.start = entry.vertex_begin;
@@ -76,17 +171,140 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 				mesh.min = glm::min(mesh.min, data[v].Position);
 				mesh.max = glm::max(mesh.max, data[v].Position);
 			}
-			bool inserted = meshes.insert(std::make_pair(name, mesh)).second;
-			if (!inserted) {
-				std::cerr << "WARNING: mesh name '" + name + "' in filename '" + filename + "' collides with existing mesh." << std::endl;
+			add_mesh(name, mesh, entry.vertex_begin, entry.vertex_end);
+		}
+	} else { //read (indexed) index chunk, add to meshes:
+		struct IndexEntry {
+			uint32_t name_begin, name_end;
+			uint32_t vertex_begin, vertex_end;
+			uint32_t index_begin, index_end; //indices are relative to vertex_begin
+		};
+		static_assert(sizeof(IndexEntry) == 24, "Index entry should be packed");
+
+		std::vector< IndexEntry > index_unaligned;
+		std::span< IndexEntry const > index = map_chunk(*mapped, &at, "idx1", &index_unaligned);
+
+		for (auto const &entry : index) {
+			if (!(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
+				throw std::runtime_error("index entry has out-of-range name begin/end");
 			}
+			if (!(entry.vertex_begin <= entry.vertex_end && entry.vertex_end <= total)) {
+				throw std::runtime_error("index entry has out-of-range vertex start/count");
+			}
+			if (!(entry.index_begin <= entry.index_end && entry.index_end <= index_total)) {
+				throw std::runtime_error("index entry has out-of-range index start/count");
+			}
+			//(check indices here, since out-of-range indices are undefined behavior on the GPU)
+			for (uint32_t i = entry.index_begin; i < entry.index_end; ++i) {
+				if (index_at(i) >= entry.vertex_end - entry.vertex_begin) {
+					throw std::runtime_error("index entry references vertex outside its range");
+				}
+			}
+			std::string name(strings.data() + entry.name_begin, strings.data() + entry.name_end);
+			Mesh mesh;
+			mesh.type = GL_TRIANGLES;
+			mesh.start = entry.index_begin;
+			mesh.count = entry.index_end - entry.index_begin;
+			mesh.index_type = index_type;
+			mesh.base_vertex = GLint(entry.vertex_begin);
+			for (uint32_t v = entry.vertex_begin; v < entry.vertex_end; ++v) {
+				mesh.min = glm::min(mesh.min, data[v].Position);
+				mesh.max = glm::max(mesh.max, data[v].Position);
+			}
+			add_mesh(name, mesh, entry.vertex_begin, entry.vertex_end);
+		}
+	}
+
+	//read (optional) level of detail chunk:
+	struct LODEntry {
+		uint32_t mesh; //index entry of the coarser mesh
+		uint32_t lod_of; //index entry of the full-detail mesh
+		float error; //relative to half the full-detail mesh's bounding box diagonal
+	};
+	static_assert(sizeof(LODEntry) == 12, "LOD entry should be packed");
+	std::vector< LODEntry > lods_unaligned;
+	std::span< LODEntry const > lods;
+	if (at <= mapped->size && mapped->size - at >= 4 && std::string(reinterpret_cast< char const * >(mapped->data + at), 4) == "lod0") {
+		lods = map_chunk(*mapped, &at, "lod0", &lods_unaligned);
+	}
+
+	if (format == Quantized) {
+		//repack vertices (reading from 'data', which points into 'pending'):
+		struct QuantizedVertex {
+			glm::u16vec4 Position; //(w is always 0xffff, so comes out as 1.0)
+			uint32_t Normal;
+			glm::u8vec4 Color;
+			glm::u16vec2 TexCoord;
+		};
+		static_assert(sizeof(QuantizedVertex) == 4*2+4+4*1+2*2, "QuantizedVertex is packed.");
+
+		std::vector< QuantizedVertex > quantized(total, QuantizedVertex{ glm::u16vec4(0), 0, glm::u8vec4(0), glm::u16vec2(0) });
+		for (MeshRange const &range : ranges) {
+			Mesh &mesh = *range.mesh;
+			if (range.vertex_begin == range.vertex_end) continue;
+
+			//positions are stored relative to the mesh's bounding box:
+			glm::vec3 size = mesh.max - mesh.min;
+			mesh.position_offset = mesh.min;
+			mesh.position_scale = size;
+			glm::vec3 inv_size = glm::vec3(
+				size.x > 0.0f ? 1.0f / size.x : 0.0f,
+				size.y > 0.0f ? 1.0f / size.y : 0.0f,
+				size.z > 0.0f ? 1.0f / size.z : 0.0f
+			);
+
+			for (uint32_t v = range.vertex_begin; v < range.vertex_end; ++v) {
+				Vertex const &in = data[v];
+				QuantizedVertex &out = quantized[v];
+				glm::vec3 q = glm::clamp((in.Position - mesh.min) * inv_size, glm::vec3(0.0f), glm::vec3(1.0f)) * 65535.0f;
+				out.Position = glm::u16vec4(
+					uint16_t(std::round(q.x)),
+					uint16_t(std::round(q.y)),
+					uint16_t(std::round(q.z)),
+					uint16_t(0xffff)
+				);
+				out.Normal = pack_snorm_10_10_10_2(in.Normal);
+				out.Color = in.Color;
+				out.TexCoord = glm::u16vec2(pack_half(in.TexCoord.x), pack_half(in.TexCoord.y));
+			}
+		}
+
+		std::vector< uint8_t > bytes(quantized.size() * sizeof(QuantizedVertex));
+		if (!bytes.empty()) std::memcpy(bytes.data(), quantized.data(), bytes.size());
+		unaligned = std::move(bytes);
+		pending = std::span< uint8_t const >(unaligned);
+		data = nullptr;
+
+		//GL undoes everything but the bounding box scaling while fetching attributes:
+		Position = Attrib(4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(QuantizedVertex), offsetof(QuantizedVertex, Position));
+		Normal = Attrib(4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(QuantizedVertex), offsetof(QuantizedVertex, Normal));
+		Color = Attrib(4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(QuantizedVertex), offsetof(QuantizedVertex, Color));
+		TexCoord = Attrib(2, GL_HALF_FLOAT, GL_FALSE, sizeof(QuantizedVertex), offsetof(QuantizedVertex, TexCoord));
+	}
+
+	//attach levels of detail to their meshes (after quantizing, so they are copied with their dequantization):
+	for (auto const &entry : lods) {
+		if (!(entry.mesh < entry_meshes.size() && entry.lod_of < entry_meshes.size() && entry.mesh != entry.lod_of)) {
+			throw std::runtime_error("level of detail entry has out-of-range mesh");
 		}
+		Mesh *lod = entry_meshes[entry.mesh];
+		Mesh *mesh = entry_meshes[entry.lod_of];
+		if (!lod || !mesh) continue; //(name collision already warned about)
+		mesh->lods.emplace_back(*lod);
+		mesh->lods.back().lod_error = entry.error;
+	}
+	for (auto &[name, mesh] : meshes) {
+		std::stable_sort(mesh.lods.begin(), mesh.lods.end(), [](Mesh const &a, Mesh const &b) {
+			return a.lod_error < b.lod_error;
+		});
 	}
 
-	if (file.peek() != EOF) {
+	if (at != mapped->size) {
 		std::cerr << "WARNING: trailing data in mesh file '" << filename << "'" << std::endl;
 	}
 
+	if (when == UploadNow) upload();
+
 	/* //DEBUG:
 	std::cout << "File '" << filename << "' contained meshes";
 	for (auto const &m : meshes) {
@@ -98,6 +316,33 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 	*/
 }
 
+void MeshBuffer::upload() {
+	assert(buffer == 0 && "MeshBuffer should only be uploaded once");
+
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, pending.size(), pending.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	if (!pending_indices.empty()) {
+		assert(index_buffer == 0);
+		glGenBuffers(1, &index_buffer);
+		//(uploaded via GL_ARRAY_BUFFER since the GL_ELEMENT_ARRAY_BUFFER binding belongs to whatever vertex array object is bound)
+		glBindBuffer(GL_ARRAY_BUFFER, index_buffer);
+		glBufferData(GL_ARRAY_BUFFER, pending_indices.size(), pending_indices.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	//data now lives on the GPU:
+	pending = std::span< uint8_t const >();
+	pending_indices = std::span< uint8_t const >();
+	mapped.reset();
+	unaligned.clear();
+	unaligned.shrink_to_fit();
+	unaligned_indices.clear();
+	unaligned_indices.shrink_to_fit();
+}
+
 const Mesh &MeshBuffer::lookup(std::string const &name) const {
 	auto f = meshes.find(name);
 	if (f == meshes.end()) {
@@ -107,6 +352,8 @@ const Mesh &MeshBuffer::lookup(std::string const &name) const {
 }
 
 GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
+	assert(buffer != 0 && "MeshBuffer should be uploaded before making vertex array objects");
+
 	//create a new vertex array object:
 	GLuint vao = 0;
 	glGenVertexArrays(1, &vao);
@@ -128,6 +375,8 @@ GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
 	bind_attribute("Color", Color);
 	bind_attribute("TexCoord", TexCoord);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	//element array buffer binding is part of the vertex array object's state:
+	if (index_buffer != 0) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
 	glBindVertexArray(0);
 
 	//Check that all active attributes were bound:
@@ -1,27 +1,46 @@
 #pragma once
 
 /*
- * In this code, "Mesh" is a range of vertices that should be sent through
- *  the OpenGL pipeline together.
+ * In this code, "Mesh" is a range of vertices (or of indices) that should be
+ *  sent through the OpenGL pipeline together.
  * A "MeshBuffer" holds a collection of such meshes (loaded from a file) in
- *  a single OpenGL array buffer. Individual meshes can be looked up by name
- *  using the MeshBuffer::lookup() function.
+ *  a single OpenGL array buffer (plus, for indexed files, a single element
+ *  array buffer). Individual meshes can be looked up by name using the
+ *  MeshBuffer::lookup() function.
  *
  */
 
 #include "GL.hpp"
+#include "MappedFile.hpp"
 #include <glm/glm.hpp>
 #include <map>
+#include <memory>
+#include <span>
 #include <limits>
 #include <string>
+#include <vector>
 
 
 struct Mesh {
 	//Meshes are vertex ranges (and primitive types) in their MeshBuffer:
+	// -- or, if index_type isn't GL_NONE, index ranges (draw with glDrawElementsBaseVertex)
 
 	GLenum type = GL_TRIANGLES; //type of primitives in mesh
-	GLuint start = 0; //index of first vertex
-	GLuint count = 0; //count of vertices
+	GLuint start = 0; //index of first vertex (or first index)
+	GLuint count = 0; //count of vertices (or indices)
+
+	GLenum index_type = GL_NONE; //GL_UNSIGNED_SHORT or GL_UNSIGNED_INT for indexed meshes
+	GLint base_vertex = 0; //added to every index (indices are relative to the mesh's first vertex)
+
+	//Position attribute dequantization (identity unless loaded with MeshBuffer::Quantized):
+	// object-space position = position_offset + position_scale * Position.xyz
+	glm::vec3 position_offset = glm::vec3(0.0f);
+	glm::vec3 position_scale = glm::vec3(1.0f);
+
+	//Levels of detail (from the file's lod0 chunk; see simplify-meshes.cpp):
+	// coarser versions of this mesh, finest first; each also exists as its own mesh named "<name>/lod<N>"
+	std::vector< Mesh > lods;
+	float lod_error = 0.0f; //for levels of detail: distance from the full mesh, relative to half its bounding box diagonal
 
 	//Bounding box.
 	//useful for debug visualization and (perhaps, eventually) collision detection:
@@ -32,9 +51,21 @@ struct Mesh {
 struct MeshBuffer {
 	//construct from a file:
 	// note: will throw if file fails to read.
-	MeshBuffer(std::string const &filename);
+	// with DeferUpload, no OpenGL calls are made (so this can run on a loading thread) until upload() is called.
+	// with Quantized, vertices are repacked into 20 bytes (instead of 36) when loaded:
+	//  - Position as 16-bit unsigned normalized values over each mesh's bounding box
+	//     (drawables must pass Mesh::position_offset/position_scale on to their pipeline to undo this)
+	//  - Normal as signed normalized 10:10:10:2
+	//  - TexCoord as half floats
+	enum Upload { UploadNow, DeferUpload };
+	enum Format { Float, Quantized };
+	MeshBuffer(std::string const &filename, Upload when = UploadNow, Format format = Float);
+
+	//send data read by the constructor to the GPU (only needed after DeferUpload):
+	void upload();
 
 	//look up a particular mesh by name:
+	// (returns the full-detail mesh; coarser levels are in Mesh::lods)
 	// note: will throw if mesh not found.
 	const Mesh &lookup(std::string const &name) const;
 	
@@ -45,11 +76,23 @@ struct MeshBuffer {
 	//This is the OpenGL vertex buffer object containing the mesh data:
 	GLuint buffer = 0;
 
+	//...and the element buffer containing the indices (0 if the file isn't indexed):
+	// (make_vao_for_program binds this into the vertex array object)
+	GLuint index_buffer = 0;
+
 	//-- internals ---
 
 	//used by the lookup() function:
 	std::map< std::string, Mesh > meshes;
 
+	//vertex data waiting for upload():
+	// (points into 'mapped' -- or, rarely, into 'unaligned' if the data can't be used in place)
+	std::span< uint8_t const > pending;
+	std::unique_ptr< MappedFile > mapped;
+	std::vector< uint8_t > unaligned; //(also holds repacked vertices for Quantized buffers)
+	std::span< uint8_t const > pending_indices;
+	std::vector< uint8_t > unaligned_indices;
+
 	//These 'Attrib' structures describe the location of various attributes within the buffer (in exactly format wanted by glVertexAttribPointer). They are set when the file is loaded and are used by the "make_vao_for_program" call:
 	struct Attrib {
 		GLint size = 0;
@@ -0,0 +1,136 @@
+#include "OpusStream.hpp"
+
+#include <opusfile.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cassert>
+#include <stdexcept>
+#include <iostream>
+
+//ring buffer holds this many samples (about 0.68 seconds at 48kHz):
+constexpr uint32_t const RingSize = 1 << 15;
+//opus packets are at most 120ms, so this is the most a single read will return:
+constexpr uint32_t const MaxRead = 5760;
+//decoder waits until at least this much of the ring is free before reading:
+constexpr uint32_t const MinRead = 960;
+
+OpusStream::OpusStream(std::string const &filename_) : filename(filename_) {
+	int err = 0;
+	op = op_open_file(filename.c_str(), &err);
+	if (err != 0 || op == nullptr) {
+		throw std::runtime_error("opusfile error " + std::to_string(err) + " opening \"" + filename + "\".");
+	}
+
+	ring.assign(RingSize, 0.0f);
+	mask = RingSize - 1;
+
+	decoder = std::thread(&OpusStream::decode, this);
+}
+
+OpusStream::~OpusStream() {
+	quit = true;
+	if (decoder.joinable()) decoder.join();
+	if (op) {
+		op_free(op);
+		op = nullptr;
+	}
+}
+
+uint32_t OpusStream::restart() {
+	next_serial += 1;
+	if (next_serial == 0) next_serial = 1; //(0 means "nothing requested")
+	requested.store(next_serial, std::memory_order_release);
+	return next_serial;
+}
+
+bool OpusStream::sync(uint32_t serial) {
+	uint64_t s = started.load(std::memory_order_acquire);
+	if (uint32_t(s >> 32) != serial) return false;
+	//skip anything decoded before the restart:
+	uint32_t start = uint32_t(s);
+	uint32_t h = head.load(std::memory_order_relaxed);
+	if (int32_t(start - h) > 0) head.store(start, std::memory_order_release);
+	return true;
+}
+
+uint32_t OpusStream::readable(float const **data) {
+	assert(data);
+	uint32_t h = head.load(std::memory_order_relaxed);
+	uint32_t t = tail.load(std::memory_order_acquire);
+	*data = ring.data() + (h & mask);
+	return std::min(t - h, RingSize - (h & mask));
+}
+
+void OpusStream::consume(uint32_t count) {
+	uint32_t h = head.load(std::memory_order_relaxed);
+	assert(count <= tail.load(std::memory_order_acquire) - h);
+	head.store(h + count, std::memory_order_release);
+}
+
+bool OpusStream::finished(uint32_t serial) const {
+	if (int32_t(requested.load(std::memory_order_acquire) - serial) > 0) return true; //restarted since
+	uint64_t e = ended.load(std::memory_order_acquire);
+	return uint32_t(e >> 32) == serial && head.load(std::memory_order_relaxed) == uint32_t(e);
+}
+
+void OpusStream::decode() {
+	std::vector< float > pcm(2 * MaxRead, 0.0f); //stereo, as returned by op_read_float_stereo
+
+	uint32_t current = 0; //serial being decoded
+	bool at_end = false; //reached end of file (and not looping)
+	uint32_t since_seek = 0; //samples decoded since last seek to start (to avoid spinning on empty files)
+
+	//helper: stop decoding this serial; reader will finish once it catches up:
+	auto end = [&]() {
+		ended.store((uint64_t(current) << 32) | tail.load(std::memory_order_relaxed), std::memory_order_release);
+		at_end = true;
+	};
+	//helper: go back to the start of the file:
+	auto rewind = [&]() -> bool {
+		int err = op_pcm_seek(op, 0);
+		if (err != 0) {
+			std::cerr << "WARNING: opusfile error " << err << " seeking in \"" << filename << "\"; stopping stream." << std::endl;
+			end();
+			return false;
+		}
+		since_seek = 0;
+		return true;
+	};
+
+	while (!quit) {
+		uint32_t req = requested.load(std::memory_order_acquire);
+		if (req != current) {
+			current = req;
+			at_end = false;
+			started.store((uint64_t(current) << 32) | tail.load(std::memory_order_relaxed), std::memory_order_release);
+			rewind();
+		}
+
+		uint32_t t = tail.load(std::memory_order_relaxed);
+		uint32_t space = RingSize - (t - head.load(std::memory_order_acquire));
+		if (current == 0 || at_end || space < MinRead) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			continue;
+		}
+
+		int ret = op_read_float_stereo(op, pcm.data(), int(2 * std::min(space, MaxRead)));
+		if (ret < 0) {
+			std::cerr << "WARNING: opusfile read error " << ret << " reading \"" << filename << "\"; stopping stream." << std::endl;
+			end();
+		} else if (ret == 0) {
+			//end of file:
+			if (loop.load(std::memory_order_relaxed) && since_seek > 0) {
+				rewind(); //(seamless: the next read continues right after the last one in the ring)
+			} else {
+				end();
+			}
+		} else {
+			for (uint32_t i = 0; i < uint32_t(ret); ++i) {
+				ring[(t + i) & mask] = (pcm[2*i] + pcm[2*i+1]) * 0.5f; //downmix to mono by averaging
+			}
+			tail.store(t + uint32_t(ret), std::memory_order_release);
+			since_seek += uint32_t(ret);
+		}
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+/*
+ * OpusStream decodes an '.opus' file a little at a time on a background
+ *  thread, keeping a small ring buffer of 48kHz mono samples just ahead of
+ *  whoever is reading it (generally, the audio callback).
+ *
+ * Memory use is the same no matter how long the file is.
+ *
+ * Three threads are involved:
+ *  - the "game" thread (which constructs the stream and calls restart()),
+ *  - the decode thread (owned by the stream),
+ *  - the reader (which calls sync()/readable()/consume()/finished()).
+ * None of the reader's functions block or allocate.
+ *
+ */
+
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+typedef struct OggOpusFile OggOpusFile;
+
+struct OpusStream {
+	//open 'filename' and start decoding; throws on error:
+	OpusStream(std::string const &filename);
+	~OpusStream();
+
+	OpusStream(OpusStream const &) = delete;
+	OpusStream &operator=(OpusStream const &) = delete;
+
+	//(game thread) ask the decoder to start over from the beginning of the file;
+	// returns the serial number the reader should pass to sync():
+	uint32_t restart();
+
+	//(any thread) should the decoder wrap back to the start when it reaches the end of the file?
+	std::atomic< bool > loop{false};
+
+	//(reader) has the decoder started on restart 'serial'?
+	// if so, skips any data left over from before the restart and returns true:
+	bool sync(uint32_t serial);
+
+	//(reader) get the longest contiguous run of decoded samples available; returns its length:
+	uint32_t readable(float const **data);
+
+	//(reader) mark 'count' samples (no more than readable() returned) as used:
+	void consume(uint32_t count);
+
+	//(reader) is restart 'serial' over? (either everything has been read -- only possible if !loop -- or restart() was called again)
+	bool finished(uint32_t serial) const;
+
+	//-- internals --
+	std::string filename;
+	OggOpusFile *op = nullptr;
+
+	//decoded samples; head and tail are free-running counters, as in SPSCQueue:
+	std::vector< float > ring;
+	uint32_t mask = 0;
+	alignas(64) std::atomic< uint32_t > head{0}; //next sample to read (written by reader)
+	alignas(64) std::atomic< uint32_t > tail{0}; //next sample to write (written by decoder)
+
+	//restarts are handed from game thread => decoder => reader as serial numbers:
+	std::atomic< uint32_t > requested{0}; //latest serial asked for by restart()
+	std::atomic< uint64_t > started{0}; //(serial << 32) | tail position where that serial's data starts
+	std::atomic< uint64_t > ended{~0ull}; //(serial << 32) | tail position where that serial's data ends
+	uint32_t next_serial = 0; //(game thread only)
+
+	std::atomic< bool > quit{false};
+	std::thread decoder;
+	void decode(); //decode thread main loop
+};
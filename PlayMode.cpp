@@ -9,6 +9,7 @@
 
 #include "gl_errors.hpp"
 #include "data_path.hpp"
+#include "SampleCache.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
@@ -81,17 +82,19 @@ static glm::vec2 mouse_px_to_ndc(glm::vec2 mouse_px, glm::uvec2 wnd)
 
 // Load the mesh data from scene
 GLuint parrot_meshes_for_lit_color_texture_program = 0;
-Load<MeshBuffer> parrot_meshes(LoadTagDefault, []() -> MeshBuffer const *
+// (file reading happens on a loader thread; GL upload on the main thread)
+Load<MeshBuffer> parrot_meshes(LoadTagDefault, "parrot.pnct", {}, []() -> MeshBuffer *
+							   { return new MeshBuffer(data_path("parrot.pnct"), MeshBuffer::DeferUpload, MeshBuffer::Quantized); },
+							   [](MeshBuffer *ret)
 							   {
-	MeshBuffer const *ret = new MeshBuffer(data_path("parrot.pnct"));
-	parrot_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program->program);
-	return ret; });
+	ret->upload();
+	parrot_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program->program); });
 
-Load< Sound::Sample > bg_sample(LoadTagDefault, []() -> Sound::Sample const * {
-	return new Sound::Sample(data_path("bg.wav"));
-});
+// background loop: starts loading (through the shared sample cache) at startup; PlayMode picks it up:
+Load< void > prefetch_bg(LoadTagDefault, []()
+						 { SampleCache::global().prefetch(data_path("bg.wav")); });
 
-Load<Scene> parrot_scene(LoadTagDefault, []() -> Scene const *
+Load<Scene> parrot_scene(LoadTagDefault, "parrot.scene", {&parrot_meshes}, []() -> Scene *
 						 { return new Scene(data_path("parrot.scene"), [&](Scene &scene, Scene::Transform *transform, std::string const &mesh_name)
 											{
 												Mesh const &mesh = parrot_meshes->lookup(mesh_name);
@@ -104,10 +107,24 @@ Load<Scene> parrot_scene(LoadTagDefault, []() -> Scene const *
 												drawable.pipeline.vao = parrot_meshes_for_lit_color_texture_program;
 												drawable.pipeline.type = mesh.type;
 												drawable.pipeline.start = mesh.start;
-												drawable.pipeline.count = mesh.count; }); });
+												drawable.pipeline.count = mesh.count;
+												drawable.pipeline.index_type = mesh.index_type;
+												drawable.pipeline.base_vertex = mesh.base_vertex;
+												drawable.pipeline.position_offset = mesh.position_offset;
+												drawable.pipeline.position_scale = mesh.position_scale;
+												for (Mesh const &lod : mesh.lods) {
+													drawable.lods.emplace_back(Scene::Drawable::LOD{ lod.start, lod.count, lod.base_vertex, lod.position_offset, lod.position_scale, lod.lod_error });
+												}
+
+												drawable.min = mesh.min;
+												drawable.max = mesh.max; }); });
 
 PlayMode::PlayMode() : scene(*parrot_scene)
 {
+	scene.cache_world_transforms = true; // world transforms are updated once per frame in draw()
+	scene.batch_draws = true;			 // parrot drawables share a program + vao, so most binds can be skipped
+	scene.frustum_cull = true;			 // drawables carry mesh bounds (see parrot_scene)
+
 	for (auto &transform : scene.transforms) // Credit: imitate starter code
 	{
 		if (transform.name == "Parrot")
@@ -146,16 +163,40 @@ PlayMode::PlayMode() : scene(*parrot_scene)
 	current_fan = &fan_FMM;
 	next_fan = (MLH ? &fan_MLH : nullptr);
 
+	// start loading voices in the background (the current fan's line first, since it plays soonest):
+	SampleCache::global().prefetch(data_path(current_fan->file_key() + ".wav"));
+	prefetch_voices(current_fan->voice);
+	if (next_fan)
+	{
+		SampleCache::global().prefetch(data_path(next_fan->file_key() + ".wav"));
+		prefetch_voices(next_fan->voice);
+	}
+
 	// start music loop playing:
 	//  (note: position will be over-ridden in update())
 	//  leg_tip_loop = Sound::loop_3D(*dusty_floor_sample, 1.0f, get_leg_tip_position(), 10.0f);
 	//  bg_loop = Sound::loop_3D(*dusty_floor_sample, 1.0f, get_leg_tip_position(), 10.0f);
 
-	 bg_loop = Sound::loop_3D(*bg_sample, 1.0f, fan_base_pos, 3.0f);
+	 bg_sample = SampleCache::global().wait(data_path("bg.wav"));
+	 if (bg_sample)
+		 bg_loop = Sound::loop_3D(*bg_sample, 1.0f, fan_base_pos, 3.0f);
 }
 
 PlayMode::~PlayMode()
 {
+	SampleCache::Stats stats = SampleCache::global().get_stats();
+	printf("Samples: %u hits, %u misses (waited %.1f ms on average, %.1f ms at most); %u loads in %.1f ms (%.1f ms at most), %u failed.\n",
+		   stats.hits, stats.misses,
+		   stats.waits ? 1e3f * stats.wait_time / stats.waits : 0.0f, 1e3f * stats.max_wait_time,
+		   stats.loads, 1e3f * stats.load_time, 1e3f * stats.max_load_time, stats.failures);
+	printf("  %.1f MB loaded (%.1f MB peak), %u evictions (%.1f MB).\n",
+		   stats.bytes / 1e6, stats.peak_bytes / 1e6, stats.evictions, stats.evicted_bytes / 1e6);
+
+	Sound::Stats audio = Sound::get_stats();
+	printf("Audio: %llu callbacks, %llu late; play() to output %.1f ms on average, %.1f ms at most (%u-frame device buffer, %u frames queued at most).\n",
+		   (unsigned long long)audio.callbacks, (unsigned long long)audio.late_callbacks,
+		   audio.play_latency_count ? 1e3 * audio.total_play_latency / audio.play_latency_count : 0.0, 1e3f * audio.max_play_latency,
+		   audio.block_frames, audio.max_queued_frames);
 }
 
 bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
@@ -243,10 +284,9 @@ bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 					   q.c_str(), current_fan->voice.c_str(), key.c_str());
 
 				// play imitation from the Parrot:
-				auto *samp = get_sample_for(key);
 				glm::mat4x3 pxf = Parrot->make_world_from_local();
 				glm::vec3 parrot_pos = pxf[3];
-				Sound::play_3D(*samp, 1.0f, parrot_pos, 3.0f);
+				play_voice(key, parrot_pos);
 
 				// ---- check each quality; set per-line match states (no scoring) ----
 				char g_ui = to_char_gender(ui.gender);
@@ -294,9 +334,8 @@ bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 			{
 				std::string key = current_fan->file_key(); // "FMM_Aria"
 				printf("Listen clicked -> playing key='%s'\n", key.c_str());
-				auto *samp = get_sample_for(key);
 				glm::vec3 pos = fan_world_position(*current_fan);
-				Sound::play_3D(*samp, 1.0f, pos, 3.0f);
+				play_voice(key, pos);
 				return true;
 			}
 		}
@@ -343,15 +382,36 @@ void PlayMode::update(float elapsed)
             if (current_fan) {
                 std::string key = current_fan->file_key(); // e.g., "MML_Andrew"
                 printf("Swap: movement done. Autoplay '%s'\n", key.c_str());
-                auto *samp = get_sample_for(key);
                 glm::vec3 pos = fan_world_position(*current_fan);
-                Sound::play_3D(*samp, 1.0f, pos, 3.0f);
+                play_voice(key, pos);
+                prefetch_voices(current_fan->voice);
             }
 
             swap_phase = SwapPhase::Idle; // ready for whatever's next
         }
     }
 
+	// play any voices whose samples have finished loading:
+	for (auto it = pending_voices.begin(); it != pending_voices.end();)
+	{
+		it->age += elapsed;
+		std::string filename = data_path(it->key + ".wav");
+		if (auto samp = SampleCache::global().peek(filename))
+		{
+			Sound::play_3D(*samp, 1.0f, it->position, 3.0f);
+			it = pending_voices.erase(it);
+		}
+		else if (it->age > pending_voice_timeout || SampleCache::global().failed(filename))
+		{
+			printf("Voice '%s' didn't load in time; skipping it.\n", it->key.c_str());
+			it = pending_voices.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+
 	// reset button press counters:
 	left.downs = 0;
 	right.downs = 0;
@@ -364,12 +424,15 @@ void PlayMode::draw(glm::uvec2 const &drawable_size)
 	// update camera aspect ratio for drawable:
 	camera->aspect = float(drawable_size.x) / float(drawable_size.y);
 
-	// set up light type and position for lit_color_texture_program:
+	// set up light type and position for lit_color_texture_program (and its instanced variant):
 	//  TODO: consider using the Light(s) in the scene to do this
-	glUseProgram(lit_color_texture_program->program);
-	glUniform1i(lit_color_texture_program->LIGHT_TYPE_int, 1);
-	glUniform3fv(lit_color_texture_program->LIGHT_DIRECTION_vec3, 1, glm::value_ptr(glm::vec3(0.0f, 0.0f, -1.0f)));
-	glUniform3fv(lit_color_texture_program->LIGHT_ENERGY_vec3, 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 0.95f)));
+	for (LitColorTextureProgram const *program : {&*lit_color_texture_program, &*lit_color_texture_program_instanced})
+	{
+		glUseProgram(program->program);
+		glUniform1i(program->LIGHT_TYPE_int, 1);
+		glUniform3fv(program->LIGHT_DIRECTION_vec3, 1, glm::value_ptr(glm::vec3(0.0f, 0.0f, -1.0f)));
+		glUniform3fv(program->LIGHT_ENERGY_vec3, 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 0.95f)));
+	}
 	glUseProgram(0);
 
 	glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
@@ -379,6 +442,7 @@ void PlayMode::draw(glm::uvec2 const &drawable_size)
 	glEnable(GL_DEPTH_TEST);
 	glDepthFunc(GL_LESS); // this is the default depth comparison function, but FYI you can change it.
 
+	scene.update_world_from_local();
 	scene.draw(*camera);
 	glDisable(GL_DEPTH_TEST);
 	float aspect = float(drawable_size.x) / float(drawable_size.y);
@@ -486,16 +550,37 @@ glm::vec3 PlayMode::fan_world_position(Fan const &fan) const
 	return xf[3];
 }
 
-Sound::Sample const *PlayMode::get_sample_for(std::string const &key)
+std::shared_ptr<Sound::Sample const> PlayMode::get_sample_for(std::string const &key)
 {
-	// loads "<key>.wav" from data path; cache it
-	auto it = sample_cache.find(key);
-	if (it != sample_cache.end())
-		return it->second.get();
-
+	// "<key>.wav" from data path, if the sample cache has loaded it (otherwise, it loads next):
 	std::string filename = key + ".wav"; // convert your mp3 to wav or use .opus
-	auto samp = std::make_unique<Sound::Sample>(data_path(filename));
-	Sound::Sample *ptr = samp.get();
-	sample_cache.emplace(key, std::move(samp));
-	return ptr;
+	return SampleCache::global().get(data_path(filename));
+}
+
+void PlayMode::play_voice(std::string const &key, glm::vec3 const &position)
+{
+	if (auto samp = get_sample_for(key))
+	{
+		Sound::play_3D(*samp, 1.0f, position, 3.0f);
+	}
+	else
+	{
+		// not loaded yet -- update() will play it when it is (unless it takes too long):
+		pending_voices.emplace_back(PendingVoice{key, position});
+	}
+}
+
+void PlayMode::prefetch_voices(std::string const &voice)
+{
+	// every quality the UI can pick, for this voice (the fan's own quality is requested first by whoever calls this):
+	for (char g : {'F', 'M'})
+	{
+		for (char p : {'L', 'M', 'H'})
+		{
+			for (char s : {'L', 'M', 'H'})
+			{
+				SampleCache::global().prefetch(data_path(std::string() + g + p + s + "_" + voice + ".wav"));
+			}
+		}
+	}
 }
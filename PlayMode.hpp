@@ -9,6 +9,7 @@
 
 #include <vector>
 #include <deque>
+#include <memory>
 
 struct PlayMode : Mode
 {
@@ -26,7 +27,9 @@ struct PlayMode : Mode
 	VoiceUI::State ui;
 
 	glm::vec3 fan_world_position(Fan const &fan) const;
-	Sound::Sample const *get_sample_for(std::string const &key);
+	std::shared_ptr<Sound::Sample const> get_sample_for(std::string const &key); // nullptr if not loaded yet
+	void play_voice(std::string const &key, glm::vec3 const &position); // plays now, or once loaded
+	void prefetch_voices(std::string const &voice);
 	std::string current_quality_from_ui() const;
 
 	// --- game state ---
@@ -77,12 +80,24 @@ struct PlayMode : Mode
 	Match match_pitch = Match::Unknown;
 	Match match_speed = Match::Unknown;
 
-	// --- audio sample cache ---
-	std::unordered_map<std::string, std::unique_ptr<Sound::Sample>> sample_cache;
+	// --- audio samples ---
+	// samples come from SampleCache::global(), which loads them on a background thread (all variants of
+	// the current voices are prefetched), so clicking Speak or Listen doesn't stall the main thread on a file load:
+	std::shared_ptr<Sound::Sample const> bg_sample; // (held while looping, so the cache can't evict it)
 
-	std::shared_ptr<Sound::PlayingSample> bg_loop;
+	// voices requested before their sample finished loading (played by update() once it has):
+	struct PendingVoice
+	{
+		std::string key;
+		glm::vec3 position;
+		float age = 0.0f; // seconds since requested
+	};
+	std::vector<PendingVoice> pending_voices;
+	float pending_voice_timeout = 0.5f; // seconds; later than this, skip the voice rather than play it late
+
+	Sound::PlayingSample bg_loop;
 	// music coming from the tip of the leg (as a demonstration):
-	//  std::shared_ptr< Sound::PlayingSample > leg_tip_loop;
+	//  Sound::PlayingSample leg_tip_loop;
 
 	// camera:
 	Scene::Camera *camera = nullptr;
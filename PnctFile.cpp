@@ -0,0 +1,157 @@
+#include "PnctFile.hpp"
+#include "read_write_chunk.hpp"
+
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <algorithm>
+
+//magic number of the next chunk in a stream (or "" at end of file):
+static std::string peek_magic(std::istream &from) {
+	char magic[4];
+	std::streampos at = from.tellg();
+	if (!from.read(magic, 4)) {
+		from.clear();
+		from.seekg(at);
+		return "";
+	}
+	from.seekg(at);
+	return std::string(magic, 4);
+}
+
+PnctFile::PnctFile(std::string const &filename) {
+	std::ifstream in(filename, std::ios::binary);
+	if (!in) throw std::runtime_error("Failed to open '" + filename + "' for reading.");
+
+	std::vector< Vertex > data;
+	read_chunk(in, "pnct", &data);
+
+	std::vector< uint16_t > indices16;
+	std::vector< uint32_t > indices32;
+	std::string index_magic = peek_magic(in);
+	if (index_magic == "ix16") read_chunk(in, "ix16", &indices16);
+	else if (index_magic == "ix32") read_chunk(in, "ix32", &indices32);
+
+	std::vector< char > strings;
+	read_chunk(in, "str0", &strings);
+	auto get_name = [&](uint32_t name_begin, uint32_t name_end) {
+		if (!(name_begin <= name_end && name_end <= strings.size())) {
+			throw std::runtime_error("index entry has out-of-range name begin/end");
+		}
+		return std::string(strings.data() + name_begin, strings.data() + name_end);
+	};
+
+	if (index_magic == "ix16" || index_magic == "ix32") {
+		struct IndexEntry {
+			uint32_t name_begin, name_end;
+			uint32_t vertex_begin, vertex_end;
+			uint32_t index_begin, index_end;
+		};
+		static_assert(sizeof(IndexEntry) == 24, "Index entry should be packed");
+		std::vector< IndexEntry > index;
+		read_chunk(in, "idx1", &index);
+
+		size_t index_total = (index_magic == "ix16" ? indices16.size() : indices32.size());
+		for (auto const &entry : index) {
+			if (!(entry.vertex_begin <= entry.vertex_end && entry.vertex_end <= data.size())) {
+				throw std::runtime_error("index entry has out-of-range vertex start/count");
+			}
+			if (!(entry.index_begin <= entry.index_end && entry.index_end <= index_total)) {
+				throw std::runtime_error("index entry has out-of-range index start/count");
+			}
+			Mesh mesh;
+			mesh.name = get_name(entry.name_begin, entry.name_end);
+			mesh.vertices.assign(data.begin() + entry.vertex_begin, data.begin() + entry.vertex_end);
+			mesh.indices.reserve(entry.index_end - entry.index_begin);
+			for (uint32_t i = entry.index_begin; i < entry.index_end; ++i) {
+				uint32_t v = (index_magic == "ix16" ? indices16[i] : indices32[i]);
+				if (v >= mesh.vertices.size()) throw std::runtime_error("index entry references vertex outside its range");
+				mesh.indices.emplace_back(v);
+			}
+			meshes.emplace_back(std::move(mesh));
+		}
+
+		if (peek_magic(in) == "lod0") {
+			read_chunk(in, "lod0", &lods);
+			for (auto const &lod : lods) {
+				if (!(lod.mesh < meshes.size() && lod.lod_of < meshes.size() && lod.mesh != lod.lod_of)) {
+					throw std::runtime_error("level of detail entry has out-of-range mesh");
+				}
+			}
+		}
+	} else {
+		struct IndexEntry {
+			uint32_t name_begin, name_end;
+			uint32_t vertex_begin, vertex_end;
+		};
+		static_assert(sizeof(IndexEntry) == 16, "Index entry should be packed");
+		std::vector< IndexEntry > index;
+		read_chunk(in, "idx0", &index);
+
+		for (auto const &entry : index) {
+			if (!(entry.vertex_begin <= entry.vertex_end && entry.vertex_end <= data.size())) {
+				throw std::runtime_error("index entry has out-of-range vertex start/count");
+			}
+			Mesh mesh;
+			mesh.name = get_name(entry.name_begin, entry.name_end);
+
+			//merge identical vertices:
+			std::unordered_map< std::string, uint32_t > unique;
+			for (uint32_t v = entry.vertex_begin; v < entry.vertex_end; ++v) {
+				std::string key(reinterpret_cast< char const * >(&data[v]), sizeof(Vertex));
+				auto ret = unique.emplace(key, uint32_t(mesh.vertices.size()));
+				if (ret.second) mesh.vertices.emplace_back(data[v]);
+				mesh.indices.emplace_back(ret.first->second);
+			}
+			meshes.emplace_back(std::move(mesh));
+		}
+	}
+
+	for (Mesh const &mesh : meshes) {
+		if (mesh.indices.size() % 3 != 0) {
+			throw std::runtime_error("mesh '" + mesh.name + "' index count isn't a multiple of three (only triangles are supported)");
+		}
+	}
+}
+
+void PnctFile::write(std::string const &filename) const {
+	struct IndexEntry {
+		uint32_t name_begin, name_end;
+		uint32_t vertex_begin, vertex_end;
+		uint32_t index_begin, index_end;
+	};
+	std::vector< IndexEntry > index;
+	std::vector< Vertex > data;
+	std::vector< uint32_t > indices;
+	std::vector< char > strings;
+	size_t max_vertices = 0;
+	for (Mesh const &mesh : meshes) {
+		IndexEntry entry;
+		entry.name_begin = uint32_t(strings.size());
+		entry.name_end = uint32_t(strings.size() + mesh.name.size());
+		entry.vertex_begin = uint32_t(data.size());
+		entry.vertex_end = uint32_t(data.size() + mesh.vertices.size());
+		entry.index_begin = uint32_t(indices.size());
+		entry.index_end = uint32_t(indices.size() + mesh.indices.size());
+		index.emplace_back(entry);
+		strings.insert(strings.end(), mesh.name.begin(), mesh.name.end());
+		data.insert(data.end(), mesh.vertices.begin(), mesh.vertices.end());
+		indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+		max_vertices = std::max(max_vertices, mesh.vertices.size());
+	}
+
+	std::ofstream out(filename, std::ios::binary);
+	if (!out) throw std::runtime_error("Failed to open '" + filename + "' for writing.");
+	write_chunk("pnct", data, &out);
+	//(indices are relative to each mesh's first vertex, so 16 bits are usually enough)
+	if (max_vertices <= 0x10000) {
+		std::vector< uint16_t > indices16(indices.begin(), indices.end());
+		write_chunk("ix16", indices16, &out);
+	} else {
+		write_chunk("ix32", indices, &out);
+	}
+	write_chunk("str0", strings, &out);
+	write_chunk("idx1", index, &out);
+	if (!lods.empty()) write_chunk("lod0", lods, &out);
+	if (!out) throw std::runtime_error("Failed to write '" + filename + "'.");
+}
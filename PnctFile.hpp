@@ -0,0 +1,52 @@
+#pragma once
+
+/*
+ * PnctFile is an editable, CPU-side copy of the meshes in a .pnct file,
+ *  for offline tools (optimize-meshes, simplify-meshes) that rewrite them.
+ * (For drawing meshes, use MeshBuffer.)
+ *
+ * Reads both unindexed files (duplicate vertices get merged) and indexed
+ *  files; always writes the indexed format (see export-meshes.py).
+ *
+ */
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct PnctFile {
+	PnctFile() = default;
+	//read from a file:
+	// note: will throw if file fails to read.
+	PnctFile(std::string const &filename);
+
+	//write to a file:
+	// note: will throw if file fails to write.
+	void write(std::string const &filename) const;
+
+	struct Vertex {
+		glm::vec3 Position;
+		glm::vec3 Normal;
+		glm::u8vec4 Color;
+		glm::vec2 TexCoord;
+	};
+	static_assert(sizeof(Vertex) == 3*4+3*4+4*1+2*4, "Vertex is packed.");
+
+	struct Mesh {
+		std::string name;
+		std::vector< Vertex > vertices;
+		std::vector< uint32_t > indices; //triangle list, indexing 'vertices'
+	};
+	std::vector< Mesh > meshes;
+
+	//levels of detail (in the order written to the 'lod0' chunk):
+	struct LOD {
+		uint32_t mesh; //index of the coarser mesh in 'meshes'
+		uint32_t lod_of; //index of the full-detail mesh in 'meshes'
+		float error; //distance from the full-detail mesh, relative to half its bounding box diagonal
+	};
+	static_assert(sizeof(LOD) == 12, "LOD is packed.");
+	std::vector< LOD > lods;
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+/*
+ * SPSCQueue< T > is a fixed-capacity, lock-free queue for passing values
+ *  from exactly one producer thread to exactly one consumer thread.
+ *
+ * Neither push() nor pop() ever blocks or allocates, which makes this
+ *  suitable for talking to the audio callback.
+ *
+ */
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cassert>
+
+template< typename T >
+struct SPSCQueue {
+	//capacity is rounded up to a power of two:
+	SPSCQueue(uint32_t capacity_) {
+		assert(capacity_ > 0 && capacity_ <= (1u << 31));
+		uint32_t capacity = 1;
+		while (capacity < capacity_) capacity *= 2;
+		slots.resize(capacity);
+		mask = capacity - 1;
+	}
+
+	//since slots are handed between threads, copying a queue is not advised:
+	SPSCQueue(SPSCQueue const &) = delete;
+	SPSCQueue &operator=(SPSCQueue const &) = delete;
+
+	//(producer thread only) add a value to the back of the queue:
+	// returns false (and leaves 'value' alone) if the queue is full.
+	bool push(T &&value) {
+		uint32_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) > mask) return false;
+		slots[t & mask] = std::move(value);
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	//(consumer thread only) remove the value at the front of the queue:
+	// returns false if the queue is empty.
+	bool pop(T *value_) {
+		assert(value_);
+		uint32_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) return false;
+		*value_ = std::move(slots[h & mask]);
+		slots[h & mask] = T(); //don't leave references (e.g., shared_ptrs) behind in the slot
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	//(either thread) approximate number of values waiting in the queue:
+	uint32_t size() const {
+		return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+	}
+
+	uint32_t capacity() const {
+		return mask + 1;
+	}
+
+	//-- internals --
+	std::vector< T > slots;
+	uint32_t mask = 0;
+
+	//head and tail are free-running counters; they live on separate cache lines to avoid false sharing:
+	alignas(64) std::atomic< uint32_t > head{0}; //next slot to pop (written by consumer)
+	alignas(64) std::atomic< uint32_t > tail{0}; //next slot to push (written by producer)
+};
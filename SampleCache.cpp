@@ -0,0 +1,190 @@
+#include "SampleCache.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+//bytes of sample data held by a sample:
+static size_t sample_bytes(Sound::Sample const &sample) {
+	return sample.data.size() * sizeof(float);
+}
+
+SampleCache::SampleCache(size_t budget_) : budget(budget_) {
+	loader = std::thread(&SampleCache::loader_main, this);
+}
+
+SampleCache::~SampleCache() {
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		quit = true;
+	}
+	queue_cv.notify_all();
+	loader.join();
+}
+
+SampleCache &SampleCache::global() {
+	//(destroyed after main() returns, so after Sound::shutdown() has stopped all voices)
+	static SampleCache cache;
+	return cache;
+}
+
+void SampleCache::prefetch(std::string const &filename) {
+	std::unique_lock< std::mutex > lock(mutex);
+	auto ret = entries.emplace(filename, Entry());
+	if (!ret.second) return; //(already loaded or on its way)
+	ret.first->second.last_used = ++use_clock;
+	queue.emplace_back(filename);
+	stats.prefetches += 1;
+	trim_locked();
+	lock.unlock();
+	queue_cv.notify_one();
+}
+
+std::shared_ptr< Sound::Sample const > SampleCache::get(std::string const &filename) {
+	std::unique_lock< std::mutex > lock(mutex);
+	auto ret = entries.emplace(filename, Entry());
+	Entry &entry = ret.first->second;
+	entry.last_used = ++use_clock;
+	if (entry.state == Entry::Loaded) {
+		stats.hits += 1;
+		std::shared_ptr< Sound::Sample const > sample = entry.sample;
+		trim_locked(); //(won't evict 'sample', since it is held)
+		return sample;
+	}
+	if (entry.state == Entry::Failed) return nullptr;
+
+	stats.misses += 1;
+	if (!entry.missed) {
+		entry.missed = true;
+		entry.missed_at = std::chrono::steady_clock::now();
+	}
+	//make sure it loads next:
+	if (entry.state == Entry::Queued) {
+		auto f = std::find(queue.begin(), queue.end(), filename);
+		if (f != queue.end()) queue.erase(f);
+		queue.emplace_front(filename);
+	}
+	trim_locked();
+	lock.unlock();
+	queue_cv.notify_one();
+	return nullptr;
+}
+
+std::shared_ptr< Sound::Sample const > SampleCache::peek(std::string const &filename) {
+	std::unique_lock< std::mutex > lock(mutex);
+	auto f = entries.find(filename);
+	if (f == entries.end() || f->second.state != Entry::Loaded) return nullptr;
+	f->second.last_used = ++use_clock;
+	return f->second.sample;
+}
+
+std::shared_ptr< Sound::Sample const > SampleCache::wait(std::string const &filename) {
+	std::unique_lock< std::mutex > lock(mutex);
+	while (true) {
+		//(looked up every time around, since another thread's trim could evict the sample between loading and waking up here)
+		Entry &entry = entries.emplace(filename, Entry()).first->second;
+		entry.last_used = ++use_clock;
+		if (entry.state == Entry::Loaded) return entry.sample;
+		if (entry.state == Entry::Failed) return nullptr;
+		if (entry.state == Entry::Queued) {
+			//(load next)
+			auto f = std::find(queue.begin(), queue.end(), filename);
+			if (f != queue.end()) queue.erase(f);
+			queue.emplace_front(filename);
+			queue_cv.notify_one();
+		}
+		loaded_cv.wait(lock);
+	}
+}
+
+bool SampleCache::failed(std::string const &filename) {
+	std::unique_lock< std::mutex > lock(mutex);
+	auto f = entries.find(filename);
+	return (f != entries.end() && f->second.state == Entry::Failed);
+}
+
+void SampleCache::set_budget(size_t budget_) {
+	std::unique_lock< std::mutex > lock(mutex);
+	budget = budget_;
+	trim_locked();
+}
+
+void SampleCache::trim() {
+	std::unique_lock< std::mutex > lock(mutex);
+	trim_locked();
+}
+
+SampleCache::Stats SampleCache::get_stats() {
+	std::unique_lock< std::mutex > lock(mutex);
+	return stats;
+}
+
+void SampleCache::trim_locked(Entry const *keep) {
+	while (stats.bytes > budget) {
+		//least-recently-used sample that nothing is using:
+		// (use_count() == 1 means only this cache holds the sample, and new holders can only come
+		//  from this cache, under this lock; voices == 0 means the audio callback is done with it)
+		auto victim = entries.end();
+		for (auto e = entries.begin(); e != entries.end(); ++e) {
+			Entry const &entry = e->second;
+			if (entry.state != Entry::Loaded || &entry == keep) continue;
+			if (entry.sample.use_count() != 1) continue;
+			if (entry.sample->voices.load(std::memory_order_acquire) != 0) continue;
+			if (victim == entries.end() || entry.last_used < victim->second.last_used) victim = e;
+		}
+		if (victim == entries.end()) break; //everything loaded is in use, so stay over budget for now
+
+		size_t bytes = sample_bytes(*victim->second.sample);
+		stats.bytes -= bytes;
+		stats.evictions += 1;
+		stats.evicted_bytes += bytes;
+		entries.erase(victim);
+	}
+}
+
+void SampleCache::loader_main() {
+	std::unique_lock< std::mutex > lock(mutex);
+	while (true) {
+		queue_cv.wait(lock, [this](){ return quit || !queue.empty(); });
+		if (quit) break;
+		std::string filename = queue.front();
+		queue.pop_front();
+		entries[filename].state = Entry::Loading;
+		lock.unlock();
+
+		//load without holding the lock, so get() and prefetch() don't wait on the disk:
+		auto before = std::chrono::steady_clock::now();
+		std::shared_ptr< Sound::Sample const > sample;
+		try {
+			sample = std::make_shared< Sound::Sample >(filename);
+		} catch (std::exception &e) {
+			std::cerr << "WARNING: failed to load sample '" << filename << "': " << e.what() << std::endl;
+		}
+		auto after = std::chrono::steady_clock::now();
+
+		lock.lock();
+		//(entries that are loading never get evicted, so this is the same entry as above)
+		Entry &entry = entries[filename];
+		entry.state = (sample ? Entry::Loaded : Entry::Failed);
+		entry.sample = std::move(sample);
+
+		float load_time = std::chrono::duration< float >(after - before).count();
+		stats.loads += 1;
+		if (entry.state == Entry::Failed) stats.failures += 1;
+		stats.load_time += load_time;
+		stats.max_load_time = std::max(stats.max_load_time, load_time);
+		if (entry.missed && entry.state == Entry::Loaded) {
+			float wait_time = std::chrono::duration< float >(after - entry.missed_at).count();
+			stats.waits += 1;
+			stats.wait_time += wait_time;
+			stats.max_wait_time = std::max(stats.max_wait_time, wait_time);
+		}
+		if (entry.state == Entry::Loaded) {
+			stats.bytes += sample_bytes(*entry.sample);
+			stats.peak_bytes = std::max(stats.peak_bytes, stats.bytes);
+			//(the just-loaded sample was asked for, so make room for it rather than evicting it straight away)
+			entry.last_used = ++use_clock;
+			trim_locked(&entry);
+		}
+		loaded_cv.notify_all();
+	}
+}
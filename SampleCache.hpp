@@ -0,0 +1,106 @@
+#pragma once
+
+/*
+ * SampleCache is the process-wide store of loaded Sound::Samples, keyed by path.
+ *
+ * Samples load on a background thread, so they can be requested ahead of
+ *  time (prefetch) and picked up later without a file read / decode on the
+ *  main thread. get() never blocks: if the sample isn't loaded yet it returns
+ *  nullptr (and moves the sample to the front of the loading queue), so the
+ *  caller can try again next frame, play something else, or skip the sound.
+ *
+ * Samples are handed out as shared pointers. When the loaded samples add up
+ *  to more than 'budget' bytes, the least-recently-used samples that nobody
+ *  else holds a pointer to and that no voice is playing (Sample::voices) are
+ *  freed; they will load again if asked for.
+ *  -> keep hold of the pointer while calling Sound::play(), since the sample's
+ *     voice count only protects it once play() has returned.
+ *
+ */
+
+#include "Sound.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+struct SampleCache {
+	SampleCache(size_t budget = 64 * 1024 * 1024);
+	~SampleCache(); //(waits for any in-progress load to finish)
+
+	SampleCache(SampleCache const &) = delete;
+	SampleCache &operator=(SampleCache const &) = delete;
+
+	//the process-wide cache (made on first use):
+	static SampleCache &global();
+
+	//start loading 'filename' in the background, unless it is already loaded or loading:
+	void prefetch(std::string const &filename);
+
+	//the sample for 'filename' if it has loaded (counts a hit), otherwise nullptr (counts a miss, and
+	// loads 'filename' next); also nullptr if loading failed:
+	std::shared_ptr< Sound::Sample const > get(std::string const &filename);
+
+	//like get(), but doesn't count toward hits / misses or change load order (e.g., for polling after a miss):
+	std::shared_ptr< Sound::Sample const > peek(std::string const &filename);
+
+	//the sample for 'filename', waiting for it to load if needed (e.g., at startup); nullptr if loading failed:
+	std::shared_ptr< Sound::Sample const > wait(std::string const &filename);
+
+	//has loading 'filename' failed? (the error was printed when it happened)
+	bool failed(std::string const &filename);
+
+	//change the byte budget (evicting samples, if possible, to get under it):
+	void set_budget(size_t budget);
+
+	//evict what can be evicted to get under budget: (also happens after each load and in get() / prefetch())
+	void trim();
+
+	struct Stats {
+		uint32_t hits = 0; //get() calls that found the sample loaded
+		uint32_t misses = 0; //get() calls that didn't
+		uint32_t prefetches = 0; //loads started by prefetch()
+		uint32_t loads = 0; //loads finished (including failures)
+		uint32_t failures = 0; //loads that threw
+		float load_time = 0.0f; //total seconds spent loading (on the background thread)
+		float max_load_time = 0.0f;
+		uint32_t waits = 0; //misses that were waited out (the sample loaded later)
+		float wait_time = 0.0f; //total seconds from a miss to its sample loading
+		float max_wait_time = 0.0f;
+		size_t bytes = 0; //sample data currently loaded
+		size_t peak_bytes = 0; //most sample data ever loaded at once
+		uint32_t evictions = 0; //samples freed to stay under budget
+		size_t evicted_bytes = 0;
+	};
+	Stats get_stats();
+
+	//-- internals --
+	struct Entry {
+		enum State : uint8_t { Queued, Loading, Loaded, Failed } state = Queued;
+		std::shared_ptr< Sound::Sample const > sample;
+		uint64_t last_used = 0; //'use_clock' at last access, for picking what to evict
+		bool missed = false; //has get() missed since this was queued?
+		std::chrono::steady_clock::time_point missed_at;
+	};
+
+	std::mutex mutex; //guards everything below
+	std::condition_variable queue_cv; //(loader waits on this for work)
+	std::condition_variable loaded_cv; //(wait() waits on this for loads)
+	std::unordered_map< std::string, Entry > entries;
+	std::deque< std::string > queue; //filenames waiting to load, next first
+	size_t budget;
+	uint64_t use_clock = 0;
+	Stats stats;
+	bool quit = false;
+
+	void trim_locked(Entry const *keep = nullptr); //(evicts anything but 'keep')
+
+	std::thread loader;
+	void loader_main();
+};
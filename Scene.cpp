@@ -5,7 +5,10 @@
 
 #include <glm/gtc/type_ptr.hpp>
 
-#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+
 
 //-------------------------
 
@@ -73,6 +76,341 @@ glm::mat4x3 Scene::Transform::make_local_from_world() const {
 
 //-------------------------
 
+//update passes are numbered globally, since transforms may have parents in other scenes:
+static uint32_t world_from_local_pass = 0;
+
+//helper: update a transform's cached world_from_local (after updating its parent):
+static void update_cached_world_from_local(Scene::Transform &transform) {
+	if (transform.cached_pass == world_from_local_pass) return;
+
+	//parents first:
+	if (transform.parent) update_cached_world_from_local(*transform.parent);
+
+	bool dirty = transform.cached_pass == 0
+		|| transform.parent != transform.cached_parent
+		|| (transform.parent && transform.parent->cached_changed)
+		|| transform.position != transform.cached_position
+		|| transform.rotation != transform.cached_rotation
+		|| transform.scale != transform.cached_scale;
+
+	if (dirty) {
+		transform.cached_position = transform.position;
+		transform.cached_rotation = transform.rotation;
+		transform.cached_scale = transform.scale;
+		transform.cached_parent = transform.parent;
+		if (!transform.parent) {
+			transform.cached_world_from_local = transform.make_parent_from_local();
+		} else {
+			transform.cached_world_from_local = transform.parent->cached_world_from_local * glm::mat4(transform.make_parent_from_local());
+		}
+	}
+	transform.cached_changed = dirty;
+	transform.cached_pass = world_from_local_pass;
+}
+
+void Scene::update_world_from_local() {
+	if (transform_storage == TransformStorage::Arrays) {
+		gather_transform_arrays();
+		transform_arrays.update_world_from_local();
+		return;
+	}
+
+	world_from_local_pass += 1;
+	if (world_from_local_pass == 0) world_from_local_pass = 1; //(0 means "never updated")
+
+	for (auto &transform : transforms) {
+		update_cached_world_from_local(transform);
+	}
+}
+
+//-------------------------
+
+void Scene::TransformArrays::clear() {
+	//(doesn't touch the adapters, since they may already be gone)
+	position.clear();
+	rotation.clear();
+	scale.clear();
+	parent.clear();
+	world_from_local.clear();
+	adapters.clear();
+	dirty.clear();
+	changed.clear();
+	changed_adapters.clear();
+}
+
+uint32_t Scene::TransformArrays::push_back(Transform *adapter, uint32_t parent_) {
+	assert(adapter);
+	assert(parent_ == -1U || parent_ < size());
+	uint32_t index = size();
+	position.emplace_back(adapter->position);
+	rotation.emplace_back(adapter->rotation);
+	scale.emplace_back(adapter->scale);
+	parent.emplace_back(parent_);
+	world_from_local.emplace_back(1.0f);
+	adapters.emplace_back(adapter);
+	dirty.emplace_back(1);
+	changed.emplace_back(1);
+	adapter->arrays = this;
+	adapter->array_index = index;
+	return index;
+}
+
+void Scene::TransformArrays::update_world_from_local() {
+	uint32_t count = size();
+	assert(world_from_local.size() == count);
+
+	//parents come earlier in the arrays, so they are already up to date (and their 'changed' flags set) when reached:
+	for (uint32_t i = 0; i < count; ++i) {
+		bool recompute = dirty[i] || (parent[i] != -1U && changed[parent[i]]);
+		dirty[i] = 0;
+		changed[i] = recompute;
+		if (!recompute) continue;
+
+		glm::mat3 rot = glm::mat3_cast(rotation[i]);
+		world_from_local[i] = glm::mat4x3(
+			rot[0] * scale[i].x,
+			rot[1] * scale[i].y,
+			rot[2] * scale[i].z,
+			position[i]
+		);
+		if (parent[i] == -1U) continue;
+
+		//compose with parent:
+		glm::mat4x3 const &world_from_parent = world_from_local[parent[i]];
+		glm::mat4x3 &m = world_from_local[i];
+		//(same as world_from_parent * glm::mat4(m), without the multiplies by the implied bottom row)
+		glm::vec3 x = world_from_parent[0], y = world_from_parent[1], z = world_from_parent[2];
+		glm::mat4x3 parent_from_local = m;
+		for (uint32_t c = 0; c < 4; ++c) {
+			m[c] = x * parent_from_local[c].x + y * parent_from_local[c].y + z * parent_from_local[c].z;
+		}
+		m[3] += world_from_parent[3];
+	}
+}
+
+void Scene::TransformHandle::set_position(glm::vec3 const &position) const {
+	arrays->position[index] = position;
+	arrays->adapters[index]->position = position;
+	arrays->dirty[index] = 1;
+}
+
+void Scene::TransformHandle::set_rotation(glm::quat const &rotation) const {
+	arrays->rotation[index] = rotation;
+	arrays->adapters[index]->rotation = rotation;
+	arrays->dirty[index] = 1;
+}
+
+void Scene::TransformHandle::set_scale(glm::vec3 const &scale) const {
+	arrays->scale[index] = scale;
+	arrays->adapters[index]->scale = scale;
+	arrays->dirty[index] = 1;
+}
+
+//helper: rebuild a scene's transform arrays from its transforms list:
+// entries are sorted by depth in the hierarchy, so parents come first and siblings are near each other.
+static void rebuild_transform_arrays(Scene &scene) {
+	Scene::TransformArrays &arrays = scene.transform_arrays;
+	arrays.clear();
+
+	//depth of each transform in the hierarchy (-1U == not computed yet):
+	std::unordered_map< Scene::Transform const *, uint32_t > depth;
+	depth.reserve(scene.transforms.size());
+	for (auto const &t : scene.transforms) {
+		depth.emplace(&t, -1U);
+	}
+
+	std::vector< std::vector< Scene::Transform * > > levels;
+	std::vector< Scene::Transform * > chain;
+	for (auto &t : scene.transforms) {
+		//walk up until reaching a transform with a known depth (or the root):
+		chain.clear();
+		uint32_t d = -1U;
+		for (Scene::Transform *at = &t; at != nullptr; at = at->parent) {
+			auto f = depth.find(at);
+			if (f == depth.end()) {
+				throw std::runtime_error("Transform '" + t.name + "' has an ancestor ('" + at->name + "') that isn't in the same scene; can't store it in transform arrays.");
+			}
+			if (f->second != -1U) {
+				d = f->second;
+				break;
+			}
+			chain.emplace_back(at);
+		}
+		//assign depths going back down:
+		for (auto c = chain.rbegin(); c != chain.rend(); ++c) {
+			d = d + 1; //(-1U + 1 == 0 for roots)
+			depth[*c] = d;
+			if (d >= levels.size()) levels.resize(d + 1);
+			levels[d].emplace_back(*c);
+		}
+	}
+
+	uint32_t count = uint32_t(scene.transforms.size());
+	arrays.position.reserve(count);
+	arrays.rotation.reserve(count);
+	arrays.scale.reserve(count);
+	arrays.parent.reserve(count);
+	arrays.world_from_local.reserve(count);
+	arrays.adapters.reserve(count);
+	arrays.dirty.reserve(count);
+	arrays.changed.reserve(count);
+	for (auto const &level : levels) {
+		for (Scene::Transform *t : level) {
+			arrays.push_back(t, (t->parent ? t->parent->array_index : -1U));
+		}
+	}
+	assert(arrays.size() == count);
+
+	arrays.update_world_from_local();
+}
+
+void Scene::set_transform_storage(TransformStorage storage) {
+	transform_storage = storage;
+	if (storage == TransformStorage::Arrays) {
+		cache_world_transforms = true;
+		rebuild_transform_arrays(*this);
+	} else {
+		transform_arrays.clear();
+		for (auto &t : transforms) {
+			t.arrays = nullptr;
+			t.array_index = -1U;
+			t.cached_pass = 0; //(list cache will need to be rebuilt)
+		}
+	}
+}
+
+void Scene::gather_transform_arrays() {
+	assert(transform_storage == TransformStorage::Arrays);
+	TransformArrays &arrays = transform_arrays;
+
+	//transforms were added (or removed) since the arrays were built:
+	if (arrays.size() != transforms.size()) {
+		rebuild_transform_arrays(*this);
+		return;
+	}
+
+	//only adapters marked with Transform::mark_changed() need to be looked at:
+	for (uint32_t i : arrays.changed_adapters) {
+		Transform const &t = *arrays.adapters[i];
+		Transform const *parent = (arrays.parent[i] == -1U ? nullptr : arrays.adapters[arrays.parent[i]]);
+		if (t.parent != parent) {
+			//re-parented:
+			rebuild_transform_arrays(*this);
+			return;
+		}
+		arrays.position[i] = t.position;
+		arrays.rotation[i] = t.rotation;
+		arrays.scale[i] = t.scale;
+		arrays.dirty[i] = 1;
+	}
+	arrays.changed_adapters.clear();
+}
+
+//-------------------------
+
+//helper: object-to-world matrix for a drawable (from the cache, if the scene uses it):
+static glm::mat4x3 drawable_world_from_object(Scene const &scene, Scene::Drawable const &drawable) {
+	assert(drawable.transform); //drawables *must* have a transform
+	return (scene.cache_world_transforms ? drawable.transform->world_from_local() : drawable.transform->make_world_from_local());
+}
+
+//helper: does a drawable have a (non-empty) bounding box?
+static bool has_bounds(Scene::Drawable const &drawable) {
+	return drawable.min.x <= drawable.max.x && drawable.min.y <= drawable.max.y && drawable.min.z <= drawable.max.z;
+}
+
+//helper: world-space box that contains a drawable's (transformed) object-space box:
+static BVH::Box world_bounds(Scene::Drawable const &drawable, glm::mat4x3 const &world_from_object) {
+	glm::vec3 center = world_from_object * glm::vec4(0.5f * (drawable.min + drawable.max), 1.0f);
+	glm::vec3 half = 0.5f * (drawable.max - drawable.min);
+	glm::vec3 extent = glm::abs(world_from_object[0]) * half.x
+	                 + glm::abs(world_from_object[1]) * half.y
+	                 + glm::abs(world_from_object[2]) * half.z;
+	BVH::Box box;
+	box.min = center - extent;
+	box.max = center + extent;
+	return box;
+}
+
+void Scene::update_bvh() {
+	assert(use_bvh);
+
+	//if any drawables in the tree were removed, rebuild from scratch:
+	uint32_t in_tree = 0;
+	for (auto const &drawable : drawables) {
+		if (drawable.bvh_leaf != -1U) in_tree += 1;
+	}
+
+	if (in_tree != bvh.leaf_count() || bvh.leaf_count() == 0) {
+		std::vector< BVH::Box > boxes;
+		std::vector< uint32_t > items;
+		bvh_drawables.clear();
+		for (auto &drawable : drawables) {
+			drawable.bvh_leaf = -1U;
+			if (!has_bounds(drawable)) continue;
+			boxes.emplace_back(world_bounds(drawable, drawable_world_from_object(*this, drawable)));
+			items.emplace_back(uint32_t(bvh_drawables.size()));
+			bvh_drawables.emplace_back(&drawable);
+		}
+		std::vector< uint32_t > leaves = bvh.build(boxes, items);
+		for (uint32_t i = 0; i < leaves.size(); ++i) {
+			bvh_drawables[i]->bvh_leaf = leaves[i];
+		}
+		return;
+	}
+
+	//transforms' cached_changed flags (or, with TransformStorage::Arrays, the arrays' changed flags) say which
+	// world transforms changed in the last update_world_from_local():
+	bool only_changed = cache_world_transforms;
+	auto world_changed = [](Transform const &t) {
+		return (t.arrays ? t.arrays->changed[t.array_index] != 0 : t.cached_changed);
+	};
+
+	for (auto &drawable : drawables) {
+		if (drawable.bvh_leaf == -1U) {
+			//new drawable:
+			if (!has_bounds(drawable)) continue;
+			drawable.bvh_leaf = bvh.insert(world_bounds(drawable, drawable_world_from_object(*this, drawable)), uint32_t(bvh_drawables.size()));
+			bvh_drawables.emplace_back(&drawable);
+		} else if (!only_changed || world_changed(*drawable.transform)) {
+			//(possibly) moved drawable:
+			bvh.update(drawable.bvh_leaf, world_bounds(drawable, drawable_world_from_object(*this, drawable)));
+		}
+	}
+}
+
+Scene::Drawable const *Scene::pick(glm::vec3 const &origin, glm::vec3 const &direction, float *distance_) const {
+	Drawable const *best = nullptr;
+	float best_distance = std::numeric_limits< float >::infinity();
+
+	if (use_bvh) {
+		//only drawables in the bvh (i.e., as of the last update_bvh()):
+		bvh.query_ray(origin, direction, best_distance, [&](uint32_t item, float t) {
+			if (t < best_distance) {
+				best = bvh_drawables[item];
+				best_distance = t;
+			}
+			return best_distance;
+		});
+	} else {
+		//test every drawable with bounds:
+		glm::vec3 inv_direction = 1.0f / direction;
+		for (auto const &drawable : drawables) {
+			if (!has_bounds(drawable)) continue;
+			float t = BVH::ray_enter(world_bounds(drawable, drawable_world_from_object(*this, drawable)), origin, inv_direction, best_distance);
+			if (t < best_distance) {
+				best = &drawable;
+				best_distance = t;
+			}
+		}
+	}
+
+	if (distance_) *distance_ = best_distance;
+	return best;
+}
+
+//-------------------------
+
 glm::mat4 Scene::Camera::make_projection() const {
 	return glm::infinitePerspective( fovy, aspect, near );
 }
@@ -87,11 +425,107 @@ void Scene::draw(Camera const &camera) const {
 	draw(clip_from_world, light_from_world);
 }
 
+//helper: the vertex (or index) range a drawable is drawn with at its current level of detail:
+static Scene::Drawable::LOD draw_range(Scene::Drawable const &drawable) {
+	if (drawable.lod > 0) return drawable.lods[drawable.lod - 1];
+	Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
+	return Scene::Drawable::LOD{ pipeline.start, pipeline.count, pipeline.base_vertex, pipeline.position_offset, pipeline.position_scale, 0.0f };
+}
+
+//helper: ordering used by the render queue (drawables that share state end up next to each other,
+// and drawables that draw the same vertices with the same state end up in runs that can be instanced):
+static bool draw_state_less(Scene::Drawable const *a, Scene::Drawable const *b) {
+	Scene::Drawable::Pipeline const &pa = a->pipeline;
+	Scene::Drawable::Pipeline const &pb = b->pipeline;
+	if (pa.program != pb.program) return pa.program < pb.program;
+	if (pa.instanced.program != pb.instanced.program) return pa.instanced.program < pb.instanced.program;
+	if (pa.vao != pb.vao) return pa.vao < pb.vao;
+	for (uint32_t i = 0; i < Scene::Drawable::Pipeline::TextureCount; ++i) {
+		if (pa.textures[i].texture != pb.textures[i].texture) return pa.textures[i].texture < pb.textures[i].texture;
+		if (pa.textures[i].target != pb.textures[i].target) return pa.textures[i].target < pb.textures[i].target;
+	}
+	if (pa.type != pb.type) return pa.type < pb.type;
+	if (pa.index_type != pb.index_type) return pa.index_type < pb.index_type;
+	Scene::Drawable::LOD ra = draw_range(*a);
+	Scene::Drawable::LOD rb = draw_range(*b);
+	if (ra.base_vertex != rb.base_vertex) return ra.base_vertex < rb.base_vertex;
+	if (ra.start != rb.start) return ra.start < rb.start;
+	if (ra.count != rb.count) return ra.count < rb.count;
+	return false;
+}
+
+//helper: do the range's positions need dequantizing?
+static bool is_quantized(Scene::Drawable::LOD const &range) {
+	return range.position_offset != glm::vec3(0.0f) || range.position_scale != glm::vec3(1.0f);
+}
+
+//helper: matrix that takes (quantized) positions to object space:
+static glm::mat4x3 object_from_position(Scene::Drawable::LOD const &range) {
+	return glm::mat4x3(
+		glm::vec3(range.position_scale.x, 0.0f, 0.0f),
+		glm::vec3(0.0f, range.position_scale.y, 0.0f),
+		glm::vec3(0.0f, 0.0f, range.position_scale.z),
+		range.position_offset
+	);
+}
+
+//helper: can 'b' be drawn as another instance of 'a'?
+static bool draw_same_instance(Scene::Drawable const *a, Scene::Drawable const *b) {
+	Scene::Drawable::Pipeline const &pa = a->pipeline;
+	Scene::Drawable::Pipeline const &pb = b->pipeline;
+	if (pa.instanced.program == 0 || pa.set_uniforms || pb.set_uniforms) return false;
+	if (pa.program != pb.program || pa.instanced.program != pb.instanced.program) return false;
+	if (pa.vao != pb.vao || pa.type != pb.type || pa.index_type != pb.index_type) return false;
+	Scene::Drawable::LOD ra = draw_range(*a);
+	Scene::Drawable::LOD rb = draw_range(*b);
+	if (ra.start != rb.start || ra.count != rb.count || ra.base_vertex != rb.base_vertex) return false;
+	if (ra.position_offset != rb.position_offset || ra.position_scale != rb.position_scale) return false;
+	if (pa.instanced.OBJECT_FROM_POSITION_mat4x3 == -1U && is_quantized(ra)) return false;
+	for (uint32_t i = 0; i < Scene::Drawable::Pipeline::TextureCount; ++i) {
+		if (pa.textures[i].texture != pb.textures[i].texture) return false;
+		if (pa.textures[i].texture != 0 && pa.textures[i].target != pb.textures[i].target) return false;
+	}
+	return true;
+}
+
+//helper: byte offset of an indexed range's first index in its element array buffer:
+static GLbyte const *first_index(Scene::Drawable::Pipeline const &pipeline, Scene::Drawable::LOD const &range) {
+	size_t size = (pipeline.index_type == GL_UNSIGNED_BYTE ? 1 : pipeline.index_type == GL_UNSIGNED_SHORT ? 2 : 4);
+	return (GLbyte const *)0 + size_t(range.start) * size;
+}
+
+//which bvh items the last frustum query found:
+static std::vector< uint8_t > bvh_visible;
+
+//world-space bounds of the drawables being culled, stored as separate arrays so the plane tests vectorize:
+// (shared by all scenes; refilled by each draw() call that culls anything)
+static struct {
+	std::vector< float > cx, cy, cz; //center
+	std::vector< float > ex, ey, ez; //half-extent
+	std::vector< uint8_t > visible;
+	void resize(size_t size) {
+		for (auto v : {&cx, &cy, &cz, &ex, &ey, &ez}) v->resize(size);
+		visible.assign(size, 1);
+	}
+} cull_bounds;
+
+//per-instance data for instanced draws:
+// (shared by all scenes; refilled and re-uploaded by each draw() call that instances anything)
+struct InstanceData {
+	glm::mat4x3 world_from_object; //-> Pipeline::Instanced::WORLD_FROM_OBJECT_mat4x3
+	glm::mat3 light_from_normal; //-> Pipeline::Instanced::LIGHT_FROM_NORMAL_mat3 (computed here once per instance, not per vertex)
+};
+static_assert(sizeof(InstanceData) == 21 * sizeof(float), "InstanceData is tightly packed");
+static GLuint instance_buffer = 0;
+static std::vector< InstanceData > instance_data;
+
 void Scene::draw(glm::mat4 const &clip_from_world, glm::mat4x3 const &light_from_world) const {
+	draw_stats = DrawStats();
 
-	//Iterate through all drawables, sending each one to OpenGL:
+	//Gather the drawables to draw, skipping ones that wouldn't draw anything:
+	std::vector< Drawable const * > queue;
+	queue.reserve(drawables.size());
 	for (auto const &drawable : drawables) {
-		//Reference to drawable's pipeline for convenience:
 		Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
 
 		//skip any drawables without a shader program set:
@@ -101,23 +535,310 @@ void Scene::draw(glm::mat4 const &clip_from_world, glm::mat4x3 const &light_from
 		//skip any drawables that don't contain any vertices:
 		if (pipeline.count == 0) continue;
 
+		queue.emplace_back(&drawable);
+	}
+
+	auto get_world_from_object = [this](Drawable const &drawable) {
+		return drawable_world_from_object(*this, drawable);
+	};
+
+	//Remove drawables that are outside the view frustum:
+	if (frustum_cull) {
+		auto cull_start = std::chrono::steady_clock::now();
+
+		glm::vec4 planes[6];
+		BVH::frustum_planes(clip_from_world, planes);
+
+		//drawables in the bvh are culled with one tree query:
+		if (use_bvh && bvh.leaf_count() > 0) {
+			bvh_visible.assign(bvh_drawables.size(), 0);
+			bvh.query_frustum(planes, [](uint32_t item) {
+				bvh_visible[item] = 1;
+			});
+		}
+
+		//other drawables with bounds get an entry in cull_bounds (in world space), the rest are always kept:
+		constexpr uint32_t InBVH = -2U;
+		std::vector< Drawable const * > bounded;
+		std::vector< uint32_t > bounds_index(queue.size(), -1U); //entry in cull_bounds for each drawable in queue (or -1U or InBVH)
+		bounded.reserve(queue.size());
+		for (uint32_t q = 0; q < queue.size(); ++q) {
+			Drawable const &drawable = *queue[q];
+			if (use_bvh && drawable.bvh_leaf != -1U) {
+				bounds_index[q] = InBVH;
+			} else if (has_bounds(drawable)) {
+				bounds_index[q] = uint32_t(bounded.size());
+				bounded.emplace_back(&drawable);
+			}
+		}
+
+		//world-space box that contains the transformed object-space box:
+		cull_bounds.resize(bounded.size());
+		for (uint32_t i = 0; i < bounded.size(); ++i) {
+			BVH::Box box = world_bounds(*bounded[i], get_world_from_object(*bounded[i]));
+			glm::vec3 center = 0.5f * (box.min + box.max);
+			glm::vec3 extent = 0.5f * (box.max - box.min);
+			cull_bounds.cx[i] = center.x; cull_bounds.cy[i] = center.y; cull_bounds.cz[i] = center.z;
+			cull_bounds.ex[i] = extent.x; cull_bounds.ey[i] = extent.y; cull_bounds.ez[i] = extent.z;
+		}
+
+		//test against the frustum planes:
+		// a box is outside if it is entirely on the negative side of any plane
+		uint32_t count = uint32_t(bounded.size());
+		for (glm::vec4 const &plane : planes) {
+			float const px = plane.x, py = plane.y, pz = plane.z, pw = plane.w;
+			float const ax = std::abs(px), ay = std::abs(py), az = std::abs(pz);
+			float const *cx = cull_bounds.cx.data(), *cy = cull_bounds.cy.data(), *cz = cull_bounds.cz.data();
+			float const *ex = cull_bounds.ex.data(), *ey = cull_bounds.ey.data(), *ez = cull_bounds.ez.data();
+			uint8_t *visible = cull_bounds.visible.data();
+			for (uint32_t i = 0; i < count; ++i) {
+				float distance = px * cx[i] + py * cy[i] + pz * cz[i] + pw;
+				float radius = ax * ex[i] + ay * ey[i] + az * ez[i];
+				visible[i] &= uint8_t(distance + radius >= 0.0f);
+			}
+		}
+
+		//(keeping queue order, since draw order matters when not batching)
+		uint32_t kept = 0;
+		for (uint32_t q = 0; q < queue.size(); ++q) {
+			bool visible;
+			if (bounds_index[q] == -1U) visible = true;
+			else if (bounds_index[q] == InBVH) visible = bvh_visible[bvh.item(queue[q]->bvh_leaf)];
+			else visible = cull_bounds.visible[bounds_index[q]];
+
+			if (visible) {
+				queue[kept++] = queue[q];
+			} else {
+				draw_stats.culled += 1;
+			}
+		}
+		queue.resize(kept);
+
+		draw_stats.cull_time = std::chrono::duration< float >(std::chrono::steady_clock::now() - cull_start).count();
+	}
+
+	//Pick levels of detail (before sorting, since the level changes which vertices are drawn):
+	{
+		//drawables' projected size comes from clip-space y, which grows like |row 1 of clip_from_world| / w:
+		float y_scale = glm::length(glm::vec3(clip_from_world[0][1], clip_from_world[1][1], clip_from_world[2][1]));
+		for (Drawable const *drawable_ : queue) {
+			Drawable const &drawable = *drawable_;
+			if (drawable.lods.empty()) continue;
+			uint32_t level = std::min(drawable.lod, uint32_t(drawable.lods.size()));
+			if (!has_bounds(drawable)) {
+				drawable.lod = 0;
+				continue;
+			}
+
+			glm::mat4x3 world_from_object = get_world_from_object(drawable);
+			glm::vec3 center = world_from_object * glm::vec4(0.5f * (drawable.min + drawable.max), 1.0f);
+			float scale = std::max(glm::length(world_from_object[0]), std::max(glm::length(world_from_object[1]), glm::length(world_from_object[2])));
+			float radius = 0.5f * glm::length(drawable.max - drawable.min) * scale;
+			float w = (clip_from_world * glm::vec4(center, 1.0f)).w;
+
+			//screen error (as a fraction of viewport height) per unit of relative error:
+			// (camera inside the bounds -- or projection without w -- gets full detail)
+			float projected = (w > radius ? radius * y_scale / (2.0f * w) : std::numeric_limits< float >::infinity());
+			auto error = [&](uint32_t l) {
+				return (l == 0 ? 0.0f : drawable.lods[l-1].error * projected);
+			};
+			while (level < drawable.lods.size() && error(level + 1) * (1.0f + lod_hysteresis) <= lod_max_error) ++level;
+			while (level > 0 && error(level) > lod_max_error * (1.0f + lod_hysteresis)) --level;
+			drawable.lod = level;
+		}
+	}
+
+	//When batching, sort so that drawables with the same state are drawn together:
+	// (stable, so drawables with identical state keep their relative order)
+	if (batch_draws) {
+		std::stable_sort(queue.begin(), queue.end(), draw_state_less);
+	}
+
+	//Split the queue into runs; each run is either one drawable or several drawn with one instanced call:
+	struct Run {
+		uint32_t begin, end; //range in queue
+		uint32_t first_instance; //first entry in instance_data, or -1U if not instanced
+	};
+	std::vector< Run > runs;
+	runs.reserve(queue.size());
+	instance_data.clear();
+	for (uint32_t begin = 0; begin < queue.size(); /* later */) {
+		uint32_t end = begin + 1;
+		if (batch_draws) {
+			while (end < queue.size() && draw_same_instance(queue[begin], queue[end])) ++end;
+		}
+		if (end - begin >= 2) {
+			runs.emplace_back(Run{ begin, end, uint32_t(instance_data.size()) });
+			for (uint32_t i = begin; i < end; ++i) {
+				glm::mat4x3 world_from_object = get_world_from_object(*queue[i]);
+				glm::mat3 light_from_object = glm::mat3(light_from_world) * glm::mat3(world_from_object);
+				instance_data.emplace_back(InstanceData{ world_from_object, glm::inverse(glm::transpose(light_from_object)) });
+			}
+		} else {
+			runs.emplace_back(Run{ begin, end, -1U });
+		}
+		begin = end;
+	}
+
+	//Upload per-instance data (if any):
+	if (!instance_data.empty()) {
+		if (instance_buffer == 0) {
+			glGenBuffers(1, &instance_buffer);
+			draw_stats.gl_calls += 1;
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+		glBufferData(GL_ARRAY_BUFFER, instance_data.size() * sizeof(instance_data[0]), instance_data.data(), GL_STREAM_DRAW);
+		draw_stats.gl_calls += 2;
+	}
+
+	//Currently-bound state (only trusted when batching):
+	GLuint bound_program = 0;
+	GLuint bound_vao = 0;
+	Drawable::Pipeline::TextureInfo bound_textures[Drawable::Pipeline::TextureCount];
+	GLenum active_texture = GL_TEXTURE0;
+
+	auto use_program = [&](GLuint program) {
+		if (batch_draws && program == bound_program) return;
+		glUseProgram(program);
+		draw_stats.gl_calls += 1;
+		draw_stats.program_changes += 1;
+		bound_program = program;
+	};
+	auto bind_vao = [&](GLuint vao) {
+		if (batch_draws && vao == bound_vao) return;
+		glBindVertexArray(vao);
+		draw_stats.gl_calls += 1;
+		draw_stats.vao_changes += 1;
+		bound_vao = vao;
+	};
+	auto set_active_texture = [&](GLenum unit) {
+		if (batch_draws && unit == active_texture) return;
+		glActiveTexture(unit);
+		draw_stats.gl_calls += 1;
+		active_texture = unit;
+	};
+	auto bind_texture = [&](GLenum target, GLuint texture) {
+		glBindTexture(target, texture);
+		draw_stats.gl_calls += 1;
+		draw_stats.texture_changes += 1;
+	};
+	auto bind_textures = [&](Drawable::Pipeline const &pipeline) {
+		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+			Drawable::Pipeline::TextureInfo const &want = pipeline.textures[i];
+			Drawable::Pipeline::TextureInfo &bound = bound_textures[i];
+			if (batch_draws) {
+				//only touch units whose binding actually changes:
+				if (want.texture == bound.texture && (want.texture == 0 || want.target == bound.target)) continue;
+				set_active_texture(GL_TEXTURE0 + i);
+				if (bound.texture != 0 && (want.texture == 0 || want.target != bound.target)) {
+					bind_texture(bound.target, 0);
+				}
+				if (want.texture != 0) {
+					bind_texture(want.target, want.texture);
+				}
+				bound = want;
+			} else if (want.texture != 0) {
+				set_active_texture(GL_TEXTURE0 + i);
+				bind_texture(want.target, want.texture);
+			}
+		}
+	};
+
+	//Send each run to OpenGL:
+	for (Run const &run : runs) {
+		//Reference to (first) drawable's pipeline for convenience:
+		Scene::Drawable::Pipeline const &pipeline = queue[run.begin]->pipeline;
+		Scene::Drawable::LOD range = draw_range(*queue[run.begin]);
+
+		if (run.first_instance != -1U) {
+			//--- several drawables, drawn with the instanced program ---
+			Scene::Drawable::Pipeline::Instanced const &instanced = pipeline.instanced;
+			use_program(instanced.program);
+			bind_vao(pipeline.vao);
+
+			if (instanced.CLIP_FROM_WORLD_mat4 != -1U) {
+				glUniformMatrix4fv(instanced.CLIP_FROM_WORLD_mat4, 1, GL_FALSE, glm::value_ptr(clip_from_world));
+				draw_stats.gl_calls += 1;
+			}
+			if (instanced.LIGHT_FROM_WORLD_mat4x3 != -1U) {
+				glUniformMatrix4x3fv(instanced.LIGHT_FROM_WORLD_mat4x3, 1, GL_FALSE, glm::value_ptr(light_from_world));
+				draw_stats.gl_calls += 1;
+			}
+			if (instanced.OBJECT_FROM_POSITION_mat4x3 != -1U) {
+				glm::mat4x3 dequantize = object_from_position(range);
+				glUniformMatrix4x3fv(instanced.OBJECT_FROM_POSITION_mat4x3, 1, GL_FALSE, glm::value_ptr(dequantize));
+				draw_stats.gl_calls += 1;
+			}
+
+			bind_textures(pipeline);
+
+			//point the per-instance attributes at this run's entries in instance_buffer:
+			// (each matrix takes one attribute location per column)
+			glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+			draw_stats.gl_calls += 1;
+			GLuint instance_locations[7]; //(4 columns of WORLD_FROM_OBJECT + 3 of LIGHT_FROM_NORMAL)
+			uint32_t instance_location_count = 0;
+			auto instance_columns = [&](GLuint location, uint32_t columns, size_t member_offset) {
+				if (location == -1U) return;
+				for (uint32_t c = 0; c < columns; ++c) {
+					size_t offset = run.first_instance * sizeof(InstanceData) + member_offset + c * sizeof(glm::vec3);
+					glVertexAttribPointer(location + c, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (GLbyte *)0 + offset);
+					glVertexAttribDivisor(location + c, 1);
+					glEnableVertexAttribArray(location + c);
+					draw_stats.gl_calls += 3;
+					instance_locations[instance_location_count++] = location + c;
+				}
+			};
+			instance_columns(instanced.WORLD_FROM_OBJECT_mat4x3, 4, offsetof(InstanceData, world_from_object));
+			instance_columns(instanced.LIGHT_FROM_NORMAL_mat3, 3, offsetof(InstanceData, light_from_normal));
+
+			GLsizei instances = GLsizei(run.end - run.begin);
+			if (pipeline.index_type != GL_NONE) {
+				glDrawElementsInstancedBaseVertex(pipeline.type, range.count, pipeline.index_type, first_index(pipeline, range), instances, range.base_vertex);
+			} else {
+				glDrawArraysInstanced(pipeline.type, range.start, range.count, instances);
+			}
+			draw_stats.gl_calls += 1;
+
+			//leave the (shared) vertex array as the plain program expects it:
+			for (uint32_t l = 0; l < instance_location_count; ++l) {
+				glDisableVertexAttribArray(instance_locations[l]);
+				glVertexAttribDivisor(instance_locations[l], 0);
+				draw_stats.gl_calls += 2;
+			}
+
+			draw_stats.draw_calls += 1;
+			draw_stats.drawables += uint32_t(instances);
+			draw_stats.instanced_drawables += uint32_t(instances);
+			draw_stats.vertices += range.count * uint32_t(instances);
+			if (queue[run.begin]->lod > 0) draw_stats.lod_reduced += uint32_t(instances);
+			continue;
+		}
+
+		//--- a single drawable ---
+		assert(run.end == run.begin + 1);
+		Drawable const &drawable = *queue[run.begin];
 
 		//Set shader program:
-		glUseProgram(pipeline.program);
+		use_program(pipeline.program);
 
 		//Set attribute sources:
-		glBindVertexArray(pipeline.vao);
+		bind_vao(pipeline.vao);
 
 		//Configure program uniforms:
 
 		//the object-to-world matrix is used in all three of these uniforms:
-		assert(drawable.transform); //drawables *must* have a transform
-		glm::mat4x3 world_from_object = drawable.transform->make_world_from_local();
+		glm::mat4x3 world_from_object = get_world_from_object(drawable);
+
+		//...and, for quantized meshes, vertex positions need dequantizing first:
+		glm::mat4x3 world_from_position = world_from_object;
+		if (is_quantized(range)) world_from_position = world_from_object * glm::mat4(object_from_position(range));
 
 		//CLIP_FROM_OBJECT takes vertices from object space to clip space:
 		if (pipeline.CLIP_FROM_OBJECT_mat4 != -1U) {
-			glm::mat4 clip_from_object = clip_from_world * glm::mat4(world_from_object);
+			glm::mat4 clip_from_object = clip_from_world * glm::mat4(world_from_position);
 			glUniformMatrix4fv(pipeline.CLIP_FROM_OBJECT_mat4, 1, GL_FALSE, glm::value_ptr(clip_from_object));
+			draw_stats.gl_calls += 1;
 		}
 
 		//the object-to-light matrix is used in the next two uniforms:
@@ -125,42 +846,67 @@ void Scene::draw(glm::mat4 const &clip_from_world, glm::mat4x3 const &light_from
 
 		//CLIP_FROM_OBJECT takes vertices from object space to light space:
 		if (pipeline.LIGHT_FROM_OBJECT_mat4x3 != -1U) {
-			glUniformMatrix4x3fv(pipeline.LIGHT_FROM_OBJECT_mat4x3, 1, GL_FALSE, glm::value_ptr(light_from_object));
+			glm::mat4x3 light_from_position = light_from_world * glm::mat4(world_from_position);
+			glUniformMatrix4x3fv(pipeline.LIGHT_FROM_OBJECT_mat4x3, 1, GL_FALSE, glm::value_ptr(light_from_position));
+			draw_stats.gl_calls += 1;
 		}
 
 		//LIGHT_FROM_NORMAL takes normals from object space to light space:
 		if (pipeline.LIGHT_FROM_NORMAL_mat3 != -1U) {
 			glm::mat3 light_from_normal = glm::inverse(glm::transpose(glm::mat3(light_from_object)));
 			glUniformMatrix3fv(pipeline.LIGHT_FROM_NORMAL_mat3, 1, GL_FALSE, glm::value_ptr(light_from_normal));
+			draw_stats.gl_calls += 1;
 		}
 
 		//set any requested custom uniforms:
 		if (pipeline.set_uniforms) pipeline.set_uniforms();
 
 		//set up textures:
-		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, pipeline.textures[i].texture);
-			}
-		}
+		bind_textures(pipeline);
 
 		//draw the object:
-		glDrawArrays(pipeline.type, pipeline.start, pipeline.count);
+		if (pipeline.index_type != GL_NONE) {
+			glDrawElementsBaseVertex(pipeline.type, range.count, pipeline.index_type, first_index(pipeline, range), range.base_vertex);
+		} else {
+			glDrawArrays(pipeline.type, range.start, range.count);
+		}
+		draw_stats.gl_calls += 1;
+		draw_stats.draw_calls += 1;
+		draw_stats.drawables += 1;
+		draw_stats.vertices += range.count;
+		if (drawable.lod > 0) draw_stats.lod_reduced += 1;
+
+		if (!batch_draws) {
+			//un-bind textures:
+			for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+				if (pipeline.textures[i].texture != 0) {
+					set_active_texture(GL_TEXTURE0 + i);
+					bind_texture(pipeline.textures[i].target, 0);
+				}
+			}
+			set_active_texture(GL_TEXTURE0);
+		}
+	}
 
-		//un-bind textures:
+	if (batch_draws) {
+		//un-bind anything still bound from the last drawables:
 		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, 0);
+			if (bound_textures[i].texture != 0) {
+				set_active_texture(GL_TEXTURE0 + i);
+				bind_texture(bound_textures[i].target, 0);
 			}
 		}
-		glActiveTexture(GL_TEXTURE0);
+		set_active_texture(GL_TEXTURE0);
+	}
 
+	if (!instance_data.empty()) {
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		draw_stats.gl_calls += 1;
 	}
 
 	glUseProgram(0);
 	glBindVertexArray(0);
+	draw_stats.gl_calls += 2;
 
 	GL_ERRORS();
 }
@@ -169,10 +915,11 @@ void Scene::draw(glm::mat4 const &clip_from_world, glm::mat4x3 const &light_from
 void Scene::load(std::string const &filename,
 	std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable) {
 
-	std::ifstream file(filename, std::ios::binary);
+	MappedFile file(filename);
+	size_t at = 0; //read position in file
 
-	std::vector< char > names;
-	read_chunk(file, "str0", &names);
+	std::vector< char > names_unaligned;
+	std::span< char const > names = map_chunk(file, &at, "str0", &names_unaligned);
 
 	struct HierarchyEntry {
 		uint32_t parent;
@@ -183,8 +930,8 @@ void Scene::load(std::string const &filename,
 		glm::vec3 scale;
 	};
 	static_assert(sizeof(HierarchyEntry) == 4 + 4 + 4 + 4*3 + 4*4 + 4*3, "HierarchyEntry is packed.");
-	std::vector< HierarchyEntry > hierarchy;
-	read_chunk(file, "xfh0", &hierarchy);
+	std::vector< HierarchyEntry > hierarchy_unaligned;
+	std::span< HierarchyEntry const > hierarchy = map_chunk(file, &at, "xfh0", &hierarchy_unaligned);
 
 	struct MeshEntry {
 		uint32_t transform;
@@ -192,8 +939,8 @@ void Scene::load(std::string const &filename,
 		uint32_t name_end;
 	};
 	static_assert(sizeof(MeshEntry) == 4 + 4 + 4, "MeshEntry is packed.");
-	std::vector< MeshEntry > meshes;
-	read_chunk(file, "msh0", &meshes);
+	std::vector< MeshEntry > meshes_unaligned;
+	std::span< MeshEntry const > meshes = map_chunk(file, &at, "msh0", &meshes_unaligned);
 
 	struct CameraEntry {
 		uint32_t transform;
@@ -202,8 +949,8 @@ void Scene::load(std::string const &filename,
 		float clip_near, clip_far;
 	};
 	static_assert(sizeof(CameraEntry) == 4 + 4 + 4 + 4 + 4, "CameraEntry is packed.");
-	std::vector< CameraEntry > loaded_cameras;
-	read_chunk(file, "cam0", &loaded_cameras);
+	std::vector< CameraEntry > cameras_unaligned;
+	std::span< CameraEntry const > loaded_cameras = map_chunk(file, &at, "cam0", &cameras_unaligned);
 
 	struct LightEntry {
 		uint32_t transform;
@@ -214,8 +961,8 @@ void Scene::load(std::string const &filename,
 		float fov;
 	};
 	static_assert(sizeof(LightEntry) == 4 + 1 + 3 + 4 + 4 + 4, "LightEntry is packed.");
-	std::vector< LightEntry > loaded_lights;
-	read_chunk(file, "lmp0", &loaded_lights);
+	std::vector< LightEntry > lights_unaligned;
+	std::span< LightEntry const > loaded_lights = map_chunk(file, &at, "lmp0", &lights_unaligned);
 
 
 	//--------------------------------
@@ -248,6 +995,18 @@ void Scene::load(std::string const &filename,
 	}
 	assert(hierarchy_transforms.size() == hierarchy.size());
 
+	//xfh0 is in topological order, so new transforms can be appended directly to up-to-date arrays:
+	if (transform_storage == TransformStorage::Arrays) {
+		if (transform_arrays.size() + hierarchy_transforms.size() == transforms.size()) {
+			for (Transform *t : hierarchy_transforms) {
+				transform_arrays.push_back(t, (t->parent ? t->parent->array_index : -1U));
+			}
+			transform_arrays.update_world_from_local();
+		} else {
+			rebuild_transform_arrays(*this);
+		}
+	}
+
 	for (auto const &m : meshes) {
 		if (m.transform >= hierarchy_transforms.size()) {
 			throw std::runtime_error("scene file '" + filename + "' contains mesh entry with invalid transform index (" + std::to_string(m.transform) + ")");
@@ -302,9 +1061,11 @@ void Scene::load(std::string const &filename,
 	}
 
 	//load any extra that a subclass wants:
-	load_extra(file, names, hierarchy_transforms);
+	MappedStreambuf extra_buf(file, at);
+	std::istream extra(&extra_buf);
+	load_extra(extra, std::vector< char >(names.begin(), names.end()), hierarchy_transforms);
 
-	if (file.peek() != EOF) {
+	if (extra.peek() != EOF) {
 		std::cerr << "WARNING: trailing data in scene file '" << filename << "'" << std::endl;
 	}
 
@@ -334,6 +1095,12 @@ void Scene::set(Scene const &other, std::unordered_map< Transform const *, Trans
 
 	transform_to_transform.clear();
 
+	cache_world_transforms = other.cache_world_transforms;
+	batch_draws = other.batch_draws;
+	frustum_cull = other.frustum_cull;
+	lod_max_error = other.lod_max_error;
+	lod_hysteresis = other.lod_hysteresis;
+
 	//null transform maps to itself:
 	transform_to_transform.insert(std::make_pair(nullptr, nullptr));
 
@@ -361,7 +1128,11 @@ void Scene::set(Scene const &other, std::unordered_map< Transform const *, Trans
 	drawables = other.drawables;
 	for (auto &d : drawables) {
 		d.transform = transform_to_transform.at(d.transform);
+		d.bvh_leaf = -1U; //(bvh will be rebuilt by the next update_bvh())
 	}
+	use_bvh = other.use_bvh;
+	bvh.clear();
+	bvh_drawables.clear();
 
 	//copy other's cameras, updating transform pointers:
 	cameras = other.cameras;
@@ -374,4 +1145,8 @@ void Scene::set(Scene const &other, std::unordered_map< Transform const *, Trans
 	for (auto &l : lights) {
 		l.transform = transform_to_transform.at(l.transform);
 	}
+
+	//rebuild (or drop) transform arrays to match other's storage:
+	// (the adapters are kept in sync by TransformHandle, so they hold other's current local transforms)
+	set_transform_storage(other.transform_storage);
 }
@@ -11,11 +11,13 @@
  */
 
 #include "GL.hpp"
+#include "BVH.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 
 #include <list>
+#include <limits>
 #include <memory>
 #include <functional>
 #include <string>
@@ -23,6 +25,9 @@
 #include <unordered_map>
 
 struct Scene {
+	struct TransformArrays;
+	struct TransformHandle;
+
 	struct Transform {
 		//Transform names are useful for debugging and looking up locations in a loaded scene:
 		std::string name;
@@ -43,17 +48,108 @@ struct Scene {
 		glm::mat4x3 make_world_from_local() const;
 		glm::mat4x3 make_local_from_world() const;
 
+		//Cached version of make_world_from_local(), as of the last Scene::update_world_from_local():
+		// (much cheaper than make_world_from_local() for deep hierarchies; only valid once update_world_from_local has run)
+		glm::mat4x3 const &world_from_local() const;
+
+		//Handle to this transform's entry in its scene's TransformArrays (only valid with TransformStorage::Arrays):
+		TransformHandle handle();
+
+		//With TransformStorage::Arrays, call after setting position / rotation / scale / parent directly,
+		// so that the next Scene::update_world_from_local() copies the change into the arrays
+		// (changes made through TransformHandle don't need this; with TransformStorage::List this does nothing):
+		void mark_changed();
+
+		//-- internals used by the cache --
+		glm::mat4x3 cached_world_from_local = glm::mat4x3(1.0f);
+		//local transform the cache was computed from (changes to these mark the transform as dirty):
+		glm::vec3 cached_position = glm::vec3(0.0f);
+		glm::quat cached_rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+		glm::vec3 cached_scale = glm::vec3(1.0f);
+		Transform *cached_parent = nullptr;
+		uint32_t cached_pass = 0; //update pass that last visited this transform (0 == never)
+		bool cached_changed = false; //did cached_world_from_local change in that pass? (used to propagate to children)
+		//with TransformStorage::Arrays, the arrays entry this transform is an adapter for:
+		TransformArrays *arrays = nullptr;
+		uint32_t array_index = -1U;
+
 		//since hierarchy is tracked through pointers, copy-constructing a transform  is not advised:
 		Transform(Transform const &) = delete;
 		//if we delete some constructors, we need to let the compiler know that the default constructor is still okay:
 		Transform() = default;
 	};
 
+	//Data-oriented storage for transforms, used with TransformStorage::Arrays:
+	// local transforms are stored as separate streams, sorted so that parents always come before their children,
+	// which means world matrices can be computed in one linear sweep over the arrays.
+	struct TransformArrays {
+		std::vector< glm::vec3 > position;
+		std::vector< glm::quat > rotation;
+		std::vector< glm::vec3 > scale;
+		std::vector< uint32_t > parent; //index of parent (always less than own index), or -1U for none
+		std::vector< glm::mat4x3 > world_from_local; //computed by update_world_from_local()
+		std::vector< Transform * > adapters; //Transform (in Scene::transforms) that stands in for each entry
+		std::vector< uint8_t > dirty; //local transform changed since the last update_world_from_local()
+		std::vector< uint8_t > changed; //world_from_local changed in the last update_world_from_local()
+		std::vector< uint32_t > changed_adapters; //entries whose adapter was changed directly (see Transform::mark_changed)
+
+		uint32_t size() const { return uint32_t(position.size()); }
+		void clear();
+
+		//append an entry for 'adapter' (copying its local transform); parent must already be in the arrays:
+		uint32_t push_back(Transform *adapter, uint32_t parent);
+
+		//recompute world matrices of dirty entries (and their descendants) from the arrays, in one sweep:
+		// (does not look at the adapters -- use this directly if all changes are made through TransformHandles)
+		void update_world_from_local();
+	};
+
+	//TransformHandle refers to an entry in TransformArrays:
+	// setters write the arrays *and* the adapter Transform, so code using either stays in sync (and mark the entry dirty).
+	struct TransformHandle {
+		TransformArrays *arrays = nullptr;
+		uint32_t index = -1U;
+
+		glm::vec3 const &position() const { return arrays->position[index]; }
+		glm::quat const &rotation() const { return arrays->rotation[index]; }
+		glm::vec3 const &scale() const { return arrays->scale[index]; }
+		void set_position(glm::vec3 const &position) const;
+		void set_rotation(glm::quat const &rotation) const;
+		void set_scale(glm::vec3 const &scale) const;
+
+		glm::mat4x3 const &world_from_local() const { return arrays->world_from_local[index]; }
+
+		//the Transform that stands in for this entry (for code that wants a Transform *):
+		Transform *transform() const { return arrays->adapters[index]; }
+	};
+
 	struct Drawable {
 		//a 'Drawable' attaches attribute data to a transform:
 		Drawable(Transform *transform_) : transform(transform_) { assert(transform); }
 		Transform * transform;
 
+		//(optional) object-space bounding box, used by draw() for frustum culling (e.g., copy from Mesh::min / Mesh::max):
+		// the default (empty) box means "never cull"
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+
+		//leaf in the scene's bvh (see Scene::update_bvh), or -1U if not in it:
+		uint32_t bvh_leaf = -1U;
+
+		//(optional) coarser levels of detail of the mesh drawn by 'pipeline', finest first (e.g., copy from Mesh::lods):
+		// draw() uses the coarsest level whose error, projected to the screen, is under Scene::lod_max_error
+		// (needs min / max, since errors are relative to the bounding box)
+		struct LOD {
+			GLuint start = 0; //replaces pipeline.start
+			GLuint count = 0; //replaces pipeline.count
+			GLint base_vertex = 0; //replaces pipeline.base_vertex
+			glm::vec3 position_offset = glm::vec3(0.0f); //replaces pipeline.position_offset
+			glm::vec3 position_scale = glm::vec3(1.0f); //replaces pipeline.position_scale
+			float error = 0.0f; //distance from the full-detail surface, relative to half the bounding box's diagonal
+		};
+		std::vector< LOD > lods;
+		mutable uint32_t lod = 0; //level used by the last draw(): 0 for pipeline itself, i for lods[i-1]
+
 		//Contains all the data needed to run the OpenGL pipeline:
 		struct Pipeline {
 			GLuint program = 0; //shader program; passed to glUseProgram
@@ -65,6 +161,15 @@ struct Scene {
 			GLuint start = 0; //first vertex to draw; passed to glDrawArrays
 			GLuint count = 0; //number of vertices to draw; passed to glDrawArrays
 
+			//indexed drawing (uses the vao's element array buffer; start and count are then in indices):
+			GLenum index_type = GL_NONE; //GL_NONE for glDrawArrays, otherwise passed to glDrawElementsBaseVertex
+			GLint base_vertex = 0; //passed to glDrawElementsBaseVertex
+
+			//position dequantization (see MeshBuffer::Quantized): object-space position = position_offset + position_scale * Position.xyz
+			// draw() folds this into CLIP_FROM_OBJECT and LIGHT_FROM_OBJECT (but not LIGHT_FROM_NORMAL)
+			glm::vec3 position_offset = glm::vec3(0.0f);
+			glm::vec3 position_scale = glm::vec3(1.0f);
+
 			//uniforms:
 			GLuint CLIP_FROM_OBJECT_mat4 = -1U; //uniform location for object to clip space matrix
 			GLuint LIGHT_FROM_OBJECT_mat4x3 = -1U; //uniform location for object to light space (== world space) matrix
@@ -72,6 +177,17 @@ struct Scene {
 
 			std::function< void() > set_uniforms; //(optional) function to set any other useful uniforms
 
+			//(optional) instanced variant of 'program', used by draw() when batching to draw drawables that share
+			// program, vao, type, start, count, and textures (and have no set_uniforms) with one call:
+			struct Instanced {
+				GLuint program = 0; //shader program; 0 means "don't instance"
+				GLuint WORLD_FROM_OBJECT_mat4x3 = -1U; //attribute location (four consecutive vec3 columns) for per-instance object to world matrix
+				GLuint LIGHT_FROM_NORMAL_mat3 = -1U; //attribute location (three consecutive vec3 columns) for per-instance normal to light space matrix
+				GLuint CLIP_FROM_WORLD_mat4 = -1U; //uniform location for world to clip space matrix
+				GLuint LIGHT_FROM_WORLD_mat4x3 = -1U; //uniform location for world to light space matrix
+				GLuint OBJECT_FROM_POSITION_mat4x3 = -1U; //uniform location for position dequantization matrix (quantized meshes aren't instanced without it)
+			} instanced;
+
 			//texture objects to bind for the first TextureCount textures:
 			enum : uint32_t { TextureCount = 4 };
 			struct TextureInfo {
@@ -122,12 +238,91 @@ struct Scene {
 	std::list< Camera > cameras;
 	std::list< Light > lights;
 
+	//Opt-in caching of world transforms:
+	// with cache_world_transforms set, draw() uses Transform::world_from_local() instead of recomputing
+	// each drawable's parent chain; call update_world_from_local() once per frame, after moving things and before drawing.
+	bool cache_world_transforms = false;
+
+	//update cached world transforms; only transforms whose local transform (or parent) changed,
+	// or whose parent's world transform changed, are recomputed:
+	// (with TransformStorage::Arrays, gathers local transforms from adapters marked with Transform::mark_changed(),
+	//  then recomputes dirty entries in one sweep over the arrays)
+	void update_world_from_local();
+
+	//How transforms are stored:
+	// List -- each Transform in 'transforms' holds its own local transform (the default)
+	// Arrays -- local and world transforms live in 'transform_arrays'; the Transforms in 'transforms' stay
+	//   around as adapters, so Drawables, Cameras, Lights, and other code holding Transform * keep working.
+	// Switching to Arrays implies cache_world_transforms.
+	// In Arrays mode, change transforms through TransformHandle, or set an adapter's fields and call its mark_changed()
+	//  (update_world_from_local() doesn't walk 'transforms' looking for changes).
+	//  Transforms added to 'transforms', or re-parented (and marked changed), are picked up by the next update_world_from_local();
+	//  if you erase transforms, call set_transform_storage(Arrays) again before the next update.
+	enum class TransformStorage : uint8_t { List, Arrays };
+	TransformStorage transform_storage = TransformStorage::List;
+	TransformArrays transform_arrays;
+	void set_transform_storage(TransformStorage storage);
+
+	//copy local transforms (and check parents) of adapters marked changed into 'transform_arrays':
+	// (called by update_world_from_local(); rebuilds the arrays if the hierarchy changed)
+	void gather_transform_arrays();
+
 	//The "draw" function provides a convenient way to pass all the things in a scene to OpenGL:
 	void draw(Camera const &camera) const;
 
 	//..sometimes, you want to draw with a custom projection matrix and/or light space:
 	void draw(glm::mat4 const &clip_from_world, glm::mat4x3 const &light_from_world = glm::mat4x3(1.0f)) const;
 
+	//Opt-in render queue: with batch_draws set, draw() sorts drawables by (program, vao, textures)
+	// and skips program/vertex array/texture changes that wouldn't change anything.
+	// Runs of drawables that draw the same vertices with the same state are drawn with glDrawArraysInstanced (or glDrawElementsInstancedBaseVertex)
+	//  if their pipeline has an instanced program (see Pipeline::instanced).
+	// n.b. this changes the order drawables are drawn in, and leaves textures bound between drawables;
+	//  set_uniforms callbacks must not change program, vertex array, or texture bindings.
+	bool batch_draws = false;
+
+	//Opt-in frustum culling: with frustum_cull set, draw() skips drawables whose bounding box (transformed to world space)
+	// is outside the view frustum given by clip_from_world, before making any GL calls:
+	bool frustum_cull = false;
+
+	//Level-of-detail selection for drawables with lods:
+	// draw() picks the coarsest level whose error would be at most lod_max_error (as a fraction of viewport height) on screen,
+	// but only changes level once the error is lod_hysteresis (as a fraction) past that, so objects don't flicker between levels.
+	float lod_max_error = 0.001f;
+	float lod_hysteresis = 0.2f;
+
+	//Opt-in spatial index over drawables: with use_bvh set, update_bvh() keeps 'bvh' in sync with the
+	// world-space bounds of drawables (those that have bounds), and draw() (with frustum_cull) and pick() use it.
+	bool use_bvh = false;
+	BVH bvh; //(items are indices into bvh_drawables)
+	std::vector< Drawable * > bvh_drawables;
+
+	//add new drawables to the bvh and refit moved ones; call after each update_world_from_local(), before draw() / pick():
+	// (with cache_world_transforms, only drawables whose transform changed in the last update are refit)
+	// rebuilds the tree from scratch if drawables were removed
+	void update_bvh();
+
+	//closest drawable whose (world-space) bounding box is hit by a ray; nullptr if none:
+	// (with use_bvh, only drawables in the bvh as of the last update_bvh() are considered)
+	// if 'distance' is given, it is set to the distance (in units of 'direction') to the box
+	Drawable const *pick(glm::vec3 const &origin, glm::vec3 const &direction, float *distance = nullptr) const;
+
+	//What the last draw() call sent to OpenGL:
+	struct DrawStats {
+		uint32_t culled = 0; //drawables skipped by frustum culling
+		float cull_time = 0.0f; //time (seconds) spent culling
+		uint32_t drawables = 0; //drawables drawn
+		uint32_t draw_calls = 0; //glDrawArrays + glDrawElements* + glDrawArraysInstanced calls
+		uint32_t instanced_drawables = 0; //drawables drawn as part of an instanced draw call
+		uint32_t gl_calls = 0; //all GL calls made by draw() (not counting set_uniforms callbacks)
+		uint32_t program_changes = 0; //glUseProgram calls
+		uint32_t vao_changes = 0; //glBindVertexArray calls
+		uint32_t texture_changes = 0; //glBindTexture calls
+		uint32_t lod_reduced = 0; //drawables drawn at a coarser level of detail
+		uint32_t vertices = 0; //vertices (or indices) drawn, over all instances
+	};
+	mutable DrawStats draw_stats;
+
 	//add transforms/objects/cameras from a scene file to this scene:
 	// the 'on_drawable' callback gives your code a chance to look up mesh data and make Drawables:
 	// throws on file format errors
@@ -151,3 +346,20 @@ struct Scene {
 	//... as a set() function that optionally returns the transform->transform mapping:
 	void set(Scene const &, std::unordered_map< Transform const *, Transform * > *transform_map = nullptr);
 };
+
+//-------------------------
+
+inline glm::mat4x3 const &Scene::Transform::world_from_local() const {
+	if (arrays) return arrays->world_from_local[array_index];
+	assert(cached_pass != 0);
+	return cached_world_from_local;
+}
+
+inline Scene::TransformHandle Scene::Transform::handle() {
+	assert(arrays);
+	return TransformHandle{ arrays, array_index };
+}
+
+inline void Scene::Transform::mark_changed() {
+	if (arrays) arrays->changed_adapters.emplace_back(array_index);
+}
@@ -4,6 +4,10 @@
 #include <iostream>
 
 ShowSceneMode::ShowSceneMode(Scene const &scene_) : scene(scene_) {
+	scene.cache_world_transforms = true;
+	scene.batch_draws = true;
+	scene.frustum_cull = true;
+	scene.use_bvh = true;
 
 	//Set up camera-only scene:
 	{ //create a single camera:
@@ -61,6 +65,34 @@ bool ShowSceneMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_
 			return true;
 		}
 	}
+	//'B' toggles batched drawing, 'C' toggles frustum culling, 'S' toggles stats display:
+	if (evt.type == SDL_EVENT_KEY_DOWN && evt.key.repeat == 0) {
+		if (evt.key.key == SDLK_B) {
+			scene.batch_draws = !scene.batch_draws;
+			return true;
+		}
+		if (evt.key.key == SDLK_C) {
+			scene.frustum_cull = !scene.frustum_cull;
+			return true;
+		}
+		if (evt.key.key == SDLK_S) {
+			show_stats = !show_stats;
+			return true;
+		}
+	}
+	//right click: pick the drawable under the mouse
+	if (evt.type == SDL_EVENT_MOUSE_BUTTON_DOWN && evt.button.button == SDL_BUTTON_RIGHT) {
+		glm::vec2 ndc = glm::vec2(
+			evt.button.x / float(window_size.x) * 2.0f - 1.0f,
+			1.0f - evt.button.y / float(window_size.y) * 2.0f
+		);
+		glm::mat4 world_from_clip = glm::inverse(scene_camera->make_projection() * glm::mat4(scene_camera->transform->make_local_from_world()));
+		glm::vec4 at = world_from_clip * glm::vec4(ndc, 0.0f, 1.0f); //(some point under the mouse)
+		glm::vec3 origin = scene_camera->transform->make_world_from_local()[3];
+		Scene::Drawable const *drawable = scene.pick(origin, glm::vec3(at) / at.w - origin);
+		picked = (drawable ? drawable->transform->name : "");
+		return true;
+	}
 	//mouse wheel: dolly
 	if (evt.type == SDL_EVENT_MOUSE_WHEEL) {
 		camera.radius *= std::pow(0.5f, 0.1f * evt.wheel.y);
@@ -84,6 +116,9 @@ void ShowSceneMode::draw(glm::uvec2 const &drawable_size) {
 	scene_camera->aspect = float(drawable_size.x) / float(drawable_size.y);
 
 
+	scene.update_world_from_local();
+	scene.update_bvh();
+
 	//--- actual drawing ---
 	glClearColor(0.5f, 0.5f, 0.5f, 0.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -96,7 +131,7 @@ void ShowSceneMode::draw(glm::uvec2 const &drawable_size) {
 	{ //decorate with some lines:
 		DrawLines draw_lines(scene_camera->make_projection() * glm::mat4(scene_camera->transform->make_local_from_world()));
 		for (auto &transform : scene.transforms) {
-			glm::mat4 world_from_local = transform.make_world_from_local();
+			glm::mat4 world_from_local = transform.world_from_local();
 			auto xf = [&world_from_local](glm::vec3 const &vec) {
 				return glm::vec3(world_from_local * glm::vec4(vec, 1.0f));
 			};
@@ -106,7 +141,7 @@ void ShowSceneMode::draw(glm::uvec2 const &drawable_size) {
 
 			if (transform.parent) {
 				//connect to parent:
-				glm::vec3 p = glm::vec3(transform.parent->make_world_from_local()[3]);
+				glm::vec3 p = glm::vec3(transform.parent->world_from_local()[3]);
 				draw_lines.draw(p, xf(glm::vec3(0.0f)), glm::u8vec4(0xff, 0xff, 0x00, 0xff));
 			}
 
@@ -136,4 +171,42 @@ void ShowSceneMode::draw(glm::uvec2 const &drawable_size) {
 		*/
 	}
 
+	if (show_stats) { //draw stats in the upper left:
+		Scene::DrawStats const &stats = scene.draw_stats;
+		float aspect = float(drawable_size.x) / float(drawable_size.y);
+		DrawLines draw_lines(glm::mat4(
+			1.0f / aspect, 0.0f, 0.0f, 0.0f,
+			0.0f, 1.0f, 0.0f, 0.0f,
+			0.0f, 0.0f, 1.0f, 0.0f,
+			0.0f, 0.0f, 0.0f, 1.0f
+		));
+		glDisable(GL_DEPTH_TEST);
+		constexpr float H = 0.06f;
+		std::string text = std::string(scene.batch_draws ? "batched" : "unbatched")
+			+ ": " + std::to_string(stats.drawables) + " drawables (" + std::to_string(stats.instanced_drawables) + " instanced), "
+			+ std::to_string(stats.draw_calls) + " draws, " + std::to_string(stats.gl_calls) + " GL calls"
+			+ " (" + std::to_string(stats.program_changes) + " program, " + std::to_string(stats.vao_changes) + " vao, " + std::to_string(stats.texture_changes) + " texture)";
+		draw_lines.draw_text(text,
+			glm::vec3(-aspect + 0.5f * H, 1.0f - 1.5f * H, 0.0f),
+			glm::vec3(H, 0.0f, 0.0f), glm::vec3(0.0f, H, 0.0f),
+			glm::u8vec4(0xff, 0xff, 0xff, 0xff)
+		);
+		std::string cull_text = (scene.frustum_cull
+			? "culling: " + std::to_string(stats.drawables) + " visible, " + std::to_string(stats.culled) + " culled in " + std::to_string(int32_t(stats.cull_time * 1e6f)) + " us"
+			: std::string("culling: off")
+		);
+		draw_lines.draw_text(cull_text,
+			glm::vec3(-aspect + 0.5f * H, 1.0f - 3.0f * H, 0.0f),
+			glm::vec3(H, 0.0f, 0.0f), glm::vec3(0.0f, H, 0.0f),
+			glm::u8vec4(0xff, 0xff, 0xff, 0xff)
+		);
+		if (picked != "") {
+			draw_lines.draw_text("picked: '" + picked + "'",
+				glm::vec3(-aspect + 0.5f * H, 1.0f - 4.5f * H, 0.0f),
+				glm::vec3(H, 0.0f, 0.0f), glm::vec3(0.0f, H, 0.0f),
+				glm::u8vec4(0xff, 0xff, 0x00, 0xff)
+			);
+		}
+	}
+
 }
@@ -27,8 +27,14 @@ struct ShowSceneMode : Mode {
 		bool flip_x = false; //flip x inputs when moving? (used to handle situations where camera is upside-down)
 	} camera;
 
-	//Scene being viewed:
-	Scene const &scene;
+	//Scene being viewed (a copy, so it can cache world transforms):
+	Scene scene;
+
+	//show Scene::draw_stats in the corner? ('S' toggles; 'B' toggles scene.batch_draws, 'C' toggles scene.frustum_cull)
+	bool show_stats = true;
+
+	//name of the transform of the drawable last picked with a right click:
+	std::string picked;
 
 	//mode uses a secondary Scene to hold a camera:
 	Scene camera_scene;
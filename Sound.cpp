@@ -1,10 +1,18 @@
 #include "Sound.hpp"
+#include "SPSCQueue.hpp"
+#include "mix_kernels.hpp"
+#include "resample.hpp"
+#include "hrtf.hpp"
+#include "OpusStream.hpp"
 #include "load_wav.hpp"
 #include "load_opus.hpp"
+#include "pcm_cache.hpp"
 
 #include <SDL3/SDL.h>
 
-#include <list>
+#include <array>
+#include <deque>
+#include <chrono>
 #include <cassert>
 #include <exception>
 #include <iostream>
@@ -19,11 +27,229 @@ namespace {
 	//The audio device:
 	SDL_AudioStream *stream = nullptr;
 
-	//list of all currently playing samples:
-	std::list< std::shared_ptr< Sound::PlayingSample > > playing_samples;
+	//...or, in offline mode (see Sound::init_offline), no device and the game thread calls Sound::render():
+	bool offline = false;
+
+	//(set by init before the callback starts) buffering options, and the device buffer size SDL picked:
+	Sound::InitOptions options;
+	uint32_t device_frames = 0;
+
+	//(allocated by init before the callback starts; audio callback only) interleaved stereo the callback mixes into,
+	// room for a device block plus 'queue_blocks' more -- callbacks that need more mix it in several pieces:
+	std::vector< float > mix_buffer;
+
+	//Gains are what the control stage (Sound::update, on the game thread) works out for each voice at the end of
+	// every frame, and what the audio callback interpolates toward as it mixes:
+	struct Gains {
+		float l = 0.0f, r = 0.0f; //left and right gains (global * voice volume * distance attenuation * panning * presence)
+		float scale = 0.0f; //global * voice volume * distance attenuation * presence (binaural voices use this instead of l and r)
+		float rate = 1.0f; //playback rate
+		float presence = 1.0f; //0 (virtual) to 1 (real); see Sound::set_audibility_threshold
+		glm::vec3 direction = glm::vec3(0.0f, 1.0f, 0.0f); //(binaural voices) toward the voice, in listener space
+	};
+
+	//Voices are the audio callback's view of playing samples:
+	struct Voice {
+		bool active = false; //is voice in the active list?
+		Sound::Sample const *sample = nullptr; //sample being played (its 'voices' count includes this voice)
+		float const *data = nullptr; //sample data being played
+		uint32_t size = 0; //length of sample data
+		uint32_t i = 0; //next data value to read
+		uint32_t frac = 0; //...plus this many 2^-32nds of a value (when not playing at 1:1)
+		OpusStream *stream = nullptr; //...or stream being played (instead of data)
+		uint32_t serial = 0; //which OpusStream::restart() this voice is playing
+		uint32_t generation = 0; //matches PlayingSample::generation of the handle controlling this voice
+		bool loop = false; //should playback loop after data runs out?
+		std::chrono::steady_clock::time_point played_at; //when play() was called, until the voice is first mixed
+
+		Gains gains; //as of the end of the last mixed block
+
+		//3D voices using the binaural spatializer convolve with these HRIRs (in convolvers[] at the same index as the voice):
+		HrirSet const *hrirs = nullptr;
+		//...and once their sound is done, play out what's left in the convolver before finishing:
+		bool draining = false;
+		uint32_t tail = 0; //frames left to play out
+
+		uint32_t silent_frames = 0; //frames mixed at zero presence (binaural voices play out their convolver before being skipped)
+	};
+
+	//(audio callback only) the voice pool; voices[active[0 .. active_count-1]] are playing:
+	std::array< Voice, Sound::MaxVoices > voices;
+	std::array< uint32_t, Sound::MaxVoices > active;
+	uint32_t active_count = 0;
+
+	//(audio callback only) convolution state for binaurally-spatialized voices (see Voice::hrirs):
+	std::array< HrtfConvolver, Sound::MaxVoices > convolvers;
+
+	//(game thread only) what the game thread knows about each voice, including the parameters the control stage works from:
+	struct VoiceInfo {
+		uint32_t generation = 0; //bumped every time the voice is (re-)used
+		bool playing = false; //false once the audio callback reports the voice finished
+		int32_t priority = 0;
+		uint64_t serial = 0; //when the voice was started (larger == more recently)
+		bool stopping = false; //is playing stopping? (the callback finishes the voice once its volume reaches zero)
+
+		Sound::Ramp< float > volume = Sound::Ramp< float >(1.0f);
+		Sound::Ramp< float > rate = Sound::Ramp< float >(1.0f); //playback rate (1.0f == unresampled; always 1.0f for streams)
+
+		//2D playback panning control: ('NaN' if sound played in 3D mode)
+		Sound::Ramp< float > pan = Sound::Ramp< float >(std::numeric_limits< float >::quiet_NaN());
+
+		//3D playback panning control: ('NaN' if sound played in 2D mode)
+		Sound::Ramp< glm::vec3 > position = Sound::Ramp< glm::vec3 >(std::numeric_limits< float >::quiet_NaN());
+		Sound::Ramp< float > half_volume_radius = Sound::Ramp< float >(std::numeric_limits< float >::quiet_NaN());
+		bool binaural = false; //(3D voices) spatialized through HRIRs, so the callback needs directions
+
+		//virtualization (see Sound::set_audibility_threshold):
+		bool real = true; //being mixed (or fading in) rather than virtual (or fading out)
+		Sound::Ramp< float > presence = Sound::Ramp< float >(1.0f); //fades voices in and out of being mixed
+	};
+	std::array< VoiceInfo, Sound::MaxVoices > voice_infos;
+
+	//(game thread only) loudness of each voice as of the last control stage, for StealPolicy::Quietest:
+	std::array< float, Sound::MaxVoices > voice_levels{};
+	std::vector< uint32_t > free_voices = [](){ //voices available without stealing
+		std::vector< uint32_t > ret;
+		ret.reserve(Sound::MaxVoices);
+		for (uint32_t v = Sound::MaxVoices; v > 0; --v) ret.emplace_back(v - 1);
+		return ret;
+	}();
+	uint64_t next_serial = 0;
+	Sound::StealPolicy steal_policy = Sound::StealPolicy::Quietest;
+
+	//(game thread) resampling filter quality:
+	Sound::ResampleQuality resample_quality = Sound::ResampleQuality::Good;
+	//(game thread => audio callback) the filter for 'resample_quality' (nullptr == linear interpolation):
+	std::atomic< ResampleFilter const * > resample_filter{nullptr};
+
+	//(game thread) virtualization settings:
+	float audibility_threshold = 1e-4f;
+	uint32_t max_real_voices = Sound::MaxVoices;
+	//(voices fade in and out of being mixed over this long, in seconds)
+	constexpr float VirtualFade = 0.01f;
+	//(virtual voices must get this much louder than the threshold to become real again, so voices near it don't flicker)
+	constexpr float VirtualHysteresis = 1.5f;
+
+	//(game thread) spatializer for newly-started 3D voices, and its HRIR set (nullptr == panning):
+	Sound::Spatializer spatializer = Sound::Spatializer::Panner;
+	HrirSet const *spatializer_hrirs = nullptr;
+
+	//(game thread) the control stage's scratch space: gains of the voices in control_list, in structure-of-arrays
+	// form so they can be computed with SIMD kernels; voice control_list[k] uses slot control_slot[k]:
+	struct GainBlock {
+		std::array< float, Sound::MaxVoices > x, y, z, half_radius; //(3D voices) position
+		std::array< float, Sound::MaxVoices > amount; //pan amount from -1 (left) to 1 (right)
+		std::array< float, Sound::MaxVoices > scale; //volume (global * voice * distance attenuation)
+		std::array< float, Sound::MaxVoices > l, r; //resulting gains
+	};
+	GainBlock control_gains;
+	std::array< uint32_t, Sound::MaxVoices > control_list;
+	std::array< uint32_t, Sound::MaxVoices > control_slot;
+
+	//Gain frames carry the control stage's results (game thread => audio callback): every playing voice's gains as of
+	// the end of a game frame, which the callback reaches 'frames' frames of audio after picking the gain frame up.
+	// (structure-of-arrays, indexed by voice; entries only apply to the use of the voice with a matching generation)
+	struct GainFrame {
+		uint32_t frames = 0;
+		std::array< uint32_t, Sound::MaxVoices > generation{}; //(0 == no entry)
+		std::array< float, Sound::MaxVoices > l, r, scale, rate, presence; //(as per Gains)
+		std::array< float, Sound::MaxVoices > x, y, z; //Gains::direction
+		std::array< bool, Sound::MaxVoices > stopped; //volume has reached zero after stop(), so finish once there
+	};
+	//...triple-buffered, so neither thread waits: the game thread fills the 'back' frame and swaps it with 'ready';
+	// the callback swaps 'ready' with its 'front' frame at the start of a block if a newer one has been published:
+	std::array< GainFrame, 3 > gain_frames;
+	constexpr uint32_t NewGainFrame = 0x4; //(flag in gain_frame_ready: not yet picked up by the callback)
+	std::atomic< uint32_t > gain_frame_ready{1};
+	uint32_t gain_frame_back = 2; //(game thread only)
+	uint32_t gain_frame_front = 0; //(audio callback only)
+	uint32_t gain_frame_played = 0; //(audio callback only) frames mixed since picking up the front frame
+
+	//Commands are how the game thread asks the audio callback to start voices:
+	// (everything else about a playing voice is passed along in gain frames)
+	struct Command {
+		enum Type : uint8_t {
+			None,
+			Play, //(re-)start voice playing data[0 .. size-1] (or stream) with gains
+			Play3D, //(re-)start voice playing data[0 .. size-1] (or stream) with gains, spatialized with hrirs (if not null)
+		} type = None;
+		bool loop = false;
+		uint32_t voice = 0;
+		uint32_t generation = 0;
+		Sound::Sample const *sample = nullptr; //(Play/Play3D hold a count in sample->voices)
+		float const *data = nullptr;
+		uint32_t size = 0;
+		OpusStream *stream = nullptr;
+		uint32_t serial = 0; //(filled in by start_voice for streams)
+		HrirSet const *hrirs = nullptr; //(filled in by start_voice for Play3D)
+		std::chrono::steady_clock::time_point played_at; //(filled in by start_voice, for measuring latency)
+		Gains gains; //(filled in by start_voice) until the next gain frame
+		//parameters for the game thread's side of the voice (see VoiceInfo):
+		glm::vec3 position = glm::vec3(0.0f);
+		float volume = 1.0f;
+		float pan = 0.0f; //(Play)
+		float half_volume_radius = 0.0f; //(Play3D)
+		float rate = 1.0f;
+	};
+
+	//commands travel game thread => audio callback through this queue:
+	SPSCQueue< Command > commands(16384);
+
+	//if the queue is full, commands wait here (on the game thread) rather than blocking:
+	std::deque< Command > deferred_commands;
+
+	//finished voices travel audio callback => game thread through this queue:
+	struct Finished {
+		uint32_t voice = 0;
+		uint32_t generation = 0;
+	};
+	//(each start of a voice finishes at most once, so this can never fill)
+	SPSCQueue< Finished > finished_voices(2 * Sound::MaxVoices);
+
+	//bookkeeping for Sound::get_stats():
+	struct {
+		std::atomic< uint64_t > callbacks{0};
+		std::atomic< uint64_t > late_callbacks{0};
+		std::atomic< uint64_t > commands{0};
+		std::atomic< uint64_t > deferred_commands{0};
+		std::atomic< float > max_callback_gap{0.0f};
+		std::atomic< float > max_mix_time{0.0f};
+		std::atomic< double > total_mix_time{0.0};
+		std::atomic< uint32_t > active_voices{0};
+		std::atomic< uint32_t > real_voices{0};
+		std::atomic< uint32_t > virtual_voices{0};
+		std::atomic< uint64_t > stolen_voices{0};
+		std::atomic< uint64_t > dropped_voices{0};
+		std::atomic< uint64_t > stream_underruns{0};
+		std::atomic< uint32_t > queued_frames{0};
+		std::atomic< uint32_t > max_queued_frames{0};
+		std::array< std::atomic< uint64_t >, Sound::Stats::MixTimeBuckets.size() > mix_time_histogram{};
+		std::atomic< uint64_t > play_latency_count{0};
+		std::atomic< double > total_play_latency{0.0};
+		std::atomic< float > max_play_latency{0.0f};
+		std::atomic< float > last_play_latency{0.0f};
+	} stats;
 
 }
 
+//These helpers (defined below) move commands between threads:
+void submit(Command &&command);
+void flush_deferred_commands();
+void apply_commands();
+//...and these manage the voice pool:
+Sound::PlayingSample start_voice(Command &&command, int32_t priority);
+void collect_finished_voices();
+void release_sample(Voice &voice);
+VoiceInfo *voice_info(uint32_t voice, uint32_t generation);
+void stop_voice(VoiceInfo &info, float ramp);
+//...and these handle playback rates:
+float clamp_rate(float rate);
+//...and this is the control stage (run by Sound::update), with helpers also used to give new voices their first gains:
+void control_stage(float elapsed);
+void compute_gains(uint32_t count);
+Gains control_result(uint32_t k, glm::mat3 const &space);
+glm::mat3 listener_space(glm::vec3 const &right, glm::vec3 const &up);
+
 //public-facing data:
 
 //global volume control:
@@ -34,25 +260,65 @@ Sound::Listener Sound::listener;
 
 //This audio-mixing callback is defined below:
 void mix_audio(void *, SDL_AudioStream *stream, int additional_amount, int total_amount);
+//...and does most of its work in this helper (also used by Sound::render):
+void mix_block(float *out, uint32_t samples, float ahead);
+void record_mix_time(std::chrono::steady_clock::time_point mix_start);
 
 //------------------------ public-facing --------------------------------
 
 Sound::Sample::Sample(std::string const &filename) {
-	if (filename.size() >= 4 && filename.substr(filename.size()-4) == ".wav") {
-		load_wav(filename, &data);
-	} else if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".opus") {
-		load_opus(filename, &data);
-	} else {
+	bool is_wav = (filename.size() >= 4 && filename.substr(filename.size()-4) == ".wav");
+	bool is_opus = (filename.size() >= 5 && filename.substr(filename.size()-5) == ".opus");
+	if (!is_wav && !is_opus) {
 		throw std::runtime_error("Sample '" + filename + "' doesn't end in either \".wav\" or \".opus\" -- unsure how to load.");
 	}
+
+	//already decoded on an earlier run?
+	mapped = pcm_cache_load(filename, &data);
+	if (mapped) return;
+
+	//(only cache audio that took work to get: wav files already in the mixer's format would just be copied)
+	bool converted = true;
+	if (is_wav) {
+		load_wav(filename, &storage, &converted);
+	} else {
+		load_opus(filename, &storage);
+	}
+	data = std::span< float const >(storage);
+
+	if (converted) pcm_cache_save(filename, storage);
+}
+
+Sound::Sample::Sample(std::vector< float > const &data_) : data(), storage(data_) {
+	data = std::span< float const >(storage);
+}
+
+Sound::Sample::~Sample() {
+}
+
+Sound::StreamingSample::StreamingSample(std::string const &filename) {
+	if (!(filename.size() >= 5 && filename.substr(filename.size()-5) == ".opus")) {
+		throw std::runtime_error("StreamingSample '" + filename + "' doesn't end in \".opus\" -- only opus files can be streamed.");
+	}
+	stream = std::make_unique< OpusStream >(filename);
 }
 
-Sound::Sample::Sample(std::vector< float > const &data_) : data(data_) {
+Sound::StreamingSample::~StreamingSample() {
 }
 
 
 
-void Sound::init() {
+void Sound::init(InitOptions const &options_) {
+	//(builds the filter tables now, rather than when the first voice needs them)
+	set_resample_quality(resample_quality);
+	set_spatializer(spatializer);
+
+	options = options_;
+	if (options.block_frames != 0) {
+		//(must be set before the device opens)
+		SDL_SetHint(SDL_HINT_AUDIO_DEVICE_SAMPLE_FRAMES, std::to_string(options.block_frames).c_str());
+	}
+
 	if (!SDL_InitSubSystem(SDL_INIT_AUDIO)) {
 		std::cerr << "Failed to initialize SDL audio subsytem:\n" << SDL_GetError() << std::endl;
 		std::cerr << "  (Will continue without audio.)\n" << std::endl;
@@ -66,22 +332,87 @@ void Sound::init() {
 		std::cerr << "Failed to open audio device:\n" << SDL_GetError() << std::endl;
 		std::cerr << "  (Will continue without audio.)\n" << std::endl;
 	} else {
+		SDL_AudioSpec device_spec;
+		int frames = 0;
+		if (SDL_GetAudioDeviceFormat(SDL_GetAudioStreamDevice(stream), &device_spec, &frames) && frames > 0) {
+			device_frames = uint32_t(frames);
+		}
+		uint32_t block = (device_frames ? device_frames : (options.block_frames ? options.block_frames : 1024));
+		mix_buffer.assign(2 * size_t(block) * (size_t(options.queue_blocks) + 1), 0.0f);
 		//start audio playback:
 		SDL_ResumeAudioStreamDevice(stream);
-		std::cout << "Audio output initialized." << std::endl;
+		std::cout << "Audio output initialized";
+		if (device_frames) std::cout << " (" << device_frames << "-frame device buffer, " << options.queue_blocks << " blocks queued)";
+		std::cout << "." << std::endl;
 	}
 }
 
 
+void Sound::init_offline() {
+	assert(stream == nullptr && "init_offline() is instead of init(), not as well");
+	set_resample_quality(resample_quality);
+	set_spatializer(spatializer);
+	offline = true;
+}
+
+void Sound::render(float *out, uint32_t frames) {
+	assert(offline && "render() is only for offline mode");
+	if (frames == 0) return;
+	auto mix_start = std::chrono::steady_clock::now();
+	mix_block(out, frames, -1.0f);
+	record_mix_time(mix_start);
+}
+
 void Sound::shutdown() {
 	if (stream != nullptr) {
 		//stop audio playback:
 		SDL_DestroyAudioStream(stream);
 		stream = nullptr;
 	}
+	mix_buffer = std::vector< float >();
+	offline = false;
+	//the callback won't run again, so apply anything still queued...
+	while (true) {
+		apply_commands();
+		if (deferred_commands.empty()) break;
+		flush_deferred_commands();
+	}
+	//...and let go of every voice's sample:
+	for (uint32_t a = 0; a < active_count; ++a) {
+		release_sample(voices[active[a]]);
+		voices[active[a]].active = false;
+	}
+	active_count = 0;
+
+	//reset the voice pool, so that a later init() / init_offline() starts from scratch:
+	// (generations keep counting up, so handles from before still do nothing)
+	Finished finished;
+	while (finished_voices.pop(&finished)) { }
+	free_voices.clear();
+	for (uint32_t v = Sound::MaxVoices; v > 0; --v) {
+		voice_infos[v - 1].playing = false;
+		voices[v - 1] = Voice();
+		voice_levels[v - 1] = 0.0f;
+		free_voices.emplace_back(v - 1);
+	}
+	for (GainFrame &frame : gain_frames) {
+		frame.generation.fill(0);
+	}
+	Sound::volume = Sound::Ramp< float >(1.0f);
+	Sound::listener = Sound::Listener();
 }
 
 
+void Sound::flush() {
+	flush_deferred_commands();
+	collect_finished_voices();
+}
+
+void Sound::update(float elapsed) {
+	flush();
+	control_stage(std::max(0.0f, elapsed));
+}
+
 void Sound::lock() {
 	if (stream) SDL_LockAudioStream(stream);
 }
@@ -90,102 +421,152 @@ void Sound::unlock() {
 	if (stream) SDL_UnlockAudioStream(stream);
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::play(Sample const &sample, float play_volume, float pan) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, play_volume, pan, false);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+Sound::Stats Sound::get_stats() {
+	Stats ret;
+	ret.callbacks = stats.callbacks.load(std::memory_order_relaxed);
+	ret.late_callbacks = stats.late_callbacks.load(std::memory_order_relaxed);
+	ret.commands = stats.commands.load(std::memory_order_relaxed);
+	ret.deferred_commands = stats.deferred_commands.load(std::memory_order_relaxed);
+	ret.max_callback_gap = stats.max_callback_gap.load(std::memory_order_relaxed);
+	ret.max_mix_time = stats.max_mix_time.load(std::memory_order_relaxed);
+	ret.total_mix_time = stats.total_mix_time.load(std::memory_order_relaxed);
+	ret.active_voices = stats.active_voices.load(std::memory_order_relaxed);
+	ret.real_voices = stats.real_voices.load(std::memory_order_relaxed);
+	ret.virtual_voices = stats.virtual_voices.load(std::memory_order_relaxed);
+	ret.stolen_voices = stats.stolen_voices.load(std::memory_order_relaxed);
+	ret.dropped_voices = stats.dropped_voices.load(std::memory_order_relaxed);
+	ret.stream_underruns = stats.stream_underruns.load(std::memory_order_relaxed);
+	ret.block_frames = device_frames;
+	ret.queued_frames = stats.queued_frames.load(std::memory_order_relaxed);
+	ret.max_queued_frames = stats.max_queued_frames.load(std::memory_order_relaxed);
+	for (uint32_t b = 0; b < ret.mix_time_histogram.size(); ++b) {
+		ret.mix_time_histogram[b] = stats.mix_time_histogram[b].load(std::memory_order_relaxed);
+	}
+	ret.play_latency_count = stats.play_latency_count.load(std::memory_order_relaxed);
+	ret.total_play_latency = stats.total_play_latency.load(std::memory_order_relaxed);
+	ret.max_play_latency = stats.max_play_latency.load(std::memory_order_relaxed);
+	ret.last_play_latency = stats.last_play_latency.load(std::memory_order_relaxed);
+	return ret;
+}
+
+Sound::PlayingSample Sound::play(Sample const &sample, float play_volume, float pan, int32_t priority, float rate) {
+	return start_voice(Command{ .type = Command::Play, .loop = false, .sample = &sample, .data = sample.data.data(), .size = uint32_t(sample.data.size()), .volume = play_volume, .pan = pan, .rate = clamp_rate(rate) }, priority);
+}
+
+Sound::PlayingSample Sound::play_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius, int32_t priority, float rate) {
+	return start_voice(Command{ .type = Command::Play3D, .loop = false, .sample = &sample, .data = sample.data.data(), .size = uint32_t(sample.data.size()), .position = position, .volume = play_volume, .half_volume_radius = half_volume_radius, .rate = clamp_rate(rate) }, priority);
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::play_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, play_volume, position, half_volume_radius, false);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+Sound::PlayingSample Sound::loop(Sample const &sample, float play_volume, float pan, int32_t priority, float rate) {
+	return start_voice(Command{ .type = Command::Play, .loop = true, .sample = &sample, .data = sample.data.data(), .size = uint32_t(sample.data.size()), .volume = play_volume, .pan = pan, .rate = clamp_rate(rate) }, priority);
+}
+
+
+
+Sound::PlayingSample Sound::loop_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius, int32_t priority, float rate) {
+	return start_voice(Command{ .type = Command::Play3D, .loop = true, .sample = &sample, .data = sample.data.data(), .size = uint32_t(sample.data.size()), .position = position, .volume = play_volume, .half_volume_radius = half_volume_radius, .rate = clamp_rate(rate) }, priority);
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::loop(Sample const &sample, float play_volume, float pan) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, play_volume, pan, true);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+
+Sound::PlayingSample Sound::play(StreamingSample &sample, float play_volume, float pan, int32_t priority) {
+	return start_voice(Command{ .type = Command::Play, .loop = false, .stream = sample.stream.get(), .volume = play_volume, .pan = pan }, priority);
 }
 
+Sound::PlayingSample Sound::play_3D(StreamingSample &sample, float play_volume, glm::vec3 const &position, float half_volume_radius, int32_t priority) {
+	return start_voice(Command{ .type = Command::Play3D, .loop = false, .stream = sample.stream.get(), .position = position, .volume = play_volume, .half_volume_radius = half_volume_radius }, priority);
+}
 
+Sound::PlayingSample Sound::loop(StreamingSample &sample, float play_volume, float pan, int32_t priority) {
+	return start_voice(Command{ .type = Command::Play, .loop = true, .stream = sample.stream.get(), .volume = play_volume, .pan = pan }, priority);
+}
 
-std::shared_ptr< Sound::PlayingSample > Sound::loop_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, play_volume, position, half_volume_radius, true);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+Sound::PlayingSample Sound::loop_3D(StreamingSample &sample, float play_volume, glm::vec3 const &position, float half_volume_radius, int32_t priority) {
+	return start_voice(Command{ .type = Command::Play3D, .loop = true, .stream = sample.stream.get(), .position = position, .volume = play_volume, .half_volume_radius = half_volume_radius }, priority);
 }
 
 
 void Sound::stop_all_samples() {
-	lock();
-	for (auto &s : playing_samples) {
-		s->stop();
+	for (uint32_t v = 0; v < MaxVoices; ++v) {
+		if (voice_infos[v].playing) stop_voice(voice_infos[v], 1.0f / 60.0f);
 	}
-	unlock();
 }
 
 void Sound::set_volume(float new_volume, float ramp) {
-	lock();
-	volume.set(new_volume, ramp);
-	unlock();
+	Sound::volume.set(new_volume, ramp);
+}
+
+void Sound::set_steal_policy(StealPolicy policy) {
+	steal_policy = policy;
+}
+
+void Sound::set_resample_quality(ResampleQuality quality) {
+	resample_quality = quality;
+	resample_filter.store(ResampleFilter::for_quality(quality), std::memory_order_release);
+}
+
+void Sound::set_audibility_threshold(float gain) {
+	audibility_threshold = std::max(0.0f, gain);
+}
+
+void Sound::set_max_real_voices(uint32_t count) {
+	max_real_voices = std::min(count, MaxVoices);
+}
+
+void Sound::set_spatializer(Spatializer spatializer_) {
+	spatializer = spatializer_;
+	//(the set is passed along with each Play3D command, so the callback never sees a half-built one)
+	spatializer_hrirs = HrirSet::for_spatializer(spatializer);
 }
 
 //------------------
 
 void Sound::PlayingSample::set_volume(float new_volume, float ramp) {
-	Sound::lock();
-	if (!stopping) {
-		volume.set(new_volume, ramp);
-	}
-	Sound::unlock();
+	VoiceInfo *info = voice_info(voice, generation);
+	if (!info || info->stopping) return;
+	info->volume.set(new_volume, ramp);
 }
 
 void Sound::PlayingSample::set_pan(float new_pan, float ramp) {
-	if (!(pan.value == pan.value)) return; //ignore if not in '2D' mode
-	Sound::lock();
-	pan.set(new_pan, ramp);
-	Sound::unlock();
+	VoiceInfo *info = voice_info(voice, generation);
+	if (!info || !(info->pan.value == info->pan.value)) return; //ignore if not in '2D' mode
+	info->pan.set(new_pan, ramp);
 }
 
 void Sound::PlayingSample::set_position(glm::vec3 const &new_position, float ramp) {
-	if (pan.value == pan.value) return; //ignore if not in '3D' mode
-	Sound::lock();
-	position.set(new_position, ramp);
-	Sound::unlock();
+	VoiceInfo *info = voice_info(voice, generation);
+	if (!info || info->pan.value == info->pan.value) return; //ignore if not in '3D' mode
+	info->position.set(new_position, ramp);
 }
 
 void Sound::PlayingSample::set_half_volume_radius(float new_radius, float ramp) {
-	if (pan.value == pan.value) return; //ignore if not in '3D' mode
-	Sound::lock();
-	half_volume_radius.set(new_radius, ramp);
-	Sound::unlock();
+	VoiceInfo *info = voice_info(voice, generation);
+	if (!info || info->pan.value == info->pan.value) return; //ignore if not in '3D' mode
+	info->half_volume_radius.set(new_radius, ramp);
+}
+
+void Sound::PlayingSample::set_rate(float new_rate, float ramp) {
+	VoiceInfo *info = voice_info(voice, generation);
+	if (!info) return;
+	info->rate.set(clamp_rate(new_rate), ramp);
 }
 
 void Sound::PlayingSample::stop(float ramp) {
-	Sound::lock();
-	if (!(stopping || stopped)) {
-		stopping = true;
-		volume.target = 0.0f;
-		volume.ramp = ramp;
-	} else {
-		volume.ramp = std::min(volume.ramp, ramp);
-	}
-	Sound::unlock();
+	VoiceInfo *info = voice_info(voice, generation);
+	if (!info) return;
+	stop_voice(*info, ramp);
+}
+
+bool Sound::PlayingSample::playing() const {
+	if (generation == 0) return false;
+	assert(voice < MaxVoices);
+	flush_deferred_commands();
+	collect_finished_voices();
+	return voice_infos[voice].generation == generation && voice_infos[voice].playing;
 }
 
 //------------------
 
 void Sound::Listener::set_position_right(glm::vec3 const &new_position, glm::vec3 const &new_right, float ramp) {
-	Sound::lock();
 	position.set(new_position, ramp);
 	//some extra code to make sure right is always a unit vector:
 	if (new_right == glm::vec3(0.0f)) {
@@ -193,55 +574,403 @@ void Sound::Listener::set_position_right(glm::vec3 const &new_position, glm::vec
 	} else {
 		right.set(glm::normalize(new_right), ramp);
 	}
-	Sound::unlock();
+}
+
+void Sound::Listener::set_position_right_up(glm::vec3 const &new_position, glm::vec3 const &new_right, glm::vec3 const &new_up, float ramp) {
+	set_position_right(new_position, new_right, ramp);
+	if (new_up == glm::vec3(0.0f)) {
+		up.set(glm::vec3(0.0f, 0.0f, 1.0f), ramp);
+	} else {
+		up.set(glm::normalize(new_up), ramp);
+	}
 }
 
 //------------------------ internals --------------------------------
 
+//helper: (game thread) pass a command to the audio callback without blocking:
+void submit(Command &&command) {
+	//keep order: anything deferred earlier must go first.
+	flush_deferred_commands();
+	if (!deferred_commands.empty() || !commands.push(std::move(command))) {
+		stats.deferred_commands.fetch_add(1, std::memory_order_relaxed);
+		deferred_commands.emplace_back(std::move(command));
+	}
+
+	//with no audio device there is no callback to drain the queue, so do it here:
+	// (unless offline, where Sound::render() drains it at the start of each block, as the callback would)
+	if (!stream && !offline) apply_commands();
+}
+
+//helper: (game thread) move commands held back by a full queue into the queue, as far as they fit:
+// (called by submit(), and every frame by Sound::flush(), so a burst's last few commands don't wait for the next one)
+void flush_deferred_commands() {
+	while (!deferred_commands.empty()) {
+		if (!commands.push(std::move(deferred_commands.front()))) break;
+		deferred_commands.pop_front();
+	}
+}
+
+//helper: (game thread) mark voices the audio callback has finished with as free:
+void collect_finished_voices() {
+	Finished finished;
+	while (finished_voices.pop(&finished)) {
+		VoiceInfo &info = voice_infos[finished.voice];
+		//(a voice that was stolen after it finished will have a newer generation)
+		if (info.generation == finished.generation && info.playing) {
+			info.playing = false;
+			free_voices.emplace_back(finished.voice);
+		}
+	}
+}
+
+//helper: (game thread) pick a voice for a Play/Play3D command and send it:
+Sound::PlayingSample start_voice(Command &&command, int32_t priority) {
+	assert(command.type == Command::Play || command.type == Command::Play3D);
+	if (command.stream == nullptr && command.size == 0) return Sound::PlayingSample(); //nothing to play
+
+	collect_finished_voices();
+
+	uint32_t voice = -1U;
+	if (!free_voices.empty()) {
+		voice = free_voices.back();
+		free_voices.pop_back();
+	} else {
+		//every voice is busy, so steal one:
+		float best_level = std::numeric_limits< float >::infinity();
+		for (uint32_t v = 0; v < Sound::MaxVoices; ++v) {
+			VoiceInfo const &info = voice_infos[v];
+			assert(info.playing);
+			if (voice == -1U) {
+				voice = v;
+			} else if (steal_policy == Sound::StealPolicy::Quietest) {
+				float level = voice_levels[v];
+				if (level < best_level || (level == best_level && info.serial < voice_infos[voice].serial)) voice = v;
+			} else if (steal_policy == Sound::StealPolicy::LowestPriority) {
+				VoiceInfo const &best = voice_infos[voice];
+				if (info.priority < best.priority || (info.priority == best.priority && info.serial < best.serial)) voice = v;
+			} else { //StealPolicy::Oldest
+				if (info.serial < voice_infos[voice].serial) voice = v;
+			}
+			if (voice == v) best_level = voice_levels[v];
+		}
+		assert(voice < Sound::MaxVoices);
+		if (steal_policy == Sound::StealPolicy::LowestPriority && voice_infos[voice].priority > priority) {
+			//everything playing is more important than the new sample:
+			stats.dropped_voices.fetch_add(1, std::memory_order_relaxed);
+			return Sound::PlayingSample();
+		}
+		stats.stolen_voices.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	VoiceInfo &info = voice_infos[voice];
+	info.generation += 1;
+	if (info.generation == 0) info.generation = 1; //(0 is reserved for "no voice")
+	info.playing = true;
+	info.priority = priority;
+	info.serial = next_serial++;
+	//a just-started voice shouldn't look quiet before the control stage has run for it:
+	voice_levels[voice] = std::numeric_limits< float >::infinity();
+
+	if (command.stream) {
+		//(restarting the stream finishes any voice that was already playing it)
+		command.stream->loop = command.loop;
+		command.serial = command.stream->restart();
+	}
 
-//helper: equal-power panning
-inline void compute_pan_weights(float pan, float *left, float *right) {
-	//clamp pan to -1 to 1 range:
-	pan = std::max(-1.0f, std::min(1.0f, pan));
-
-	//want left^2 + right^2 = 1.0, so use angles:
-	float ang = 0.5f * 3.1415926f * (0.5f * (pan + 1.0f));
-	*left = std::cos(ang);
-	*right = std::sin(ang);
-}
-
-//helper: 3D audio panning
-void compute_pan_from_listener_and_position(
-	glm::vec3 const &listener_position,
-	glm::vec3 const &listener_right,
-	glm::vec3 const &source_position,
-	float source_half_radius,
-	float *left, float *right
-	) {
-	glm::vec3 to = source_position - listener_position;
-	float distance = glm::length(to);
-	//start by panning based on direction.
-	//note that for a LR fade to sound uniform, sound power (squared magnitude) should remain constant.
-	if (distance == 0.0f) {
-		*left = *right = std::sqrt(2.0f);
+	if (command.type == Command::Play3D) command.hrirs = spatializer_hrirs;
+
+	//the game thread's side of the voice:
+	info.stopping = false;
+	info.volume = Sound::Ramp< float >(command.volume);
+	info.rate = Sound::Ramp< float >(command.rate);
+	if (command.type == Command::Play) {
+		info.pan = Sound::Ramp< float >(command.pan);
+		info.position = Sound::Ramp< glm::vec3 >(std::numeric_limits< float >::quiet_NaN());
+		info.half_volume_radius = Sound::Ramp< float >(std::numeric_limits< float >::quiet_NaN());
 	} else {
-		//amt ranges from -1 (most left) to 1 (most right):
-		float amt = glm::dot(listener_right, to) / distance;
-		//turn into an angle from 0.0f (most left) to pi/2 (most right):
-		float ang = 0.5f * 3.1415926f * (0.5f * (amt + 1.0f));
-		*left = std::cos(ang);
-		*right = std::sin(ang);
+		info.pan = Sound::Ramp< float >(std::numeric_limits< float >::quiet_NaN());
+		info.position = Sound::Ramp< glm::vec3 >(command.position);
+		info.half_volume_radius = Sound::Ramp< float >(command.half_volume_radius);
+	}
+	info.binaural = (command.hrirs != nullptr);
+
+	//...and its gains until the next gain frame (starting real or virtual without a fade -- the cap on real voices applies from the next control stage):
+	info.real = true;
+	info.presence = Sound::Ramp< float >(1.0f);
+	control_list[0] = voice;
+	compute_gains(1);
+	glm::mat3 space = listener_space(Sound::listener.right.value, Sound::listener.up.value);
+	command.gains = control_result(0, space);
+	if (std::max(command.gains.l, command.gains.r) < audibility_threshold) {
+		info.real = false;
+		info.presence = Sound::Ramp< float >(0.0f);
+		command.gains = control_result(0, space);
+	}
 
-		//squared distance attenuation is realistic if there are no walls,
-		// but I'm going to use linear because it's sounds better to me.
-		// (feel free to change it, of course)
-		//want att = 0.5f at distance == half_volume_radius
-		float att = 1.0f / (1.0f + (distance / source_half_radius));
-		*left *= att;
-		*right *= att;
+	command.voice = voice;
+	command.generation = info.generation;
+	command.played_at = std::chrono::steady_clock::now();
+	//the sample is in use from now until the audio callback lets go of it:
+	if (command.sample) command.sample->voices.fetch_add(1, std::memory_order_relaxed);
+	submit(std::move(command));
+
+	Sound::PlayingSample ret;
+	ret.voice = voice;
+	ret.generation = info.generation;
+	return ret;
+}
+
+//helper: (game thread) keep playback rates to what the resampler handles:
+float clamp_rate(float rate) {
+	if (!(rate == rate)) return 1.0f; //(NaN)
+	return std::max(MinResampleRate, std::min(MaxResampleRate, rate));
+}
+
+//helper: (audio callback) let go of the sample a voice was playing (so it may be freed):
+void release_sample(Voice &voice) {
+	if (voice.sample) {
+		//(release, so that once the count reads zero this thread is done reading the data)
+		voice.sample->voices.fetch_sub(1, std::memory_order_release);
+		voice.sample = nullptr;
 	}
 }
 
+//helper: (game thread) the voice a PlayingSample handle refers to, or nullptr if it has finished or been stolen:
+VoiceInfo *voice_info(uint32_t voice, uint32_t generation) {
+	if (generation == 0) return nullptr;
+	assert(voice < Sound::MaxVoices);
+	VoiceInfo &info = voice_infos[voice];
+	if (info.generation != generation || !info.playing) return nullptr;
+	return &info;
+}
+
+//helper: (game thread) stop a voice by fading it out over 'ramp' seconds:
+void stop_voice(VoiceInfo &info, float ramp) {
+	if (!info.stopping) {
+		info.stopping = true;
+		info.volume.set(0.0f, ramp);
+	} else {
+		info.volume.ramp = std::min(info.volume.ramp, ramp);
+		if (info.volume.ramp <= 0.0f) info.volume.set(0.0f, 0.0f);
+	}
+}
+
+//helper: (audio callback) apply every queued command:
+void apply_commands() {
+	Command command;
+	while (commands.pop(&command)) {
+		stats.commands.fetch_add(1, std::memory_order_relaxed);
+		if (command.type != Command::Play && command.type != Command::Play3D) continue;
+		Voice &voice = voices[command.voice];
+		//if the voice was stolen it is already in the active list; otherwise add it:
+		if (!voice.active) {
+			assert(active_count < Sound::MaxVoices);
+			active[active_count++] = command.voice;
+		} else {
+			release_sample(voice);
+		}
+		voice = Voice();
+		voice.active = true;
+		voice.sample = command.sample;
+		voice.data = command.data;
+		voice.size = command.size;
+		voice.stream = command.stream;
+		voice.serial = command.serial;
+		voice.generation = command.generation;
+		voice.loop = command.loop;
+		voice.played_at = command.played_at;
+		voice.gains = command.gains;
+		voice.hrirs = command.hrirs;
+		if (voice.hrirs) convolvers[command.voice].reset();
+		//(nothing in a binaural voice's convolver yet, so a voice starting virtual needn't play it out)
+		if (voice.gains.presence == 0.0f) voice.silent_frames = -1U;
+	}
+}
+
+//helper: (audio callback) mix 'count' frames from a stream into interleaved stereo 'dst'
+// (gains as per mix_span); returns false once the stream has finished:
+bool mix_stream(float *dst, uint32_t count, OpusStream &stream, uint32_t serial, float l, float r, float dl, float dr) {
+	if (stream.finished(serial)) return false;
+	//(until the decoder has started on this serial, the voice is silent)
+	if (!stream.sync(serial)) return true;
+
+	uint32_t mixed = 0;
+	while (mixed < count) {
+		float const *data = nullptr;
+		uint32_t span = std::min(count - mixed, stream.readable(&data));
+		if (span == 0) break;
+		float fm = float(mixed);
+		mix_span(dst + 2 * mixed, data, span, l + fm * dl, r + fm * dr, dl, dr);
+		stream.consume(span);
+		mixed += span;
+	}
+	if (mixed < count && !stream.finished(serial)) {
+		//decoder didn't keep up; the rest of this block is silent:
+		stats.stream_underruns.fetch_add(1, std::memory_order_relaxed);
+	}
+	return true;
+}
+
+//helper: (audio callback) mix 'count' frames from a voice playing at 'rate' (changing by 'drate' per frame)
+// into interleaved stereo 'dst' (gains as per mix_span); returns the number of frames mixed, which is
+// fewer than 'count' if a non-looping sample ends:
+uint32_t mix_resampled(float *dst, uint32_t count, Voice &voice, float rate, float drate, ResampleFilter const *filter, float l, float r, float dl, float dr) {
+	//(resampled into a small buffer, a piece at a time, then mixed like any other span)
+	std::array< float, 256 > resampled;
+	uint32_t mixed = 0;
+	while (mixed < count) {
+		uint32_t chunk = std::min(count - mixed, uint32_t(resampled.size()));
+		float fm = float(mixed);
+		uint32_t got = resample(resampled.data(), chunk,
+			voice.data, voice.size, &voice.i, &voice.frac, voice.loop,
+			rate + fm * drate, drate, filter);
+		mix_span(dst + 2 * mixed, resampled.data(), got, l + fm * dl, r + fm * dr, dl, dr);
+		mixed += got;
+		if (got < chunk) break;
+	}
+	return mixed;
+}
+
+//helper: (audio callback) read up to 'count' frames of a voice's (mono) audio into 'out', playing at 'rate' (changing by 'drate' per frame);
+// returns the number of frames read, which is fewer than 'count' once a non-looping sample or a stream ends:
+uint32_t read_voice(float *out, uint32_t count, Voice &voice, float rate, float drate, ResampleFilter const *filter) {
+	if (voice.stream) {
+		OpusStream &stream = *voice.stream;
+		if (stream.finished(voice.serial)) return 0;
+		uint32_t got = 0;
+		//(until the decoder has started on this serial, the voice is silent)
+		if (stream.sync(voice.serial)) {
+			while (got < count) {
+				float const *data = nullptr;
+				uint32_t span = std::min(count - got, stream.readable(&data));
+				if (span == 0) break;
+				std::copy(data, data + span, out + got);
+				stream.consume(span);
+				got += span;
+			}
+			if (got < count && !stream.finished(voice.serial)) {
+				//decoder didn't keep up; the rest of this block is silent:
+				stats.stream_underruns.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		if (got < count && !stream.finished(voice.serial)) {
+			std::fill(out + got, out + count, 0.0f);
+			got = count;
+		}
+		return got;
+	}
+
+	if (voice.i >= voice.size) return 0;
+	if (rate != 1.0f || drate != 0.0f || voice.frac != 0) {
+		return resample(out, count, voice.data, voice.size, &voice.i, &voice.frac, voice.loop, rate, drate, filter);
+	}
+	//copy in contiguous spans (split wherever the sample wraps or ends):
+	uint32_t got = 0;
+	while (got < count) {
+		uint32_t span = std::min(count - got, voice.size - voice.i);
+		std::copy(voice.data + voice.i, voice.data + voice.i + span, out + got);
+		got += span;
+		voice.i += span;
+		if (voice.i == voice.size) {
+			if (!voice.loop) break;
+			voice.i = 0;
+		}
+	}
+	return got;
+}
+
+//helper: (audio callback) mix 'count' frames of a 3D voice through its HRIRs into interleaved stereo 'dst',
+// with volume going from 'scale' by 'dscale' per frame, and direction (in listener space) going from 'from' to 'to';
+// returns false once the voice's sample or stream has run out (or if it was already draining):
+bool mix_binaural(float *dst, uint32_t count, Voice &voice, HrtfConvolver &convolver, float rate, float drate, ResampleFilter const *filter,
+	float scale, float dscale, glm::vec3 const &from, glm::vec3 const &to) {
+	assert(voice.hrirs);
+	//(gathered into a small buffer, a piece at a time)
+	std::array< float, 256 > mono;
+	bool more = !voice.draining;
+	uint32_t mixed = 0;
+	while (mixed < count) {
+		uint32_t chunk = std::min(count - mixed, uint32_t(mono.size()));
+		float fm = float(mixed);
+		uint32_t got = 0;
+		if (more) {
+			got = read_voice(mono.data(), chunk, voice, rate + fm * drate, drate, filter);
+			if (got < chunk) more = false;
+		}
+		for (uint32_t k = 0; k < got; ++k) {
+			mono[k] *= scale + (fm + float(k)) * dscale;
+		}
+		//(once the sound is done, the convolver still has output for the silence after it)
+		std::fill(mono.begin() + got, mono.begin() + chunk, 0.0f);
+
+		float t0 = fm / float(count);
+		float t1 = (fm + float(chunk)) / float(count);
+		convolver.process(dst + 2 * mixed, mono.data(), chunk, *voice.hrirs, glm::mix(from, to, t0), glm::mix(from, to, t1));
+		mixed += chunk;
+	}
+	return more;
+}
+
+//helper: (audio callback) advance a virtual voice by 'count' frames without mixing it, playing at 'rate' (changing by 'drate' per frame);
+// returns false once the voice's sample or stream has run out (or if it was already draining):
+bool skip_voice(Voice &voice, uint32_t count, float rate, float drate) {
+	if (voice.draining) return false;
+	if (voice.stream) {
+		OpusStream &stream = *voice.stream;
+		if (stream.finished(voice.serial)) return false;
+		//(the decoder keeps going, so the stream stays in time)
+		if (stream.sync(voice.serial)) {
+			uint32_t skipped = 0;
+			while (skipped < count) {
+				float const *data = nullptr;
+				uint32_t span = std::min(count - skipped, stream.readable(&data));
+				if (span == 0) break;
+				stream.consume(span);
+				skipped += span;
+			}
+		}
+		return true;
+	}
+
+	assert(voice.i < voice.size);
+	//advance in the same 32.32 fixed point resample() uses, by the distance a linearly-changing rate covers:
+	uint64_t const end = uint64_t(voice.size) << 32;
+	uint64_t position = (uint64_t(voice.i) << 32) | voice.frac;
+	double distance = double(count) * double(rate) + 0.5 * double(count) * double(count - 1) * double(drate);
+	position += uint64_t(std::max(0.0, distance) * 4294967296.0);
+	if (position >= end) {
+		if (!voice.loop) {
+			voice.i = voice.size;
+			voice.frac = 0;
+			return false;
+		}
+		position %= end;
+	}
+	voice.i = uint32_t(position >> 32);
+	voice.frac = uint32_t(position);
+	return true;
+}
+
+//helper: (game thread) matrix taking world-space offsets to listener space (x right, y forward, z up):
+glm::mat3 listener_space(glm::vec3 const &right, glm::vec3 const &up_) {
+	glm::vec3 up = up_ - right * glm::dot(up_, right);
+	if (glm::dot(up, up) < 1e-6f) {
+		//'up' is (nearly) along 'right', so any perpendicular will do:
+		up = glm::cross(right, std::abs(right.z) < 0.9f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f));
+		up = glm::cross(up, right);
+	}
+	up = glm::normalize(up);
+	glm::vec3 forward = glm::cross(up, right);
+	return glm::transpose(glm::mat3(right, forward, up));
+}
+
+//helper: (audio callback) keep a running maximum in an atomic:
+void update_max(std::atomic< float > &max, float value) {
+	float old = max.load(std::memory_order_relaxed);
+	while (value > old && !max.compare_exchange_weak(old, value, std::memory_order_relaxed)) { }
+}
+
+
 //helper: ramp updates...
 
 //helper: ...for single values:
@@ -300,24 +1029,255 @@ void step_direction_ramp(float step, Sound::Ramp< glm::vec3 > &ramp) {
 }
 
 
+//------------------------ control stage --------------------------------
+// (runs on the game thread, in Sound::update(); the audio callback only interpolates what it produces)
+
+//helper: (game thread) work out the gains of voices control_list[0 .. count-1] from their parameters' current values, into control_gains:
+// (3D voices take slots from the front of the gain arrays and 2D voices from the back, so that spatialize() can run over just the 3D ones)
+void compute_gains(uint32_t count) {
+	float volume = Sound::volume.value;
+	glm::vec3 position = Sound::listener.position.value;
+	glm::vec3 right = Sound::listener.right.value;
+
+	uint32_t count_3D = 0;
+	uint32_t first_2D = count;
+	for (uint32_t k = 0; k < count; ++k) {
+		VoiceInfo const &info = voice_infos[control_list[k]];
+		bool is_3D = !(info.pan.value == info.pan.value);
+		uint32_t s = (is_3D ? count_3D++ : --first_2D);
+		control_slot[k] = s;
+
+		if (is_3D) {
+			control_gains.x[s] = info.position.value.x;
+			control_gains.y[s] = info.position.value.y;
+			control_gains.z[s] = info.position.value.z;
+			control_gains.half_radius[s] = info.half_volume_radius.value;
+		} else {
+			control_gains.amount[s] = info.pan.value;
+		}
+		control_gains.scale[s] = volume * info.volume.value;
+	}
+	assert(count_3D == first_2D);
+
+	//3D panning is by direction, with volume falling off with distance:
+	// squared distance attenuation is realistic if there are no walls,
+	// but I'm going to use linear because it's sounds better to me.
+	// (feel free to change it, of course -- see spatialize() in mix_kernels.cpp)
+	// attenuation = 0.5f at distance == half_volume_radius
+	spatialize(control_gains.x.data(), control_gains.y.data(), control_gains.z.data(), control_gains.half_radius.data(),
+		&position.x, &right.x, control_gains.amount.data(), control_gains.scale.data(), count_3D);
+
+	//...and all voices are panned with equal power (left^2 + right^2 constant):
+	pan_gains(control_gains.amount.data(), control_gains.scale.data(), control_gains.l.data(), control_gains.r.data(), count);
+}
+
+//helper: (game thread) the Gains of voice control_list[k] as computed by compute_gains(), with its presence applied;
+// 'space' is listener_space() for the listener's current orientation:
+Gains control_result(uint32_t k, glm::mat3 const &space) {
+	VoiceInfo const &info = voice_infos[control_list[k]];
+	uint32_t s = control_slot[k];
+	float presence = info.presence.value;
+
+	Gains gains;
+	gains.l = control_gains.l[s] * presence;
+	gains.r = control_gains.r[s] * presence;
+	gains.scale = control_gains.scale[s] * presence;
+	gains.rate = info.rate.value;
+	gains.presence = presence;
+	if (info.binaural) gains.direction = space * (info.position.value - Sound::listener.position.value);
+	return gains;
+}
+
+//helper: (game thread) step every ramp by 'elapsed' seconds, work out every playing voice's gains, and publish them in a gain frame:
+void control_stage(float elapsed) {
+	step_value_ramp(elapsed, Sound::volume);
+	step_position_ramp(elapsed, Sound::listener.position);
+	step_direction_ramp(elapsed, Sound::listener.right);
+	step_direction_ramp(elapsed, Sound::listener.up);
+
+	uint32_t count = 0;
+	for (uint32_t v = 0; v < Sound::MaxVoices; ++v) {
+		VoiceInfo &info = voice_infos[v];
+		if (!info.playing) continue;
+		control_list[count++] = v;
+
+		step_value_ramp(elapsed, info.volume);
+		step_value_ramp(elapsed, info.rate);
+		if (info.pan.value == info.pan.value) {
+			step_value_ramp(elapsed, info.pan);
+		} else {
+			step_position_ramp(elapsed, info.position);
+			step_value_ramp(elapsed, info.half_volume_radius);
+		}
+	}
+
+	compute_gains(count);
+
+	//Virtualization: voices that are too quiet to hear -- or beyond the cap on real voices -- fade out and are then
+	// skipped by the callback (though their play position still advances); they fade back in once they are loud enough again:
+	{
+		float threshold = audibility_threshold * VirtualHysteresis;
+
+		//voices loud enough to be real, ranked by loudness (real voices get the benefit of the hysteresis):
+		std::array< float, Sound::MaxVoices > loudness;
+		std::array< uint32_t, Sound::MaxVoices > audible;
+		std::array< bool, Sound::MaxVoices > real;
+		uint32_t audible_count = 0;
+		for (uint32_t k = 0; k < count; ++k) {
+			uint32_t s = control_slot[k];
+			loudness[k] = std::max(control_gains.l[s], control_gains.r[s]) * (voice_infos[control_list[k]].real ? VirtualHysteresis : 1.0f);
+			real[k] = false;
+			if (loudness[k] >= threshold) audible[audible_count++] = k;
+		}
+		if (audible_count > max_real_voices) {
+			std::nth_element(audible.begin(), audible.begin() + max_real_voices, audible.begin() + audible_count, [&loudness](uint32_t a, uint32_t b) {
+				return loudness[a] > loudness[b];
+			});
+			audible_count = max_real_voices;
+		}
+		for (uint32_t i = 0; i < audible_count; ++i) {
+			real[audible[i]] = true;
+		}
+
+		for (uint32_t k = 0; k < count; ++k) {
+			VoiceInfo &info = voice_infos[control_list[k]];
+			if (real[k] != info.real) {
+				info.presence.set(real[k] ? 1.0f : 0.0f, VirtualFade);
+				info.real = real[k];
+			}
+			step_value_ramp(elapsed, info.presence);
+		}
+	}
+
+	//fill in the back gain frame...
+	glm::mat3 space = listener_space(Sound::listener.right.value, Sound::listener.up.value);
+	GainFrame &frame = gain_frames[gain_frame_back];
+	frame.frames = uint32_t(std::lround(elapsed * float(AUDIO_RATE)));
+	frame.generation.fill(0);
+	for (uint32_t k = 0; k < count; ++k) {
+		uint32_t v = control_list[k];
+		VoiceInfo const &info = voice_infos[v];
+		Gains gains = control_result(k, space);
+		frame.generation[v] = info.generation;
+		frame.l[v] = gains.l;
+		frame.r[v] = gains.r;
+		frame.scale[v] = gains.scale;
+		frame.rate[v] = gains.rate;
+		frame.presence[v] = gains.presence;
+		frame.x[v] = gains.direction.x;
+		frame.y[v] = gains.direction.y;
+		frame.z[v] = gains.direction.z;
+		frame.stopped[v] = (info.stopping && info.volume.value == 0.0f);
+		voice_levels[v] = std::max(gains.l, gains.r);
+	}
+
+	//...and publish it (getting back whichever frame the callback isn't using):
+	gain_frame_back = gain_frame_ready.exchange(gain_frame_back | NewGainFrame, std::memory_order_acq_rel) & ~NewGainFrame;
+}
+
+
+//------------------------ audio callback --------------------------------
+
 //The audio callback -- invoked by SDL when it needs more sound to play:
 void SDLCALL mix_audio(void *, SDL_AudioStream *stream_, int additional_amount, int total_amount) {
 	if (total_amount <= 0) return;
 	assert(stream_ == stream && "callback should only be used with our main stream");
 
+	//check timing against the previous callback:
+	auto mix_start = std::chrono::steady_clock::now();
+	static auto previous_start = mix_start;
+	static float previous_buffered = std::numeric_limits< float >::infinity(); //seconds of audio the device had to play after the previous callback
+	{
+		float gap = std::chrono::duration< float >(mix_start - previous_start).count();
+		//late if the audio buffered last time -- what the device took plus what stayed queued -- would have already run out
+		// (plus a little slack for scheduling jitter):
+		if (gap > previous_buffered + 0.002f) {
+			stats.late_callbacks.fetch_add(1, std::memory_order_relaxed);
+		}
+		update_max(stats.max_callback_gap, gap);
+		previous_start = mix_start;
+	}
+
+	constexpr uint32_t FrameBytes = 2 * sizeof(float);
+	uint32_t samples;
+	uint32_t queued = uint32_t(std::max(0, SDL_GetAudioStreamQueued(stream))) / FrameBytes; //mixed, but not yet taken by the device
+	uint32_t requested = uint32_t(total_amount) / FrameBytes; //what the device will take once this callback returns
+	if (options.block_frames == 0 && options.queue_blocks == 0) {
+		samples = requested;
+	} else {
+		//mix what the device needs now, plus enough to keep 'queue_blocks' blocks queued after it takes its share:
+		uint32_t block = (device_frames ? device_frames : std::max(1u, options.block_frames));
+		uint32_t target = requested + options.queue_blocks * block;
+		samples = (target > queued ? target - queued : 0);
+		samples = std::max(samples, uint32_t(std::max(0, additional_amount)) / FrameBytes);
+		//(in whole blocks, so the per-callback cost stays even)
+		samples = (samples + block - 1) / block * block;
+		if (samples == 0) {
+			previous_buffered = queued / float(AUDIO_RATE);
+			return;
+		}
+	}
+
+	//audio that will play before this block does: (estimated; the device's own buffer is one block)
+	float ahead = float(queued + device_frames) / float(AUDIO_RATE);
+
+	//mix into the buffer init() allocated, as many times as it takes to fill the request:
+	uint32_t const capacity = uint32_t(mix_buffer.size() / 2);
+	for (uint32_t done = 0; done < samples; ) {
+		uint32_t count = std::min(capacity, samples - done);
+		mix_block(mix_buffer.data(), count, ahead + done / float(AUDIO_RATE));
+		SDL_PutAudioStreamData(stream, mix_buffer.data(), int(count * FrameBytes));
+		done += count;
+	}
+
+	//what stays queued after the device takes its share:
+	uint32_t left = (queued + samples > requested ? queued + samples - requested : 0);
+	stats.queued_frames.store(left, std::memory_order_relaxed);
+	if (left > stats.max_queued_frames.load(std::memory_order_relaxed)) stats.max_queued_frames.store(left, std::memory_order_relaxed);
+
+	previous_buffered = (queued + samples) / float(AUDIO_RATE);
+	record_mix_time(mix_start);
+}
+
+//helper: (audio callback) count a mixed block toward Sound::Stats:
+void record_mix_time(std::chrono::steady_clock::time_point mix_start) {
+	stats.callbacks.fetch_add(1, std::memory_order_relaxed);
+	float mix_time = std::chrono::duration< float >(std::chrono::steady_clock::now() - mix_start).count();
+	update_max(stats.max_mix_time, mix_time);
+	stats.total_mix_time.fetch_add(mix_time, std::memory_order_relaxed);
+	uint32_t bucket = 0;
+	while (bucket + 1 < Sound::Stats::MixTimeBuckets.size() && mix_time >= Sound::Stats::MixTimeBuckets[bucket]) ++bucket;
+	stats.mix_time_histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+//helper: (audio callback, or Sound::render in offline mode) mix the next 'samples' frames of interleaved stereo into 'out';
+// 'ahead' is how long (seconds) until this block plays, or negative if there's no device:
+void mix_block(float *out, uint32_t samples, float ahead) {
+	//start any voices the game thread has asked for:
+	apply_commands();
+
+	//latency of voices that start this block:
+	auto now = std::chrono::steady_clock::now();
+	for (uint32_t a = 0; a < active_count; ++a) {
+		Voice &voice = voices[active[a]];
+		if (voice.played_at == std::chrono::steady_clock::time_point()) continue;
+		if (ahead >= 0.0f) {
+			float latency = std::chrono::duration< float >(now - voice.played_at).count() + ahead;
+			stats.play_latency_count.fetch_add(1, std::memory_order_relaxed);
+			stats.total_play_latency.fetch_add(latency, std::memory_order_relaxed);
+			update_max(stats.max_play_latency, latency);
+			stats.last_play_latency.store(latency, std::memory_order_relaxed);
+		}
+		voice.played_at = std::chrono::steady_clock::time_point();
+	}
+
 	struct LR {
 		float l;
 		float r;
 	};
 	static_assert(sizeof(LR) == 8, "Sample is packed");
 
-	uint32_t samples = uint32_t(total_amount) / sizeof(LR);
-
-	//adapted from older code using https://github.com/libsdl-org/SDL/blob/main/docs/README-migration.md
-	int len = samples * sizeof(LR);
-	Uint8 *buffer_ = SDL_stack_alloc(Uint8, len); //this is not actually responsive to the amount of samples requested, it just mixes in blocks of MIX_SAMPLES
-
-	LR *buffer = reinterpret_cast< LR * >(buffer_);
+	LR *buffer = reinterpret_cast< LR * >(out);
 
 	//zero the output buffer:
 	for (uint32_t s = 0; s < samples; ++s) {
@@ -325,115 +1285,138 @@ void SDLCALL mix_audio(void *, SDL_AudioStream *stream_, int additional_amount,
 		buffer[s].r = 0.0f;
 	}
 
-	//update global values:
-	float start_volume = Sound::volume.value;
-	glm::vec3 start_position =  Sound::listener.position.value;
-	glm::vec3 start_right =  Sound::listener.right.value;
-
-	const float elapsed = samples / float(AUDIO_RATE);
+	ResampleFilter const *filter = resample_filter.load(std::memory_order_acquire);
 
-	step_value_ramp(elapsed, Sound::volume);
-	step_position_ramp(elapsed, Sound::listener.position);
-	step_direction_ramp(elapsed, Sound::listener.right);
-
-	float end_volume = Sound::volume.value;
-	glm::vec3 end_position =  Sound::listener.position.value;
-	glm::vec3 end_right =  Sound::listener.right.value;
-
-	//add audio from each playing sample into the buffer:
-	for (auto si = playing_samples.begin(); si != playing_samples.end(); /* later */) {
-		Sound::PlayingSample &playing_sample = **si; //much more convenient than writing ** everywhere.
-
-		//Figure out sample panning/volume at start...
-		LR start_pan;
-		if (!(playing_sample.pan.value == playing_sample.pan.value)) {
-			//3D panning
-			compute_pan_from_listener_and_position(
-				start_position, start_right,
-				playing_sample.position.value,
-				playing_sample.half_volume_radius.value,
-				&start_pan.l, &start_pan.r);
-
-			step_position_ramp(elapsed, playing_sample.position);
-			step_value_ramp(elapsed, playing_sample.half_volume_radius);
-		} else {
-			//2D panning
-			compute_pan_weights(playing_sample.pan.value, &start_pan.l, &start_pan.r);
+	//pick up the newest gain frame from the control stage, if there is one:
+	if (gain_frame_ready.load(std::memory_order_relaxed) & NewGainFrame) {
+		gain_frame_front = gain_frame_ready.exchange(gain_frame_front, std::memory_order_acq_rel) & ~NewGainFrame;
+		gain_frame_played = 0;
+	}
+	GainFrame const &frame = gain_frames[gain_frame_front];
+
+	//voices' gains move toward the frame's so as to reach them 'frame.frames' frames after it was picked up
+	// (and then hold there until the next frame arrives); 'toward' is how far this block gets:
+	uint32_t remaining = (frame.frames > gain_frame_played ? frame.frames - gain_frame_played : 0);
+	float toward = (remaining > samples ? float(samples) / float(remaining) : 1.0f);
+	gain_frame_played += std::min(remaining, samples);
+	auto approach = [toward](float from, float to) {
+		return (toward == 1.0f ? to : from + (to - from) * toward);
+	};
 
-			step_value_ramp(elapsed, playing_sample.pan);
+	//Mixing stage: add audio from each playing sample into the buffer, interpolating its gains across the block:
+	uint32_t real_count = 0;
+	uint32_t virtual_count = 0;
+	for (uint32_t a = 0; a < active_count; /* later */) {
+		Voice &playing_sample = voices[active[a]];
+		uint32_t v = active[a];
+
+		//gains at the start and end of the block:
+		Gains start = playing_sample.gains;
+		Gains end = start;
+		bool stopped = false; //(reaches zero volume after a stop by the end of this block)
+		if (frame.generation[v] == playing_sample.generation) {
+			end.l = approach(start.l, frame.l[v]);
+			end.r = approach(start.r, frame.r[v]);
+			end.scale = approach(start.scale, frame.scale[v]);
+			end.rate = approach(start.rate, frame.rate[v]);
+			end.presence = approach(start.presence, frame.presence[v]);
+			end.direction = glm::vec3(approach(start.direction.x, frame.x[v]), approach(start.direction.y, frame.y[v]), approach(start.direction.z, frame.z[v]));
+			stopped = (frame.stopped[v] && toward == 1.0f);
 		}
-		start_pan.l *= start_volume * playing_sample.volume.value;
-		start_pan.r *= start_volume * playing_sample.volume.value;
-
-		step_value_ramp(elapsed, playing_sample.volume);
-
-		//..and end of the mix period:
-		LR end_pan;
-		if (!(playing_sample.pan.value == playing_sample.pan.value)) {
-			//3D panning
-			compute_pan_from_listener_and_position(
-				end_position, end_right,
-				playing_sample.position.value,
-				playing_sample.half_volume_radius.value,
-				&end_pan.l, &end_pan.r);
-		} else {
-			//2D panning
-			compute_pan_weights(playing_sample.pan.value, &end_pan.l, &end_pan.r);
+		playing_sample.gains = end;
+
+		//virtual voices (once faded out -- and, if binaural, once their convolver has played out) aren't mixed:
+		bool silent = (start.presence == 0.0f && end.presence == 0.0f);
+		uint32_t settle = (playing_sample.hrirs ? HrtfBlock + playing_sample.hrirs->length : 0);
+		bool skip = (silent && playing_sample.silent_frames >= settle);
+		if (!silent) {
+			//(a binaural voice that has been skipped starts its convolver over)
+			if (playing_sample.hrirs && playing_sample.silent_frames >= settle && playing_sample.silent_frames > 0) convolvers[v].reset();
+			playing_sample.silent_frames = 0;
+		} else if (playing_sample.silent_frames < settle) {
+			playing_sample.silent_frames += samples;
 		}
+		if (skip) ++virtual_count;
+		else ++real_count;
+
+		//(streams always play at 1:1)
+		float start_rate = (playing_sample.stream ? 1.0f : start.rate);
+		float end_rate = (playing_sample.stream ? 1.0f : end.rate);
 
-		end_pan.l *= end_volume * playing_sample.volume.value;
-		end_pan.r *= end_volume * playing_sample.volume.value;
+		LR start_pan{ start.l, start.r };
+		LR end_pan{ end.l, end.r };
 
-		//figure out a step to add at each sample so that pan will move smoothly from start to end:
-		LR pan = start_pan;
+		//figure out pan step per sample:
 		LR pan_step;
 		pan_step.l = (end_pan.l - start_pan.l) / samples;
 		pan_step.r = (end_pan.r - start_pan.r) / samples;
 
-		assert(playing_sample.i < playing_sample.data.size());
-
-		for (uint32_t i = 0; i < samples; ++i) {
-			//mix one sample based on current pan values:
-			buffer[i].l += pan.l * playing_sample.data[playing_sample.i];
-			buffer[i].r += pan.r * playing_sample.data[playing_sample.i];
-
-			//update position in sample:
-			playing_sample.i += 1;
-			if (playing_sample.i == playing_sample.data.size()) {
-				if (playing_sample.loop) {
-					playing_sample.i = 0;
-				} else {
-					break;
-				}
+		bool ended;
+		if (skip) {
+			ended = !skip_voice(playing_sample, samples, start_rate, (end_rate - start_rate) / samples);
+		} else if (playing_sample.hrirs) {
+			//binaural voices are spatialized by convolution (so their pan gains go unused):
+			ended = !mix_binaural(&buffer[0].l, samples, playing_sample, convolvers[v],
+				start_rate, (end_rate - start_rate) / samples, filter,
+				start.scale, (end.scale - start.scale) / samples, start.direction, end.direction);
+		} else if (playing_sample.stream) {
+			ended = !mix_stream(&buffer[0].l, samples,
+				*playing_sample.stream, playing_sample.serial,
+				start_pan.l, start_pan.r, pan_step.l, pan_step.r);
+		} else {
+			assert(playing_sample.i < playing_sample.size);
+
+			if (start_rate == 1.0f && end_rate == 1.0f && playing_sample.frac == 0) {
+				//mix in contiguous spans (split wherever the sample wraps or ends):
+				mix_sample(&buffer[0].l, samples,
+					playing_sample.data, playing_sample.size, &playing_sample.i, playing_sample.loop,
+					start_pan.l, start_pan.r, pan_step.l, pan_step.r);
+			} else {
+				mix_resampled(&buffer[0].l, samples, playing_sample,
+					start_rate, (end_rate - start_rate) / samples, filter,
+					start_pan.l, start_pan.r, pan_step.l, pan_step.r);
 			}
+			ended = (playing_sample.i >= playing_sample.size);
+		}
 
-			//update pan values:
-			pan.l += pan_step.l;
-			pan.r += pan_step.r;
+		bool finished = ended || stopped;
+		if (playing_sample.hrirs && !skip) {
+			//binaural voices finish once the convolver has played out the end of the sound (skipped ones have nothing left in it):
+			if (playing_sample.draining) {
+				playing_sample.tail -= std::min(playing_sample.tail, samples);
+				finished = (playing_sample.tail == 0);
+			} else if (finished) {
+				playing_sample.draining = true;
+				playing_sample.tail = HrtfBlock + playing_sample.hrirs->length;
+				finished = false;
+			}
 		}
 
-		if (playing_sample.i >= playing_sample.data.size()
-		 || (playing_sample.stopping && playing_sample.volume.value == 0.0f)) { //sample has finished
-		 	playing_sample.stopped = true;
-			//erase from list:
-			auto old = si;
-			++si;
-			playing_samples.erase(old);
+		if (finished) { //sample has finished
+			//let the game thread know the voice is free again:
+			bool pushed = finished_voices.push(Finished{ .voice = active[a], .generation = playing_sample.generation });
+			assert(pushed && "finished_voices can't fill");
+			(void)pushed;
+			release_sample(playing_sample);
+			playing_sample.active = false;
+			//remove from active list (order doesn't matter):
+			--active_count;
+			active[a] = active[active_count];
 		} else {
-			++si;
+			++a;
 		}
 	}
+	stats.active_voices.store(active_count, std::memory_order_relaxed);
+	stats.real_voices.store(real_count, std::memory_order_relaxed);
+	stats.virtual_voices.store(virtual_count, std::memory_order_relaxed);
 
 	/*//DEBUG: report output power:
 	float max_power = 0.0f;
-	for (uint32_t s = 0; s < MIX_SAMPLES; ++s) {
+	for (uint32_t s = 0; s < samples; ++s) {
 		max_power = std::max(max_power, (buffer[s].l * buffer[s].l + buffer[s].r * buffer[s].r));
 	}
-	std::cout << "Max Power: " << std::sqrt(max_power) << "; playing samples: " << playing_samples.size() << std::endl; //DEBUG
+	std::cout << "Max Power: " << std::sqrt(max_power) << "; playing samples: " << active_count << std::endl; //DEBUG
 	*/
-
-	SDL_PutAudioStreamData(stream, buffer_, len);
-	SDL_stack_free(buffer_);
 }
 
 
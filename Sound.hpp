@@ -2,10 +2,17 @@
 
 #include <glm/glm.hpp>
 
+#include <array>
+#include <atomic>
 #include <memory>
+#include <span>
 #include <vector>
 #include <string>
 #include <cmath>
+#include <limits>
+
+struct OpusStream;
+struct MappedFile;
 
 //Game audio system. Simplified from f18-base3.
 //Uses 48kHz sampling rate.
@@ -16,13 +23,42 @@ namespace Sound {
 struct Sample { // the thing you load
 	//Load from a '.wav' or '.opus' file.
 	//  will warn and convert if sound is not already 48kHz mono:
+	//  (decoded audio is cached on disk -- see pcm_cache.hpp -- so later loads can skip this)
 	Sample(std::string const &filename);
 	
 	//Directly supply an audio buffer:
 	Sample(std::vector< float > const &data);
 
+	~Sample();
+
+	//(data may point into the sample itself, so samples can't be copied)
+	Sample(Sample const &) = delete;
+	Sample &operator=(Sample const &) = delete;
+
 	//sample data is stored as 48kHz, mono, floating-point:
-	std::vector< float > data;
+	// (points into 'storage', or -- when loaded from the cache -- into 'mapped')
+	std::span< float const > data;
+
+	//voices playing (or about to play) this sample -- it must not be freed while this is nonzero:
+	// (counted up by play() on the game thread and down by the audio callback once the voice lets go)
+	mutable std::atomic< uint32_t > voices{0};
+
+	//-- internals --
+	std::vector< float > storage;
+	std::unique_ptr< MappedFile > mapped;
+};
+
+//StreamingSample objects decode an '.opus' file bit-by-bit as it plays (good for music):
+// - memory use doesn't depend on how long the file is
+// - decoding happens on a background thread, a fraction of a second ahead of playback
+// - a StreamingSample plays in only one voice at a time; playing it again restarts it
+//   (and the voice that was playing it finishes)
+struct StreamingSample {
+	StreamingSample(std::string const &filename); //throws on error
+	~StreamingSample();
+
+	//internals:
+	std::unique_ptr< OpusStream > stream;
 };
 
 //Ramp<> manages values that should be smoothly interpolated
@@ -48,9 +84,11 @@ struct Ramp {
 	float ramp = 0.0f;
 };
 
-// 'PlayingSample' objects book-keep samples that are currently playing:
+// 'PlayingSample' is a handle to a voice in the (fixed-size) pool of currently-playing samples:
+//  handles are small and cheap to copy; once the voice finishes, is stopped, or is stolen
+//  to make room for a newer sound, the functions below quietly do nothing.
 struct PlayingSample {
-	//change the panning or volume of a playing sample (and do proper locking);
+	//change the panning or volume of a playing sample;
 	// value will change over 'ramp' seconds to avoid creating audible artifacts:
 	void set_volume(float new_volume, float ramp = 1.0f / 60.0f);
 	//set the panning of a sample (use only on samples in "2D" mode; no effect on "3D" samples):
@@ -59,77 +97,138 @@ struct PlayingSample {
 	void set_position(glm::vec3 const &new_position, float ramp = 1.0f / 60.0f);
 	//set the half-volume radius (use only on "3D" playing sounds):
 	void set_half_volume_radius(float new_radius, float ramp = 1.0f / 60.0f);
+	//set the playback rate (2.0f == twice as fast and an octave higher; clamped to [1/64, 4]; no effect on StreamingSamples):
+	void set_rate(float new_rate, float ramp = 1.0f / 60.0f);
 
 	//'stop' will fade sample out over 'ramp' seconds and then remove it from the active samples:
 	void stop(float ramp = 1.0f / 60.0f);
 
+	//NOTE: the functions above never block; they change values on the game thread,
+	// which the audio callback hears once Sound::update() has run.
+
+	//is the voice still playing? (becomes false a block or so after the voice finishes or is stolen)
+	bool playing() const;
+
 	//internals:
-	//NOTE: PlayingSample is used in a separate thread; so setting these values directly
-	// may result in bad results. Instead, use the functions above, which perform locking!
-	std::vector< float > const &data; //reference to sample data being played
-	uint32_t i = 0; //next data value to read
-	bool loop = false; //should playback loop after data runs out?
-	bool stopping = false; //is playing stopping?
-	bool stopped = false; //was playback stopped (either by running out of sample, or by stop())?
-
-	Ramp< float > volume = Ramp< float >(1.0f);
-
-	//2D playback panning control: ('NaN' if sound played in 3D mode)
-	Ramp< float > pan = Ramp< float >(std::numeric_limits< float >::quiet_NaN());
-
-	//3D playback panning control: ('NaN' if sound played in 2D mode)
-	Ramp< glm::vec3 > position = Ramp< glm::vec3 >(std::numeric_limits< float >::quiet_NaN());
-	Ramp< float > half_volume_radius = std::numeric_limits< float >::quiet_NaN();
-
-	PlayingSample(Sample const &sample_, float volume_, float pan_, bool loop_)
-		: data(sample_.data), loop(loop_), volume(volume_), pan(pan_) { }
-	PlayingSample(Sample const &sample_, float volume_, glm::vec3 const &position_, float half_volume_radius_, bool loop_)
-		: data(sample_.data), loop(loop_), volume(volume_), position(position_), half_volume_radius(half_volume_radius_) { }
+	uint32_t voice = -1U; //index into the voice pool
+	uint32_t generation = 0; //which use of that voice this handle refers to (0 == no voice)
+};
+
+//The voice pool has a fixed number of voices:
+constexpr uint32_t MaxVoices = 256;
+
+//When every voice is busy, starting a new sample "steals" a playing voice (which is cut off):
+enum class StealPolicy : uint8_t {
+	Quietest, //steal the voice that was quietest in the last mixed block
+	Oldest, //steal the voice that started playing longest ago
+	LowestPriority, //steal the lowest-priority voice (oldest among ties); if all playing voices have higher priority than the new sample, the new sample isn't played
+};
+void set_steal_policy(StealPolicy policy); //default is StealPolicy::Quietest
+
+//Voices playing at a rate other than 1:1 are resampled as they are mixed; better filters cost more per voice:
+enum class ResampleQuality : uint8_t {
+	Linear, //linear interpolation: cheapest, but dulls high frequencies and aliases
+	Fast, //8-tap windowed-sinc filter
+	Good, //16-tap windowed-sinc filter
+	Best, //32-tap windowed-sinc filter
+};
+void set_resample_quality(ResampleQuality quality); //default is ResampleQuality::Good
+
+//3D voices are placed around the listener by a spatializer:
+enum class Spatializer : uint8_t {
+	Panner, //equal-power left/right panning: cheapest, but no elevation or front/back cues
+	Binaural, //head-related impulse responses (see hrtf.hpp): elevation and front/back cues on headphones; costs more per voice, and 3D voices play ~1.5ms later
 };
+void set_spatializer(Spatializer spatializer); //default is Spatializer::Panner; voices already playing keep the spatializer they started with
+
+//Voices too quiet to hear -- or beyond the cap on how many are mixed at once -- are "virtual": they keep playing
+// (so they stay in time and finish when they should) but aren't mixed; they fade in again once they are loud enough:
+void set_audibility_threshold(float gain); //voices whose gain (in the louder ear) is below this are virtual; default is 1e-4 (-80dB), 0 == never
+void set_max_real_voices(uint32_t count); //at most this many voices -- the loudest -- are mixed; default is MaxVoices (no cap)
 
 // ------- global functions -------
 
-void init(); //call Sound::init() from main.cpp before using any member functions
+//Buffering trades latency (time from play() to hearing the sound) against CPU cost and the risk of underruns:
+struct InitOptions {
+	//frames the device asks for at a time (a request to SDL, which may pick something else; 0 == SDL's default):
+	uint32_t block_frames = 0;
+	//whole blocks of mixed audio to keep queued beyond what the device has asked for (each adds a block of latency):
+	uint32_t queue_blocks = 0;
+};
+//(with both options at 0, the callback mixes whatever SDL asks for, as it always has)
+
+void init(InitOptions const &options = InitOptions()); //call Sound::init() from main.cpp before using any member functions
 
 void shutdown(); //call Sound::shutdown() from main.cpp to gracefully(-ish) exit
 
+//Offline (headless) mode mixes audio only when asked to, with no audio device -- for tests, benchmarks, and rendering to files:
+// call Sound::init_offline() instead of Sound::init(), then Sound::render() for each block (and Sound::update() for each game frame).
+// Output depends only on the calls made (not on timing), so the same calls always render the same audio.
+void init_offline();
+
+//(offline mode only) mix the next 'frames' frames of 48kHz interleaved stereo ( l r l r ... ) into 'out',
+// exactly as the audio callback would mix a block of that size; voices started since the last render() start first:
+void render(float *out, uint32_t frames);
+
 //Call 'Sound::play' to play a sample once.
 //  if you hang on to the return value, you can change the panning, volume, or stop playback early.
-std::shared_ptr< PlayingSample > play(
+//  'priority' is only used by StealPolicy::LowestPriority (higher == more important).
+//  'rate' is the starting playback rate (see PlayingSample::set_rate).
+PlayingSample play(
 	Sample const &sample,
 	float volume = 1.0f,
-	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
+	float pan = 0.0f, //-1.0f == hard left, 1.0f == hard right
+	int32_t priority = 0,
+	float rate = 1.0f
 );
 //The play_3D version will play a sample in '3D' mode (that is, panning determined by listener position):
-std::shared_ptr< PlayingSample > play_3D(
+PlayingSample play_3D(
 	Sample const &sample,
 	float volume,
 	glm::vec3 const &position,
-	float half_volume_radius = std::numeric_limits< float >::infinity()
+	float half_volume_radius = std::numeric_limits< float >::infinity(),
+	int32_t priority = 0,
+	float rate = 1.0f
 );
 
 //Call 'Sound::loop' to play a sample ~forever~.
 //  if you hang on to the return value, you can change the panning, volume, or stop playback.
-std::shared_ptr< PlayingSample > loop(
+PlayingSample loop(
 	Sample const &sample,
 	float volume = 1.0f,
-	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
+	float pan = 0.0f, //-1.0f == hard left, 1.0f == hard right
+	int32_t priority = 0,
+	float rate = 1.0f
 );
 //The loop_3D version will loop a sample in '3D' mode (that is, panning determined by listener position):
-std::shared_ptr< PlayingSample > loop_3D(
+PlayingSample loop_3D(
 	Sample const &sample,
 	float volume,
 	glm::vec3 const &position,
-	float half_volume_radius = std::numeric_limits< float >::infinity()
+	float half_volume_radius = std::numeric_limits< float >::infinity(),
+	int32_t priority = 0,
+	float rate = 1.0f
 );
 
+//Streaming versions of the above; looping is seamless (streams always play at 1:1):
+PlayingSample play(StreamingSample &sample, float volume = 1.0f, float pan = 0.0f, int32_t priority = 0);
+PlayingSample play_3D(StreamingSample &sample, float volume, glm::vec3 const &position, float half_volume_radius = std::numeric_limits< float >::infinity(), int32_t priority = 0);
+PlayingSample loop(StreamingSample &sample, float volume = 1.0f, float pan = 0.0f, int32_t priority = 0);
+PlayingSample loop_3D(StreamingSample &sample, float volume, glm::vec3 const &position, float half_volume_radius = std::numeric_limits< float >::infinity(), int32_t priority = 0);
+
+//NOTE: the voice pool only refers to sample data, so a Sample (or StreamingSample) must outlive any playback of it.
+// (Sample::voices says whether any voice still refers to a Sample; SampleCache uses this to only evict samples that aren't playing.)
+
 //Listener controls the panning of "3D" samples (ones played using the "position" version of the play functions):
 struct Listener {
 	void set_position_right(glm::vec3 const &new_position, glm::vec3 const &new_right, float ramp = 1.0f / 60.0f);
+	//the binaural spatializer also needs to know which way is up for the listener (default: +z):
+	void set_position_right_up(glm::vec3 const &new_position, glm::vec3 const &new_right, glm::vec3 const &new_up, float ramp = 1.0f / 60.0f);
 
-	//internals:
+	//internals: (game thread; see Sound::update())
 	Ramp< glm::vec3 > position = Ramp< glm::vec3 >(0.0f); //listener's location
 	Ramp< glm::vec3 > right = Ramp< glm::vec3 >(1.0f, 0.0f, 0.0f); //unit vector pointing to listener's right
+	Ramp< glm::vec3 > up = Ramp< glm::vec3 >(0.0f, 0.0f, 1.0f); //unit vector pointing up from the listener's head (made perpendicular to right when used)
 };
 extern struct Listener listener;
 
@@ -138,12 +237,65 @@ void stop_all_samples();
 
 //set global volume:
 void set_volume(float new_volume, float ramp = 1.0f / 60.0f);
-extern Ramp< float > volume;
+extern Ramp< float > volume; //(game thread; see Sound::update())
 
 //the audio callback doesn't run between Sound::lock() and Sound::unlock()
-// the set_*/stop/play/... functions already use these helpers, so you shouldn't need
-// to call them unless your code is modifying values directly:
+// the set_*/stop/play/... functions do *not* use these helpers (voices are started through
+// a lock-free queue, and everything else goes through Sound::update()), so you shouldn't need
+// to call them unless your code is reaching into the audio callback's data directly:
 void lock();
 void unlock();
 
+//NOTE: the command queue has a single producer, and voice parameters live on the game thread,
+// so all of the functions above and below should be called from the same thread (generally, the main game thread).
+
+//call once per frame with the frame's elapsed time (main.cpp does this after the current mode's update()):
+// - steps every ramp (volumes, pans, positions, rates, the listener, ...) by 'elapsed' seconds
+// - works out every voice's gains (spatialization, panning, virtualization) here, on the calling thread,
+//   and hands them to the audio callback, which moves each voice's gains to them over the next 'elapsed' seconds of audio
+//   (so the callback itself only interpolates and mixes)
+// - calls flush()
+// changes made by the functions above -- other than starting a voice -- are heard once this has run.
+void update(float elapsed);
+
+//if a burst of calls filled the command queue, pass along the commands held back as the audio callback makes room
+// (otherwise they would wait for the next call above); update() does this every frame:
+void flush();
+
+//counters that are handy for checking on the health of the audio callback:
+struct Stats {
+	uint64_t callbacks = 0; //number of blocks mixed
+	uint64_t late_callbacks = 0; //callbacks that started after the audio buffered as of the previous one (queued plus just mixed) would have run out (i.e., underruns)
+	uint64_t commands = 0; //commands (voice starts) applied by the audio callback
+	uint64_t deferred_commands = 0; //commands that found the queue full and were held on the game thread
+	float max_callback_gap = 0.0f; //longest time (seconds) between the starts of two callbacks
+	float max_mix_time = 0.0f; //longest time (seconds) spent in one callback
+	double total_mix_time = 0.0; //time (seconds) spent in all callbacks
+	uint32_t active_voices = 0; //voices playing as of the last callback...
+	uint32_t real_voices = 0; //...of which these were mixed...
+	uint32_t virtual_voices = 0; //...and these only kept time (see set_audibility_threshold)
+	uint64_t stolen_voices = 0; //playing voices cut off to make room for new samples
+	uint64_t dropped_voices = 0; //new samples not played because nothing could be stolen
+	uint64_t stream_underruns = 0; //blocks where a StreamingSample's decoder hadn't kept up
+
+	//buffering (see InitOptions):
+	uint32_t block_frames = 0; //frames per device buffer, as reported by SDL
+	uint32_t queued_frames = 0; //mixed frames queued ahead of the device as of the last callback
+	uint32_t max_queued_frames = 0;
+
+	//callback durations: mix_time_histogram[b] counts callbacks that took less than MixTimeBuckets[b] seconds (and at least MixTimeBuckets[b-1]):
+	static constexpr std::array< float, 10 > MixTimeBuckets = {
+		50e-6f, 100e-6f, 200e-6f, 500e-6f, 1e-3f, 2e-3f, 5e-3f, 10e-3f, 20e-3f, std::numeric_limits< float >::infinity()
+	};
+	std::array< uint64_t, MixTimeBuckets.size() > mix_time_histogram{};
+
+	//estimated latency (seconds) from a play() call to its first sample leaving the device:
+	// (time until the callback mixes it, plus the audio queued ahead of it and one device buffer; not measured in offline mode)
+	uint64_t play_latency_count = 0; //play() calls measured
+	double total_play_latency = 0.0;
+	float max_play_latency = 0.0f;
+	float last_play_latency = 0.0f;
+};
+Stats get_stats();
+
 } //namespace Sound
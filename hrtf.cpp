@@ -0,0 +1,316 @@
+#include "hrtf.hpp"
+#include "Sound.hpp"
+#include "mix_kernels.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+constexpr float Pi = 3.14159265358979323846f;
+
+//------------------------ FFT --------------------------------
+
+//Tables for an in-place radix-2 FFT of HrtfFFTSize points:
+namespace {
+	struct FFTTables {
+		FFTTables() {
+			uint32_t bits = 0;
+			while ((1u << bits) < HrtfFFTSize) ++bits;
+			for (uint32_t i = 0; i < HrtfFFTSize; ++i) {
+				uint32_t r = 0;
+				for (uint32_t b = 0; b < bits; ++b) {
+					if (i & (1u << b)) r |= 1u << (bits - 1 - b);
+				}
+				bitrev[i] = r;
+			}
+			//twiddles for the stage that combines transforms of size 'half' are at [half, 2 * half):
+			for (uint32_t half = 1; half < HrtfFFTSize; half *= 2) {
+				for (uint32_t j = 0; j < half; ++j) {
+					double angle = -3.14159265358979323846 * double(j) / double(half);
+					re[half + j] = float(std::cos(angle));
+					im[half + j] = float(std::sin(angle));
+				}
+			}
+		}
+		std::array< uint32_t, HrtfFFTSize > bitrev;
+		std::array< float, HrtfFFTSize > re, im;
+	};
+	static_assert((HrtfFFTSize & (HrtfFFTSize - 1)) == 0 && HrtfFFTSize >= 4, "FFT size is a power of two (and at least 4)");
+
+	FFTTables const &fft_tables() {
+		static FFTTables const tables;
+		return tables;
+	}
+}
+
+//forward transform (unscaled) of HrtfFFTSize complex values;
+// the inverse (also unscaled) is fft(im, re) -- that is, with the real and imaginary parts swapped:
+static void fft(float *re, float *im) {
+	FFTTables const &tables = fft_tables();
+	for (uint32_t i = 0; i < HrtfFFTSize; ++i) {
+		uint32_t j = tables.bitrev[i];
+		if (j > i) {
+			std::swap(re[i], re[j]);
+			std::swap(im[i], im[j]);
+		}
+	}
+	//the first two stages have trivial twiddles (1 and -i), so do them together:
+	for (uint32_t s = 0; s < HrtfFFTSize; s += 4) {
+		float ar = re[s + 0] + re[s + 1], ai = im[s + 0] + im[s + 1];
+		float br = re[s + 0] - re[s + 1], bi = im[s + 0] - im[s + 1];
+		float cr = re[s + 2] + re[s + 3], ci = im[s + 2] + im[s + 3];
+		float dr = re[s + 2] - re[s + 3], di = im[s + 2] - im[s + 3];
+		re[s + 0] = ar + cr; im[s + 0] = ai + ci;
+		re[s + 2] = ar - cr; im[s + 2] = ai - ci;
+		re[s + 1] = br + di; im[s + 1] = bi - dr; //(b + -i * d)
+		re[s + 3] = br - di; im[s + 3] = bi + dr;
+	}
+	for (uint32_t half = 4; half < HrtfFFTSize; half *= 2) {
+		float const *wr = &tables.re[half];
+		float const *wi = &tables.im[half];
+		for (uint32_t s = 0; s < HrtfFFTSize; s += 2 * half) {
+			float *ar = re + s, *ai = im + s;
+			float *br = ar + half, *bi = ai + half;
+			for (uint32_t j = 0; j < half; ++j) {
+				float tr = br[j] * wr[j] - bi[j] * wi[j];
+				float ti = br[j] * wi[j] + bi[j] * wr[j];
+				br[j] = ar[j] - tr;
+				bi[j] = ai[j] - ti;
+				ar[j] += tr;
+				ai[j] += ti;
+			}
+		}
+	}
+}
+
+//------------------------ HrirSet --------------------------------
+
+HrirSet::HrirSet(uint32_t azimuths_, uint32_t elevations_, float min_elevation_, float elevation_step_, uint32_t length_, std::vector< float > const &hrirs_)
+	: azimuths(azimuths_), elevations(elevations_), min_elevation(min_elevation_), elevation_step(elevation_step_),
+	  length(length_), partitions((length_ + HrtfBlock - 1) / HrtfBlock), hrirs(hrirs_) {
+
+	if (azimuths == 0 || elevations == 0 || length == 0) {
+		throw std::runtime_error("HRIR set needs at least one direction and one tap.");
+	}
+	if (partitions > MaxHrirPartitions) {
+		throw std::runtime_error("HRIRs of " + std::to_string(length) + " taps are longer than the " + std::to_string(MaxHrirPartitions * HrtfBlock) + " supported.");
+	}
+	if (hrirs.size() != size_t(directions()) * 2 * length) {
+		throw std::runtime_error("HRIR set has " + std::to_string(hrirs.size()) + " taps, expecting " + std::to_string(size_t(directions()) * 2 * length) + ".");
+	}
+
+	spectra.assign(size_t(directions()) * partitions * 2 * HrtfFFTSize, 0.0f);
+	for (uint32_t d = 0; d < directions(); ++d) {
+		float const *left = &hrirs[size_t(d) * 2 * length];
+		float const *right = left + length;
+		for (uint32_t p = 0; p < partitions; ++p) {
+			float *re = &spectra[(size_t(d) * partitions + p) * 2 * HrtfFFTSize];
+			float *im = re + HrtfFFTSize;
+			for (uint32_t k = 0; k < HrtfBlock && p * HrtfBlock + k < length; ++k) {
+				re[k] = left[p * HrtfBlock + k] / float(HrtfFFTSize);
+				im[k] = right[p * HrtfBlock + k] / float(HrtfFFTSize);
+			}
+			fft(re, im);
+		}
+	}
+}
+
+uint32_t HrirSet::nearest(glm::vec3 const &to) const {
+	float elevation = std::atan2(to.z, std::sqrt(to.x * to.x + to.y * to.y));
+	float azimuth = std::atan2(to.x, to.y); //(0 == straight ahead, pi / 2 == right; also 0 for a source right at the listener)
+	int32_t e = int32_t(std::lround((elevation - min_elevation) / elevation_step));
+	e = std::max(0, std::min(int32_t(elevations) - 1, e));
+	int32_t a = int32_t(std::lround(azimuth * (float(azimuths) / (2.0f * Pi)))) % int32_t(azimuths);
+	if (a < 0) a += azimuths;
+	return uint32_t(e) * azimuths + uint32_t(a);
+}
+
+//helper: unit vector toward direction 'index' of a grid (as per HrirSet):
+static glm::vec3 grid_direction(uint32_t azimuths, float min_elevation, float elevation_step, uint32_t index) {
+	float elevation = min_elevation + float(index / azimuths) * elevation_step;
+	float azimuth = float(index % azimuths) * (2.0f * Pi / float(azimuths));
+	return glm::vec3(std::cos(elevation) * std::sin(azimuth), std::cos(elevation) * std::cos(azimuth), std::sin(elevation));
+}
+
+glm::vec3 HrirSet::direction(uint32_t index) const {
+	assert(index < directions());
+	return grid_direction(azimuths, min_elevation, elevation_step, index);
+}
+
+HrirSet const *HrirSet::for_spatializer(Sound::Spatializer spatializer) {
+	static std::unique_ptr< HrirSet > binaural;
+	switch (spatializer) {
+		case Sound::Spatializer::Panner:
+			return nullptr;
+		case Sound::Spatializer::Binaural:
+			if (!binaural) binaural = std::make_unique< HrirSet >(spherical_head());
+			return binaural.get();
+	}
+	return nullptr;
+}
+
+HrirSet HrirSet::spherical_head() {
+	//grid every 15 degrees, from 45 degrees below the horizon to straight up:
+	uint32_t const azimuths = 24;
+	uint32_t const elevations = 10;
+	float const min_elevation = -0.25f * Pi;
+	float const elevation_step = Pi / 12.0f;
+	uint32_t const length = 2 * HrtfBlock;
+
+	constexpr double Rate = 48000.0;
+	constexpr double HeadRadius = 0.0875; //meters
+	constexpr double SpeedOfSound = 343.0; //meters per second
+	constexpr double PiD = 3.14159265358979323846;
+	constexpr double HalfPi = 0.5 * PiD;
+
+	//pinna echoes (delays given in samples at 44.1kHz):
+	struct Echo { double rho, A, B, D; };
+	Echo const echoes[] = { {0.5, 1.0, 2.0, 1.0}, {-1.0, 5.0, 4.0, 0.5}, {0.5, 5.0, 7.0, 0.5}, {-0.25, 5.0, 11.0, 0.5}, {0.25, 5.0, 13.0, 0.5} };
+
+	//one-pole, one-zero filter with unit gain at DC and gain 'alpha' far above 'omega' (radians per second):
+	auto shelf = [](std::vector< double > &h, double alpha, double omega) {
+		double K = 2.0 * Rate; //(bilinear transform)
+		double b0 = (1.0 + alpha * K / omega) / (1.0 + K / omega);
+		double b1 = (1.0 - alpha * K / omega) / (1.0 + K / omega);
+		double a1 = (1.0 - K / omega) / (1.0 + K / omega);
+		double x1 = 0.0, y1 = 0.0;
+		for (double &v : h) {
+			double y = b0 * v + b1 * x1 - a1 * y1;
+			x1 = v;
+			y1 = y;
+			v = y;
+		}
+	};
+
+	//add a (Hann-windowed sinc) impulse 'delay' samples in:
+	auto impulse = [](std::vector< double > &h, double gain, double delay) {
+		int32_t first = int32_t(std::floor(delay)) - 7;
+		for (int32_t n = std::max(0, first); n < first + 16 && n < int32_t(h.size()); ++n) {
+			double d = double(n) - delay;
+			double sinc = (d == 0.0 ? 1.0 : std::sin(PiD * d) / (PiD * d));
+			h[n] += gain * sinc * (0.5 + 0.5 * std::cos(PiD * d / 8.0));
+		}
+	};
+
+	std::vector< float > hrirs;
+	hrirs.reserve(size_t(azimuths) * elevations * 2 * length);
+	for (uint32_t d = 0; d < azimuths * elevations; ++d) {
+		glm::vec3 dir = grid_direction(azimuths, min_elevation, elevation_step, d);
+		double x = dir.x, y = dir.y, z = dir.z;
+		for (double side : { -1.0, 1.0 }) { //left ear, then right
+			//angle between the source and the ear:
+			double cos_incidence = std::max(-1.0, std::min(1.0, side * x));
+			double incidence = std::acos(cos_incidence);
+
+			//sound goes straight to the near side of the head and wraps around to the far side:
+			double delay = (HeadRadius / SpeedOfSound) * (incidence < HalfPi ? 1.0 - cos_incidence : 1.0 + incidence - HalfPi);
+
+			std::vector< double > h(length, 0.0);
+			double start = 8.0 + delay * Rate;
+			impulse(h, 1.0, start);
+
+			//pinna echoes depend on elevation, and (a little) on azimuth within the ear's front half:
+			double azimuth = std::atan2(side * x, std::abs(y));
+			double elevation = std::asin(std::max(-1.0, std::min(1.0, z)));
+			for (Echo const &echo : echoes) {
+				double samples = echo.A * std::cos(0.5 * azimuth) * std::sin(echo.D * (HalfPi - elevation)) + echo.B;
+				impulse(h, echo.rho, start + samples * (Rate / 44100.0));
+			}
+
+			//head shadow: high frequencies are boosted facing the ear and cut behind the head:
+			double const alpha_min = 0.1, incidence_min = 150.0 / 180.0 * PiD;
+			double alpha = (1.0 + 0.5 * alpha_min) + (1.0 - 0.5 * alpha_min) * std::cos(incidence / incidence_min * PiD);
+			shelf(h, alpha, 2.0 * SpeedOfSound / HeadRadius);
+
+			//the pinna shades sounds from behind, which is most of the front/back cue:
+			double behind = std::max(0.0, -y);
+			shelf(h, 1.0 - 0.6 * behind, 2.0 * PiD * 3000.0);
+
+			//(scaled so a source straight ahead is about as loud as it would be with the panner)
+			for (double v : h) hrirs.emplace_back(float(v * std::sqrt(0.5)));
+		}
+	}
+	return HrirSet(azimuths, elevations, min_elevation, elevation_step, length, hrirs);
+}
+
+//------------------------ HrtfConvolver --------------------------------
+
+void HrtfConvolver::reset() {
+	fill = 0;
+	current = -1U;
+	newest = 0;
+	input.fill(0.0f);
+	output.fill(0.0f);
+	history.fill(0.0f);
+}
+
+//helper: inverse transform of the sum over partitions of input spectra times the HRIR spectra for 'direction':
+// (real part -> 're', imaginary part -> 'im'; the last HrtfBlock values of each are the new output)
+static void convolve(HrtfConvolver const &convolver, HrirSet const &set, uint32_t direction, float *re, float *im) {
+	std::fill(re, re + HrtfFFTSize, 0.0f);
+	std::fill(im, im + HrtfFFTSize, 0.0f);
+	for (uint32_t p = 0; p < set.partitions; ++p) {
+		float const *x = &convolver.history[((convolver.newest + MaxHrirPartitions - p) % MaxHrirPartitions) * 2 * HrtfFFTSize];
+		float const *g = set.spectrum(direction, p);
+		spectrum_mac(re, im, x, x + HrtfFFTSize, g, g + HrtfFFTSize, HrtfFFTSize);
+	}
+	fft(im, re);
+}
+
+//helper: a partition's worth of input has been gathered; transform it and work out the next partition's output:
+static void run_partition(HrtfConvolver &convolver, HrirSet const &set, uint32_t direction) {
+	assert(set.partitions <= MaxHrirPartitions);
+
+	//spectrum of the last two partitions of input:
+	convolver.newest = (convolver.newest + 1) % MaxHrirPartitions;
+	float *xr = &convolver.history[convolver.newest * 2 * HrtfFFTSize];
+	float *xi = xr + HrtfFFTSize;
+	std::copy(convolver.input.begin(), convolver.input.end(), xr);
+	std::fill(xi, xi + HrtfFFTSize, 0.0f);
+	fft(xr, xi);
+	std::copy(convolver.input.begin() + HrtfBlock, convolver.input.end(), convolver.input.begin());
+
+	std::array< float, HrtfFFTSize > re, im;
+	convolve(convolver, set, direction, re.data(), im.data());
+	if (convolver.current == -1U || convolver.current == direction) {
+		for (uint32_t k = 0; k < HrtfBlock; ++k) {
+			convolver.output[2 * k + 0] = re[HrtfBlock + k];
+			convolver.output[2 * k + 1] = im[HrtfBlock + k];
+		}
+	} else {
+		//crossfade from the old pair to the new one; both see the same input history, so the result is click-free:
+		std::array< float, HrtfFFTSize > old_re, old_im;
+		convolve(convolver, set, convolver.current, old_re.data(), old_im.data());
+		for (uint32_t k = 0; k < HrtfBlock; ++k) {
+			float w = (float(k) + 0.5f) / float(HrtfBlock);
+			convolver.output[2 * k + 0] = old_re[HrtfBlock + k] + w * (re[HrtfBlock + k] - old_re[HrtfBlock + k]);
+			convolver.output[2 * k + 1] = old_im[HrtfBlock + k] + w * (im[HrtfBlock + k] - old_im[HrtfBlock + k]);
+		}
+	}
+	convolver.current = direction;
+}
+
+void HrtfConvolver::process(float *dst, float const *src, uint32_t count, HrirSet const &set, glm::vec3 const &from, glm::vec3 const &to) {
+	uint32_t done = 0;
+	while (done < count) {
+		//take input and give output up to the end of this partition:
+		uint32_t run = std::min(count - done, HrtfBlock - fill);
+		std::copy(src + done, src + done + run, &input[HrtfBlock + fill]);
+		float const *out = &output[2 * fill];
+		for (uint32_t k = 0; k < 2 * run; ++k) {
+			dst[2 * done + k] += out[k];
+		}
+		fill += run;
+		done += run;
+
+		if (fill == HrtfBlock) {
+			//(the pair for where the source is at the end of the partition)
+			float t = float(done) / float(count);
+			run_partition(*this, set, set.nearest(from + t * (to - from)));
+			fill = 0;
+		}
+	}
+}
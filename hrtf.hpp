@@ -0,0 +1,99 @@
+#pragma once
+
+/*
+ * Binaural (headphone) rendering of 3D voices (used by Sound.cpp when the
+ *  spatializer is Sound::Spatializer::Binaural).
+ *
+ * Each voice is convolved with a pair of head-related impulse responses
+ *  (HRIRs: what reaches the left and right ear from a click in some
+ *  direction), which carries elevation and front/back cues that plain
+ *  left/right panning can't.
+ *
+ * Convolution is uniformly partitioned and done in the frequency domain:
+ *  each HRIR is split into HrtfBlock-tap pieces whose spectra are
+ *  precomputed; every HrtfBlock frames of voice input are transformed once,
+ *  and the output spectrum is the sum of the last few input spectra times the
+ *  matching pieces. So the cost per frame is a couple of small FFTs plus a
+ *  multiply-add per piece, no matter how many voices share an HRIR set.
+ *
+ * The two ears are convolved together by treating the HRIR pair as one
+ *  complex signal (left + i * right): the real and imaginary parts of the
+ *  inverse FFT are then the left and right outputs.
+ *
+ */
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace Sound {
+	enum class Spatializer : uint8_t; //(in Sound.hpp)
+}
+
+//frames per partition; output is delayed by this much:
+constexpr uint32_t HrtfBlock = 64;
+constexpr uint32_t HrtfFFTSize = 2 * HrtfBlock;
+
+//longest HRIR supported is HrtfBlock * MaxHrirPartitions taps (5.3ms):
+constexpr uint32_t MaxHrirPartitions = 4;
+
+//HRIR pairs on a grid of directions:
+struct HrirSet {
+	//'hrirs' holds 'length' left-ear taps then 'length' right-ear taps for each direction, in grid order (see direction()):
+	HrirSet(uint32_t azimuths, uint32_t elevations, float min_elevation, float elevation_step, uint32_t length, std::vector< float > const &hrirs);
+
+	//the grid: 'elevations' rings, from min_elevation up by elevation_step (radians), of 'azimuths' directions each,
+	// starting straight ahead and going clockwise seen from above (toward the right):
+	uint32_t azimuths;
+	uint32_t elevations;
+	float min_elevation;
+	float elevation_step;
+
+	uint32_t length; //taps per HRIR
+	uint32_t partitions; //HrtfBlock-tap pieces per HRIR
+	std::vector< float > hrirs; //(as passed to the constructor; handy as a reference)
+
+	//for each direction and partition, the spectrum of (left + i * right) taps [p * HrtfBlock, (p+1) * HrtfBlock),
+	// zero-padded to HrtfFFTSize and scaled by 1 / HrtfFFTSize (for the inverse FFT); stored as HrtfFFTSize reals then HrtfFFTSize imaginaries:
+	std::vector< float > spectra;
+	float const *spectrum(uint32_t direction, uint32_t partition) const {
+		return &spectra[(direction * partitions + partition) * 2 * HrtfFFTSize];
+	}
+
+	uint32_t directions() const { return azimuths * elevations; }
+
+	//nearest grid direction to 'to', given in listener space (x right, y forward, z up; need not be normalized):
+	uint32_t nearest(glm::vec3 const &to) const;
+	//unit vector toward a grid direction:
+	glm::vec3 direction(uint32_t index) const;
+
+	//the HRIR set for a spatializer (nullptr for Spatializer::Panner), built on first use and kept until exit:
+	// (not thread-safe; Sound calls this from the game thread)
+	static HrirSet const *for_spatializer(Sound::Spatializer spatializer);
+
+	//a set synthesized from a model of a spherical head with simple pinna echoes (after Brown and Duda, 1998);
+	// no measured data needed, but (of course) it fits nobody's ears exactly:
+	static HrirSet spherical_head();
+};
+
+//Per-voice convolution state:
+struct HrtfConvolver {
+	//forget any input so far (e.g., when a voice starts a new sound):
+	void reset();
+
+	//Add the binaural rendering of 'count' frames of mono input 'src' to interleaved stereo 'dst' ( l r l r ... ):
+	// - output runs HrtfBlock frames behind input (the first HrtfBlock frames after a reset are silent)
+	// - the direction of the source moves linearly from 'from' to 'to' (listener space, as per HrirSet::nearest) over the span;
+	//   the HRIR pair is picked once per partition, and a change of pair is crossfaded over that partition
+	void process(float *dst, float const *src, uint32_t count, HrirSet const &set, glm::vec3 const &from, glm::vec3 const &to);
+
+	//internals:
+	uint32_t fill = 0; //input frames gathered toward the next partition
+	uint32_t current = -1U; //HRIR pair in use (-1U == none yet)
+	uint32_t newest = 0; //slot of the most recent spectrum in 'history'
+	std::array< float, HrtfFFTSize > input{}; //previous partition's input, then this one's (as it fills)
+	std::array< float, 2 * HrtfBlock > output{}; //stereo output for the frames being gathered
+	std::array< float, MaxHrirPartitions * 2 * HrtfFFTSize > history{}; //spectra of the last few inputs (as in HrirSet::spectra)
+};
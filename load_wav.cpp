@@ -3,12 +3,14 @@
 #include <SDL3/SDL.h>
 
 #include <iostream>
+#include <fstream>
 #include <cassert>
+#include <cstring>
 #include <algorithm>
 
 constexpr uint32_t AUDIO_RATE = 48000;
 
-void load_wav(std::string const &filename, std::vector< float > *data_) {
+void load_wav(std::string const &filename, std::vector< float > *data_, bool *converted) {
 	assert(data_);
 	auto &data = *data_;
 
@@ -20,7 +22,9 @@ void load_wav(std::string const &filename, std::vector< float > *data_) {
 		throw std::runtime_error("Failed to load WAV file '" + filename + "'; SDL says \"" + std::string(SDL_GetError()) + "\"");
 	}
 	SDL_AudioSpec out_spec{ .format=SDL_AUDIO_F32, .channels=1, .freq=AUDIO_RATE };
-	if (audio_spec.format != out_spec.format || audio_spec.channels != out_spec.channels || audio_spec.freq != out_spec.freq) {
+	bool convert = (audio_spec.format != out_spec.format || audio_spec.channels != out_spec.channels || audio_spec.freq != out_spec.freq);
+	if (converted) *converted = convert;
+	if (convert) {
 		Uint8 *out_buf = NULL;
 		int out_len = 0;
 		std::cout << "WAV file '" + filename + "' didn't load as " + std::to_string(AUDIO_RATE) + " Hz, float32, mono; converting." << std::endl;
@@ -54,3 +58,37 @@ void load_wav(std::string const &filename, std::vector< float > *data_) {
 	std::cout << "Range of " << filename << ": " << min << ", " << max << std::endl;
 	*/
 }
+
+void save_wav(std::string const &filename, std::vector< float > const &data, uint32_t channels) {
+	assert(channels > 0);
+	//WAV files are little-endian, so fields are written a byte at a time:
+	uint8_t header[44];
+	uint32_t at = 0;
+	auto u32 = [&](uint32_t v) { for (uint32_t b = 0; b < 4; ++b) header[at++] = uint8_t(v >> (8 * b)); };
+	auto u16 = [&](uint16_t v) { for (uint32_t b = 0; b < 2; ++b) header[at++] = uint8_t(v >> (8 * b)); };
+	auto tag = [&](char const *t) { for (uint32_t b = 0; b < 4; ++b) header[at++] = uint8_t(t[b]); };
+
+	uint32_t data_bytes = uint32_t(data.size() * sizeof(float));
+	tag("RIFF"); u32(4 + (8 + 16) + (8 + data_bytes)); tag("WAVE");
+	tag("fmt "); u32(16);
+	u16(3); //WAVE_FORMAT_IEEE_FLOAT
+	u16(uint16_t(channels));
+	u32(AUDIO_RATE);
+	u32(AUDIO_RATE * channels * sizeof(float)); //bytes per second
+	u16(uint16_t(channels * sizeof(float))); //bytes per frame
+	u16(32); //bits per sample
+	tag("data"); u32(data_bytes);
+	assert(at == sizeof(header));
+
+	std::ofstream out(filename, std::ios::binary);
+	out.write(reinterpret_cast< char const * >(header), sizeof(header));
+	for (float f : data) {
+		uint32_t bits;
+		std::memcpy(&bits, &f, sizeof(bits));
+		char bytes[4] = { char(bits), char(bits >> 8), char(bits >> 16), char(bits >> 24) };
+		out.write(bytes, 4);
+	}
+	if (!out) {
+		throw std::runtime_error("Failed to write WAV file '" + filename + "'.");
+	}
+}
@@ -4,4 +4,8 @@
 #include <vector>
 
 //Load a WAV file as 48kHz floating-point mono; throws on error:
-void load_wav(std::string const &filename, std::vector< float > *data);
+// (if 'converted' is given, it is set to whether the file was in some other format and had to be converted)
+void load_wav(std::string const &filename, std::vector< float > *data, bool *converted = nullptr);
+
+//Save 48kHz floating-point audio ('channels' interleaved channels) as a WAV file; throws on error:
+void save_wav(std::string const &filename, std::vector< float > const &data, uint32_t channels);
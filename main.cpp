@@ -183,6 +183,9 @@ int main(int argc, char **argv) {
 
 			Mode::current->update(elapsed);
 			if (!Mode::current) break;
+
+			//work out this frame's sound changes (ramps, spatialization) and pass them to the audio callback:
+			Sound::update(elapsed);
 		}
 
 		{ //(3) call the current mode's "draw" function to produce output:
@@ -0,0 +1,450 @@
+#include "mix_kernels.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+//Which SIMD kernels can be compiled depends on the target architecture;
+// on x86 the AVX2 kernel is compiled regardless of build flags and picked at runtime if the CPU supports it:
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+	#define MIX_KERNELS_X86
+	#include <immintrin.h>
+	#if defined(_MSC_VER) && !defined(__clang__)
+		#include <intrin.h>
+		#define TARGET_AVX2
+	#else
+		#define TARGET_AVX2 __attribute__((target("avx2")))
+	#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+	#define MIX_KERNELS_NEON
+	#include <arm_neon.h>
+#endif
+
+//NOTE: all kernels compute gains as (l + k * dl) rather than accumulating a step,
+// so they produce (nearly) the same bits as the scalar reference.
+
+void mix_span_scalar(float *dst, float const *src, uint32_t count, float l, float r, float dl, float dr) {
+	for (uint32_t k = 0; k < count; ++k) {
+		float fk = float(k);
+		dst[2*k+0] += (l + fk * dl) * src[k];
+		dst[2*k+1] += (r + fk * dr) * src[k];
+	}
+}
+
+float filter_dot_scalar(float const *row, float const *delta, float t, float const *src, uint32_t count) {
+	float sum = 0.0f;
+	for (uint32_t j = 0; j < count; ++j) {
+		sum += (row[j] + t * delta[j]) * src[j];
+	}
+	return sum;
+}
+
+void spectrum_mac_scalar(float *zr, float *zi, float const *xr, float const *xi, float const *gr, float const *gi, uint32_t count) {
+	for (uint32_t k = 0; k < count; ++k) {
+		zr[k] += xr[k] * gr[k] - xi[k] * gi[k];
+		zi[k] += xr[k] * gi[k] + xi[k] * gr[k];
+	}
+}
+
+//pan_gains evaluates cos and sin with short series on [-pi/4, pi/4] (error < 3e-8), using
+// cos(pi/4 + u) = (cos u - sin u) / sqrt(2) and sin(pi/4 + u) = (cos u + sin u) / sqrt(2);
+// these are the series coefficients, shared by every version so they all agree:
+constexpr float QuarterPi = 0.78539816f;
+constexpr float InvSqrt2 = 0.70710678f;
+constexpr float S3 = -1.0f / 6.0f, S5 = 1.0f / 120.0f, S7 = -1.0f / 5040.0f, S9 = 1.0f / 362880.0f;
+constexpr float C2 = -1.0f / 2.0f, C4 = 1.0f / 24.0f, C6 = -1.0f / 720.0f, C8 = 1.0f / 40320.0f;
+
+void spatialize_scalar(float const *x, float const *y, float const *z, float const *half_radius,
+	float const listener[3], float const right[3], float *amount, float *scale, uint32_t count) {
+	for (uint32_t v = 0; v < count; ++v) {
+		float tx = x[v] - listener[0];
+		float ty = y[v] - listener[1];
+		float tz = z[v] - listener[2];
+		float distance = std::sqrt(tx * tx + ty * ty + tz * tz);
+		if (distance == 0.0f) {
+			amount[v] = 0.0f;
+			scale[v] *= 2.0f;
+		} else {
+			amount[v] = (right[0] * tx + right[1] * ty + right[2] * tz) / distance;
+			scale[v] *= 1.0f / (1.0f + distance / half_radius[v]);
+		}
+	}
+}
+
+void pan_gains_scalar(float const *amount, float const *scale, float *l, float *r, uint32_t count) {
+	for (uint32_t v = 0; v < count; ++v) {
+		float u = QuarterPi * std::max(-1.0f, std::min(1.0f, amount[v]));
+		float u2 = u * u;
+		float su = u * (1.0f + u2 * (S3 + u2 * (S5 + u2 * (S7 + u2 * S9))));
+		float cu = 1.0f + u2 * (C2 + u2 * (C4 + u2 * (C6 + u2 * C8)));
+		float k = InvSqrt2 * scale[v];
+		l[v] = (cu - su) * k;
+		r[v] = (cu + su) * k;
+	}
+}
+
+#if defined(MIX_KERNELS_X86)
+
+static void mix_span_sse2(float *dst, float const *src, uint32_t count, float l, float r, float dl, float dr) {
+	uint32_t k = 0;
+	__m128 base = _mm_setr_ps(l, r, l, r);
+	__m128 step = _mm_setr_ps(dl, dr, dl, dr);
+	__m128 offset_lo = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f); //frame offsets of lanes in the first output vector
+	__m128 offset_hi = _mm_setr_ps(2.0f, 2.0f, 3.0f, 3.0f); //...and in the second
+	for (; k + 4 <= count; k += 4) {
+		__m128 fk = _mm_set1_ps(float(k));
+		__m128 s = _mm_loadu_ps(src + k);
+		__m128 s_lo = _mm_unpacklo_ps(s, s); //s0 s0 s1 s1
+		__m128 s_hi = _mm_unpackhi_ps(s, s); //s2 s2 s3 s3
+		__m128 g_lo = _mm_add_ps(base, _mm_mul_ps(_mm_add_ps(fk, offset_lo), step));
+		__m128 g_hi = _mm_add_ps(base, _mm_mul_ps(_mm_add_ps(fk, offset_hi), step));
+		_mm_storeu_ps(dst + 2*k + 0, _mm_add_ps(_mm_loadu_ps(dst + 2*k + 0), _mm_mul_ps(g_lo, s_lo)));
+		_mm_storeu_ps(dst + 2*k + 4, _mm_add_ps(_mm_loadu_ps(dst + 2*k + 4), _mm_mul_ps(g_hi, s_hi)));
+	}
+	//leftovers:
+	for (; k < count; ++k) {
+		float fk = float(k);
+		dst[2*k+0] += (l + fk * dl) * src[k];
+		dst[2*k+1] += (r + fk * dr) * src[k];
+	}
+}
+
+TARGET_AVX2 static void mix_span_avx2(float *dst, float const *src, uint32_t count, float l, float r, float dl, float dr) {
+	uint32_t k = 0;
+	__m256 base = _mm256_setr_ps(l, r, l, r, l, r, l, r);
+	__m256 step = _mm256_setr_ps(dl, dr, dl, dr, dl, dr, dl, dr);
+	__m256 offset_lo = _mm256_setr_ps(0.0f, 0.0f, 1.0f, 1.0f, 2.0f, 2.0f, 3.0f, 3.0f);
+	__m256 offset_hi = _mm256_setr_ps(4.0f, 4.0f, 5.0f, 5.0f, 6.0f, 6.0f, 7.0f, 7.0f);
+	__m256i dup_lo = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3); //duplicate each source sample into l,r lanes
+	__m256i dup_hi = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+	for (; k + 8 <= count; k += 8) {
+		__m256 fk = _mm256_set1_ps(float(k));
+		__m256 s = _mm256_loadu_ps(src + k);
+		__m256 s_lo = _mm256_permutevar8x32_ps(s, dup_lo);
+		__m256 s_hi = _mm256_permutevar8x32_ps(s, dup_hi);
+		__m256 g_lo = _mm256_add_ps(base, _mm256_mul_ps(_mm256_add_ps(fk, offset_lo), step));
+		__m256 g_hi = _mm256_add_ps(base, _mm256_mul_ps(_mm256_add_ps(fk, offset_hi), step));
+		_mm256_storeu_ps(dst + 2*k + 0, _mm256_add_ps(_mm256_loadu_ps(dst + 2*k + 0), _mm256_mul_ps(g_lo, s_lo)));
+		_mm256_storeu_ps(dst + 2*k + 8, _mm256_add_ps(_mm256_loadu_ps(dst + 2*k + 8), _mm256_mul_ps(g_hi, s_hi)));
+	}
+	//leftovers:
+	for (; k < count; ++k) {
+		float fk = float(k);
+		dst[2*k+0] += (l + fk * dl) * src[k];
+		dst[2*k+1] += (r + fk * dr) * src[k];
+	}
+}
+
+static float filter_dot_sse2(float const *row, float const *delta, float t, float const *src, uint32_t count) {
+	assert(count % 8 == 0);
+	__m128 tt = _mm_set1_ps(t);
+	__m128 sum0 = _mm_setzero_ps();
+	__m128 sum1 = _mm_setzero_ps(); //(two accumulators, to overlap the adds)
+	for (uint32_t j = 0; j < count; j += 8) {
+		__m128 c0 = _mm_add_ps(_mm_loadu_ps(row + j), _mm_mul_ps(tt, _mm_loadu_ps(delta + j)));
+		__m128 c1 = _mm_add_ps(_mm_loadu_ps(row + j + 4), _mm_mul_ps(tt, _mm_loadu_ps(delta + j + 4)));
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(c0, _mm_loadu_ps(src + j)));
+		sum1 = _mm_add_ps(sum1, _mm_mul_ps(c1, _mm_loadu_ps(src + j + 4)));
+	}
+	__m128 sum = _mm_add_ps(sum0, sum1);
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	return _mm_cvtss_f32(sum);
+}
+
+TARGET_AVX2 static float filter_dot_avx2(float const *row, float const *delta, float t, float const *src, uint32_t count) {
+	assert(count % 8 == 0);
+	__m256 tt = _mm256_set1_ps(t);
+	__m256 sum = _mm256_setzero_ps();
+	for (uint32_t j = 0; j < count; j += 8) {
+		__m256 c = _mm256_add_ps(_mm256_loadu_ps(row + j), _mm256_mul_ps(tt, _mm256_loadu_ps(delta + j)));
+		sum = _mm256_add_ps(sum, _mm256_mul_ps(c, _mm256_loadu_ps(src + j)));
+	}
+	__m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+	half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+	half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+	return _mm_cvtss_f32(half);
+}
+
+static void spectrum_mac_sse2(float *zr, float *zi, float const *xr, float const *xi, float const *gr, float const *gi, uint32_t count) {
+	assert(count % 8 == 0);
+	for (uint32_t k = 0; k < count; k += 4) {
+		__m128 a = _mm_loadu_ps(xr + k), b = _mm_loadu_ps(xi + k);
+		__m128 c = _mm_loadu_ps(gr + k), d = _mm_loadu_ps(gi + k);
+		_mm_storeu_ps(zr + k, _mm_add_ps(_mm_loadu_ps(zr + k), _mm_sub_ps(_mm_mul_ps(a, c), _mm_mul_ps(b, d))));
+		_mm_storeu_ps(zi + k, _mm_add_ps(_mm_loadu_ps(zi + k), _mm_add_ps(_mm_mul_ps(a, d), _mm_mul_ps(b, c))));
+	}
+}
+
+TARGET_AVX2 static void spectrum_mac_avx2(float *zr, float *zi, float const *xr, float const *xi, float const *gr, float const *gi, uint32_t count) {
+	assert(count % 8 == 0);
+	for (uint32_t k = 0; k < count; k += 8) {
+		__m256 a = _mm256_loadu_ps(xr + k), b = _mm256_loadu_ps(xi + k);
+		__m256 c = _mm256_loadu_ps(gr + k), d = _mm256_loadu_ps(gi + k);
+		_mm256_storeu_ps(zr + k, _mm256_add_ps(_mm256_loadu_ps(zr + k), _mm256_sub_ps(_mm256_mul_ps(a, c), _mm256_mul_ps(b, d))));
+		_mm256_storeu_ps(zi + k, _mm256_add_ps(_mm256_loadu_ps(zi + k), _mm256_add_ps(_mm256_mul_ps(a, d), _mm256_mul_ps(b, c))));
+	}
+}
+
+//(control-rate kernels process at most MaxVoices values, so there's little to gain from AVX2 over SSE2)
+static void spatialize_sse2(float const *x, float const *y, float const *z, float const *half_radius,
+	float const listener[3], float const right[3], float *amount, float *scale, uint32_t count) {
+	uint32_t v = 0;
+	__m128 lx = _mm_set1_ps(listener[0]), ly = _mm_set1_ps(listener[1]), lz = _mm_set1_ps(listener[2]);
+	__m128 rx = _mm_set1_ps(right[0]), ry = _mm_set1_ps(right[1]), rz = _mm_set1_ps(right[2]);
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 two = _mm_set1_ps(2.0f);
+	for (; v + 4 <= count; v += 4) {
+		__m128 tx = _mm_sub_ps(_mm_loadu_ps(x + v), lx);
+		__m128 ty = _mm_sub_ps(_mm_loadu_ps(y + v), ly);
+		__m128 tz = _mm_sub_ps(_mm_loadu_ps(z + v), lz);
+		__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, tx), _mm_mul_ps(ty, ty)), _mm_mul_ps(tz, tz)));
+		__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, tx), _mm_mul_ps(ry, ty)), _mm_mul_ps(rz, tz));
+		__m128 att = _mm_div_ps(one, _mm_add_ps(one, _mm_div_ps(distance, _mm_loadu_ps(half_radius + v))));
+		//(lanes at distance zero get amount 0 and attenuation 2)
+		__m128 at_listener = _mm_cmpeq_ps(distance, zero);
+		__m128 amt = _mm_andnot_ps(at_listener, _mm_div_ps(dot, distance));
+		att = _mm_or_ps(_mm_and_ps(at_listener, two), _mm_andnot_ps(at_listener, att));
+		_mm_storeu_ps(amount + v, amt);
+		_mm_storeu_ps(scale + v, _mm_mul_ps(_mm_loadu_ps(scale + v), att));
+	}
+	//leftovers:
+	spatialize_scalar(x + v, y + v, z + v, half_radius + v, listener, right, amount + v, scale + v, count - v);
+}
+
+static void pan_gains_sse2(float const *amount, float const *scale, float *l, float *r, uint32_t count) {
+	uint32_t v = 0;
+	__m128 lo = _mm_set1_ps(-1.0f), hi = _mm_set1_ps(1.0f);
+	for (; v + 4 <= count; v += 4) {
+		__m128 u = _mm_mul_ps(_mm_set1_ps(QuarterPi), _mm_max_ps(lo, _mm_min_ps(hi, _mm_loadu_ps(amount + v))));
+		__m128 u2 = _mm_mul_ps(u, u);
+		__m128 su = _mm_add_ps(_mm_set1_ps(S7), _mm_mul_ps(u2, _mm_set1_ps(S9)));
+		su = _mm_add_ps(_mm_set1_ps(S5), _mm_mul_ps(u2, su));
+		su = _mm_add_ps(_mm_set1_ps(S3), _mm_mul_ps(u2, su));
+		su = _mm_mul_ps(u, _mm_add_ps(hi, _mm_mul_ps(u2, su)));
+		__m128 cu = _mm_add_ps(_mm_set1_ps(C6), _mm_mul_ps(u2, _mm_set1_ps(C8)));
+		cu = _mm_add_ps(_mm_set1_ps(C4), _mm_mul_ps(u2, cu));
+		cu = _mm_add_ps(_mm_set1_ps(C2), _mm_mul_ps(u2, cu));
+		cu = _mm_add_ps(hi, _mm_mul_ps(u2, cu));
+		__m128 k = _mm_mul_ps(_mm_set1_ps(InvSqrt2), _mm_loadu_ps(scale + v));
+		_mm_storeu_ps(l + v, _mm_mul_ps(_mm_sub_ps(cu, su), k));
+		_mm_storeu_ps(r + v, _mm_mul_ps(_mm_add_ps(cu, su), k));
+	}
+	//leftovers:
+	pan_gains_scalar(amount + v, scale + v, l + v, r + v, count - v);
+}
+
+static bool cpu_has_avx2() {
+	#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!(osxsave && avx)) return false;
+	if ((_xgetbv(0) & 0x6) != 0x6) return false; //OS saves ymm registers
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+	#else
+	return __builtin_cpu_supports("avx2");
+	#endif
+}
+
+#elif defined(MIX_KERNELS_NEON)
+
+static void mix_span_neon(float *dst, float const *src, uint32_t count, float l, float r, float dl, float dr) {
+	uint32_t k = 0;
+	float const base_[4] = {l, r, l, r};
+	float const step_[4] = {dl, dr, dl, dr};
+	float const offset_lo_[4] = {0.0f, 0.0f, 1.0f, 1.0f};
+	float const offset_hi_[4] = {2.0f, 2.0f, 3.0f, 3.0f};
+	float32x4_t base = vld1q_f32(base_);
+	float32x4_t step = vld1q_f32(step_);
+	float32x4_t offset_lo = vld1q_f32(offset_lo_);
+	float32x4_t offset_hi = vld1q_f32(offset_hi_);
+	for (; k + 4 <= count; k += 4) {
+		float32x4_t fk = vdupq_n_f32(float(k));
+		float32x4_t s = vld1q_f32(src + k);
+		float32x4x2_t s2 = vzipq_f32(s, s); //s0 s0 s1 s1 | s2 s2 s3 s3
+		//(separate multiply and add -- rather than vmlaq/vfmaq -- to match the scalar reference)
+		float32x4_t g_lo = vaddq_f32(base, vmulq_f32(vaddq_f32(fk, offset_lo), step));
+		float32x4_t g_hi = vaddq_f32(base, vmulq_f32(vaddq_f32(fk, offset_hi), step));
+		vst1q_f32(dst + 2*k + 0, vaddq_f32(vld1q_f32(dst + 2*k + 0), vmulq_f32(g_lo, s2.val[0])));
+		vst1q_f32(dst + 2*k + 4, vaddq_f32(vld1q_f32(dst + 2*k + 4), vmulq_f32(g_hi, s2.val[1])));
+	}
+	//leftovers:
+	for (; k < count; ++k) {
+		float fk = float(k);
+		dst[2*k+0] += (l + fk * dl) * src[k];
+		dst[2*k+1] += (r + fk * dr) * src[k];
+	}
+}
+
+static float filter_dot_neon(float const *row, float const *delta, float t, float const *src, uint32_t count) {
+	assert(count % 8 == 0);
+	float32x4_t tt = vdupq_n_f32(t);
+	float32x4_t sum0 = vdupq_n_f32(0.0f);
+	float32x4_t sum1 = vdupq_n_f32(0.0f);
+	for (uint32_t j = 0; j < count; j += 8) {
+		float32x4_t c0 = vaddq_f32(vld1q_f32(row + j), vmulq_f32(tt, vld1q_f32(delta + j)));
+		float32x4_t c1 = vaddq_f32(vld1q_f32(row + j + 4), vmulq_f32(tt, vld1q_f32(delta + j + 4)));
+		sum0 = vaddq_f32(sum0, vmulq_f32(c0, vld1q_f32(src + j)));
+		sum1 = vaddq_f32(sum1, vmulq_f32(c1, vld1q_f32(src + j + 4)));
+	}
+	float32x4_t sum = vaddq_f32(sum0, sum1);
+	float32x2_t pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+	return vget_lane_f32(vpadd_f32(pair, pair), 0);
+}
+
+static void spectrum_mac_neon(float *zr, float *zi, float const *xr, float const *xi, float const *gr, float const *gi, uint32_t count) {
+	assert(count % 8 == 0);
+	//(separate multiply and add -- rather than vmlaq/vfmaq -- to match the scalar reference)
+	for (uint32_t k = 0; k < count; k += 4) {
+		float32x4_t a = vld1q_f32(xr + k), b = vld1q_f32(xi + k);
+		float32x4_t c = vld1q_f32(gr + k), d = vld1q_f32(gi + k);
+		vst1q_f32(zr + k, vaddq_f32(vld1q_f32(zr + k), vsubq_f32(vmulq_f32(a, c), vmulq_f32(b, d))));
+		vst1q_f32(zi + k, vaddq_f32(vld1q_f32(zi + k), vaddq_f32(vmulq_f32(a, d), vmulq_f32(b, c))));
+	}
+}
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+//(these need vsqrtq / vdivq, which 32-bit NEON doesn't have)
+#define MIX_KERNELS_NEON_CONTROL
+
+static void spatialize_neon(float const *x, float const *y, float const *z, float const *half_radius,
+	float const listener[3], float const right[3], float *amount, float *scale, uint32_t count) {
+	uint32_t v = 0;
+	float32x4_t lx = vdupq_n_f32(listener[0]), ly = vdupq_n_f32(listener[1]), lz = vdupq_n_f32(listener[2]);
+	float32x4_t rx = vdupq_n_f32(right[0]), ry = vdupq_n_f32(right[1]), rz = vdupq_n_f32(right[2]);
+	float32x4_t zero = vdupq_n_f32(0.0f);
+	float32x4_t one = vdupq_n_f32(1.0f);
+	float32x4_t two = vdupq_n_f32(2.0f);
+	for (; v + 4 <= count; v += 4) {
+		float32x4_t tx = vsubq_f32(vld1q_f32(x + v), lx);
+		float32x4_t ty = vsubq_f32(vld1q_f32(y + v), ly);
+		float32x4_t tz = vsubq_f32(vld1q_f32(z + v), lz);
+		float32x4_t distance = vsqrtq_f32(vaddq_f32(vaddq_f32(vmulq_f32(tx, tx), vmulq_f32(ty, ty)), vmulq_f32(tz, tz)));
+		float32x4_t dot = vaddq_f32(vaddq_f32(vmulq_f32(rx, tx), vmulq_f32(ry, ty)), vmulq_f32(rz, tz));
+		float32x4_t att = vdivq_f32(one, vaddq_f32(one, vdivq_f32(distance, vld1q_f32(half_radius + v))));
+		//(lanes at distance zero get amount 0 and attenuation 2)
+		uint32x4_t at_listener = vceqq_f32(distance, zero);
+		float32x4_t amt = vbslq_f32(at_listener, zero, vdivq_f32(dot, distance));
+		att = vbslq_f32(at_listener, two, att);
+		vst1q_f32(amount + v, amt);
+		vst1q_f32(scale + v, vmulq_f32(vld1q_f32(scale + v), att));
+	}
+	//leftovers:
+	spatialize_scalar(x + v, y + v, z + v, half_radius + v, listener, right, amount + v, scale + v, count - v);
+}
+
+static void pan_gains_neon(float const *amount, float const *scale, float *l, float *r, uint32_t count) {
+	uint32_t v = 0;
+	float32x4_t lo = vdupq_n_f32(-1.0f), hi = vdupq_n_f32(1.0f);
+	//(separate multiply and add -- rather than vfmaq -- to match the scalar reference)
+	for (; v + 4 <= count; v += 4) {
+		float32x4_t u = vmulq_f32(vdupq_n_f32(QuarterPi), vmaxq_f32(lo, vminq_f32(hi, vld1q_f32(amount + v))));
+		float32x4_t u2 = vmulq_f32(u, u);
+		float32x4_t su = vaddq_f32(vdupq_n_f32(S7), vmulq_f32(u2, vdupq_n_f32(S9)));
+		su = vaddq_f32(vdupq_n_f32(S5), vmulq_f32(u2, su));
+		su = vaddq_f32(vdupq_n_f32(S3), vmulq_f32(u2, su));
+		su = vmulq_f32(u, vaddq_f32(hi, vmulq_f32(u2, su)));
+		float32x4_t cu = vaddq_f32(vdupq_n_f32(C6), vmulq_f32(u2, vdupq_n_f32(C8)));
+		cu = vaddq_f32(vdupq_n_f32(C4), vmulq_f32(u2, cu));
+		cu = vaddq_f32(vdupq_n_f32(C2), vmulq_f32(u2, cu));
+		cu = vaddq_f32(hi, vmulq_f32(u2, cu));
+		float32x4_t k = vmulq_f32(vdupq_n_f32(InvSqrt2), vld1q_f32(scale + v));
+		vst1q_f32(l + v, vmulq_f32(vsubq_f32(cu, su), k));
+		vst1q_f32(r + v, vmulq_f32(vaddq_f32(cu, su), k));
+	}
+	//leftovers:
+	pan_gains_scalar(amount + v, scale + v, l + v, r + v, count - v);
+}
+#endif
+
+#endif
+
+namespace {
+	typedef void (*SpatializeFn)(float const *x, float const *y, float const *z, float const *half_radius,
+		float const listener[3], float const right[3], float *amount, float *scale, uint32_t count);
+	typedef void (*PanGainsFn)(float const *amount, float const *scale, float *l, float *r, uint32_t count);
+	typedef void (*SpectrumMacFn)(float *zr, float *zi, float const *xr, float const *xi, float const *gr, float const *gi, uint32_t count);
+
+	struct Kernel {
+		MixSpanFn fn;
+		FilterDotFn filter_dot;
+		SpatializeFn spatialize;
+		PanGainsFn pan_gains;
+		SpectrumMacFn spectrum_mac;
+		char const *name;
+	};
+
+	Kernel const &get_kernel() {
+		static Kernel const kernel = []() -> Kernel {
+			#if defined(MIX_KERNELS_X86)
+			if (cpu_has_avx2()) return Kernel{ mix_span_avx2, filter_dot_avx2, spatialize_sse2, pan_gains_sse2, spectrum_mac_avx2, "avx2" };
+			return Kernel{ mix_span_sse2, filter_dot_sse2, spatialize_sse2, pan_gains_sse2, spectrum_mac_sse2, "sse2" };
+			#elif defined(MIX_KERNELS_NEON_CONTROL)
+			return Kernel{ mix_span_neon, filter_dot_neon, spatialize_neon, pan_gains_neon, spectrum_mac_neon, "neon" };
+			#elif defined(MIX_KERNELS_NEON)
+			return Kernel{ mix_span_neon, filter_dot_neon, spatialize_scalar, pan_gains_scalar, spectrum_mac_neon, "neon" };
+			#else
+			return Kernel{ mix_span_scalar, filter_dot_scalar, spatialize_scalar, pan_gains_scalar, spectrum_mac_scalar, "scalar" };
+			#endif
+		}();
+		return kernel;
+	}
+}
+
+void mix_span(float *dst, float const *src, uint32_t count, float l, float r, float dl, float dr) {
+	get_kernel().fn(dst, src, count, l, r, dl, dr);
+}
+
+float filter_dot(float const *row, float const *delta, float t, float const *src, uint32_t count) {
+	return get_kernel().filter_dot(row, delta, t, src, count);
+}
+
+void spatialize(float const *x, float const *y, float const *z, float const *half_radius,
+	float const listener[3], float const right[3], float *amount, float *scale, uint32_t count) {
+	get_kernel().spatialize(x, y, z, half_radius, listener, right, amount, scale, count);
+}
+
+void pan_gains(float const *amount, float const *scale, float *l, float *r, uint32_t count) {
+	get_kernel().pan_gains(amount, scale, l, r, count);
+}
+
+void spectrum_mac(float *zr, float *zi, float const *xr, float const *xi, float const *gr, float const *gi, uint32_t count) {
+	get_kernel().spectrum_mac(zr, zi, xr, xi, gr, gi, count);
+}
+
+char const *mix_span_kernel_name() {
+	return get_kernel().name;
+}
+
+uint32_t mix_sample(float *dst, uint32_t count,
+	float const *data, uint32_t size, uint32_t *i_, bool loop,
+	float l, float r, float dl, float dr,
+	MixSpanFn kernel) {
+	assert(i_);
+	uint32_t &i = *i_;
+	assert(i < size);
+
+	uint32_t mixed = 0;
+	while (mixed < count) {
+		//longest run that doesn't wrap:
+		uint32_t span = std::min(count - mixed, size - i);
+		float fm = float(mixed);
+		kernel(dst + 2 * mixed, data + i, span, l + fm * dl, r + fm * dr, dl, dr);
+		mixed += span;
+		i += span;
+		if (i == size) {
+			if (loop) {
+				i = 0;
+			} else {
+				break;
+			}
+		}
+	}
+	return mixed;
+}
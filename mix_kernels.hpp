@@ -0,0 +1,68 @@
+#pragma once
+
+/*
+ * Inner loops used by the audio mixer (Sound.cpp).
+ *
+ * A "span" is a run of mono sample data that doesn't wrap; it is mixed into
+ *  interleaved stereo output ( l r l r ... ) with gains that change linearly
+ *  across the span: frame k is mixed with gains (l + k * dl, r + k * dr).
+ *
+ */
+
+#include <cstdint>
+
+typedef void (*MixSpanFn)(float *dst, float const *src, uint32_t count, float l, float r, float dl, float dr);
+
+//mix a span using the fastest kernel available on this CPU (AVX2, SSE2, or NEON; otherwise scalar):
+void mix_span(float *dst, float const *src, uint32_t count, float l, float r, float dl, float dr);
+
+//plain C++ version of the above; used as a reference and where no SIMD kernel exists:
+void mix_span_scalar(float *dst, float const *src, uint32_t count, float l, float r, float dl, float dr);
+
+//name of the kernel that mix_span() uses (e.g., "avx2"), handy for benchmark output:
+char const *mix_span_kernel_name();
+
+typedef float (*FilterDotFn)(float const *row, float const *delta, float t, float const *src, uint32_t count);
+
+//Evaluate one output sample of a polyphase filter (see resample.hpp), interpolating between two phases:
+// returns the sum over j < count of (row[j] + t * delta[j]) * src[j]; 'count' must be a multiple of 8.
+// (uses the same CPU features as mix_span)
+float filter_dot(float const *row, float const *delta, float t, float const *src, uint32_t count);
+
+//plain C++ version of the above:
+float filter_dot_scalar(float const *row, float const *delta, float t, float const *src, uint32_t count);
+
+//Multiply-accumulate complex spectra stored as separate real and imaginary arrays (for HRTF convolution; see hrtf.hpp):
+// (zr + i zi)[k] += (xr + i xi)[k] * (gr + i gi)[k] for k < count; 'count' must be a multiple of 8.
+void spectrum_mac(float *zr, float *zi, float const *xr, float const *xi, float const *gr, float const *gi, uint32_t count);
+
+//plain C++ version of the above:
+void spectrum_mac_scalar(float *zr, float *zi, float const *xr, float const *xi, float const *gr, float const *gi, uint32_t count);
+
+//Control-rate kernels work on one value per voice (structure-of-arrays), for computing the
+// gains that the mixing kernels above interpolate between:
+
+//Turn 3D voice positions into pan amounts and distance attenuation:
+// with to = (x[v], y[v], z[v]) - listener, sets amount[v] = dot(right, to) / |to| and
+// multiplies scale[v] by 1 / (1 + |to| / half_radius[v]);
+// (a voice right at the listener gets amount 0 and scale * 2 -- that is, gains of sqrt(2) after pan_gains)
+void spatialize(float const *x, float const *y, float const *z, float const *half_radius,
+	float const listener[3], float const right[3], float *amount, float *scale, uint32_t count);
+
+//Equal-power panning: l[v] = cos(a) * scale[v] and r[v] = sin(a) * scale[v],
+// where a = (pi / 4) * (amount[v] + 1) after clamping amount[v] to [-1, 1]:
+void pan_gains(float const *amount, float const *scale, float *l, float *r, uint32_t count);
+
+//plain C++ versions of the above:
+void spatialize_scalar(float const *x, float const *y, float const *z, float const *half_radius,
+	float const listener[3], float const right[3], float *amount, float *scale, uint32_t count);
+void pan_gains_scalar(float const *amount, float const *scale, float *l, float *r, uint32_t count);
+
+//Mix 'count' frames of a mono sample (data[0 .. size-1]) into 'dst', starting at data[*i]:
+// - splits the work into spans wherever the sample wraps (if 'loop') or ends (if not 'loop')
+// - advances *i; if a non-looping sample ends, *i == size and fewer than 'count' frames are mixed
+// - returns the number of frames mixed
+uint32_t mix_sample(float *dst, uint32_t count,
+	float const *data, uint32_t size, uint32_t *i, bool loop,
+	float l, float r, float dl, float dr,
+	MixSpanFn kernel = mix_span);
@@ -0,0 +1,387 @@
+//optimize-meshes reorders the triangles (and vertices) of each mesh in a .pnct file
+// so that they make good use of the GPU's post-transform vertex cache, and can
+// optionally also sort groups of triangles to reduce overdraw.
+//
+//The output is always an indexed .pnct (see export-meshes.py and MeshBuffer),
+// so unindexed files have their duplicate vertices merged as well.
+
+#include "PnctFile.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cassert>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using Vertex = PnctFile::Vertex;
+
+//------------------------------------------------
+//post-transform cache simulation:
+
+//simulates a FIFO cache of the given size (like most hardware):
+// (a vertex is in the cache if it was added fewer than 'size' misses ago)
+struct CacheSim {
+	CacheSim(uint32_t size_, size_t vertex_count) : size(size_), added(vertex_count, 0), time(size_ + 1) { }
+	uint32_t size;
+	std::vector< uint32_t > added; //miss count when vertex was last added
+	uint32_t time;
+
+	//returns 1 if vertex missed the cache (and adds it):
+	uint32_t miss(uint32_t v) {
+		if (time - added[v] <= size) return 0;
+		added[v] = time++;
+		return 1;
+	}
+	uint32_t misses(uint32_t const *tri) {
+		return miss(tri[0]) + miss(tri[1]) + miss(tri[2]);
+	}
+	//empty the cache:
+	void reset() {
+		time += size + 1;
+	}
+};
+
+//average cache miss ratio (transformed vertices per triangle; 3.0 is no reuse, ~0.5 is the usual best case):
+static float acmr(std::vector< uint32_t > const &indices, size_t vertex_count, uint32_t cache_size) {
+	if (indices.empty()) return 0.0f;
+	CacheSim cache(cache_size, vertex_count);
+	uint32_t misses = 0;
+	for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+		misses += cache.misses(&indices[i]);
+	}
+	return float(misses) / float(indices.size() / 3);
+}
+
+//------------------------------------------------
+//vertex cache optimization:
+// Tom Forsyth's "Linear-Speed Vertex Cache Optimisation" (2006): greedily emit the triangle whose
+// vertices score best, where vertices score higher if they are recently used (in a simulated LRU cache)
+// and if they have few triangles left to emit (so that isolated triangles don't get left behind).
+
+static std::vector< uint32_t > optimize_vertex_cache(std::vector< uint32_t > const &indices, size_t vertex_count) {
+	constexpr uint32_t CacheSize = 32; //(simulated LRU cache; larger than the FIFO sizes we're optimizing for, as per Forsyth)
+
+	auto vertex_score = [](int32_t cache_position, uint32_t remaining) -> float {
+		if (remaining == 0) return -1.0f; //(vertex isn't used any more)
+		float score = 0.0f;
+		if (cache_position >= 0) {
+			if (cache_position < 3) {
+				//vertices of the triangle just emitted get a fixed score, so strips don't double back on themselves:
+				score = 0.75f;
+			} else {
+				score = std::pow(1.0f - float(cache_position - 3) / float(CacheSize - 3), 1.5f);
+			}
+		}
+		//boost vertices with only a few triangles left:
+		score += 2.0f / std::sqrt(float(remaining));
+		return score;
+	};
+
+	size_t triangle_count = indices.size() / 3;
+
+	//triangles using each vertex (the first remaining[v] entries from adjacency_begin[v] are the ones not yet emitted):
+	std::vector< uint32_t > remaining(vertex_count, 0);
+	for (uint32_t v : indices) remaining[v] += 1;
+	std::vector< uint32_t > adjacency_begin(vertex_count + 1, 0);
+	for (size_t v = 0; v < vertex_count; ++v) {
+		adjacency_begin[v+1] = adjacency_begin[v] + remaining[v];
+	}
+	std::vector< uint32_t > adjacency(indices.size());
+	{
+		std::vector< uint32_t > filled(vertex_count, 0);
+		for (size_t i = 0; i < indices.size(); ++i) {
+			uint32_t v = indices[i];
+			adjacency[adjacency_begin[v] + filled[v]] = uint32_t(i / 3);
+			filled[v] += 1;
+		}
+	}
+
+	std::vector< int32_t > cache_position(vertex_count, -1);
+	std::vector< float > score(vertex_count);
+	for (size_t v = 0; v < vertex_count; ++v) {
+		score[v] = vertex_score(-1, remaining[v]);
+	}
+
+	std::vector< bool > emitted(triangle_count, false);
+
+	std::vector< uint32_t > cache; //most recent first
+	cache.reserve(CacheSize + 3);
+	std::vector< uint32_t > next_cache;
+	next_cache.reserve(CacheSize + 3);
+
+	std::vector< uint32_t > result;
+	result.reserve(indices.size());
+
+	uint32_t best = uint32_t(-1);
+	size_t cursor = 0; //everything before this has been emitted (used when no cached vertex has triangles left)
+	for (size_t emit = 0; emit < triangle_count; ++emit) {
+		if (best == uint32_t(-1)) {
+			while (emitted[cursor]) ++cursor;
+			best = uint32_t(cursor);
+		}
+
+		//emit triangle:
+		uint32_t const *tri = &indices[3*best];
+		result.insert(result.end(), tri, tri + 3);
+		emitted[best] = true;
+
+		//remove it from its vertices' adjacency lists:
+		for (uint32_t c = 0; c < 3; ++c) {
+			uint32_t v = tri[c];
+			uint32_t *begin = &adjacency[adjacency_begin[v]];
+			uint32_t *end = begin + remaining[v];
+			uint32_t *found = std::find(begin, end, best);
+			assert(found != end);
+			std::swap(*found, *(end - 1));
+			remaining[v] -= 1;
+		}
+
+		//move its vertices to the front of the cache:
+		next_cache.clear();
+		next_cache.insert(next_cache.end(), tri, tri + 3);
+		for (uint32_t v : cache) {
+			if (v != tri[0] && v != tri[1] && v != tri[2]) next_cache.emplace_back(v);
+		}
+		std::swap(cache, next_cache);
+
+		//update scores of vertices in (or just pushed out of) the cache:
+		for (uint32_t i = 0; i < cache.size(); ++i) {
+			uint32_t v = cache[i];
+			cache_position[v] = (i < CacheSize ? int32_t(i) : -1);
+			score[v] = vertex_score(cache_position[v], remaining[v]);
+		}
+
+		//...and of their triangles, picking the best one to emit next:
+		best = uint32_t(-1);
+		float best_score = -1.0f;
+		for (uint32_t v : cache) {
+			for (uint32_t a = 0; a < remaining[v]; ++a) {
+				uint32_t t = adjacency[adjacency_begin[v] + a];
+				float s = score[indices[3*t+0]] + score[indices[3*t+1]] + score[indices[3*t+2]];
+				if (s > best_score) {
+					best_score = s;
+					best = t;
+				}
+			}
+		}
+
+		if (cache.size() > CacheSize) cache.resize(CacheSize);
+	}
+
+	return result;
+}
+
+//------------------------------------------------
+//overdraw optimization:
+// after Sander, Nehab, and Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (2007):
+// split the cache-optimized order into clusters (at points where the cache is cold anyway, or where splitting
+// costs less than 'threshold' times the cluster's miss ratio), then draw outward-facing clusters first.
+
+static std::vector< uint32_t > optimize_overdraw(std::vector< uint32_t > const &indices, std::vector< Vertex > const &vertices, uint32_t cache_size, float threshold) {
+	size_t triangle_count = indices.size() / 3;
+	if (triangle_count == 0) return indices;
+
+	//"hard" cluster boundaries: triangles that miss on all three vertices:
+	std::vector< uint32_t > hard;
+	{
+		CacheSim cache(cache_size, vertices.size());
+		for (uint32_t t = 0; t < triangle_count; ++t) {
+			if (cache.misses(&indices[3*t]) == 3) hard.emplace_back(t);
+		}
+		if (hard.empty() || hard[0] != 0) hard.insert(hard.begin(), 0);
+		hard.emplace_back(uint32_t(triangle_count));
+	}
+
+	//"soft" boundaries: split hard clusters wherever the miss ratio so far is already close to the whole cluster's:
+	std::vector< uint32_t > clusters;
+	{
+		CacheSim cache(cache_size, vertices.size());
+		for (size_t h = 0; h + 1 < hard.size(); ++h) {
+			uint32_t begin = hard[h], end = hard[h+1];
+
+			cache.reset();
+			uint32_t cluster_misses = 0;
+			for (uint32_t t = begin; t < end; ++t) {
+				cluster_misses += cache.misses(&indices[3*t]);
+			}
+			float cluster_threshold = threshold * float(cluster_misses) / float(end - begin);
+
+			cache.reset();
+			clusters.emplace_back(begin);
+			uint32_t running_misses = 0, running_triangles = 0;
+			for (uint32_t t = begin; t < end; ++t) {
+				running_misses += cache.misses(&indices[3*t]);
+				running_triangles += 1;
+				if (t + 1 < end && float(running_misses) / float(running_triangles) <= cluster_threshold) {
+					//(n.b. next cluster starts with a cold cache)
+					clusters.emplace_back(t + 1);
+					cache.reset();
+					running_misses = running_triangles = 0;
+				}
+			}
+		}
+		clusters.emplace_back(uint32_t(triangle_count));
+	}
+
+	//area-weighted centroid and normal of each cluster (and of the whole mesh):
+	struct Cluster {
+		uint32_t begin, end;
+		float sort_key;
+	};
+	std::vector< Cluster > sorted;
+	sorted.reserve(clusters.size() - 1);
+	std::vector< glm::vec3 > centroids, normals;
+	glm::vec3 mesh_centroid = glm::vec3(0.0f);
+	float mesh_area = 0.0f;
+	for (size_t c = 0; c + 1 < clusters.size(); ++c) {
+		glm::vec3 centroid = glm::vec3(0.0f);
+		glm::vec3 normal = glm::vec3(0.0f);
+		float area = 0.0f;
+		for (uint32_t t = clusters[c]; t < clusters[c+1]; ++t) {
+			glm::vec3 const &a = vertices[indices[3*t+0]].Position;
+			glm::vec3 const &b = vertices[indices[3*t+1]].Position;
+			glm::vec3 const &d = vertices[indices[3*t+2]].Position;
+			glm::vec3 n = glm::cross(b - a, d - a); //(length is twice the area)
+			float tri_area = glm::length(n);
+			centroid += (a + b + d) * (tri_area / 3.0f);
+			normal += n;
+			area += tri_area;
+		}
+		mesh_centroid += centroid;
+		mesh_area += area;
+		centroids.emplace_back(area > 0.0f ? centroid / area : centroid);
+		normals.emplace_back(normal);
+	}
+	if (mesh_area > 0.0f) mesh_centroid /= mesh_area;
+
+	for (size_t c = 0; c + 1 < clusters.size(); ++c) {
+		float length = glm::length(normals[c]);
+		glm::vec3 normal = (length > 0.0f ? normals[c] / length : glm::vec3(0.0f));
+		//clusters on the outside of the mesh facing outward are likely to occlude others, so draw those first:
+		sorted.emplace_back(Cluster{ clusters[c], clusters[c+1], glm::dot(centroids[c] - mesh_centroid, normal) });
+	}
+	std::stable_sort(sorted.begin(), sorted.end(), [](Cluster const &a, Cluster const &b) {
+		return a.sort_key > b.sort_key;
+	});
+
+	std::vector< uint32_t > result;
+	result.reserve(indices.size());
+	for (Cluster const &cluster : sorted) {
+		result.insert(result.end(), indices.begin() + 3 * cluster.begin, indices.begin() + 3 * cluster.end);
+	}
+	return result;
+}
+
+//------------------------------------------------
+
+//renumber vertices in order of first use (good for the pre-transform cache), dropping unused vertices:
+static void reorder_vertices(PnctFile::Mesh *mesh_) {
+	assert(mesh_);
+	PnctFile::Mesh &mesh = *mesh_;
+
+	std::vector< uint32_t > remap(mesh.vertices.size(), uint32_t(-1));
+	std::vector< Vertex > vertices;
+	vertices.reserve(mesh.vertices.size());
+	for (uint32_t &i : mesh.indices) {
+		if (remap[i] == uint32_t(-1)) {
+			remap[i] = uint32_t(vertices.size());
+			vertices.emplace_back(mesh.vertices[i]);
+		}
+		i = remap[i];
+	}
+	mesh.vertices = std::move(vertices);
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	//when compiled on windows, unhandled exceptions don't have their message printed, which can make debugging simple issues difficult.
+	try {
+#endif
+
+	std::vector< std::string > args(argv + 1, argv + argc);
+	uint32_t cache_size = 16;
+	bool overdraw = false;
+	float overdraw_threshold = 1.05f;
+	std::vector< std::string > files;
+	bool usage = false;
+	for (size_t i = 0; i < args.size(); ++i) {
+		if (args[i] == "--cache" && i + 1 < args.size()) {
+			cache_size = uint32_t(std::stoul(args[i+1]));
+			i += 1;
+		} else if (args[i] == "--overdraw") {
+			overdraw = true;
+			if (i + 1 < args.size() && !args[i+1].empty() && (std::isdigit(args[i+1][0]) || args[i+1][0] == '.')) {
+				overdraw_threshold = std::stof(args[i+1]);
+				i += 1;
+			}
+		} else if (args[i].substr(0,2) == "--") {
+			usage = true;
+		} else {
+			files.emplace_back(args[i]);
+		}
+	}
+	if (files.size() != 2 || cache_size < 3) usage = true;
+
+	if (usage) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <in.pnct> <out.pnct> [--cache N=16] [--overdraw [threshold=1.05]]\n"
+		          << "Reorders each mesh's triangles for the post-transform vertex cache (and, with --overdraw, to reduce overdraw),\n"
+		          << "and writes the result as an indexed .pnct (in and out may be the same file).\n"
+		          << "Reports the average cache miss ratio (ACMR) of each mesh before and after for a FIFO cache of N vertices." << std::endl;
+		return 1;
+	}
+
+	PnctFile file(files[0]);
+
+	//---- optimize ----
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "ACMR for a " << cache_size << "-vertex FIFO cache (before -> after):" << std::endl;
+	uint64_t total_triangles = 0;
+	double total_before = 0.0, total_after = 0.0;
+	for (PnctFile::Mesh &mesh : file.meshes) {
+		float before = acmr(mesh.indices, mesh.vertices.size(), cache_size);
+
+		mesh.indices = optimize_vertex_cache(mesh.indices, mesh.vertices.size());
+		float optimized = acmr(mesh.indices, mesh.vertices.size(), cache_size);
+		if (overdraw) mesh.indices = optimize_overdraw(mesh.indices, mesh.vertices, cache_size, overdraw_threshold);
+		reorder_vertices(&mesh);
+
+		float after = acmr(mesh.indices, mesh.vertices.size(), cache_size);
+		size_t triangles = mesh.indices.size() / 3;
+		std::cout << "  '" << mesh.name << "': "
+		          << triangles << " triangles, " << mesh.vertices.size() << " vertices, "
+		          << before << " -> " << after;
+		if (overdraw) std::cout << " (" << optimized << " before overdraw sort)";
+		if (!mesh.vertices.empty()) std::cout << ", ATVR " << (after * triangles / mesh.vertices.size());
+		std::cout << std::endl;
+
+		total_triangles += triangles;
+		total_before += double(before) * triangles;
+		total_after += double(after) * triangles;
+	}
+	if (total_triangles) {
+		std::cout << "  total: " << total_triangles << " triangles, "
+		          << (total_before / total_triangles) << " -> " << (total_after / total_triangles) << std::endl;
+	}
+
+	file.write(files[1]);
+	std::cout << "Wrote '" << files[1] << "'." << std::endl;
+
+	return 0;
+
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		throw;
+	}
+#endif
+}
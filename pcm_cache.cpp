@@ -0,0 +1,128 @@
+#include "pcm_cache.hpp"
+#include "read_write_chunk.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+bool pcm_cache_enabled = true;
+
+//cache files hold two chunks: 'pcmk' (one Key) and 'f32m' (48kHz mono float samples)
+namespace {
+	constexpr uint32_t const AUDIO_RATE = 48000;
+	constexpr uint32_t const VERSION = 1; //bump if decoding changes, to ignore old cache files
+
+	struct Key {
+		uint64_t hash = 0; //of source file contents
+		uint64_t size = 0; //of source file
+		int64_t mtime = 0; //of source file
+		uint32_t rate = AUDIO_RATE;
+		uint32_t version = VERSION;
+	};
+	static_assert(sizeof(Key) == 32, "Key is packed");
+}
+
+//64-bit FNV-1a style hash, consuming eight bytes at a time (this runs on every load, so should be quick):
+static uint64_t hash_bytes(uint8_t const *data, size_t size) {
+	uint64_t hash = 0xcbf29ce484222325ULL ^ uint64_t(size);
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		std::memcpy(&word, data + i, 8);
+		hash = (hash ^ word) * 0x100000001b3ULL;
+		hash ^= hash >> 29;
+	}
+	for (; i < size; ++i) {
+		hash = (hash ^ data[i]) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+//key for the current contents of 'source' (or false if it can't be read):
+static bool get_key(std::string const &source, Key *key) {
+	std::error_code ec;
+	auto mtime = std::filesystem::last_write_time(source, ec);
+	if (ec) return false;
+	try {
+		MappedFile file(source);
+		key->hash = hash_bytes(file.data, file.size);
+		key->size = file.size;
+	} catch (std::exception &) {
+		return false;
+	}
+	key->mtime = int64_t(mtime.time_since_epoch().count());
+	return true;
+}
+
+static std::filesystem::path cache_path(std::string const &source, Key const &key) {
+	char name[17];
+	std::snprintf(name, sizeof(name), "%016llx", (unsigned long long)key.hash);
+	return std::filesystem::path(source).parent_path() / "pcm-cache" / (std::string(name) + ".pcm");
+}
+
+std::unique_ptr< MappedFile > pcm_cache_load(std::string const &source, std::span< float const > *data) {
+	if (!pcm_cache_enabled) return nullptr;
+
+	Key key;
+	if (!get_key(source, &key)) return nullptr;
+
+	std::filesystem::path path = cache_path(source, key);
+	std::error_code ec;
+	if (!std::filesystem::exists(path, ec)) return nullptr;
+
+	try {
+		std::unique_ptr< MappedFile > file = std::make_unique< MappedFile >(path.string());
+		size_t at = 0;
+
+		std::vector< Key > unaligned_key;
+		std::span< Key const > stored = map_chunk(*file, &at, "pcmk", &unaligned_key);
+		if (stored.size() != 1 || std::memcmp(&stored[0], &key, sizeof(Key)) != 0) return nullptr; //(out of date)
+
+		std::vector< float > unaligned_samples;
+		std::span< float const > samples = map_chunk(*file, &at, "f32m", &unaligned_samples);
+		if (!unaligned_samples.empty()) return nullptr; //(written aligned, so something is off)
+
+		*data = samples;
+		return file;
+	} catch (std::exception &e) {
+		std::cerr << "WARNING: ignoring cached audio '" << path.string() << "' for '" << source << "': " << e.what() << std::endl;
+		return nullptr;
+	}
+}
+
+void pcm_cache_save(std::string const &source, std::vector< float > const &data) {
+	if (!pcm_cache_enabled) return;
+
+	Key key;
+	if (!get_key(source, &key)) return;
+
+	std::filesystem::path path = cache_path(source, key);
+	std::error_code ec;
+	std::filesystem::create_directories(path.parent_path(), ec);
+	if (ec) {
+		std::cerr << "WARNING: can't make audio cache directory '" << path.parent_path().string() << "': " << ec.message() << std::endl;
+		return;
+	}
+
+	//write to a temporary file and then rename, so a partly-written cache file is never mapped:
+	std::filesystem::path temp = path;
+	temp += ".tmp";
+	{
+		std::ofstream out(temp, std::ios::binary);
+		write_chunk("pcmk", std::vector< Key >{ key }, &out);
+		write_chunk("f32m", data, &out);
+		if (!out) {
+			std::cerr << "WARNING: failed to write cached audio '" << temp.string() << "'." << std::endl;
+			out.close();
+			std::filesystem::remove(temp, ec);
+			return;
+		}
+	}
+	std::filesystem::rename(temp, path, ec);
+	if (ec) {
+		std::cerr << "WARNING: failed to replace cached audio '" << path.string() << "': " << ec.message() << std::endl;
+		std::filesystem::remove(temp, ec);
+	}
+}
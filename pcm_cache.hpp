@@ -0,0 +1,32 @@
+#pragma once
+
+/*
+ * On-disk cache of decoded audio, so that sound files which need decoding (.opus)
+ *  or converting (.wav files that aren't 48kHz mono float) only go through that once:
+ *  later loads map the ready-to-mix samples straight out of the cache file.
+ *
+ * Cache files live in a 'pcm-cache/' directory next to the source file and are
+ *  named by a hash of the source file's contents. They also record the source's
+ *  size and modification time, and are only used if all of these still match.
+ *
+ * Used by Sound::Sample's constructor.
+ *
+ */
+
+#include "MappedFile.hpp"
+
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+//set to false to always decode (and never write cache files):
+extern bool pcm_cache_enabled;
+
+//Map cached samples for 'source'; returns nullptr (and leaves *data alone) if there aren't any,
+// they are out of date, or the cache file is damaged. (*data points into the returned file.)
+std::unique_ptr< MappedFile > pcm_cache_load(std::string const &source, std::span< float const > *data);
+
+//Write samples decoded from 'source' to the cache:
+// note: failures (e.g., read-only data directory) only warn, since the cache is just an optimization.
+void pcm_cache_save(std::string const &source, std::vector< float > const &data);
@@ -1,7 +1,11 @@
 #pragma once
 
+#include "MappedFile.hpp"
+
 #include <iostream>
 #include <vector>
+#include <span>
+#include <cstring>
 #include <stdexcept>
 #include <cassert>
 
@@ -41,6 +45,52 @@ void read_chunk(std::istream &from, std::string const &magic, std::vector< T > *
 }
 
 
+//helper function that gets a view of a chunk (same format as above) in a memory-mapped file without copying it:
+// - *at is the offset of the chunk header in the file; it is advanced past the chunk
+// - the returned span points into 'from' (so is only valid while 'from' is), unless the chunk data
+//   isn't suitably aligned for T, in which case it is copied to *unaligned and the span points there.
+template< typename T >
+std::span< T const > map_chunk(MappedFile const &from, size_t *at_, std::string const &magic, std::vector< T > *unaligned) {
+	assert(at_);
+	assert(unaligned);
+	size_t &at = *at_;
+
+	struct ChunkHeader {
+		char magic[4] = {'\0', '\0', '\0', '\0'};
+		uint32_t size = 0;
+	};
+	static_assert(sizeof(ChunkHeader) == 8, "header is packed");
+
+	ChunkHeader header;
+	if (at > from.size || from.size - at < sizeof(header)) {
+		throw std::runtime_error("Failed to read chunk header");
+	}
+	std::memcpy(&header, from.data + at, sizeof(header));
+	at += sizeof(header);
+	if (std::string(header.magic,4) != magic) {
+		throw std::runtime_error("Unexpected magic number in chunk");
+	}
+
+	if (header.size % sizeof(T) != 0) {
+		throw std::runtime_error("Size of chunk not divisible by element size");
+	}
+	if (from.size - at < header.size) {
+		throw std::runtime_error("Failed to read chunk data.");
+	}
+
+	uint8_t const *begin = from.data + at;
+	size_t count = header.size / sizeof(T);
+	at += header.size;
+
+	if (count == 0) return std::span< T const >();
+	if (reinterpret_cast< uintptr_t >(begin) % alignof(T) != 0) {
+		unaligned->resize(count);
+		std::memcpy(unaligned->data(), begin, header.size);
+		return std::span< T const >(unaligned->data(), count);
+	}
+	return std::span< T const >(reinterpret_cast< T const * >(begin), count);
+}
+
 //helper function to write a chunk of data in the same format as read_chunk:
 template< typename T >
 void write_chunk(std::string const &magic, std::vector< T > const &from, std::ostream *to_) {
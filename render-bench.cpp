@@ -0,0 +1,310 @@
+//render-bench mixes scripted voice loads with Sound's offline mode (no audio device needed)
+// and reports how fast mixing runs compared to real time. Run with --help for usage information.
+
+#include "Sound.hpp"
+#include "load_wav.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <random>
+#include <cstring>
+
+//a quiet test tone, so that results don't depend on any particular asset:
+static std::vector< float > make_tone(float hz, float seconds) {
+	std::vector< float > data(uint32_t(seconds * 48000.0f));
+	for (uint32_t i = 0; i < data.size(); ++i) {
+		data[i] = 0.05f * std::sin(2.0f * 3.1415926f * hz * (i / 48000.0f));
+	}
+	return data;
+}
+
+//A script plays a voice load: start() is called once, then update() at 60Hz of (simulated) game time:
+struct Script {
+	virtual ~Script() { }
+	virtual void start() = 0;
+	virtual void update(uint32_t frame) = 0;
+};
+
+//"loops": 'count' 2D voices looping at fixed volume and pan:
+struct LoopsScript : Script {
+	LoopsScript(uint32_t count_, std::vector< std::unique_ptr< Sound::Sample > > const &tones_) : count(count_), tones(tones_) { }
+	uint32_t count;
+	std::vector< std::unique_ptr< Sound::Sample > > const &tones;
+	void start() override {
+		for (uint32_t v = 0; v < count; ++v) {
+			Sound::loop(*tones[v % tones.size()], 0.5f / count, (v % 9) / 4.0f - 1.0f);
+		}
+	}
+	void update(uint32_t) override { }
+};
+
+//"moving": 'count' 3D voices circling a listener that turns, with positions updated every frame:
+struct MovingScript : Script {
+	MovingScript(uint32_t count_, std::vector< std::unique_ptr< Sound::Sample > > const &tones_) : count(count_), tones(tones_) { }
+	uint32_t count;
+	std::vector< std::unique_ptr< Sound::Sample > > const &tones;
+	std::vector< Sound::PlayingSample > voices;
+	void start() override {
+		for (uint32_t v = 0; v < count; ++v) {
+			voices.emplace_back(Sound::loop_3D(*tones[v % tones.size()], 0.5f / count, glm::vec3(0.0f), 2.0f));
+		}
+	}
+	void update(uint32_t frame) override {
+		for (uint32_t v = 0; v < voices.size(); ++v) {
+			float t = frame / 60.0f + v;
+			float radius = 1.0f + (v % 8);
+			voices[v].set_position(radius * glm::vec3(std::cos(t), std::sin(t), 0.1f * (v % 3)));
+		}
+		float t = frame / 60.0f;
+		Sound::listener.set_position_right(glm::vec3(0.0f), glm::vec3(std::cos(0.3f * t), std::sin(0.3f * t), 0.0f));
+	}
+};
+
+//"pitched": 'count' looping voices whose playback rates sweep (so every voice is resampled):
+struct PitchedScript : Script {
+	PitchedScript(uint32_t count_, std::vector< std::unique_ptr< Sound::Sample > > const &tones_) : count(count_), tones(tones_) { }
+	uint32_t count;
+	std::vector< std::unique_ptr< Sound::Sample > > const &tones;
+	std::vector< Sound::PlayingSample > voices;
+	void start() override {
+		for (uint32_t v = 0; v < count; ++v) {
+			voices.emplace_back(Sound::loop(*tones[v % tones.size()], 0.5f / count, 0.0f, 0, 0.5f + 0.01f * v));
+		}
+	}
+	void update(uint32_t frame) override {
+		//(a few voices per frame, as a game might)
+		for (uint32_t v = frame % 4; v < voices.size(); v += 4) {
+			voices[v].set_rate(std::exp2(std::sin(frame / 60.0f + v)), 1.0f / 15.0f);
+		}
+	}
+};
+
+//"oneshots": 'count' short 3D sounds started per second, at random places, volumes, and rates:
+struct OneshotsScript : Script {
+	OneshotsScript(uint32_t count_, std::vector< std::unique_ptr< Sound::Sample > > const &tones_) : count(count_), tones(tones_) { }
+	uint32_t count;
+	std::vector< std::unique_ptr< Sound::Sample > > const &tones;
+	std::mt19937 mt = std::mt19937(0xbe11);
+	void start() override { }
+	void update(uint32_t frame) override {
+		std::uniform_real_distribution< float > unit(0.0f, 1.0f);
+		//spread starts evenly over frames:
+		uint32_t starts = uint32_t((uint64_t(frame + 1) * count) / 60 - (uint64_t(frame) * count) / 60);
+		for (uint32_t s = 0; s < starts; ++s) {
+			Sound::Sample const &tone = *tones[mt() % tones.size()];
+			glm::vec3 at = glm::vec3(20.0f * unit(mt) - 10.0f, 20.0f * unit(mt) - 10.0f, 0.0f);
+			float rate = (mt() % 2 == 0 ? 1.0f : 0.75f + 0.5f * unit(mt));
+			Sound::play_3D(tone, 0.05f + 0.1f * unit(mt), at, 2.0f, 0, rate);
+		}
+	}
+};
+
+//"crowd": 'count' looping 3D voices scattered over a few square kilometers, with the listener walking through them
+// (most are far enough away to be virtual -- see Sound::set_audibility_threshold):
+struct CrowdScript : Script {
+	CrowdScript(uint32_t count_, std::vector< std::unique_ptr< Sound::Sample > > const &tones_) : count(count_), tones(tones_) { }
+	uint32_t count;
+	std::vector< std::unique_ptr< Sound::Sample > > const &tones;
+	std::mt19937 mt = std::mt19937(0xc20d);
+	void start() override {
+		std::uniform_real_distribution< float > unit(0.0f, 1.0f);
+		for (uint32_t v = 0; v < count; ++v) {
+			glm::vec3 at = glm::vec3(4000.0f * unit(mt) - 2000.0f, 4000.0f * unit(mt) - 2000.0f, 0.0f);
+			Sound::loop_3D(*tones[v % tones.size()], 0.1f, at, 1.0f);
+		}
+	}
+	void update(uint32_t frame) override {
+		//walk at a brisk 50 m/s (so voices cross the threshold often):
+		float t = frame / 60.0f;
+		glm::vec3 at = glm::vec3(50.0f * t - 1000.0f, 500.0f * std::sin(0.05f * t), 0.0f);
+		Sound::listener.set_position_right(at, glm::vec3(std::cos(0.2f * t), std::sin(0.2f * t), 0.0f));
+	}
+};
+
+//"mixed": all of the above at once, splitting 'count' between them:
+struct MixedScript : Script {
+	MixedScript(uint32_t count, std::vector< std::unique_ptr< Sound::Sample > > const &tones)
+		: loops(count / 4, tones), moving(count / 4, tones), pitched(count / 4, tones), oneshots(count, tones) { }
+	LoopsScript loops;
+	MovingScript moving;
+	PitchedScript pitched;
+	OneshotsScript oneshots;
+	void start() override { loops.start(); moving.start(); pitched.start(); oneshots.start(); }
+	void update(uint32_t frame) override { loops.update(frame); moving.update(frame); pitched.update(frame); oneshots.update(frame); }
+};
+
+static std::unique_ptr< Script > make_script(std::string const &name, uint32_t count, std::vector< std::unique_ptr< Sound::Sample > > const &tones) {
+	if (name == "loops") return std::make_unique< LoopsScript >(count, tones);
+	if (name == "moving") return std::make_unique< MovingScript >(count, tones);
+	if (name == "pitched") return std::make_unique< PitchedScript >(count, tones);
+	if (name == "oneshots") return std::make_unique< OneshotsScript >(count, tones);
+	if (name == "crowd") return std::make_unique< CrowdScript >(count, tones);
+	if (name == "mixed") return std::make_unique< MixedScript >(count, tones);
+	throw std::runtime_error("Unknown scenario '" + name + "'; expecting loops, moving, pitched, oneshots, crowd, mixed, or all.");
+}
+
+struct Result {
+	std::vector< float > block_times; //seconds spent in each Sound::render() call
+	double update_time = 0.0; //seconds spent in Sound::update() (the game thread's share of the work)
+	uint32_t updates = 0;
+	uint64_t real_voices = 0, virtual_voices = 0; //summed over blocks (from Sound::get_stats())
+	uint64_t hash = 0; //of the rendered audio
+	std::vector< float > audio; //(only kept if asked for)
+};
+
+//render 'seconds' of a scenario in 'block'-frame blocks, running its script at 60Hz of rendered time:
+static Result run(std::string const &name, uint32_t count, float seconds, uint32_t block, bool keep_audio,
+	std::vector< std::unique_ptr< Sound::Sample > > const &tones) {
+
+	Sound::init_offline();
+	std::unique_ptr< Script > script = make_script(name, count, tones);
+	script->start();
+
+	Result result;
+	uint64_t total = uint64_t(seconds * 48000.0f);
+	uint64_t rendered = 0;
+	uint32_t frame = 0; //script updates so far
+	std::vector< float > out(2 * block);
+	result.hash = 0xcbf29ce484222325ull;
+	while (rendered < total) {
+		//script updates (each followed by Sound::update(), as a game's frame would be) that happen before this block starts:
+		while (uint64_t(frame) * 48000 <= rendered * 60) {
+			script->update(frame);
+			auto before = std::chrono::steady_clock::now();
+			Sound::update(1.0f / 60.0f);
+			result.update_time += std::chrono::duration< double >(std::chrono::steady_clock::now() - before).count();
+			++result.updates;
+			++frame;
+		}
+
+		uint32_t frames = uint32_t(std::min< uint64_t >(block, total - rendered));
+		auto before = std::chrono::steady_clock::now();
+		Sound::render(out.data(), frames);
+		result.block_times.emplace_back(std::chrono::duration< float >(std::chrono::steady_clock::now() - before).count());
+		Sound::Stats stats = Sound::get_stats();
+		result.real_voices += stats.real_voices;
+		result.virtual_voices += stats.virtual_voices;
+
+		//FNV-1a over the bits of the output:
+		for (uint32_t i = 0; i < 2 * frames; ++i) {
+			uint32_t bits;
+			static_assert(sizeof(bits) == sizeof(float), "floats are 32 bits");
+			std::memcpy(&bits, &out[i], sizeof(bits));
+			result.hash = (result.hash ^ bits) * 0x100000001b3ull;
+		}
+		if (keep_audio) result.audio.insert(result.audio.end(), out.begin(), out.begin() + 2 * frames);
+		rendered += frames;
+	}
+
+	script.reset();
+	Sound::shutdown();
+	return result;
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	//when compiled on windows, unhandled exceptions don't have their message printed, which can make debugging simple issues difficult.
+	try {
+#endif
+
+	std::vector< std::string > args;
+	std::string wav;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--wav" && i + 1 < argc) {
+			wav = argv[++i];
+		} else if (arg == "--binaural") {
+			Sound::set_spatializer(Sound::Spatializer::Binaural);
+		} else if (arg == "--max-real" && i + 1 < argc) {
+			Sound::set_max_real_voices(uint32_t(std::stoul(argv[++i])));
+		} else if (arg == "--no-virtual") {
+			Sound::set_audibility_threshold(0.0f);
+		} else {
+			args.emplace_back(arg);
+		}
+	}
+
+	if (args.size() > 4 || (args.size() >= 1 && (args[0] == "-h" || args[0] == "--help"))) {
+		std::cerr << "Usage:\n"
+			"\t" << argv[0] << " [scenario=all] [voices=64] [seconds=10] [block=512] [--binaural] [--max-real N] [--no-virtual] [--wav out.wav]\n"
+			"\t\trender a scripted voice load with Sound's offline mode; report real-time factor and per-block times\n"
+			"\t\tscenario is one of: loops, moving, pitched, oneshots (voices is starts per second), crowd, mixed, all\n"
+			"\t\t--binaural spatializes 3D voices with HRTFs instead of panning them\n"
+			"\t\t--max-real mixes at most N voices (the loudest) at once; --no-virtual mixes even inaudible voices\n"
+			"\t\t--wav saves the rendered audio (of the last scenario run)\n"
+		;
+		return 1;
+	}
+
+	std::string scenario = (args.size() >= 1 ? args[0] : "all");
+	uint32_t count = (args.size() >= 2 ? uint32_t(std::stoul(args[1])) : 64);
+	float seconds = (args.size() >= 3 ? std::stof(args[2]) : 10.0f);
+	uint32_t block = (args.size() >= 4 ? uint32_t(std::stoul(args[3])) : 512);
+	if (block == 0) throw std::runtime_error("Block size must be at least one frame.");
+
+	std::vector< std::unique_ptr< Sound::Sample > > tones;
+	for (uint32_t t = 0; t < 8; ++t) {
+		tones.emplace_back(std::make_unique< Sound::Sample >(make_tone(220.0f * (t + 1), 0.25f + 0.25f * t)));
+	}
+
+	std::vector< std::string > scenarios;
+	if (scenario == "all") scenarios = { "loops", "moving", "pitched", "oneshots", "crowd", "mixed" };
+	else scenarios = { scenario };
+
+	float block_seconds = block / 48000.0f;
+	std::cout << "Rendering " << seconds << " seconds per scenario in " << block << "-frame blocks (" << block_seconds * 1e3f << " ms of audio each):" << std::endl;
+
+	bool deterministic = true;
+	for (auto const &name : scenarios) {
+		bool keep = (!wav.empty() && &name == &scenarios.back());
+		Result result = run(name, count, seconds, block, keep, tones);
+		//(a second run should produce exactly the same audio)
+		Result again = run(name, count, seconds, block, false, tones);
+
+		std::vector< float > times = result.block_times;
+		double total = 0.0;
+		for (float t : times) total += t;
+		std::sort(times.begin(), times.end());
+		auto percentile = [&](float p) {
+			return times[std::min< size_t >(times.size() - 1, size_t(p * times.size()))];
+		};
+
+		double rtf = total / seconds;
+		std::cout << "  " << name << " (" << count << "):" << std::endl;
+		std::cout << "    real-time factor: " << rtf << " (" << 1.0 / rtf << "x faster than real time)" << std::endl;
+		std::cout << "    per block: p50 " << percentile(0.5f) * 1e6f << " us, p90 " << percentile(0.9f) * 1e6f << " us, p99 " << percentile(0.99f) * 1e6f
+		          << " us, p99.9 " << percentile(0.999f) * 1e6f << " us, max " << times.back() * 1e6f << " us (of " << block_seconds * 1e6f << " us)" << std::endl;
+		double blocks = double(result.block_times.size());
+		std::cout << "    Sound::update(): " << (result.update_time / std::max(result.updates, 1U)) * 1e6 << " us average over " << result.updates << " frames" << std::endl;
+		std::cout << "    voices per block: " << result.real_voices / blocks << " real, " << result.virtual_voices / blocks << " virtual" << std::endl;
+		std::cout << "    deterministic: " << (result.hash == again.hash ? "yes" : "NO") << std::endl;
+		if (result.hash != again.hash) deterministic = false;
+
+		if (keep) {
+			save_wav(wav, result.audio, 2);
+			std::cout << "    wrote '" << wav << "'" << std::endl;
+		}
+	}
+
+	if (!deterministic) {
+		std::cerr << "ERROR: rendering the same script twice gave different audio." << std::endl;
+		return 1;
+	}
+	return 0;
+
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		throw;
+	}
+#endif
+}
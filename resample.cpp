@@ -0,0 +1,159 @@
+#include "resample.hpp"
+#include "Sound.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <memory>
+
+//resample() picks rows with the top 8 bits of the position's fraction:
+static_assert(ResamplePhases == (1 << 8), "ResamplePhases should match the bits used to pick a row");
+
+//zeroth-order modified Bessel function of the first kind (for the Kaiser window):
+static double bessel_i0(double x) {
+	double sum = 1.0;
+	double term = 1.0;
+	for (uint32_t k = 1; k < 64; ++k) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if (term < sum * 1e-12) break;
+	}
+	return sum;
+}
+
+ResampleFilter::ResampleFilter(uint32_t taps, float cutoff, float kaiser_beta) {
+	assert(taps % 8 == 0 && taps >= 8 && taps * MaxResampleRate <= MaxResampleTaps);
+	assert(cutoff > 0.0f && cutoff <= 1.0f);
+
+	constexpr double Pi = 3.14159265358979323846;
+	double const i0_beta = bessel_i0(kaiser_beta);
+
+	for (float scale : { 1.0f, 1.5f, 2.0f, 3.0f, 4.0f }) {
+		Band band;
+		band.max_rate = scale;
+		band.taps = (uint32_t(std::ceil(taps * scale)) + 7) / 8 * 8;
+		double band_cutoff = double(cutoff) / scale;
+		double half = 0.5 * band.taps;
+
+		//row p is the filter for an output sample (p / ResamplePhases) past source sample n,
+		// with tap j applying to source sample (n - taps/2 + 1 + j); one extra row (p == ResamplePhases) for the deltas:
+		std::vector< float > rows((ResamplePhases + 1) * band.taps);
+		for (uint32_t p = 0; p <= ResamplePhases; ++p) {
+			double phase = p / double(ResamplePhases);
+			float *row = &rows[p * band.taps];
+			double sum = 0.0;
+			for (uint32_t j = 0; j < band.taps; ++j) {
+				double d = (double(j) + 1.0 - half) - phase; //distance from output to source sample
+				double x = band_cutoff * d;
+				double sinc = (x == 0.0 ? 1.0 : std::sin(Pi * x) / (Pi * x));
+				double w = d / half;
+				double window = (std::abs(w) >= 1.0 ? 0.0 : bessel_i0(kaiser_beta * std::sqrt(1.0 - w * w)) / i0_beta);
+				double h = band_cutoff * sinc * window;
+				row[j] = float(h);
+				sum += h;
+			}
+			//unity gain at DC, so that slowly-changing signals don't get louder or quieter:
+			for (uint32_t j = 0; j < band.taps; ++j) {
+				row[j] = float(row[j] / sum);
+			}
+		}
+
+		band.rows.assign(rows.begin(), rows.begin() + ResamplePhases * band.taps);
+		band.deltas.resize(ResamplePhases * band.taps);
+		for (uint32_t k = 0; k < band.deltas.size(); ++k) {
+			band.deltas[k] = rows[k + band.taps] - rows[k];
+		}
+		bands.emplace_back(std::move(band));
+	}
+}
+
+ResampleFilter::Band const &ResampleFilter::band_for(float rate) const {
+	for (auto const &band : bands) {
+		if (rate <= band.max_rate) return band;
+	}
+	return bands.back();
+}
+
+ResampleFilter const *ResampleFilter::for_quality(Sound::ResampleQuality quality) {
+	static std::unique_ptr< ResampleFilter > fast, good, best;
+	switch (quality) {
+		case Sound::ResampleQuality::Linear:
+			return nullptr;
+		case Sound::ResampleQuality::Fast:
+			if (!fast) fast = std::make_unique< ResampleFilter >(8, 0.80f, 5.0f);
+			return fast.get();
+		case Sound::ResampleQuality::Good:
+			if (!good) good = std::make_unique< ResampleFilter >(16, 0.88f, 7.0f);
+			return good.get();
+		case Sound::ResampleQuality::Best:
+			if (!best) best = std::make_unique< ResampleFilter >(32, 0.94f, 9.0f);
+			return best.get();
+	}
+	return nullptr;
+}
+
+uint32_t resample(float *out, uint32_t count,
+	float const *data, uint32_t size, uint32_t *i_, uint32_t *frac_, bool loop,
+	float rate, float drate,
+	ResampleFilter const *filter,
+	FilterDotFn dot) {
+
+	assert(size > 0);
+	//position in 32.32 fixed point:
+	uint64_t const end = uint64_t(size) << 32;
+	uint64_t position = (uint64_t(*i_) << 32) | *frac_;
+
+	//(one band for the whole call, picked for the fastest rate reached)
+	ResampleFilter::Band const *band = nullptr;
+	if (filter) band = &filter->band_for(std::max(rate, rate + float(count) * drate));
+
+	uint32_t k = 0;
+	for (; k < count; ++k) {
+		if (position >= end) {
+			if (!loop) break;
+			position %= end;
+		}
+		uint32_t n = uint32_t(position >> 32);
+		uint32_t frac = uint32_t(position);
+
+		if (band == nullptr) {
+			float a = data[n];
+			float b = (n + 1 < size ? data[n + 1] : (loop ? data[0] : 0.0f));
+			out[k] = a + (b - a) * (float(frac) * (1.0f / 4294967296.0f));
+		} else {
+			uint32_t taps = band->taps;
+			int64_t first = int64_t(n) + 1 - int64_t(taps / 2);
+			float const *src;
+			float window[MaxResampleTaps];
+			if (first >= 0 && first + taps <= size) {
+				src = data + first;
+			} else {
+				//near the ends of the sample, gather the (wrapped or zero-padded) neighborhood:
+				for (uint32_t j = 0; j < taps; ++j) {
+					int64_t s = first + j;
+					if (loop) {
+						s %= int64_t(size);
+						if (s < 0) s += size;
+						window[j] = data[s];
+					} else {
+						window[j] = (s >= 0 && s < int64_t(size) ? data[s] : 0.0f);
+					}
+				}
+				src = window;
+			}
+			uint32_t p = frac >> 24; //(top bits pick a row...)
+			float t = float(frac & 0xffffff) * (1.0f / 16777216.0f); //(...and the rest blend it with the next)
+			out[k] = dot(&band->rows[p * taps], &band->deltas[p * taps], t, src, taps);
+		}
+
+		float r = rate + float(k) * drate;
+		position += uint64_t(double(r) * 4294967296.0);
+	}
+
+	if (position >= end) {
+		position = (loop ? position % end : end);
+	}
+	*i_ = uint32_t(position >> 32);
+	*frac_ = uint32_t(position);
+	return k;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+/*
+ * Variable-rate playback of mono sample data (used by Sound.cpp for voices
+ *  whose playback rate isn't 1:1).
+ *
+ * Output samples are computed with a windowed-sinc ("polyphase") filter:
+ *  the filter is precomputed at ResamplePhases fractional offsets, and each
+ *  output sample blends the two nearest offsets and takes a dot product with
+ *  the surrounding source samples (filter_dot, in mix_kernels.hpp).
+ *
+ * When playing faster than 1:1, the filter's cutoff must drop to keep
+ *  source frequencies above the new Nyquist limit from aliasing; so filters
+ *  are precomputed for several "bands" of rate, with wider (more taps)
+ *  filters for faster rates.
+ *
+ */
+
+#include "mix_kernels.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace Sound {
+	enum class ResampleQuality : uint8_t; //(in Sound.hpp)
+}
+
+//fractional offsets the filter is tabulated at:
+constexpr uint32_t ResamplePhases = 256;
+
+//supported playback rates (callers should clamp to these):
+constexpr float MinResampleRate = 1.0f / 64.0f;
+constexpr float MaxResampleRate = 4.0f;
+
+//widest filter ever used (taps * the largest band), for scratch buffers:
+constexpr uint32_t MaxResampleTaps = 32 * 4;
+
+struct ResampleFilter {
+	//'taps' source samples (a multiple of 8, at most 32) are used per output sample at rates <= 1.0;
+	// 'cutoff' is the passband edge as a fraction of the source Nyquist frequency, and
+	// 'kaiser_beta' trades stopband rejection for transition width:
+	ResampleFilter(uint32_t taps, float cutoff, float kaiser_beta);
+
+	struct Band {
+		float max_rate; //use this band for rates up to (and including) this
+		uint32_t taps;
+		std::vector< float > rows; //ResamplePhases rows of 'taps' coefficients
+		std::vector< float > deltas; //difference between each row and the next (the last row's "next" is row 0 shifted by one tap)
+	};
+	std::vector< Band > bands; //in order of increasing max_rate
+
+	Band const &band_for(float rate) const;
+
+	//the filter for a quality tier (nullptr for ResampleQuality::Linear), built on first use and kept until exit:
+	// (not thread-safe; Sound calls this from the game thread)
+	static ResampleFilter const *for_quality(Sound::ResampleQuality quality);
+};
+
+//Produce 'count' samples of 'data' (data[0 .. size-1]) played at a rate that starts at 'rate'
+// and changes by 'drate' per output sample, starting at position (*i + *frac / 2^32):
+// - uses 'filter', or linear interpolation if 'filter' is nullptr
+// - reads past the ends of 'data' as silence, or wrap around if 'loop'
+// - advances *i and *frac; if a non-looping sample ends, *i == size and fewer than 'count' samples are produced
+// - returns the number of samples written to 'out'
+uint32_t resample(float *out, uint32_t count,
+	float const *data, uint32_t size, uint32_t *i, uint32_t *frac, bool loop,
+	float rate, float drate,
+	ResampleFilter const *filter,
+	FilterDotFn dot = filter_dot);
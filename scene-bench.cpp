@@ -0,0 +1,338 @@
+//scene-bench times scene-management code on large synthetic scenes.
+// Run with no arguments for usage information.
+
+#include "Scene.hpp"
+
+#include <glm/gtc/quaternion.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <random>
+
+//build a random hierarchy of 'count' transforms, 'depth' levels deep
+// (parents always come before their children in scene.transforms):
+static std::vector< Scene::Transform * > make_hierarchy(Scene &scene, uint32_t count, uint32_t depth, std::mt19937 &mt) {
+	std::uniform_real_distribution< float > unit(0.0f, 1.0f);
+
+	std::vector< Scene::Transform * > ret;
+	std::vector< std::vector< Scene::Transform * > > levels(depth);
+	for (uint32_t i = 0; i < count; ++i) {
+		uint32_t level = i % depth; //(so every level gets about the same number of transforms)
+		scene.transforms.emplace_back();
+		Scene::Transform &t = scene.transforms.back();
+		t.name = "t" + std::to_string(i);
+		if (level > 0) {
+			auto const &parents = levels[level - 1];
+			t.parent = parents[mt() % parents.size()];
+		}
+		t.position = glm::vec3(unit(mt), unit(mt), unit(mt)) - 0.5f;
+		t.rotation = glm::angleAxis(unit(mt) * 6.28f, glm::normalize(glm::vec3(unit(mt), unit(mt), unit(mt)) + 0.1f));
+		t.scale = glm::vec3(0.9f + 0.2f * unit(mt));
+		levels[level].emplace_back(&t);
+		ret.emplace_back(&t);
+	}
+	return ret;
+}
+
+//"transforms": compare recomputing world matrices (make_world_from_local) against the cached update and transform arrays:
+static int transforms(uint32_t count, uint32_t depth, uint32_t frames) {
+	std::mt19937 mt(0x15466);
+	Scene scene;
+	std::vector< Scene::Transform * > all = make_hierarchy(scene, count, depth, mt);
+
+	std::cout << "Transforms: " << count << " nodes, depth " << depth << ", " << frames << " frames." << std::endl;
+
+	//touch a fraction of the transforms each frame (through Transform * or, with arrays storage, through handles):
+	bool use_handles = false;
+	auto animate = [&](uint32_t frame, float fraction) {
+		uint32_t moved = uint32_t(std::ceil(fraction * float(all.size())));
+		for (uint32_t m = 0; m < moved; ++m) {
+			Scene::Transform &t = *all[(frame * 7919u + m * 104729u) % all.size()];
+			if (use_handles) {
+				Scene::TransformHandle h = t.handle();
+				h.set_rotation(glm::normalize(h.rotation() * glm::angleAxis(0.01f, glm::vec3(0.0f, 0.0f, 1.0f))));
+			} else {
+				t.rotation = glm::normalize(t.rotation * glm::angleAxis(0.01f, glm::vec3(0.0f, 0.0f, 1.0f)));
+				t.mark_changed(); //(only needed with arrays storage)
+			}
+		}
+	};
+
+	float checksum = 0.0f; //(keeps the compiler from skipping work)
+
+	auto time = [&](float fraction, auto &&fn) -> float {
+		auto before = std::chrono::steady_clock::now();
+		for (uint32_t f = 0; f < frames; ++f) {
+			animate(f, fraction);
+			fn();
+		}
+		return std::chrono::duration< float >(std::chrono::steady_clock::now() - before).count() / float(frames);
+	};
+
+	//what Scene::draw does without caching (once per transform):
+	auto recompute = [&]() {
+		for (auto const &t : scene.transforms) {
+			checksum += t.make_world_from_local()[3].x;
+		}
+	};
+	//list storage with cache, or arrays storage with gather (of adapters marked changed):
+	auto cached = [&]() {
+		scene.update_world_from_local();
+		for (auto const &t : scene.transforms) {
+			checksum += t.world_from_local()[3].x;
+		}
+	};
+	//arrays storage, all changes through handles (so no need to gather):
+	auto sweep = [&]() {
+		scene.transform_arrays.update_world_from_local();
+		for (auto const &m : scene.transform_arrays.world_from_local) {
+			checksum += m[3].x;
+		}
+	};
+
+	//check that cached world transforms match recomputed ones:
+	auto max_diff = [](Scene const &s) {
+		float diff = 0.0f;
+		for (auto const &t : s.transforms) {
+			glm::mat4x3 a = t.make_world_from_local();
+			glm::mat4x3 const &b = t.world_from_local();
+			for (uint32_t c = 0; c < 4; ++c) {
+				for (uint32_t r = 0; r < 3; ++r) {
+					diff = std::max(diff, std::abs(a[c][r] - b[c][r]));
+				}
+			}
+		}
+		return diff;
+	};
+
+	std::cout << "  (times are per frame; 'arrays' gathers changes made through Transform * (and marked), 'handles' writes the arrays directly;" << std::endl;
+	std::cout << "   speedups are against recomputing, and, in brackets, arrays storage against cached list storage)" << std::endl;
+	for (float fraction : {1.0f, 0.1f, 0.01f, 0.0f}) {
+		scene.set_transform_storage(Scene::TransformStorage::List);
+		scene.update_world_from_local(); //(prime cache)
+		float recompute_time = time(fraction, recompute);
+		float cached_time = time(fraction, cached);
+
+		scene.set_transform_storage(Scene::TransformStorage::Arrays);
+		float arrays_time = time(fraction, cached);
+		use_handles = true;
+		float handles_time = time(fraction, sweep);
+		use_handles = false;
+
+		std::cout << "  " << 100.0f * fraction << "% of nodes moving: recompute " << recompute_time * 1e3f << " ms, cached " << cached_time * 1e3f << " ms (" << recompute_time / cached_time << "x)"
+			<< ", arrays " << arrays_time * 1e3f << " ms (" << recompute_time / arrays_time << "x) [" << cached_time / arrays_time << "x]"
+			<< ", handles " << handles_time * 1e3f << " ms (" << recompute_time / handles_time << "x) [" << cached_time / handles_time << "x]" << std::endl;
+	}
+
+	scene.update_world_from_local();
+	float arrays_diff = max_diff(scene);
+
+	//copies keep arrays storage:
+	Scene copy = scene;
+	copy.update_world_from_local();
+	float copy_diff = max_diff(copy);
+
+	scene.set_transform_storage(Scene::TransformStorage::List);
+	scene.update_world_from_local();
+	float cached_diff = max_diff(scene);
+
+	std::cout << "  max difference from recomputed: cached " << cached_diff << ", arrays " << arrays_diff << ", arrays (copy) " << copy_diff << " (checksum " << checksum << ")" << std::endl;
+
+	if (copy.transform_storage != Scene::TransformStorage::Arrays || copy.transform_arrays.size() != count) {
+		std::cerr << "ERROR: scene copy didn't keep transform arrays." << std::endl;
+		return 1;
+	}
+	if (std::max(cached_diff, std::max(arrays_diff, copy_diff)) > 1e-3f) {
+		std::cerr << "ERROR: cached world transforms don't match." << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+//build a flat "city" of 'count' boxes scattered over a square, each with a drawable:
+static void make_city(Scene &scene, uint32_t count, std::mt19937 &mt) {
+	std::uniform_real_distribution< float > unit(0.0f, 1.0f);
+	float size = 4.0f * std::sqrt(float(count)); //(about one box per 16 square units)
+	for (uint32_t i = 0; i < count; ++i) {
+		scene.transforms.emplace_back();
+		Scene::Transform &t = scene.transforms.back();
+		t.name = "b" + std::to_string(i);
+		t.position = glm::vec3((unit(mt) - 0.5f) * size, (unit(mt) - 0.5f) * size, 0.0f);
+		t.rotation = glm::angleAxis(unit(mt) * 6.28f, glm::vec3(0.0f, 0.0f, 1.0f));
+		scene.drawables.emplace_back(&t);
+		Scene::Drawable &d = scene.drawables.back();
+		d.min = glm::vec3(-0.5f, -0.5f, 0.0f);
+		d.max = glm::vec3( 0.5f,  0.5f, 1.0f + 4.0f * unit(mt));
+	}
+}
+
+//"bvh": time building, refitting, and querying Scene's bvh against linear scans over the drawables:
+static int bvh(std::vector< uint32_t > const &counts, uint32_t frames) {
+	std::cout << "BVH: " << frames << " frames per test." << std::endl;
+
+	auto seconds_since = [](auto before) {
+		return std::chrono::duration< float >(std::chrono::steady_clock::now() - before).count();
+	};
+
+	for (uint32_t count : counts) {
+		std::mt19937 mt(0x15466);
+		std::uniform_real_distribution< float > unit(0.0f, 1.0f);
+
+		Scene scene;
+		make_city(scene, count, mt);
+		scene.cache_world_transforms = true;
+		scene.use_bvh = true;
+		scene.update_world_from_local();
+
+		std::vector< Scene::Transform * > all;
+		for (auto &t : scene.transforms) all.emplace_back(&t);
+
+		//--- build ---
+		float build_time = 0.0f;
+		for (uint32_t f = 0; f < frames; ++f) {
+			scene.bvh.clear(); //(update_bvh notices and rebuilds)
+			auto before = std::chrono::steady_clock::now();
+			scene.update_bvh();
+			build_time += seconds_since(before);
+		}
+
+		//--- refit (10% of objects moving) ---
+		float refit_time = 0.0f;
+		for (uint32_t f = 0; f < frames; ++f) {
+			for (uint32_t m = 0; m < count / 10; ++m) {
+				Scene::Transform &t = *all[(f * 7919u + m * 104729u) % all.size()];
+				t.position += glm::vec3(unit(mt) - 0.5f, unit(mt) - 0.5f, 0.0f);
+			}
+			scene.update_world_from_local();
+			auto before = std::chrono::steady_clock::now();
+			scene.update_bvh();
+			refit_time += seconds_since(before);
+		}
+
+		//--- frustum queries (camera in the middle of the city, looking in various directions) ---
+		Scene::Transform camera_transform;
+		Scene::Camera camera(&camera_transform);
+		camera.aspect = 16.0f / 9.0f;
+		float frustum_bvh_time = 0.0f, frustum_linear_time = 0.0f;
+		uint64_t visible_bvh = 0, visible_linear = 0;
+		for (uint32_t f = 0; f < frames; ++f) {
+			camera_transform.position = glm::vec3(0.0f, 0.0f, 2.0f);
+			camera_transform.rotation = glm::angleAxis(f * 0.3f, glm::vec3(0.0f, 0.0f, 1.0f)) * glm::angleAxis(1.4f, glm::vec3(1.0f, 0.0f, 0.0f));
+			glm::mat4 clip_from_world = camera.make_projection() * glm::mat4(camera_transform.make_local_from_world());
+			glm::vec4 planes[6];
+			BVH::frustum_planes(clip_from_world, planes);
+
+			auto before = std::chrono::steady_clock::now();
+			scene.bvh.query_frustum(planes, [&](uint32_t) { visible_bvh += 1; });
+			frustum_bvh_time += seconds_since(before);
+
+			//(what Scene::draw does without a bvh: transform every box and test it)
+			before = std::chrono::steady_clock::now();
+			for (auto const &d : scene.drawables) {
+				glm::mat4x3 const &world_from_object = d.transform->world_from_local();
+				glm::vec3 center = world_from_object * glm::vec4(0.5f * (d.min + d.max), 1.0f);
+				glm::vec3 half = 0.5f * (d.max - d.min);
+				glm::vec3 extent = glm::abs(world_from_object[0]) * half.x + glm::abs(world_from_object[1]) * half.y + glm::abs(world_from_object[2]) * half.z;
+				bool inside = true;
+				for (glm::vec4 const &p : planes) {
+					if (glm::dot(glm::vec3(p), center) + p.w + glm::dot(glm::abs(glm::vec3(p)), extent) < 0.0f) { inside = false; break; }
+				}
+				if (inside) visible_linear += 1;
+			}
+			frustum_linear_time += seconds_since(before);
+		}
+
+		//--- ray queries (picking) ---
+		constexpr uint32_t Rays = 100;
+		float ray_bvh_time = 0.0f, ray_linear_time = 0.0f;
+		uint32_t mismatched = 0;
+		for (uint32_t f = 0; f < frames; ++f) {
+			std::vector< std::pair< glm::vec3, glm::vec3 > > rays;
+			for (uint32_t r = 0; r < Rays; ++r) {
+				float angle = unit(mt) * 6.28f;
+				rays.emplace_back(glm::vec3(0.0f, 0.0f, 2.0f), glm::vec3(std::cos(angle), std::sin(angle), -0.05f * unit(mt)));
+			}
+			std::vector< Scene::Drawable const * > hits_bvh, hits_linear;
+
+			scene.use_bvh = true;
+			auto before = std::chrono::steady_clock::now();
+			for (auto const &ray : rays) hits_bvh.emplace_back(scene.pick(ray.first, ray.second));
+			ray_bvh_time += seconds_since(before);
+
+			scene.use_bvh = false;
+			before = std::chrono::steady_clock::now();
+			for (auto const &ray : rays) hits_linear.emplace_back(scene.pick(ray.first, ray.second));
+			ray_linear_time += seconds_since(before);
+			scene.use_bvh = true;
+
+			for (uint32_t r = 0; r < Rays; ++r) {
+				if (hits_bvh[r] != hits_linear[r]) mismatched += 1;
+			}
+		}
+
+		float ms = 1e3f / float(frames);
+		std::cout << "  " << count << " objects:\n"
+			<< "    build " << build_time * ms << " ms, refit (10% moving) " << refit_time * ms << " ms\n"
+			<< "    frustum: bvh " << frustum_bvh_time * ms << " ms, linear " << frustum_linear_time * ms << " ms (" << frustum_linear_time / frustum_bvh_time << "x); "
+				<< visible_bvh / frames << " visible\n"
+			<< "    " << Rays << " rays: bvh " << ray_bvh_time * ms << " ms, linear " << ray_linear_time * ms << " ms (" << ray_linear_time / ray_bvh_time << "x)"
+			<< std::endl;
+
+		if (visible_bvh != visible_linear || mismatched != 0) {
+			std::cerr << "ERROR: bvh and linear results differ (" << visible_bvh << " vs " << visible_linear << " visible, " << mismatched << " different ray hits)." << std::endl;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	//when compiled on windows, unhandled exceptions don't have their message printed, which can make debugging simple issues difficult.
+	try {
+#endif
+
+	std::vector< std::string > args(argv + 1, argv + argc);
+
+	if (args.size() >= 1 && args[0] == "transforms") {
+		uint32_t count = (args.size() >= 2 ? uint32_t(std::stoul(args[1])) : 10000);
+		uint32_t depth = (args.size() >= 3 ? uint32_t(std::stoul(args[2])) : 20);
+		uint32_t frames = (args.size() >= 4 ? uint32_t(std::stoul(args[3])) : 100);
+		if (depth == 0 || count < depth) throw std::runtime_error("Need at least one node per level.");
+		return transforms(count, depth, frames);
+	}
+
+	if (args.size() >= 1 && args[0] == "bvh") {
+		uint32_t frames = (args.size() >= 2 ? uint32_t(std::stoul(args[1])) : 20);
+		if (frames == 0) throw std::runtime_error("Need at least one frame.");
+		std::vector< uint32_t > counts;
+		for (uint32_t i = 2; i < args.size(); ++i) {
+			counts.emplace_back(uint32_t(std::stoul(args[i])));
+		}
+		if (counts.empty()) counts = {1000, 10000, 100000};
+		return bvh(counts, frames);
+	}
+
+	std::cerr << "Usage:\n"
+		"\t" << argv[0] << " transforms [nodes=10000] [depth=20] [frames=100]\n"
+		"\t\ttime world-matrix computation with and without Scene's cache (and with transform arrays) on a random hierarchy\n"
+		"\t" << argv[0] << " bvh [frames=20] [objects...=1000 10000 100000]\n"
+		"\t\ttime building, refitting, frustum and ray queries of Scene's bvh (against linear scans) on a random city\n"
+	;
+	return 1;
+
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		throw;
+	}
+#endif
+}
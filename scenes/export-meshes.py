@@ -3,6 +3,7 @@
 #based on 'export-sprites.py' and 'glsprite.py' from TCHOW Rainbow; code used is released into the public domain.
 #Patched for 15-466-f19 to remove non-pnct formats!
 #Patched for 15-466-f20 to merge data all at once (slightly faster)
+#Patched to write indexed meshes (deduplicated vertices + ix16/ix32 index chunk + idx1 index)
 
 #Note: Script meant to be executed within blender 4.2.1, as per:
 #blender --background --python export-meshes.py -- [...see below...]
@@ -88,16 +89,22 @@ def set_visible(layer_collection):
 
 set_visible(bpy.context.view_layer.layer_collection)
 
-#data contains vertex, normal, color, and texture data from the meshes:
+#data contains (deduplicated) vertex, normal, color, and texture data from the meshes:
 data = []
 
+#indices contains, for each mesh, the (mesh-relative) vertex index of each triangle corner:
+indices = []
+
 #strings contains the mesh names:
 strings = b''
 
-#index gives offsets into the data (and names) for each mesh:
-index = b''
+#index gives offsets into the data, indices, and names for each mesh:
+# (written at the end, once the index size is known)
+entries = []
 
 vertex_count = 0
+index_count = 0
+soup_count = 0 #vertices that would have been written without indexing (for stats)
 for obj in bpy.data.objects:
 	if obj.data in to_write:
 		to_write.remove(obj.data)
@@ -130,15 +137,10 @@ for obj in bpy.data.objects:
 	bpy.ops.mesh.quads_convert_to_tris(quad_method='BEAUTY', ngon_method='BEAUTY')
 	bpy.ops.object.mode_set(mode='OBJECT')
 
-	#record mesh name, start position and vertex count in the index:
+	#record mesh name:
 	name_begin = len(strings)
 	strings += bytes(name, "utf8")
 	name_end = len(strings)
-	index += struct.pack('I', name_begin)
-	index += struct.pack('I', name_end)
-
-	index += struct.pack('I', vertex_count) #vertex_begin
-	#...count will be written below
 
 	colors = None
 	if len(obj.data.color_attributes) == 0:
@@ -156,7 +158,10 @@ for obj in bpy.data.objects:
 		if len(obj.data.uv_layers) != 1:
 			print("WARNING: object '" + name + "' has multiple texture coordinate layers; only exporting '" + obj.data.uv_layers.active.name + "'")
 
-	local_data = b''
+	#unique vertices in this mesh (packed bytes => mesh-relative index):
+	local_vertices = dict()
+	local_data = []
+	local_indices = []
 
 	#write the mesh triangles:
 	for poly in mesh.polygons:
@@ -165,10 +170,11 @@ for obj in bpy.data.objects:
 			assert(mesh.loops[poly.loop_indices[i]].vertex_index == poly.vertices[i])
 			loop = mesh.loops[poly.loop_indices[i]]
 			vertex = mesh.vertices[loop.vertex_index]
+			vertex_data = b''
 			for x in vertex.co:
-				local_data += struct.pack('f', x)
+				vertex_data += struct.pack('f', x)
 			for x in loop.normal:
-				local_data += struct.pack('f', x)
+				vertex_data += struct.pack('f', x)
 
 			col = None
 			if colors != None and colors.domain == 'POINT':
@@ -177,42 +183,68 @@ for obj in bpy.data.objects:
 				col = colors.data[poly.loop_indices[i]].color
 			else:
 				col = (1.0, 1.0, 1.0, 1.0)
-			local_data += struct.pack('BBBB', int(col[0] * 255), int(col[1] * 255), int(col[2] * 255), 255)
+			vertex_data += struct.pack('BBBB', int(col[0] * 255), int(col[1] * 255), int(col[2] * 255), 255)
 
 			if uvs != None:
 				uv = uvs[poly.loop_indices[i]].uv
-				local_data += struct.pack('ff', uv.x, uv.y)
+				vertex_data += struct.pack('ff', uv.x, uv.y)
 			else:
-				local_data += struct.pack('ff', 0, 0)
-		if len(local_data) > 1000:
-			data.append(local_data)
-			local_data = b''
-	vertex_count += len(mesh.polygons) * 3
+				vertex_data += struct.pack('ff', 0, 0)
+
+			#corners with identical attributes share a vertex:
+			if vertex_data not in local_vertices:
+				local_vertices[vertex_data] = len(local_data)
+				local_data.append(vertex_data)
+			local_indices.append(local_vertices[vertex_data])
 
-	data.append(local_data)
+	data.extend(local_data)
+	indices.append(local_indices)
+	entries.append((name_begin, name_end, vertex_count, vertex_count + len(local_data), index_count, index_count + len(local_indices)))
 
-	index += struct.pack('I', vertex_count) #vertex_end
+	vertex_count += len(local_data)
+	index_count += len(local_indices)
+	soup_count += len(mesh.polygons) * 3
 
 data = b''.join(data)
 
 #check that code created as much data as anticipated:
 assert(vertex_count * (4*3+4*3+1*4+4*2) == len(data))
 
+#indices are relative to each mesh's first vertex, so 16 bits are enough unless some mesh has more than 65536 vertices:
+max_local = max([ e[3] - e[2] for e in entries ] + [ 0 ])
+if max_local <= 0x10000:
+	index_magic = b'ix16'
+	index_format = 'H'
+else:
+	index_magic = b'ix32'
+	index_format = 'I'
+index_data = b''.join( struct.pack(str(len(l)) + index_format, *l) for l in indices )
+assert(index_count * struct.calcsize(index_format) == len(index_data))
+
+index = b''.join( struct.pack('IIIIII', *e) for e in entries )
+
 #write the data chunk and index chunk to an output blob:
 blob = open(outfile, 'wb')
 #first chunk: the data
 blob.write(struct.pack('4s',b'pnct')) #type
 blob.write(struct.pack('I', len(data))) #length
 blob.write(data)
-#second chunk: the strings
+#second chunk: the indices
+blob.write(struct.pack('4s',index_magic)) #type
+blob.write(struct.pack('I', len(index_data))) #length
+blob.write(index_data)
+#third chunk: the strings
 blob.write(struct.pack('4s',b'str0')) #type
 blob.write(struct.pack('I', len(strings))) #length
 blob.write(strings)
-#third chunk: the index
-blob.write(struct.pack('4s',b'idx0')) #type
+#fourth chunk: the index
+blob.write(struct.pack('4s',b'idx1')) #type
 blob.write(struct.pack('I', len(index))) #length
 blob.write(index)
 wrote = blob.tell()
 blob.close()
 
-print("Wrote " + str(wrote) + " bytes [== " + str(len(data)+8) + " bytes of data + " + str(len(strings)+8) + " bytes of strings + " + str(len(index)+8) + " bytes of index] to '" + outfile + "'")
+print("Wrote " + str(wrote) + " bytes [== " + str(len(data)+8) + " bytes of data + " + str(len(index_data)+8) + " bytes of indices + " + str(len(strings)+8) + " bytes of strings + " + str(len(index)+8) + " bytes of index] to '" + outfile + "'")
+if soup_count > 0:
+	soup_bytes = soup_count * (4*3+4*3+1*4+4*2)
+	print("  " + str(vertex_count) + " unique vertices for " + str(soup_count) + " triangle corners; vertex + index data is " + str(len(data) + len(index_data)) + " bytes vs " + str(soup_bytes) + " unindexed (" + "{:.2f}".format(soup_bytes / max(1, len(data) + len(index_data))) + "x smaller)")
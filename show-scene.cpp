@@ -123,6 +123,16 @@ int main(int argc, char **argv) {
 				drawable.pipeline.type = mesh.type;
 				drawable.pipeline.start = mesh.start;
 				drawable.pipeline.count = mesh.count;
+				drawable.pipeline.index_type = mesh.index_type;
+				drawable.pipeline.base_vertex = mesh.base_vertex;
+				drawable.pipeline.position_offset = mesh.position_offset;
+				drawable.pipeline.position_scale = mesh.position_scale;
+				for (Mesh const &lod : mesh.lods) {
+					drawable.lods.emplace_back(Scene::Drawable::LOD{ lod.start, lod.count, lod.base_vertex, lod.position_offset, lod.position_scale, lod.lod_error });
+				}
+
+				drawable.min = mesh.min;
+				drawable.max = mesh.max;
 
 			});
 		} catch (std::exception &e) {
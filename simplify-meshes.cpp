@@ -0,0 +1,399 @@
+//simplify-meshes adds coarser levels of detail for each mesh in a .pnct file,
+// made by quadric-error edge collapse (Garland and Heckbert, "Surface Simplification
+// Using Quadric Error Metrics", 1997).
+//
+//Each level is stored as its own mesh, named "<name>/lod<N>", and listed in the
+// file's 'lod0' chunk along with its error, so MeshBuffer can attach it to the
+// full-detail mesh (see Mesh::lods) and Scene::draw can pick levels by screen size.
+//
+//Collapses only ever move a vertex onto one of its neighbors (so no new vertices are made),
+// and vertices on mesh borders or attribute seams (e.g., UV island edges or hard normals) stay put.
+
+#include "PnctFile.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using Vertex = PnctFile::Vertex;
+
+//sum of (weighted) squared distances to a set of planes:
+struct Quadric {
+	//symmetric 4x4 matrix of plane coefficient products (a, b, c, d), upper triangle:
+	double aa = 0.0, ab = 0.0, ac = 0.0, ad = 0.0;
+	double bb = 0.0, bc = 0.0, bd = 0.0;
+	double cc = 0.0, cd = 0.0;
+	double dd = 0.0;
+	double weight = 0.0; //total weight of planes
+
+	//add plane a*x + b*y + c*z + d = 0 (with |(a,b,c)| = 1):
+	void add_plane(double a, double b, double c, double d, double w) {
+		aa += w * a * a; ab += w * a * b; ac += w * a * c; ad += w * a * d;
+		bb += w * b * b; bc += w * b * c; bd += w * b * d;
+		cc += w * c * c; cd += w * c * d;
+		dd += w * d * d;
+		weight += w;
+	}
+	Quadric &operator+=(Quadric const &o) {
+		aa += o.aa; ab += o.ab; ac += o.ac; ad += o.ad;
+		bb += o.bb; bc += o.bc; bd += o.bd;
+		cc += o.cc; cd += o.cd;
+		dd += o.dd;
+		weight += o.weight;
+		return *this;
+	}
+	//weighted mean squared distance from 'p' to the planes:
+	double evaluate(glm::vec3 const &p) const {
+		double x = p.x, y = p.y, z = p.z;
+		double sum = x*x*aa + y*y*bb + z*z*cc
+		           + 2.0 * (x*y*ab + x*z*ac + y*z*bc)
+		           + 2.0 * (x*ad + y*bd + z*cd)
+		           + dd;
+		return (weight > 0.0 ? std::max(0.0, sum) / weight : 0.0);
+	}
+};
+
+//simplification state for one mesh; levels are made one after another, each starting from the last:
+struct Simplifier {
+	Simplifier(std::vector< Vertex > const &vertices, std::vector< uint32_t > const &indices);
+
+	//collapse edges until the mesh has at most 'target' triangles, or the next collapse would move
+	// the surface more than 'max_error'; returns false if nothing could be collapsed:
+	bool reduce(size_t target, float max_error);
+
+	std::vector< Vertex > const &vertices;
+	std::vector< uint32_t > indices; //current triangles (indexing 'vertices')
+	float error = 0.0f; //largest collapse error so far
+
+	//per position (vertices with the same position are collapsed together):
+	std::vector< uint32_t > position_of; //for each vertex, the position it is at
+	std::vector< glm::vec3 > positions;
+	std::vector< Quadric > quadrics;
+	std::vector< bool > locked; //on a border, seam, or non-manifold edge
+
+	size_t triangle_count() const { return indices.size() / 3; }
+};
+
+Simplifier::Simplifier(std::vector< Vertex > const &vertices_, std::vector< uint32_t > const &indices_) : vertices(vertices_), indices(indices_) {
+	//weld vertices by (exact) position:
+	{
+		std::unordered_map< std::string, uint32_t > ids;
+		position_of.reserve(vertices.size());
+		for (Vertex const &v : vertices) {
+			std::string key(reinterpret_cast< char const * >(&v.Position), sizeof(v.Position));
+			auto ret = ids.emplace(key, uint32_t(positions.size()));
+			if (ret.second) positions.emplace_back(v.Position);
+			position_of.emplace_back(ret.first->second);
+		}
+	}
+
+	//seams: positions used by more than one (referenced) vertex:
+	locked.assign(positions.size(), false);
+	{
+		std::vector< uint32_t > vertex_at(positions.size(), -1U);
+		for (uint32_t v : indices) {
+			uint32_t p = position_of[v];
+			if (vertex_at[p] == -1U) vertex_at[p] = v;
+			else if (vertex_at[p] != v) locked[p] = true;
+		}
+	}
+
+	//borders and non-manifold edges: edges not used by exactly two triangles:
+	{
+		std::map< std::pair< uint32_t, uint32_t >, uint32_t > edge_uses;
+		for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+			for (uint32_t c = 0; c < 3; ++c) {
+				uint32_t a = position_of[indices[i + c]];
+				uint32_t b = position_of[indices[i + (c + 1) % 3]];
+				edge_uses[std::make_pair(std::min(a,b), std::max(a,b))] += 1;
+			}
+		}
+		for (auto const &[edge, uses] : edge_uses) {
+			if (uses != 2) {
+				locked[edge.first] = true;
+				locked[edge.second] = true;
+			}
+		}
+	}
+
+	//quadrics from (area-weighted) triangle planes:
+	quadrics.assign(positions.size(), Quadric());
+	for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+		glm::vec3 const &a = positions[position_of[indices[i+0]]];
+		glm::vec3 const &b = positions[position_of[indices[i+1]]];
+		glm::vec3 const &c = positions[position_of[indices[i+2]]];
+		glm::vec3 n = glm::cross(b - a, c - a);
+		float length = glm::length(n);
+		if (length == 0.0f) continue;
+		n /= length;
+		double d = -double(glm::dot(n, a));
+		for (uint32_t k = 0; k < 3; ++k) {
+			quadrics[position_of[indices[i+k]]].add_plane(n.x, n.y, n.z, d, 0.5 * length);
+		}
+	}
+}
+
+bool Simplifier::reduce(size_t target, float max_error) {
+	bool reduced = false;
+
+	while (triangle_count() > target) {
+		size_t triangles = triangle_count();
+
+		//triangles around each position:
+		std::vector< std::vector< uint32_t > > around(positions.size());
+		for (uint32_t t = 0; t < triangles; ++t) {
+			for (uint32_t c = 0; c < 3; ++c) {
+				around[position_of[indices[3*t+c]]].emplace_back(t);
+			}
+		}
+
+		//candidate collapses (moving position 'from' onto position 'to'), cheapest first:
+		struct Collapse {
+			uint32_t from, to;
+			float error;
+		};
+		std::vector< Collapse > collapses;
+		for (uint32_t t = 0; t < triangles; ++t) {
+			for (uint32_t c = 0; c < 3; ++c) {
+				uint32_t from = position_of[indices[3*t+c]];
+				uint32_t to = position_of[indices[3*t+(c+1)%3]];
+				if (from == to || locked[from]) continue;
+				collapses.emplace_back(Collapse{ from, to, float(std::sqrt(quadrics[from].evaluate(positions[to]))) });
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](Collapse const &a, Collapse const &b) {
+			if (a.error != b.error) return a.error < b.error;
+			if (a.from != b.from) return a.from < b.from;
+			return a.to < b.to;
+		});
+
+		//apply as many as possible, touching each neighborhood at most once per pass:
+		// (so each collapse can be checked against the mesh as it was at the start of the pass)
+		std::vector< bool > touched(positions.size(), false);
+		std::vector< bool > dead(triangles, false);
+		std::vector< uint32_t > remap(vertices.size());
+		for (uint32_t v = 0; v < remap.size(); ++v) remap[v] = v;
+		size_t remaining = triangles;
+		for (Collapse const &collapse : collapses) {
+			if (remaining <= target) break;
+			if (collapse.error > max_error) break;
+			if (touched[collapse.from] || touched[collapse.to]) continue;
+
+			//the vertex at 'to' on the collapsing edge (must be the same in every triangle on the edge):
+			uint32_t to_vertex = -1U;
+			uint32_t on_edge = 0;
+			bool ok = true;
+			for (uint32_t t : around[collapse.from]) {
+				for (uint32_t c = 0; c < 3; ++c) {
+					uint32_t v = indices[3*t+c];
+					if (position_of[v] != collapse.to) continue;
+					if (to_vertex == -1U) to_vertex = v;
+					else if (to_vertex != v) ok = false;
+					on_edge += 1;
+				}
+			}
+			if (!ok || on_edge != 2) continue;
+
+			//link condition: 'from' and 'to' should share exactly the two neighbors across the edge (otherwise the result isn't manifold):
+			{
+				std::vector< uint32_t > from_neighbors, to_neighbors;
+				for (uint32_t t : around[collapse.from]) {
+					for (uint32_t c = 0; c < 3; ++c) from_neighbors.emplace_back(position_of[indices[3*t+c]]);
+				}
+				for (uint32_t t : around[collapse.to]) {
+					for (uint32_t c = 0; c < 3; ++c) to_neighbors.emplace_back(position_of[indices[3*t+c]]);
+				}
+				for (auto *list : {&from_neighbors, &to_neighbors}) {
+					std::sort(list->begin(), list->end());
+					list->erase(std::unique(list->begin(), list->end()), list->end());
+				}
+				std::vector< uint32_t > shared;
+				std::set_intersection(from_neighbors.begin(), from_neighbors.end(), to_neighbors.begin(), to_neighbors.end(), std::back_inserter(shared));
+				//(shared includes 'from' and 'to' themselves)
+				if (shared.size() != 4) continue;
+			}
+
+			//don't flip (or squash flat) any of the triangles that move:
+			for (uint32_t t : around[collapse.from]) {
+				glm::vec3 p[3], q[3];
+				bool on_collapsing_edge = false;
+				for (uint32_t c = 0; c < 3; ++c) {
+					uint32_t pos = position_of[indices[3*t+c]];
+					if (pos == collapse.to) on_collapsing_edge = true;
+					p[c] = positions[pos];
+					q[c] = (pos == collapse.from ? positions[collapse.to] : p[c]);
+				}
+				if (on_collapsing_edge) continue;
+				glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+				if (glm::dot(before, after) <= 0.1f * glm::length(before) * glm::length(after)) {
+					ok = false;
+					break;
+				}
+			}
+			if (!ok) continue;
+
+			//collapse:
+			for (uint32_t t : around[collapse.from]) {
+				bool on_collapsing_edge = false;
+				for (uint32_t c = 0; c < 3; ++c) {
+					uint32_t v = indices[3*t+c];
+					if (position_of[v] == collapse.to) on_collapsing_edge = true;
+					touched[position_of[v]] = true;
+					if (position_of[v] == collapse.from) remap[v] = to_vertex;
+				}
+				if (on_collapsing_edge) {
+					dead[t] = true;
+					remaining -= 1;
+				}
+			}
+			quadrics[collapse.to] += quadrics[collapse.from];
+			error = std::max(error, collapse.error);
+			reduced = true;
+		}
+
+		if (remaining == triangles) break; //(no progress)
+
+		//rebuild triangle list:
+		std::vector< uint32_t > next;
+		next.reserve(remaining * 3);
+		for (uint32_t t = 0; t < triangles; ++t) {
+			if (dead[t]) continue;
+			for (uint32_t c = 0; c < 3; ++c) {
+				next.emplace_back(remap[indices[3*t+c]]);
+			}
+		}
+		indices = std::move(next);
+	}
+
+	return reduced;
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	//when compiled on windows, unhandled exceptions don't have their message printed, which can make debugging simple issues difficult.
+	try {
+#endif
+
+	std::vector< std::string > args(argv + 1, argv + argc);
+	std::vector< float > ratios;
+	float max_error = 0.05f;
+	std::vector< std::string > files;
+	bool usage = false;
+	for (size_t i = 0; i < args.size(); ++i) {
+		if (args[i] == "--levels") {
+			while (i + 1 < args.size() && !args[i+1].empty() && (std::isdigit(args[i+1][0]) || args[i+1][0] == '.')) {
+				ratios.emplace_back(std::stof(args[i+1]));
+				i += 1;
+			}
+		} else if (args[i] == "--max-error" && i + 1 < args.size()) {
+			max_error = std::stof(args[i+1]);
+			i += 1;
+		} else if (args[i].substr(0,2) == "--") {
+			usage = true;
+		} else {
+			files.emplace_back(args[i]);
+		}
+	}
+	if (ratios.empty()) ratios = { 0.5f, 0.25f, 0.125f };
+	if (files.size() != 2) usage = true;
+	for (float ratio : ratios) {
+		if (!(ratio > 0.0f && ratio < 1.0f)) usage = true;
+	}
+
+	if (usage) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <in.pnct> <out.pnct> [--levels ratio...=0.5 0.25 0.125] [--max-error E=0.05]\n"
+		          << "Adds levels of detail with (about) 'ratio' times the triangles of each mesh, stopping early for any mesh\n"
+		          << "where simplifying further would move the surface by more than E times half its bounding box diagonal.\n"
+		          << "Existing levels of detail in in.pnct are replaced. (in and out may be the same file)" << std::endl;
+		return 1;
+	}
+	std::sort(ratios.begin(), ratios.end(), std::greater< float >());
+
+	PnctFile in(files[0]);
+
+	//(existing levels of detail are dropped and re-made)
+	std::vector< bool > is_lod(in.meshes.size(), false);
+	for (auto const &lod : in.lods) is_lod[lod.mesh] = true;
+
+	PnctFile out;
+	for (uint32_t m = 0; m < in.meshes.size(); ++m) {
+		if (!is_lod[m]) out.meshes.emplace_back(in.meshes[m]);
+	}
+
+	std::cout << std::fixed << std::setprecision(4);
+	uint32_t full_count = uint32_t(out.meshes.size());
+	for (uint32_t m = 0; m < full_count; ++m) {
+		//n.b. copies, since out.meshes grows below:
+		std::string name = out.meshes[m].name;
+		std::vector< Vertex > vertices = out.meshes[m].vertices;
+		size_t triangles = out.meshes[m].indices.size() / 3;
+
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+		for (uint32_t i : out.meshes[m].indices) {
+			min = glm::min(min, vertices[i].Position);
+			max = glm::max(max, vertices[i].Position);
+		}
+		float radius = (triangles ? 0.5f * glm::length(max - min) : 0.0f);
+
+		std::cout << "  '" << name << "': " << triangles << " triangles";
+
+		Simplifier simplifier(vertices, out.meshes[m].indices);
+		size_t last = triangles;
+		uint32_t level = 0;
+		for (float ratio : ratios) {
+			if (radius == 0.0f) break;
+			simplifier.reduce(size_t(std::ceil(ratio * triangles)), max_error * radius);
+			//(not worth a level unless it saves at least 10% over the previous one)
+			if (simplifier.triangle_count() == 0 || simplifier.triangle_count() > 0.9f * last) break;
+			last = simplifier.triangle_count();
+			level += 1;
+
+			//keep just the vertices this level uses:
+			PnctFile::Mesh lod;
+			lod.name = name + "/lod" + std::to_string(level);
+			std::vector< uint32_t > remap(vertices.size(), -1U);
+			for (uint32_t i : simplifier.indices) {
+				if (remap[i] == -1U) {
+					remap[i] = uint32_t(lod.vertices.size());
+					lod.vertices.emplace_back(vertices[i]);
+				}
+				lod.indices.emplace_back(remap[i]);
+			}
+
+			float error = simplifier.error / radius;
+			std::cout << ", lod" << level << " " << simplifier.triangle_count() << " (error " << error << ")";
+			out.lods.emplace_back(PnctFile::LOD{ uint32_t(out.meshes.size()), m, error });
+			out.meshes.emplace_back(std::move(lod));
+		}
+		if (level == 0) std::cout << " (no levels of detail)";
+		std::cout << std::endl;
+	}
+
+	out.write(files[1]);
+	std::cout << "Wrote '" << files[1] << "' with " << out.lods.size() << " levels of detail." << std::endl;
+
+	return 0;
+
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		throw;
+	}
+#endif
+}
@@ -0,0 +1,956 @@
+//sound-bench exercises the audio system and reports on how well it keeps up.
+// Run with no arguments for usage information.
+
+#include "Sound.hpp"
+#include "mix_kernels.hpp"
+#include "resample.hpp"
+#include "hrtf.hpp"
+#include "pcm_cache.hpp"
+#include "load_wav.hpp"
+#include "SampleCache.hpp"
+
+#include <SDL3/SDL.h>
+#include <SDL3/SDL_main.h>
+
+#include <chrono>
+#include <thread>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <random>
+
+//a quiet test tone, so that benchmarks don't depend on any particular asset:
+static std::vector< float > make_tone(float hz, float seconds) {
+	std::vector< float > data(uint32_t(seconds * 48000.0f));
+	for (uint32_t i = 0; i < data.size(); ++i) {
+		data[i] = 0.05f * std::sin(2.0f * 3.1415926f * hz * (i / 48000.0f));
+	}
+	return data;
+}
+
+//"stress": hammer voices with parameter updates from a simulated 60fps game loop (calling Sound::update() each frame),
+// and report how often the audio callback ran late; then check that a burst of starts too big for the command queue
+// still delivers its last voice -- which is stopped right away -- with nothing but Sound::update() called after it:
+static int stress(uint32_t updates_per_frame, float seconds) {
+	Sound::init();
+
+	Sound::Sample tone(make_tone(440.0f, 1.0f));
+
+	std::vector< Sound::PlayingSample > voices;
+	for (uint32_t v = 0; v < 64; ++v) {
+		if (v % 2 == 0) {
+			voices.emplace_back(Sound::loop(tone, 0.1f, 0.0f));
+		} else {
+			voices.emplace_back(Sound::loop_3D(tone, 0.1f, glm::vec3(float(v), 0.0f, 0.0f), 2.0f));
+		}
+	}
+
+	std::cout << "Stress: " << voices.size() << " voices, " << updates_per_frame << " updates per frame, " << seconds << " seconds." << std::endl;
+
+	auto const frame = std::chrono::microseconds(16667);
+	uint32_t frames = uint32_t(seconds * 60.0f);
+	float max_submit = 0.0f;
+	float total_submit = 0.0f;
+
+	auto next = std::chrono::steady_clock::now();
+	for (uint32_t f = 0; f < frames; ++f) {
+		auto before = std::chrono::steady_clock::now();
+		for (uint32_t u = 0; u < updates_per_frame; ++u) {
+			auto &voice = voices[u % voices.size()];
+			float t = (f + u / float(updates_per_frame)) / 60.0f;
+			switch (u % 3) {
+				case 0: voice.set_volume(0.05f + 0.05f * std::sin(t)); break;
+				case 1: voice.set_pan(std::sin(3.0f * t)); break;
+				default: voice.set_position(glm::vec3(std::cos(t), std::sin(t), 0.0f) * 5.0f); break;
+			}
+		}
+		Sound::listener.set_position_right(glm::vec3(0.0f), glm::vec3(std::cos(f / 60.0f), std::sin(f / 60.0f), 0.0f));
+		Sound::update(1.0f / 60.0f);
+		float submit = std::chrono::duration< float >(std::chrono::steady_clock::now() - before).count();
+		max_submit = std::max(max_submit, submit);
+		total_submit += submit;
+
+		next += frame;
+		std::this_thread::sleep_until(next);
+	}
+
+	Sound::Stats stats = Sound::get_stats();
+
+	//let the loops fade out:
+	Sound::stop_all_samples();
+	for (uint32_t f = 0; f < 60 && Sound::get_stats().active_voices != 0; ++f) {
+		Sound::update(1.0f / 60.0f);
+		std::this_thread::sleep_for(frame);
+	}
+
+	//a burst of (very short) starts that overfills the queue, ending with a loop that is stopped right away:
+	// (holding the audio lock, so the callback can't drain the queue partway through)
+	Sound::Sample blip(make_tone(880.0f, 0.001f));
+	uint64_t deferred_before = Sound::get_stats().deferred_commands;
+	uint64_t commands_before = Sound::get_stats().commands;
+	uint32_t const burst = 20000;
+	Sound::lock();
+	for (uint32_t u = 0; u < burst; ++u) {
+		Sound::play(blip, 0.01f);
+	}
+	Sound::loop(tone, 0.1f).stop(0.0f);
+	Sound::unlock();
+	uint64_t burst_deferred = Sound::get_stats().deferred_commands - deferred_before;
+	//...after which the game only calls Sound::update() (not playing(), which would flush as well):
+	uint32_t burst_frames = 0;
+	bool burst_stopped = false;
+	for (; burst_frames < 60 && !burst_stopped; ++burst_frames) {
+		Sound::update(1.0f / 60.0f);
+		std::this_thread::sleep_for(frame);
+		Sound::Stats now = Sound::get_stats();
+		//(the loop has to have started -- it's the last command -- and finished)
+		burst_stopped = (now.commands - commands_before == burst + 1 && now.active_voices == 0);
+	}
+
+	std::cout << "  game thread: " << (total_submit / frames) * 1e3f << " ms average, " << max_submit * 1e3f << " ms max spent on updates (including Sound::update()) per frame" << std::endl;
+	std::cout << "  callbacks: " << stats.callbacks << ", late: " << stats.late_callbacks;
+	if (stats.callbacks) std::cout << " (" << 100.0f * float(stats.late_callbacks) / float(stats.callbacks) << "%)";
+	std::cout << std::endl;
+	std::cout << "  commands applied: " << stats.commands << ", deferred because queue was full: " << stats.deferred_commands << std::endl;
+	std::cout << "  max gap between callbacks: " << stats.max_callback_gap * 1e3f << " ms, max time in callback: " << stats.max_mix_time * 1e3f << " ms" << std::endl;
+	std::cout << "  burst ending in a stopped loop: " << burst_deferred << " commands deferred; loop ";
+	if (burst_stopped) std::cout << "stopped after " << burst_frames << " frames" << std::endl;
+	else std::cout << "NOT stopped after " << burst_frames << " frames" << std::endl;
+
+	Sound::shutdown();
+
+	if (stats.callbacks == 0) {
+		std::cerr << "WARNING: the audio callback never ran (no audio device?), so timing results are meaningless." << std::endl;
+		return 1;
+	}
+	if (!burst_stopped) {
+		std::cerr << "ERROR: the loop stopped at the end of a burst never finished." << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+//"oneshots": trigger many short sounds per second (more than fit in the voice pool) and report on voice stealing:
+static int oneshots(uint32_t per_second, float seconds, Sound::StealPolicy policy) {
+	Sound::init();
+	Sound::set_steal_policy(policy);
+
+	std::vector< std::unique_ptr< Sound::Sample > > tones;
+	for (uint32_t t = 0; t < 8; ++t) {
+		tones.emplace_back(std::make_unique< Sound::Sample >(make_tone(220.0f * (t + 1), 0.25f + 0.25f * t)));
+	}
+
+	std::cout << "One-shots: " << per_second << " per second for " << seconds << " seconds, " << Sound::MaxVoices << " voices." << std::endl;
+
+	std::mt19937 mt(0x15466);
+	std::uniform_real_distribution< float > unit(0.0f, 1.0f);
+
+	auto const frame = std::chrono::microseconds(16667);
+	uint32_t frames = uint32_t(seconds * 60.0f);
+	float max_play = 0.0f;
+	uint32_t played = 0;
+	uint32_t not_played = 0;
+
+	auto next = std::chrono::steady_clock::now();
+	for (uint32_t f = 0; f < frames; ++f) {
+		//spread triggers evenly over frames:
+		uint32_t count = uint32_t((uint64_t(f + 1) * per_second) / 60 - (uint64_t(f) * per_second) / 60);
+		auto before = std::chrono::steady_clock::now();
+		for (uint32_t c = 0; c < count; ++c) {
+			Sound::Sample const &tone = *tones[mt() % tones.size()];
+			int32_t priority = int32_t(mt() % 4);
+			Sound::PlayingSample ps = Sound::play_3D(tone, 0.05f + 0.1f * unit(mt), glm::vec3(20.0f * unit(mt) - 10.0f, 20.0f * unit(mt) - 10.0f, 0.0f), 2.0f, priority);
+			if (ps.playing()) ++played;
+			else ++not_played;
+		}
+		Sound::update(1.0f / 60.0f);
+		max_play = std::max(max_play, std::chrono::duration< float >(std::chrono::steady_clock::now() - before).count());
+
+		next += frame;
+		std::this_thread::sleep_until(next);
+	}
+
+	Sound::Stats stats = Sound::get_stats();
+	Sound::stop_all_samples();
+	Sound::update(1.0f / 60.0f);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	std::cout << "  started: " << played << ", not started: " << not_played << std::endl;
+	std::cout << "  active voices at end: " << stats.active_voices << ", stolen: " << stats.stolen_voices << ", dropped: " << stats.dropped_voices << std::endl;
+	std::cout << "  game thread: " << max_play * 1e3f << " ms max spent starting sounds (and in Sound::update()) per frame" << std::endl;
+	std::cout << "  callbacks: " << stats.callbacks << ", late: " << stats.late_callbacks << ", max time in callback: " << stats.max_mix_time * 1e3f << " ms" << std::endl;
+
+	Sound::shutdown();
+
+	if (stats.callbacks == 0) {
+		std::cerr << "WARNING: the audio callback never ran (no audio device?), so timing results are meaningless." << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+//"stream": loop an opus file with Sound::StreamingSample and report whether the decoder kept up:
+static int stream(std::string const &filename, float seconds) {
+	Sound::init();
+
+	auto before = std::chrono::steady_clock::now();
+	Sound::StreamingSample music(filename);
+	Sound::PlayingSample ps = Sound::loop(music, 0.5f);
+	float open_time = std::chrono::duration< float >(std::chrono::steady_clock::now() - before).count();
+
+	std::cout << "Stream: looping '" << filename << "' for " << seconds << " seconds (opened in " << open_time * 1e3f << " ms)." << std::endl;
+
+	auto next = std::chrono::steady_clock::now();
+	for (uint32_t f = 0; f < uint32_t(seconds * 60.0f); ++f) {
+		Sound::update(1.0f / 60.0f);
+		next += std::chrono::microseconds(16667);
+		std::this_thread::sleep_until(next);
+	}
+
+	Sound::Stats stats = Sound::get_stats();
+	bool playing = ps.playing();
+	ps.stop();
+	Sound::update(1.0f / 60.0f);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	std::cout << "  still playing: " << (playing ? "yes" : "no") << ", stream underruns: " << stats.stream_underruns << std::endl;
+	std::cout << "  callbacks: " << stats.callbacks << ", late: " << stats.late_callbacks << ", max time in callback: " << stats.max_mix_time * 1e3f << " ms" << std::endl;
+
+	Sound::shutdown();
+
+	if (stats.callbacks == 0) {
+		std::cerr << "WARNING: the audio callback never ran (no audio device?), so results are meaningless." << std::endl;
+		return 1;
+	}
+	return (playing && stats.stream_underruns == 0 ? 0 : 1);
+}
+
+//"latency": play short sounds with the given buffering options and report latency, queue depth, and callback durations:
+static int latency(uint32_t block_frames, uint32_t queue_blocks, float seconds) {
+	Sound::InitOptions options;
+	options.block_frames = block_frames;
+	options.queue_blocks = queue_blocks;
+	Sound::init(options);
+
+	Sound::Sample click(make_tone(880.0f, 0.05f));
+	//some background load, so callbacks aren't trivially short:
+	Sound::Sample tone(make_tone(220.0f, 1.0f));
+	for (uint32_t v = 0; v < 32; ++v) Sound::loop_3D(tone, 0.01f, glm::vec3(float(v), 1.0f, 0.0f), 2.0f);
+
+	std::cout << "Latency: block-frames " << block_frames << " (0 == SDL's choice), queue-blocks " << queue_blocks << ", " << seconds << " seconds." << std::endl;
+
+	//a click every ~100ms, as a player pressing buttons might (staggered against the callback on purpose):
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t c = 0; std::chrono::steady_clock::now() - start < std::chrono::duration< float >(seconds); ++c) {
+		Sound::play(click, 0.2f);
+		uint32_t wait = 100000 + 3700 * (c % 7);
+		Sound::update(wait * 1e-6f);
+		std::this_thread::sleep_for(std::chrono::microseconds(wait));
+	}
+
+	Sound::Stats stats = Sound::get_stats();
+	Sound::stop_all_samples();
+	Sound::update(1.0f / 60.0f);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	Sound::shutdown();
+
+	std::cout << "  device buffer: " << stats.block_frames << " frames (" << stats.block_frames / 48.0f << " ms); queued after callbacks: " << stats.queued_frames << " frames now, " << stats.max_queued_frames << " max" << std::endl;
+	if (stats.play_latency_count) {
+		std::cout << "  play() to output (estimated): " << 1e3 * stats.total_play_latency / stats.play_latency_count << " ms average, "
+		          << stats.max_play_latency * 1e3f << " ms max, over " << stats.play_latency_count << " sounds" << std::endl;
+	}
+	std::cout << "  callbacks: " << stats.callbacks << ", late (underruns): " << stats.late_callbacks << ", max time in callback: " << stats.max_mix_time * 1e3f << " ms" << std::endl;
+	std::cout << "  callback durations:" << std::endl;
+	for (uint32_t b = 0; b < stats.mix_time_histogram.size(); ++b) {
+		if (stats.mix_time_histogram[b] == 0) continue;
+		float limit = Sound::Stats::MixTimeBuckets[b];
+		if (std::isinf(limit)) std::cout << "    >= " << std::lround(Sound::Stats::MixTimeBuckets[b - 1] * 1e6f);
+		else std::cout << "    < " << std::lround(limit * 1e6f);
+		std::cout << " us: " << stats.mix_time_histogram[b] << std::endl;
+	}
+
+	if (stats.callbacks == 0) {
+		std::cerr << "WARNING: the audio callback never ran (no audio device?), so results are meaningless." << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+//"mix": time the inner mixing loop on many voices, comparing the SIMD kernel against the scalar reference:
+static int mix(uint32_t voice_count, uint32_t frames, uint32_t blocks) {
+	std::mt19937 mt(0x15466);
+	std::uniform_real_distribution< float > unit(0.0f, 1.0f);
+
+	//samples of various lengths (some shorter than a block, so they wrap or end mid-block):
+	std::vector< std::unique_ptr< Sound::Sample > > samples;
+	for (uint32_t s = 0; s < 16; ++s) {
+		std::vector< float > data(200 + uint32_t(unit(mt) * 48000.0f));
+		for (auto &d : data) d = 2.0f * unit(mt) - 1.0f;
+		samples.emplace_back(std::make_unique< Sound::Sample >(data));
+	}
+
+	struct Voice {
+		Sound::Sample const *sample;
+		uint32_t i;
+		bool loop;
+		float l, r, dl, dr;
+	};
+	std::vector< Voice > voices;
+	for (uint32_t v = 0; v < voice_count; ++v) {
+		Sound::Sample const &sample = *samples[v % samples.size()];
+		bool loop = (v % 4 != 0);
+		Voice voice;
+		voice.sample = &sample;
+		voice.i = uint32_t(unit(mt) * float(sample.data.size() - 1));
+		voice.loop = loop;
+		voice.l = unit(mt) / float(voice_count);
+		voice.r = unit(mt) / float(voice_count);
+		voice.dl = (unit(mt) - 0.5f) / float(voice_count * frames);
+		voice.dr = (unit(mt) - 0.5f) / float(voice_count * frames);
+		voices.emplace_back(voice);
+	}
+
+	//mix all voices into one block using the given kernel; returns seconds per block:
+	auto run = [&](MixSpanFn kernel, std::vector< float > *out) -> float {
+		std::vector< uint32_t > start(voices.size());
+		for (uint32_t v = 0; v < voices.size(); ++v) start[v] = voices[v].i;
+
+		out->assign(2 * frames, 0.0f);
+		auto before = std::chrono::steady_clock::now();
+		for (uint32_t b = 0; b < blocks; ++b) {
+			std::fill(out->begin(), out->end(), 0.0f);
+			for (uint32_t v = 0; v < voices.size(); ++v) {
+				Voice &voice = voices[v];
+				voice.i = start[v]; //mix the same audio every block so output can be compared
+				mix_sample(out->data(), frames, voice.sample->data.data(), uint32_t(voice.sample->data.size()), &voice.i, voice.loop,
+					voice.l, voice.r, voice.dl, voice.dr, kernel);
+			}
+		}
+		float elapsed = std::chrono::duration< float >(std::chrono::steady_clock::now() - before).count();
+		for (uint32_t v = 0; v < voices.size(); ++v) voices[v].i = start[v];
+		return elapsed / float(blocks);
+	};
+
+	std::vector< float > reference, simd;
+	float scalar_time = run(mix_span_scalar, &reference);
+	float simd_time = run(mix_span, &simd);
+
+	float max_diff = 0.0f;
+	for (uint32_t i = 0; i < reference.size(); ++i) {
+		max_diff = std::max(max_diff, std::abs(reference[i] - simd[i]));
+	}
+
+	float block_seconds = float(frames) / 48000.0f;
+	std::cout << "Mix: " << voice_count << " voices into " << frames << "-frame blocks (" << blocks << " blocks):" << std::endl;
+	std::cout << "  scalar: " << scalar_time * 1e6f << " us/block (" << 100.0f * scalar_time / block_seconds << "% of real time)" << std::endl;
+	std::cout << "  " << mix_span_kernel_name() << ": " << simd_time * 1e6f << " us/block (" << 100.0f * simd_time / block_seconds << "% of real time)" << std::endl;
+	std::cout << "  speedup: " << scalar_time / simd_time << "x, max difference from scalar: " << max_diff << std::endl;
+
+	if (max_diff > 1e-6f) {
+		std::cerr << "ERROR: SIMD output differs from scalar reference." << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+//"voices": time the audio callback and Sound::update() as the number of playing voices grows, and time the control stage's
+// gain computation (SIMD against scalar, and against computing gains one voice at a time):
+static int voices_bench(float seconds) {
+	std::mt19937 mt(0xa0d10);
+	std::uniform_real_distribution< float > unit(0.0f, 1.0f);
+
+	{ //gains, for a full voice pool of 3D voices:
+		uint32_t const count = Sound::MaxVoices;
+		std::vector< float > x(count), y(count), z(count), radius(count), amount(count), scale(count), l(count), r(count);
+		for (uint32_t v = 0; v < count; ++v) {
+			x[v] = 20.0f * unit(mt) - 10.0f;
+			y[v] = 20.0f * unit(mt) - 10.0f;
+			z[v] = 2.0f * unit(mt) - 1.0f;
+			radius[v] = 1.0f + 4.0f * unit(mt);
+		}
+		if (count > 1) x[1] = y[1] = z[1] = 0.0f; //(one voice right at the listener)
+		float const listener[3] = {0.0f, 0.0f, 0.0f};
+		float const right[3] = {1.0f, 0.0f, 0.0f};
+
+		uint32_t const reps = 20000;
+		//the way gains were computed before the control stage existed (and still a handy reference):
+		std::vector< float > one_l(count), one_r(count);
+		auto before = std::chrono::steady_clock::now();
+		for (uint32_t rep = 0; rep < reps; ++rep) {
+			for (uint32_t v = 0; v < count; ++v) {
+				glm::vec3 to = glm::vec3(x[v], y[v], z[v]) - glm::vec3(listener[0], listener[1], listener[2]);
+				float distance = glm::length(to);
+				if (distance == 0.0f) {
+					one_l[v] = one_r[v] = std::sqrt(2.0f);
+				} else {
+					float amt = glm::dot(glm::vec3(right[0], right[1], right[2]), to) / distance;
+					float ang = 0.5f * 3.1415926f * (0.5f * (amt + 1.0f));
+					float att = 1.0f / (1.0f + (distance / radius[v]));
+					one_l[v] = std::cos(ang) * att;
+					one_r[v] = std::sin(ang) * att;
+				}
+			}
+		}
+		float one_time = std::chrono::duration< float >(std::chrono::steady_clock::now() - before).count() / reps;
+
+		auto run = [&](bool simd, std::vector< float > *out_l, std::vector< float > *out_r) -> float {
+			out_l->resize(count);
+			out_r->resize(count);
+			auto before = std::chrono::steady_clock::now();
+			for (uint32_t rep = 0; rep < reps; ++rep) {
+				std::fill(scale.begin(), scale.end(), 1.0f);
+				if (simd) {
+					spatialize(x.data(), y.data(), z.data(), radius.data(), listener, right, amount.data(), scale.data(), count);
+					pan_gains(amount.data(), scale.data(), out_l->data(), out_r->data(), count);
+				} else {
+					spatialize_scalar(x.data(), y.data(), z.data(), radius.data(), listener, right, amount.data(), scale.data(), count);
+					pan_gains_scalar(amount.data(), scale.data(), out_l->data(), out_r->data(), count);
+				}
+			}
+			return std::chrono::duration< float >(std::chrono::steady_clock::now() - before).count() / reps;
+		};
+		std::vector< float > scalar_l, scalar_r, simd_l, simd_r;
+		float scalar_time = run(false, &scalar_l, &scalar_r);
+		float simd_time = run(true, &simd_l, &simd_r);
+
+		float max_diff = 0.0f; //SIMD against scalar
+		float max_error = 0.0f; //against std::cos / std::sin
+		for (uint32_t v = 0; v < count; ++v) {
+			max_diff = std::max(max_diff, std::max(std::abs(simd_l[v] - scalar_l[v]), std::abs(simd_r[v] - scalar_r[v])));
+			max_error = std::max(max_error, std::max(std::abs(simd_l[v] - one_l[v]), std::abs(simd_r[v] - one_r[v])));
+		}
+
+		std::cout << "Gains for " << count << " 3D voices (one control stage):" << std::endl;
+		std::cout << "  one voice at a time: " << one_time * 1e6f << " us" << std::endl;
+		std::cout << "  scalar: " << scalar_time * 1e6f << " us" << std::endl;
+		std::cout << "  " << mix_span_kernel_name() << ": " << simd_time * 1e6f << " us (max difference from scalar: " << max_diff << ", from std::cos / std::sin: " << max_error << ")" << std::endl;
+
+		if (max_diff > 1e-6f || max_error > 1e-5f) {
+			std::cerr << "ERROR: batched gains differ from the reference." << std::endl;
+			return 1;
+		}
+	}
+
+	//the whole callback, with a mix of moving 3D voices and 2D voices:
+	Sound::init();
+	Sound::Sample tone(make_tone(440.0f, 1.0f));
+
+	std::cout << "Callback and Sound::update() time by voice count (" << seconds << " seconds each):" << std::endl;
+	bool ran = false;
+	for (uint32_t count = 16; count <= Sound::MaxVoices; count *= 2) {
+		std::vector< Sound::PlayingSample > voices;
+		for (uint32_t v = 0; v < count; ++v) {
+			if (v % 4 == 0) voices.emplace_back(Sound::loop(tone, 0.5f / count, 2.0f * unit(mt) - 1.0f));
+			else voices.emplace_back(Sound::loop_3D(tone, 0.5f / count, glm::vec3(10.0f * unit(mt), 10.0f * unit(mt), 0.0f), 2.0f));
+		}
+		Sound::update(1.0f / 60.0f);
+		std::this_thread::sleep_for(std::chrono::milliseconds(50)); //(let the voices start)
+
+		Sound::Stats before = Sound::get_stats();
+		double update_time = 0.0;
+		uint32_t updates = 0;
+		auto start = std::chrono::steady_clock::now();
+		auto const frame = std::chrono::microseconds(16667);
+		auto next = start;
+		for (uint32_t f = 0; f < uint32_t(seconds * 60.0f); ++f) {
+			for (uint32_t v = 0; v < count; ++v) {
+				float t = f / 60.0f + v;
+				if (v % 4 != 0) voices[v].set_position(glm::vec3(std::cos(t), std::sin(t), 0.0f) * 5.0f);
+			}
+			auto before_update = std::chrono::steady_clock::now();
+			Sound::update(1.0f / 60.0f);
+			update_time += std::chrono::duration< double >(std::chrono::steady_clock::now() - before_update).count();
+			++updates;
+			next += frame;
+			std::this_thread::sleep_until(next);
+		}
+		float wall = std::chrono::duration< float >(std::chrono::steady_clock::now() - start).count();
+		Sound::Stats after = Sound::get_stats();
+
+		uint64_t callbacks = after.callbacks - before.callbacks;
+		double mix_time = after.total_mix_time - before.total_mix_time;
+		if (callbacks > 0) {
+			ran = true;
+			std::cout << "  " << count << " voices: " << (mix_time / callbacks) * 1e6 << " us/callback average, "
+			          << 100.0 * mix_time / wall << "% of real time; " << (update_time / std::max(updates, 1U)) * 1e6 << " us/update" << std::endl;
+		}
+
+		for (auto &voice : voices) voice.stop(0.0f);
+		Sound::update(1.0f / 60.0f);
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+
+	Sound::Stats stats = Sound::get_stats();
+	std::cout << "  callbacks: " << stats.callbacks << ", late: " << stats.late_callbacks << ", max time in callback: " << stats.max_mix_time * 1e3f << " ms" << std::endl;
+	Sound::shutdown();
+
+	if (!ran) {
+		std::cerr << "WARNING: the audio callback never ran (no audio device?), so callback timing was skipped." << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+//"resample": time variable-rate playback at each quality tier (SIMD against scalar filter evaluation),
+// and measure how cleanly each tier plays tones at rates other than 1:1:
+static int resample_bench(uint32_t voice_count, uint32_t frames, uint32_t blocks) {
+	std::mt19937 mt(0x2e5a);
+	std::uniform_real_distribution< float > unit(0.0f, 1.0f);
+
+	std::vector< float > noise(48000);
+	for (auto &n : noise) n = 2.0f * unit(mt) - 1.0f;
+
+	struct Voice {
+		uint32_t i, frac;
+		float rate, drate;
+	};
+	std::vector< Voice > voices;
+	for (uint32_t v = 0; v < voice_count; ++v) {
+		Voice voice;
+		voice.i = uint32_t(unit(mt) * float(noise.size() - 1));
+		voice.frac = uint32_t(unit(mt) * 4294967295.0f);
+		//rates spread over two octaves down and up, some of them ramping:
+		voice.rate = std::exp2(4.0f * unit(mt) - 2.0f);
+		voice.drate = (v % 2 == 0 ? 0.0f : (unit(mt) - 0.5f) * voice.rate / float(frames));
+		voices.emplace_back(voice);
+	}
+
+	//resample every voice for one block (and sum the results, for comparison); returns seconds per block:
+	auto run = [&](ResampleFilter const *filter, FilterDotFn dot, std::vector< float > *out) -> float {
+		std::vector< float > buffer(frames);
+		out->assign(frames, 0.0f);
+		auto before = std::chrono::steady_clock::now();
+		for (uint32_t b = 0; b < blocks; ++b) {
+			for (auto const &voice : voices) {
+				uint32_t i = voice.i, frac = voice.frac; //(the same audio every block)
+				resample(buffer.data(), frames, noise.data(), uint32_t(noise.size()), &i, &frac, true,
+					voice.rate, voice.drate, filter, dot);
+				if (b == 0) {
+					for (uint32_t k = 0; k < frames; ++k) (*out)[k] += buffer[k];
+				}
+			}
+		}
+		float elapsed = std::chrono::duration< float >(std::chrono::steady_clock::now() - before).count();
+		return elapsed / float(blocks);
+	};
+
+	//play a 'hz' tone at 'rate'; returns the level (dB) of everything in the output other than a
+	// 'hz * rate' tone -- or of the whole output, if that is above the output's Nyquist frequency:
+	auto noise_level = [&](ResampleFilter const *filter, float hz, float rate) -> float {
+		std::vector< float > tone(48000);
+		for (uint32_t i = 0; i < tone.size(); ++i) tone[i] = float(std::sin(2.0 * 3.14159265358979323846 * double(hz) * (i / 48000.0)));
+		std::vector< float > out(8192);
+		uint32_t i = 0, frac = 0;
+		resample(out.data(), uint32_t(out.size()), tone.data(), uint32_t(tone.size()), &i, &frac, true, rate, 0.0f, filter);
+
+		//least-squares fit of the expected tone (skipping the start, where the filter sees the loop seam):
+		double w = 2.0 * 3.14159265358979323846 * double(hz) * double(rate) / 48000.0;
+		bool audible = (hz * rate < 24000.0f);
+		double ss = 0.0, sc = 0.0, cc = 0.0, ys = 0.0, yc = 0.0;
+		uint32_t const first = 256;
+		for (uint32_t k = first; k < out.size(); ++k) {
+			double s = std::sin(w * k), c = std::cos(w * k);
+			ss += s * s; sc += s * c; cc += c * c;
+			ys += out[k] * s; yc += out[k] * c;
+		}
+		double det = ss * cc - sc * sc;
+		double a = (audible ? (ys * cc - yc * sc) / det : 0.0);
+		double b = (audible ? (yc * ss - ys * sc) / det : 0.0);
+		double err = 0.0;
+		for (uint32_t k = first; k < out.size(); ++k) {
+			double e = out[k] - (a * std::sin(w * k) + b * std::cos(w * k));
+			err += e * e;
+		}
+		//(relative to the input tone's power of 1/2)
+		return float(10.0 * std::log10(std::max(1e-20, err / double(out.size() - first) / 0.5)));
+	};
+
+	std::cout << "Resample: " << voice_count << " voices into " << frames << "-frame blocks (" << blocks << " blocks):" << std::endl;
+	float block_seconds = float(frames) / 48000.0f;
+	bool ok = true;
+	struct Tier {
+		char const *name;
+		Sound::ResampleQuality quality;
+	};
+	for (Tier tier : { Tier{"linear", Sound::ResampleQuality::Linear}, Tier{"fast", Sound::ResampleQuality::Fast}, Tier{"good", Sound::ResampleQuality::Good}, Tier{"best", Sound::ResampleQuality::Best} }) {
+		ResampleFilter const *filter = ResampleFilter::for_quality(tier.quality);
+
+		std::vector< float > reference, simd;
+		float scalar_time = run(filter, filter_dot_scalar, &reference);
+		float simd_time = run(filter, filter_dot, &simd);
+		float max_diff = 0.0f;
+		for (uint32_t k = 0; k < frames; ++k) {
+			max_diff = std::max(max_diff, std::abs(reference[k] - simd[k]));
+		}
+
+		std::cout << "  " << tier.name << ":" << std::endl;
+		if (filter) {
+			std::cout << "    scalar: " << scalar_time * 1e6f << " us/block (" << 100.0f * scalar_time / block_seconds << "% of real time)" << std::endl;
+		}
+		std::cout << "    " << (filter ? mix_span_kernel_name() : "interpolate") << ": " << simd_time * 1e6f << " us/block (" << 100.0f * simd_time / block_seconds << "% of real time)";
+		if (filter) std::cout << ", max difference from scalar: " << max_diff;
+		std::cout << std::endl;
+		std::cout << "    noise + distortion: " << noise_level(filter, 1000.0f, 0.7071f) << " dB (1kHz at 0.71x), "
+		          << noise_level(filter, 6000.0f, 1.4142f) << " dB (6kHz at 1.41x)" << std::endl;
+		std::cout << "    aliasing: " << noise_level(filter, 16000.0f, 1.9f) << " dB (16kHz at 1.9x)" << std::endl;
+
+		//(sums of 'voice_count' voices of unit-scale noise, so allow for float rounding)
+		if (max_diff > 1e-4f * float(voice_count)) {
+			std::cerr << "ERROR: " << tier.name << " SIMD output differs from scalar reference." << std::endl;
+			ok = false;
+		}
+	}
+	return (ok ? 0 : 1);
+}
+
+//"binaural": check HRTF convolution against direct convolution, then time it per voice against the panner
+// (both by itself and in the whole mixer, with Sound's offline mode):
+static int binaural_bench(uint32_t voice_count, float seconds) {
+	std::mt19937 mt(0xb1a0);
+	std::uniform_real_distribution< float > unit(0.0f, 1.0f);
+
+	HrirSet const &set = *HrirSet::for_spatializer(Sound::Spatializer::Binaural);
+	std::cout << "Binaural: " << set.directions() << " HRIR pairs of " << set.length << " taps (" << set.partitions << " partitions of " << HrtfBlock << " frames)." << std::endl;
+
+	bool ok = true;
+	{ //accuracy: a fixed direction, fed in uneven pieces, should match direct convolution (delayed by HrtfBlock):
+		std::vector< float > input(4800);
+		for (auto &x : input) x = 2.0f * unit(mt) - 1.0f;
+		float max_diff = 0.0f, max_out = 0.0f;
+		for (uint32_t d = 0; d < set.directions(); d += 37) {
+			HrtfConvolver convolver;
+			convolver.reset();
+			std::vector< float > out(2 * input.size(), 0.0f);
+			glm::vec3 dir = set.direction(d);
+			for (uint32_t done = 0; done < input.size(); ) {
+				uint32_t piece = std::min(uint32_t(input.size()) - done, 1 + uint32_t(mt() % 300));
+				convolver.process(&out[2 * done], &input[done], piece, set, dir, dir);
+				done += piece;
+			}
+			float const *left = &set.hrirs[size_t(d) * 2 * set.length];
+			float const *right = left + set.length;
+			for (uint32_t n = HrtfBlock; n < input.size(); ++n) {
+				double l = 0.0, r = 0.0;
+				for (uint32_t t = 0; t < set.length && t <= n - HrtfBlock; ++t) {
+					l += double(left[t]) * input[n - HrtfBlock - t];
+					r += double(right[t]) * input[n - HrtfBlock - t];
+				}
+				max_diff = std::max(max_diff, float(std::max(std::abs(l - out[2 * n + 0]), std::abs(r - out[2 * n + 1]))));
+				max_out = std::max(max_out, float(std::max(std::abs(l), std::abs(r))));
+			}
+		}
+		std::cout << "  max difference from direct convolution: " << max_diff << " (largest output: " << max_out << ")" << std::endl;
+		if (max_diff > 1e-4f * max_out) {
+			std::cerr << "ERROR: partitioned convolution differs from direct convolution." << std::endl;
+			ok = false;
+		}
+
+		//the SIMD multiply-add against the scalar reference:
+		std::vector< float > x(4 * HrtfFFTSize);
+		for (auto &v : x) v = 2.0f * unit(mt) - 1.0f;
+		std::vector< float > simd(2 * HrtfFFTSize, 0.5f), scalar(2 * HrtfFFTSize, 0.5f);
+		spectrum_mac(simd.data(), simd.data() + HrtfFFTSize, x.data(), x.data() + HrtfFFTSize, x.data() + 2 * HrtfFFTSize, x.data() + 3 * HrtfFFTSize, HrtfFFTSize);
+		spectrum_mac_scalar(scalar.data(), scalar.data() + HrtfFFTSize, x.data(), x.data() + HrtfFFTSize, x.data() + 2 * HrtfFFTSize, x.data() + 3 * HrtfFFTSize, HrtfFFTSize);
+		float mac_diff = 0.0f;
+		for (uint32_t k = 0; k < simd.size(); ++k) mac_diff = std::max(mac_diff, std::abs(simd[k] - scalar[k]));
+		if (mac_diff > 1e-6f) {
+			std::cerr << "ERROR: " << mix_span_kernel_name() << " spectrum_mac differs from scalar reference by " << mac_diff << "." << std::endl;
+			ok = false;
+		}
+	}
+
+	{ //cost per voice, of the spatialization step alone, for one second of audio in 512-frame blocks:
+		uint32_t const frames = 512;
+		uint32_t const blocks = 48000 / frames;
+		std::vector< float > input(frames), out(2 * frames);
+		for (auto &x : input) x = 2.0f * unit(mt) - 1.0f;
+		float const block_seconds = float(frames) / 48000.0f;
+
+		auto report = [&](char const *name, float per_block) {
+			std::cout << "  " << name << ": " << per_block * 1e6f << " us/block per voice (" << 100.0f * per_block / block_seconds << "% of real time)" << std::endl;
+		};
+
+		auto before = std::chrono::steady_clock::now();
+		for (uint32_t b = 0; b < blocks; ++b) {
+			for (uint32_t v = 0; v < voice_count; ++v) {
+				mix_span(out.data(), input.data(), frames, 0.5f, 0.5f, 1e-6f, -1e-6f);
+			}
+		}
+		float pan_time = std::chrono::duration< float >(std::chrono::steady_clock::now() - before).count() / float(blocks * voice_count);
+
+		//(time-domain convolution, for comparison)
+		before = std::chrono::steady_clock::now();
+		float const *left = &set.hrirs[0];
+		float const *right = left + set.length;
+		std::vector< float > history(set.length + frames, 0.0f);
+		for (uint32_t b = 0; b < blocks / 8; ++b) {
+			for (uint32_t v = 0; v < voice_count; ++v) {
+				std::copy(input.begin(), input.end(), history.begin() + set.length);
+				for (uint32_t n = 0; n < frames; ++n) {
+					float l = 0.0f, r = 0.0f;
+					for (uint32_t t = 0; t < set.length; ++t) {
+						l += left[t] * history[set.length + n - t];
+						r += right[t] * history[set.length + n - t];
+					}
+					out[2 * n + 0] += l;
+					out[2 * n + 1] += r;
+				}
+			}
+		}
+		float direct_time = std::chrono::duration< float >(std::chrono::steady_clock::now() - before).count() / float((blocks / 8) * voice_count);
+
+		//steady sources, and sources that move enough to change HRIR pair (and crossfade) every partition:
+		auto run = [&](bool moving) {
+			std::vector< HrtfConvolver > convolvers(voice_count);
+			for (auto &convolver : convolvers) convolver.reset();
+			auto before = std::chrono::steady_clock::now();
+			for (uint32_t b = 0; b < blocks; ++b) {
+				for (uint32_t v = 0; v < voice_count; ++v) {
+					glm::vec3 from = set.direction((v * 7) % set.directions());
+					glm::vec3 to = (moving ? set.direction((v * 7 + 1 + b % 2) % set.directions()) : from);
+					convolvers[v].process(out.data(), input.data(), frames, set, from, to);
+				}
+			}
+			return std::chrono::duration< float >(std::chrono::steady_clock::now() - before).count() / float(blocks * voice_count);
+		};
+		float steady_time = run(false);
+		float moving_time = run(true);
+
+		std::cout << "Spatializing one voice (" << frames << "-frame blocks, averaged over " << voice_count << " voices):" << std::endl;
+		report("panner", pan_time);
+		report("direct convolution", direct_time);
+		report("binaural", steady_time);
+		report("binaural, crossfading every partition", moving_time);
+	}
+
+	{ //whole mixer, 'voice_count' 3D voices circling the listener (up and down, too):
+		Sound::Sample tone(make_tone(440.0f, 1.0f));
+		uint32_t const frames = 512;
+		auto render = [&](Sound::Spatializer spatializer) {
+			Sound::set_spatializer(spatializer);
+			Sound::init_offline();
+			std::vector< Sound::PlayingSample > voices;
+			for (uint32_t v = 0; v < voice_count; ++v) {
+				voices.emplace_back(Sound::loop_3D(tone, 0.5f / voice_count, glm::vec3(0.0f, 1.0f, 0.0f), 2.0f));
+			}
+			std::vector< float > out(2 * frames);
+			float mix_time = 0.0f;
+			uint32_t blocks = uint32_t(seconds * 48000.0f / frames);
+			for (uint32_t b = 0; b < blocks; ++b) {
+				float t = b * (frames / 48000.0f);
+				for (uint32_t v = 0; v < voice_count; ++v) {
+					float a = t + v;
+					voices[v].set_position(3.0f * glm::vec3(std::cos(a), std::sin(a), std::sin(0.3f * a)), frames / 48000.0f);
+				}
+				Sound::update(frames / 48000.0f);
+				auto before = std::chrono::steady_clock::now();
+				Sound::render(out.data(), frames);
+				mix_time += std::chrono::duration< float >(std::chrono::steady_clock::now() - before).count();
+			}
+			Sound::shutdown();
+			return mix_time / float(blocks);
+		};
+		float pan_time = render(Sound::Spatializer::Panner);
+		float binaural_time = render(Sound::Spatializer::Binaural);
+		Sound::set_spatializer(Sound::Spatializer::Panner);
+
+		float block_seconds = float(frames) / 48000.0f;
+		std::cout << "Mixing " << voice_count << " moving 3D voices (" << frames << "-frame blocks, " << seconds << " seconds):" << std::endl;
+		std::cout << "  panner: " << pan_time * 1e6f << " us/block (" << 100.0f * pan_time / block_seconds << "% of real time)" << std::endl;
+		std::cout << "  binaural: " << binaural_time * 1e6f << " us/block (" << 100.0f * binaural_time / block_seconds << "% of real time)" << std::endl;
+		std::cout << "  binaural costs " << (binaural_time - pan_time) / voice_count * 1e6f << " us/block more per voice" << std::endl;
+	}
+
+	return (ok ? 0 : 1);
+}
+
+//"load": time loading samples by decoding them against mapping them from the on-disk cache (see pcm_cache.hpp):
+static int load(std::vector< std::string > const &filenames) {
+	auto time_load = [](std::string const &filename, std::unique_ptr< Sound::Sample > *sample) {
+		auto before = std::chrono::steady_clock::now();
+		*sample = std::make_unique< Sound::Sample >(filename);
+		return std::chrono::duration< float >(std::chrono::steady_clock::now() - before).count();
+	};
+
+	float decode_total = 0.0f, cached_total = 0.0f;
+	bool mismatch = false;
+	for (std::string const &filename : filenames) {
+		std::unique_ptr< Sound::Sample > decoded, stored, cached;
+
+		pcm_cache_enabled = false;
+		float decode_time = time_load(filename, &decoded);
+		pcm_cache_enabled = true;
+		float store_time = time_load(filename, &stored); //(decodes, unless already cached, and writes the cache file)
+		float cached_time = time_load(filename, &cached);
+
+		//wav files that are already 48kHz mono float aren't cached (there'd be nothing to save):
+		bool cacheable = true;
+		if (filename.size() >= 4 && filename.substr(filename.size() - 4) == ".wav") {
+			std::vector< float > scratch;
+			load_wav(filename, &scratch, &cacheable);
+		}
+
+		bool same = (cached->data.size() == decoded->data.size() && std::equal(cached->data.begin(), cached->data.end(), decoded->data.begin()));
+		if (!same || bool(cached->mapped) != cacheable) mismatch = true;
+
+		std::cout << "  '" << filename << "': " << decoded->data.size() << " samples; decode " << decode_time * 1e3f << " ms, first cached load " << store_time * 1e3f << " ms, cached " << cached_time * 1e3f << " ms"
+		          << (cached->mapped ? "" : (cacheable ? " (NOT from cache)" : " (not cached: needs no conversion)")) << (same ? "" : " (DIFFERENT)") << std::endl;
+		decode_total += decode_time;
+		cached_total += cached_time;
+	}
+	std::cout << "Load: " << filenames.size() << " files, decode " << decode_total * 1e3f << " ms, cached " << cached_total * 1e3f << " ms (" << decode_total / cached_total << "x)." << std::endl;
+
+	if (mismatch) {
+		std::cerr << "ERROR: some cached samples weren't mapped (or were, but needed no conversion), or didn't match decoded samples." << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+//"cache": play random samples through a SampleCache with a small budget, so samples are evicted and
+// reloaded while the audio callback is (maybe) still playing others, and report on the cache:
+static int cache(float budget_mb, float seconds, std::vector< std::string > const &filenames) {
+	Sound::init();
+
+	SampleCache cache(size_t(budget_mb * 1024.0f * 1024.0f));
+	std::mt19937 mt(0x15466);
+	std::uniform_real_distribution< float > unit(0.0f, 1.0f);
+
+	std::cout << "Cache: playing " << filenames.size() << " files through a " << budget_mb << " MB cache for " << seconds << " seconds." << std::endl;
+
+	uint32_t played = 0;
+	auto start = std::chrono::steady_clock::now();
+	while (std::chrono::duration< float >(std::chrono::steady_clock::now() - start).count() < seconds) {
+		//a few requests per (simulated) frame; misses just get skipped, like a game would:
+		for (uint32_t r = 0; r < 4; ++r) {
+			std::string const &filename = filenames[mt() % filenames.size()];
+			if (std::shared_ptr< Sound::Sample const > sample = cache.get(filename)) {
+				Sound::play(*sample, 0.05f, 2.0f * unit(mt) - 1.0f);
+				played += 1;
+			}
+		}
+		Sound::update(0.016f);
+		std::this_thread::sleep_for(std::chrono::milliseconds(16));
+	}
+
+	Sound::stop_all_samples();
+	Sound::update(1.0f / 60.0f);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	Sound::shutdown();
+
+	//with nothing playing, everything over budget can go:
+	cache.trim();
+
+	SampleCache::Stats stats = cache.get_stats();
+	std::cout << "  played: " << played << ", hits: " << stats.hits << ", misses: " << stats.misses
+	          << " (waited " << (stats.waits ? 1e3f * stats.wait_time / stats.waits : 0.0f) << " ms on average)" << std::endl;
+	std::cout << "  loads: " << stats.loads << " (" << stats.failures << " failed), " << 1e3f * stats.load_time << " ms total" << std::endl;
+	std::cout << "  bytes: " << stats.bytes << " (peak " << stats.peak_bytes << "), evictions: " << stats.evictions << " (" << stats.evicted_bytes << " bytes)" << std::endl;
+
+	if (stats.bytes > size_t(budget_mb * 1024.0f * 1024.0f)) {
+		std::cerr << "ERROR: cache is still over budget with nothing playing." << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	//when compiled on windows, unhandled exceptions don't have their message printed, which can make debugging simple issues difficult.
+	try {
+#endif
+
+	std::vector< std::string > args(argv + 1, argv + argc);
+
+	if (args.size() >= 1 && args[0] == "stress") {
+		uint32_t updates = (args.size() >= 2 ? uint32_t(std::stoul(args[1])) : 5000);
+		float seconds = (args.size() >= 3 ? std::stof(args[2]) : 10.0f);
+		return stress(updates, seconds);
+	}
+	if (args.size() >= 1 && args[0] == "oneshots") {
+		uint32_t per_second = (args.size() >= 2 ? uint32_t(std::stoul(args[1])) : 500);
+		float seconds = (args.size() >= 3 ? std::stof(args[2]) : 5.0f);
+		Sound::StealPolicy policy = Sound::StealPolicy::Quietest;
+		if (args.size() >= 4) {
+			if (args[3] == "quietest") policy = Sound::StealPolicy::Quietest;
+			else if (args[3] == "oldest") policy = Sound::StealPolicy::Oldest;
+			else if (args[3] == "priority") policy = Sound::StealPolicy::LowestPriority;
+			else throw std::runtime_error("Unknown steal policy '" + args[3] + "'; expecting quietest, oldest, or priority.");
+		}
+		return oneshots(per_second, seconds, policy);
+	}
+	if (args.size() >= 2 && args[0] == "stream") {
+		float seconds = (args.size() >= 3 ? std::stof(args[2]) : 10.0f);
+		return stream(args[1], seconds);
+	}
+	if (args.size() >= 1 && args[0] == "mix") {
+		uint32_t voices = (args.size() >= 2 ? uint32_t(std::stoul(args[1])) : 256);
+		uint32_t frames = (args.size() >= 3 ? uint32_t(std::stoul(args[2])) : 1024);
+		uint32_t blocks = (args.size() >= 4 ? uint32_t(std::stoul(args[3])) : 1000);
+		return mix(voices, frames, blocks);
+	}
+	if (args.size() >= 1 && args[0] == "latency") {
+		uint32_t block_frames = (args.size() >= 2 ? uint32_t(std::stoul(args[1])) : 0);
+		uint32_t queue_blocks = (args.size() >= 3 ? uint32_t(std::stoul(args[2])) : 0);
+		float seconds = (args.size() >= 4 ? std::stof(args[3]) : 5.0f);
+		return latency(block_frames, queue_blocks, seconds);
+	}
+	if (args.size() >= 1 && args[0] == "voices") {
+		float seconds = (args.size() >= 2 ? std::stof(args[1]) : 1.0f);
+		return voices_bench(seconds);
+	}
+	if (args.size() >= 1 && args[0] == "resample") {
+		uint32_t voices = (args.size() >= 2 ? uint32_t(std::stoul(args[1])) : 64);
+		uint32_t frames = (args.size() >= 3 ? uint32_t(std::stoul(args[2])) : 1024);
+		uint32_t blocks = (args.size() >= 4 ? uint32_t(std::stoul(args[3])) : 200);
+		return resample_bench(voices, frames, blocks);
+	}
+	if (args.size() >= 1 && args[0] == "binaural") {
+		uint32_t voices = (args.size() >= 2 ? uint32_t(std::stoul(args[1])) : 64);
+		float seconds = (args.size() >= 3 ? std::stof(args[2]) : 2.0f);
+		return binaural_bench(voices, seconds);
+	}
+	if (args.size() >= 4 && args[0] == "cache") {
+		return cache(std::stof(args[1]), std::stof(args[2]), std::vector< std::string >(args.begin() + 3, args.end()));
+	}
+	if (args.size() >= 2 && args[0] == "load") {
+		return load(std::vector< std::string >(args.begin() + 1, args.end()));
+	}
+
+	std::cerr << "Usage:\n"
+		"\t" << argv[0] << " stress [updates-per-frame=5000] [seconds=10]\n"
+		"\t\tissue many parameter updates per (simulated) frame, then Sound::update(), and report late audio callbacks\n"
+		"\t" << argv[0] << " oneshots [per-second=500] [seconds=5] [quietest|oldest|priority]\n"
+		"\t\ttrigger more short sounds than fit in the voice pool and report on voice stealing\n"
+		"\t" << argv[0] << " stream <file.opus> [seconds=10]\n"
+		"\t\tloop an opus file as a StreamingSample and report any decoder underruns\n"
+		"\t" << argv[0] << " latency [block-frames=0] [queue-blocks=0] [seconds=5]\n"
+		"\t\tplay short sounds with the given buffering (see Sound::InitOptions) and report latency, queue depth, and callback durations\n"
+		"\t" << argv[0] << " mix [voices=256] [frames=1024] [blocks=1000]\n"
+		"\t\ttime the SIMD mixing kernel against the scalar reference and check their outputs match\n"
+		"\t" << argv[0] << " voices [seconds=1]\n"
+		"\t\ttime gain computation, Sound::update(), and the audio callback as the number of voices grows\n"
+		"\t" << argv[0] << " resample [voices=64] [frames=1024] [blocks=200]\n"
+		"\t\ttime variable-rate playback at each resampling quality, check SIMD against scalar, and measure noise and aliasing\n"
+		"\t" << argv[0] << " binaural [voices=64] [seconds=2]\n"
+		"\t\tcheck HRTF convolution against direct convolution, and time binaural spatialization per voice against the panner\n"
+		"\t" << argv[0] << " cache <budget-MB> <seconds> <file.wav|file.opus>...\n"
+		"\t\tplay random samples through a SampleCache too small to hold them all, and report loads and evictions\n"
+		"\t" << argv[0] << " load <file.wav|file.opus>...\n"
+		"\t\ttime decoding samples against mapping them from the on-disk cache, and check they match\n"
+	;
+	return 1;
+
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		throw;
+	}
+#endif
+}